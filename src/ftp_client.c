@@ -1,26 +1,89 @@
 #include "ftp_client.h"
 
+#include <limits.h>
 #include <lwip/sockets.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "configure.h"
+#include "ftp_client_clock.h"
+#include "ftp_client_poller.h"
+#include "ftp_client_queue.h"
+#include "ftp_client_thread.h"
 #include "lwip/errno.h"
 
-#define FILE_BUFFER_SIZE 4096
+// Host builds send regular files straight from the page cache. nxdk/lwIP has
+// no equivalent, so uploads there always go through stdio.
+#ifndef NXDK
+#if defined(HAVE_SENDFILE)
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#define ZERO_COPY_SENDFILE
+#elif defined(HAVE_MMAP)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define ZERO_COPY_MMAP
+#endif
+#endif
+
+#define DEFAULT_CHUNK_SIZE 4096
+#define MIN_ADAPTIVE_CHUNK_SIZE 1024
+#define MAX_ADAPTIVE_CHUNK_SIZE (256 * 1024)
 #define BUFFER_SIZE 1023
-#define MAX_SEND_OPERATIONS 4
+#define DEFAULT_MAX_ACTIVE_OPERATIONS 4
+#define READ_AHEAD_BUFFER_COUNT 2
+#define MAX_SEGMENTS_PER_WRITE 16
 
 #define DEFAULT_CONNECT_TIMEOUT_MILLISECONDS (20 * 1000)
 #define DEFAULT_PROCESS_TIMEOUT_MILLISECONDS 100
+//! Maximum time to block in select while an operation is waiting on a
+//! read-ahead buffer to be filled and the fill cannot wake the wait (e.g., on
+//! nxdk, or when the caller waits via FTPClientGetPollDescriptors).
+#define READ_AHEAD_POLL_INTERVAL_MILLISECONDS 1
+//! Maximum time to block in select while a streamed operation is waiting for
+//! its fill callback to produce data.
+#define STREAM_POLL_INTERVAL_MILLISECONDS 10
+//! Maximum time for the background worker to block between events when
+//! submissions can interrupt the wait.
+#define WORKER_WAIT_MILLISECONDS 1000
+//! Maximum time for the background worker to block between events when waits
+//! cannot be interrupted (nxdk), which bounds the latency of new submissions.
+#define WORKER_POLL_INTERVAL_MILLISECONDS 10
+
+#define DEFAULT_RECONNECT_MAX_ATTEMPTS 8
+#define DEFAULT_RECONNECT_INITIAL_DELAY_MILLISECONDS 250
+#define DEFAULT_RECONNECT_MAX_DELAY_MILLISECONDS (30 * 1000)
+#define DEFAULT_RECONNECT_JITTER_PERCENT 25
+#define DEFAULT_MIN_STRIPE_SIZE (1024 * 1024)
+#define DEFAULT_PROGRESS_INTERVAL_MILLISECONDS 250
+
+// Token buckets default to holding this much time's worth of data, and data
+// connections they throttle wait until this much time's worth has accrued.
+#define RATE_LIMIT_BURST_MICROSECONDS (100 * 1000)
+#define RATE_LIMIT_MIN_BURST_BYTES 4096
+#define RATE_LIMIT_WAKE_MICROSECONDS (10 * 1000)
+#define PRIORITY_COUNT 3
+#define DEFAULT_URGENT_WEIGHT 8
+#define DEFAULT_NORMAL_WEIGHT 4
+#define DEFAULT_BULK_WEIGHT 1
+#define DEFAULT_PRIORITY_QUANTUM_BYTES (8 * 1024)
+// A scheduling round between priorities ends once the data connections that
+// may still write in it have not done so for this long, so that a stalled
+// connection does not hold back the others indefinitely.
+#define PRIORITY_ROUND_STALL_MICROSECONDS (250 * 1000)
+
+// Interval over which the current data throughput is measured.
+#define THROUGHPUT_WINDOW_MICROSECONDS (250 * 1000)
 
 static const char kStoreCommand[] = "STOR";
 static const char kAppendCommand[] = "APPE";
 
 typedef enum FTPClientState {
   FTP_CLIENT_STATE_DISCONNECTED,
+  FTP_CLIENT_STATE_CONNECTING,
   FTP_CLIENT_STATE_CONNECTED_AWAIT_220,
   FTP_CLIENT_STATE_USERNAME_AWAIT_331,
   FTP_CLIENT_STATE_PASSWORD_REJECTED,
@@ -29,9 +92,84 @@ typedef enum FTPClientState {
   FTP_CLIENT_STATE_FULLY_CONNECTED,
 } FTPClientState;
 
+typedef enum ReadAheadState {
+  READ_AHEAD_STATE_EMPTY,
+  READ_AHEAD_STATE_FILLING,
+  READ_AHEAD_STATE_READY,
+} ReadAheadState;
+
+//! Chunk buffer that is filled from a local file by the read-ahead executor
+//! while the previous chunk is being sent.
+struct ReadAheadBuffer {
+  FILE *read_file;
+
+  char *data;
+  size_t capacity;
+
+  //! Number of bytes requested by the most recent fill.
+  size_t request_size;
+  //! Number of valid bytes in `data`.
+  size_t length;
+  //! `errno` value describing a failed fill.
+  int error;
+  //! Whether the most recent fill reached the end of `read_file`.
+  bool eof;
+
+  //! ReadAheadState, written by the executor when a fill completes.
+  atomic_int state;
+
+  //! Poller woken once the fill completes, or NULL.
+  FTPPoller *poller;
+  //! Nonzero while the executor is waking `poller` after a fill completed.
+  atomic_int waking;
+};
+
+//! Throttled progress reporting for an upload, shared by its ranges if it is
+//! striped.
+struct ProgressState {
+  FTPClientProgressCallback callback;
+  void *userdata;
+  uint64_t interval_bytes;
+  uint64_t interval_microseconds;
+
+  uint64_t total_bytes;
+  //! Sum of the resume offsets and bytes sent of the upload's operations.
+  uint64_t bytes_sent;
+  //! `bytes_sent` at which progress is next reported, or UINT64_MAX.
+  uint64_t next_bytes;
+  //! `bytes_sent` and FTPClockMicroseconds() as of the previous report, or of
+  //! the first data connection being established.
+  uint64_t last_bytes;
+  uint64_t last_time;
+};
+
+//! Limits the rate at which data is written.
+struct TokenBucket {
+  uint64_t bytes_per_second;
+  uint64_t burst_bytes;
+  //! Bytes that may be written, as of FTPClockMicroseconds() `last_refill`.
+  uint64_t tokens;
+  uint64_t last_refill;
+};
+
+//! Reference-counted, immutable upload buffer.
+struct FTPClientPayload {
+  atomic_int ref_count;
+  size_t length;
+  char data[];
+};
+
 //! Encapsulates information about a passive upload operation.
 struct SendOperation {
+  //! Next operation in the pending FIFO or the active list.
+  struct SendOperation *next;
+  //! Link in the client's submission queue until the operation is drained
+  //! into the pending FIFO.
+  FTPMPSCQueueNode submission;
+
   int socket;
+  //! FTP_POLLER_EVENT_* flags currently registered for `socket`.
+  uint32_t poll_interest;
 
   char *filename;
   struct sockaddr_in data_sockaddr;
@@ -41,16 +179,199 @@ struct SendOperation {
   ssize_t offset;
   bool buffer_owned;
 
+  //! Optional list of segments sent in place of `buffer`. `buffer_length` and
+  //! `offset` then describe the total across all segments.
+  struct iovec *segments;
+  size_t segment_count;
+  //! Index of the first segment that has not been fully sent.
+  size_t segment_index;
+  //! Number of bytes of `segments[segment_index]` that have been sent.
+  size_t segment_offset;
+
   //! Append to the remote file instead of truncating.
   bool append;
 
+  //! Optional shared payload backing `buffer`. One reference is held for the
+  //! lifetime of the operation.
+  FTPClientPayload *payload;
+
+  //! Optional local file that is opened into `read_file` (or a zero-copy
+  //! source) when the operation becomes active.
+  char *local_filename;
+  bool disable_read_ahead;
+  bool disable_zero_copy;
+
   //! Optional file descriptor from which `buffer` should be populated.
   FILE *read_file;
 
+  //! Optional callback from which `buffer` should be populated.
+  FTPClientStreamFillCallback fill;
+  //! Whether `fill` has signaled the end of the stream.
+  bool stream_ended;
+
+#ifdef ZERO_COPY_SENDFILE
+  //! Optional regular file sent directly via sendfile(), in which case
+  //! `offset` and `buffer_length` are positions within the file.
+  FILE *sendfile_file;
+#endif
+#ifdef ZERO_COPY_MMAP
+  //! Size of the file mapping backing `buffer`, if any.
+  size_t mapping_length;
+#endif
+
+  //! Number of bytes read from `read_file` per chunk.
+  size_t chunk_size;
+  //! Number of bytes allocated for `buffer` when populated from `read_file`.
+  size_t chunk_capacity;
+  //! Whether `chunk_size` should be tuned based on observed writes.
+  bool adaptive_chunk_size;
+  //! Number of write() calls used to send the current chunk.
+  uint32_t chunk_writes;
+  //! Largest number of bytes accepted by a single write() for the current
+  //! chunk.
+  size_t chunk_largest_write;
+
+  //! Optional double buffer filled from `read_file` by `read_ahead_executor`.
+  //! When set, `buffer` points into one of these entries.
+  struct ReadAheadBuffer *read_ahead;
+  //! Index of the read-ahead buffer that will back `buffer` next.
+  uint32_t read_ahead_next;
+  //! Whether the operation has drained `buffer` and is waiting for its source
+  //! to produce more data.
+  bool awaiting_data;
+  FTPClientReadAheadExecutor read_ahead_executor;
+  void *read_ahead_executor_userdata;
+  //! Poller of the thread driving the operation, woken when a read-ahead
+  //! buffer has been filled. NULL if it does not support wakeups.
+  FTPPoller *read_ahead_poller;
+
+  //! Number of bytes counted against the client's pending queue while the
+  //! operation waits to become active. 0 for streams.
+  uint64_t queued_bytes;
+
+  //! Number of times an interrupted transfer may be resumed from the size of
+  //! the remote file, and the number of times it has been.
+  uint32_t max_resume_attempts;
+  uint32_t resume_attempts;
+  //! Whether the next activation should continue from the size of the remote
+  //! file rather than from the start.
+  bool resume;
+  //! Offset passed to REST before STOR, or 0.
+  uint64_t resume_offset;
+  //! Whether the data connection failed before all data was written. The
+  //! operation remains active until the server's final reply arrives, at
+  //! which point it is resumed.
+  bool interrupted;
+
+  //! Number of ranges the operation is split into when first activated.
+  size_t stripe_count;
+  //! Set the operation belongs to once split, or NULL.
+  struct StripeSet *stripe_set;
+  //! Offset of the operation's data within the remote file, which is passed
+  //! to REST before STOR. For file-backed operations, the local file is read
+  //! from the same offset up to `range_end`, or its end if 0.
+  uint64_t range_start;
+  uint64_t range_end;
+  //! Offset within the local file of the next chunk to be read.
+  uint64_t read_position;
+
+  //! Whether all data has been written and the data connection closed. The
+  //! operation remains active until the server's final reply arrives.
+  bool data_complete;
+  //! Whether on_complete has been invoked.
+  bool completion_notified;
+  uint64_t bytes_sent;
+  FTPClientTransferTimings timings;
+  //! Optional progress reporting. Owned by the stripe set, if any, and by the
+  //! operation otherwise.
+  struct ProgressState *progress;
+  //! Optional rate limit specific to the upload, owned like `progress`.
+  struct TokenBucket *rate_limit;
+  //! Whether the data connection is waiting for a rate limit to allow more
+  //! data, during which it is not polled for writability.
+  bool throttled;
+  //! Resolved priority, shared by the ranges of a striped upload.
+  FTPClientPriority priority;
+  //! Bytes the data connection may still write in the current scheduling
+  //! round while data connections of more than one priority are sending.
+  uint64_t deficit;
+  //! Whether the data connection is held back by the priority scheduler,
+  //! during which it is not polled for writability.
+  bool descheduled;
+  //! Identifies the operation in trace events. Assigned once drained from the
+  //! client's submissions and shared by the ranges of a striped upload.
+  uint64_t id;
+
   //! Callback to be invoked when the operation is completed.
   void (*on_complete)(bool successful, void *userdata);
   //! Data to be passed to the on_complete callback.
   void *userdata;
+
+  FTPClientTransferResultCallback on_result;
+  void *on_result_userdata;
+};
+
+typedef enum PendingReplyKind {
+  PENDING_REPLY_KIND_PASV,
+  //! SIZE, which determines the offset at which an interrupted upload resumes.
+  PENDING_REPLY_KIND_SIZE,
+  //! REST, which is followed by STOR once accepted.
+  PENDING_REPLY_KIND_REST,
+  //! STOR or APPE, which yields a preliminary 1xx reply once the data
+  //! connection may be opened followed by a final reply once the transfer
+  //! completes.
+  PENDING_REPLY_KIND_TRANSFER,
+  //! Keepalive sent while the control connection is idle.
+  PENDING_REPLY_KIND_NOOP,
+} PendingReplyKind;
+
+//! Describes a command that has been queued on the control connection and
+//! whose final reply has not yet been processed.
+struct PendingReply {
+  struct PendingReply *next;
+  PendingReplyKind kind;
+  //! Operation that issued the command. Cleared if the operation is freed
+  //! before the reply arrives.
+  struct SendOperation *operation;
+  //! Whether the command has been handed to the control connection, which
+  //! attributes traced commands to their operation.
+  bool command_sent;
+};
+
+#ifdef FTP_CLIENT_ENABLE_STATS
+//! Counters reported by FTPClientGetStats.
+struct ClientStats {
+  //! Cumulative counters. Queue depths and rates are derived when queried.
+  FTPClientStats counters;
+  //! Sum of the durations of the transfers counted in `completed_bytes`.
+  uint64_t transfer_microseconds;
+
+  //! FTPClockMicroseconds() at which the current throughput window started,
+  //! and the number of data bytes written since.
+  uint64_t window_start;
+  uint64_t window_bytes;
+  //! Throughput measured over the most recent complete window.
+  uint64_t window_bytes_per_second;
+};
+#endif
+
+//! State shared by the data connections that are scheduled together (see
+//! ScheduleDataConnections).
+struct PriorityScheduler {
+  //! Whether data connections of more than one priority are sending, in which
+  //! case each writes no more than its deficit per round.
+  bool fair_queueing;
+  //! FTPClockMicroseconds() of the start of the current round or of the most
+  //! recent write within it.
+  uint64_t round_activity;
+  //! Whether an urgent upload was active when last scheduled.
+  bool urgent_in_flight;
+};
+
+//! FIFO of SendOperations of one priority waiting for an active slot.
+struct PendingQueue {
+  struct SendOperation *head;
+  struct SendOperation *tail;
 };
 
 struct FTPClient {
@@ -60,22 +381,439 @@ struct FTPClient {
   char *password;
 
   int control_socket;
+  //! FTP_POLLER_EVENT_* flags currently registered for `control_socket`.
+  uint32_t control_interest;
+
+  //! Readiness backend, created on first connect. Shared with the other
+  //! members of `group`, if any.
+  FTPClientPollerBackend poller_backend;
+  FTPPoller *poller;
+  FTPClientGroup *group;
 
   FTPClientState state;
+  //! FTPClockMicroseconds() by which login must complete, or 0.
+  uint64_t connect_deadline;
+
+  FTPClientReconnectPolicy reconnect_policy;
+  //! Whether login has completed at least once, which enables reconnects.
+  bool logged_in;
+  //! Reconnects scheduled since login last completed.
+  uint32_t reconnect_attempts;
+  //! FTPClockMicroseconds() at which the next reconnect starts, or 0.
+  uint64_t reconnect_deadline;
+  //! State of the xorshift generator that jitters reconnect delays.
+  uint32_t jitter_state;
+  //! FTPClockMicroseconds() of the most recent traffic on the control
+  //! connection, from which keepalives are scheduled.
+  uint64_t last_control_activity;
 
   char recv_buffer[BUFFER_SIZE + 1];
   size_t recv_buffer_len;
+  //! Reply code of the multi-line reply currently being received, or 0.
+  int multiline_reply_code;
+  //! Whether the remainder of an over-long reply line is being discarded.
+  bool skip_line_remainder;
 
   char send_buffer[BUFFER_SIZE + 1];
   size_t send_buffer_len;
-
-  //! Null terminated array of SendOperation instances describing files being
-  //! stored to the server.
-  struct SendOperation *file_send_buffer[MAX_SEND_OPERATIONS];
+  //! Whether the last write to the control connection ended within a command
+  //! line.
+  bool send_mid_line;
+
+  //! Default chunk settings for file-backed upload operations.
+  size_t chunk_size;
+  FTPClientChunkMode chunk_mode;
+  //! Default number of times an interrupted upload is resumed.
+  uint32_t max_resume_attempts;
+  //! Default number of ranges uploads are split into, and the smallest range.
+  size_t stripe_count;
+  size_t min_stripe_size;
+  //! Additional connections that send the ranges of striped uploads after the
+  //! first, which is sent over this client's. They share this client's poller
+  //! and are driven along with it.
+  FTPClient **stripe_sessions;
+  size_t stripe_session_count;
+
+  //! Points at `rate_limit_storage` while a rate limit is set, or at that of
+  //! the client that owns this stripe session. NULL if unlimited.
+  struct TokenBucket *rate_limit;
+  struct TokenBucket rate_limit_storage;
+
+  //! Priority of uploads that do not specify one, and how uploads of
+  //! different priorities share the client.
+  FTPClientPriority default_priority;
+  FTPClientPriorityPolicy priority_policy;
+  //! Points at `scheduler_storage`, or at that of the client that owns this
+  //! stripe session or of the group the client belongs to.
+  struct PriorityScheduler *scheduler;
+  struct PriorityScheduler scheduler_storage;
+
+  FTPClientReadAheadExecutor read_ahead_executor;
+  void *read_ahead_executor_userdata;
+  //! Lazily started thread backing the default read-ahead executor.
+  struct ReadAheadWorker *read_ahead_worker;
+
+  //! SendOperations that have issued PASV or own a data connection, in the
+  //! order they were started.
+  struct SendOperation *active_head;
+  size_t active_count;
+  size_t max_active_operations;
+
+  //! SendOperations submitted from any thread that have not yet been moved to
+  //! the pending FIFO by the thread driving the client.
+  FTPMPSCQueue submissions;
+
+  //! FIFOs of SendOperations waiting for an active slot, one per priority
+  //! from urgent to bulk.
+  struct PendingQueue pending[PRIORITY_COUNT];
+  size_t pending_count;
+  uint64_t pending_bytes;
+
+  //! FIFO of commands awaiting a final reply, in the order they were queued.
+  struct PendingReply *reply_head;
+  struct PendingReply *reply_tail;
+  //! Whether a PASV has been issued whose reply has not been processed. Only
+  //! one PASV is outstanding at a time, as servers generally close the
+  //! previous passive listener when a new PASV arrives.
+  bool pasv_outstanding;
+
+  size_t high_water_operations;
+  uint64_t high_water_bytes;
+  FTPClientQueueStateCallback on_queue_state;
+  void *queue_state_userdata;
+  bool above_high_water;
+
+  FTPClientTransferResultCallback on_transfer_result;
+  void *transfer_result_userdata;
+
+  FTPClientTraceCallback on_trace;
+  void *trace_userdata;
+  //! Reported as FTPClientTraceEvent::session.
+  uint32_t trace_session;
+  //! Id of the operation most recently drained from `submissions`.
+  uint64_t last_operation_id;
+
+  FTPClientCallbackMode callback_mode;
+  //! DeferredCompletions awaiting FTPClientDispatchCallbacks.
+  FTPMPSCQueue deferred_completions;
+
+  //! Background thread started by FTPClientStartWorker.
+  FTPThread worker_thread;
+  atomic_bool worker_running;
+  atomic_bool worker_stop;
+  //! Whether submissions can interrupt the worker's wait.
+  bool worker_interruptible;
+  //! Status that ended the worker, valid once it has been joined.
+  FTPClientProcessStatus worker_status;
+
+#ifdef FTP_CLIENT_ENABLE_STATS
+  //! Points at `stats_storage`, or at that of the client that owns this
+  //! stripe session.
+  struct ClientStats *stats;
+  struct ClientStats stats_storage;
+#endif
 
   int last_errno;
 };
 
+#ifdef FTP_CLIENT_ENABLE_STATS
+#define STATS_ADD(CONTEXT, FIELD, VALUE) \
+  ((CONTEXT)->stats->counters.FIELD += (uint64_t)(VALUE))
+
+//! Counts a successful write to a socket of the given class.
+#define STATS_COUNT_WRITE(CONTEXT, CLASS, OFFERED, WRITTEN)          \
+  do {                                                               \
+    STATS_ADD(CONTEXT, CLASS.writes, 1);                             \
+    STATS_ADD(CONTEXT, CLASS.partial_writes, (WRITTEN) < (OFFERED)); \
+    STATS_ADD(CONTEXT, CLASS.bytes_written, WRITTEN);                \
+  } while (0)
+
+//! Accounts for data written to a data connection in the current throughput
+//! window, closing the window once it spans THROUGHPUT_WINDOW_MICROSECONDS.
+static void CountDataThroughput(FTPClient *context, size_t bytes_written) {
+  struct ClientStats *stats = context->stats;
+  uint64_t now = FTPClockMicroseconds();
+  if (!stats->window_start) {
+    stats->window_start = now;
+  }
+  stats->window_bytes += bytes_written;
+
+  uint64_t elapsed = now - stats->window_start;
+  if (elapsed >= THROUGHPUT_WINDOW_MICROSECONDS) {
+    stats->window_bytes_per_second = stats->window_bytes * 1000000 / elapsed;
+    stats->window_start = now;
+    stats->window_bytes = 0;
+  }
+}
+
+//! Counts the completion of the given operation.
+static void CountCompletion(FTPClient *context, const struct SendOperation *fs,
+                            bool successful) {
+  if (!successful) {
+    STATS_ADD(context, failed_operations, 1);
+    return;
+  }
+  STATS_ADD(context, completed_operations, 1);
+  STATS_ADD(context, completed_bytes, fs->bytes_sent);
+  if (fs->timings.data_connected &&
+      fs->timings.last_byte_sent > fs->timings.data_connected) {
+    context->stats->transfer_microseconds +=
+        fs->timings.last_byte_sent - fs->timings.data_connected;
+  }
+}
+#else
+// Counters compile to nothing, and their arguments are not evaluated.
+#define STATS_ADD(CONTEXT, FIELD, VALUE) ((void)0)
+#define STATS_COUNT_WRITE(CONTEXT, CLASS, OFFERED, WRITTEN) ((void)0)
+#define CountDataThroughput(CONTEXT, BYTES_WRITTEN) ((void)0)
+#define CountCompletion(CONTEXT, FS, SUCCESSFUL) ((void)0)
+#endif
+
+//! Reports an event to the client's trace callback, if any.
+static void Trace(FTPClient *context, FTPClientTraceEventType type,
+                  uint64_t operation_id, uint64_t value, const char *text,
+                  size_t text_length) {
+  if (!context->on_trace) {
+    return;
+  }
+  FTPClientTraceEvent event;
+  event.type = type;
+  event.timestamp = FTPClockMicroseconds();
+  event.operation_id = operation_id;
+  event.session = context->trace_session;
+  event.value = value;
+  event.text = text;
+  event.text_length = text_length;
+  context->on_trace(&event, context->trace_userdata);
+}
+
+//! Invokes the progress callback of the given operation's upload.
+static void ReportProgress(struct SendOperation *fs, uint64_t now) {
+  struct ProgressState *progress = fs->progress;
+  FTPClientProgress report;
+  report.filename = fs->filename;
+  report.bytes_sent = progress->bytes_sent;
+  report.total_bytes = progress->total_bytes;
+  report.bytes_per_second = 0;
+  uint64_t elapsed = now - progress->last_time;
+  if (elapsed && progress->bytes_sent > progress->last_bytes) {
+    report.bytes_per_second =
+        (progress->bytes_sent - progress->last_bytes) * 1000000 / elapsed;
+  }
+
+  progress->last_bytes = progress->bytes_sent;
+  progress->last_time = now;
+  progress->next_bytes = progress->interval_bytes
+                             ? progress->bytes_sent + progress->interval_bytes
+                             : UINT64_MAX;
+  progress->callback(&report, progress->userdata);
+}
+
+//! Accounts for bytes of the operation's upload that are no longer considered
+//! sent (`removed`) or that a resumed upload skips (`added`) without reporting
+//! the change.
+static void AdjustProgress(struct SendOperation *fs, uint64_t removed,
+                           uint64_t added) {
+  struct ProgressState *progress = fs->progress;
+  if (!progress) {
+    return;
+  }
+  progress->bytes_sent = progress->bytes_sent - removed + added;
+  progress->last_bytes = progress->bytes_sent;
+  progress->next_bytes = progress->interval_bytes
+                             ? progress->bytes_sent + progress->interval_bytes
+                             : UINT64_MAX;
+}
+
+//! Reports progress if the time interval has passed with data sent since the
+//! previous report, or unconditionally if `force` is set.
+static void CheckProgressInterval(struct SendOperation *fs, bool force) {
+  struct ProgressState *progress = fs->progress;
+  if (!progress || progress->bytes_sent == progress->last_bytes ||
+      (!force && !progress->interval_microseconds)) {
+    return;
+  }
+  uint64_t now = FTPClockMicroseconds();
+  if (force || now - progress->last_time >= progress->interval_microseconds) {
+    ReportProgress(fs, now);
+  }
+}
+
+static void InitTokenBucket(struct TokenBucket *bucket,
+                            uint64_t bytes_per_second, uint64_t burst_bytes) {
+  if (!burst_bytes) {
+    burst_bytes = bytes_per_second * RATE_LIMIT_BURST_MICROSECONDS / 1000000;
+    if (burst_bytes < RATE_LIMIT_MIN_BURST_BYTES) {
+      burst_bytes = RATE_LIMIT_MIN_BURST_BYTES;
+    }
+  }
+  bucket->bytes_per_second = bytes_per_second;
+  bucket->burst_bytes = burst_bytes;
+  bucket->tokens = burst_bytes;
+  bucket->last_refill = FTPClockMicroseconds();
+}
+
+//! Adds the tokens that have accrued since the last refill. Time that has not
+//! yet accrued a whole token is carried over.
+static void RefillTokenBucket(struct TokenBucket *bucket, uint64_t now) {
+  uint64_t missing = bucket->burst_bytes - bucket->tokens;
+  uint64_t elapsed = now - bucket->last_refill;
+  if (elapsed >= missing * 1000000 / bucket->bytes_per_second) {
+    bucket->tokens = bucket->burst_bytes;
+    bucket->last_refill = now;
+    return;
+  }
+  uint64_t accrued = elapsed * bucket->bytes_per_second / 1000000;
+  bucket->tokens += accrued;
+  bucket->last_refill += accrued * 1000000 / bucket->bytes_per_second;
+}
+
+//! Applies the client's and the operation's rate limits to a write of up to
+//! `bytes_to_send` bytes. Returns the number of bytes that may be written, or
+//! 0 if the operation should wait for `*wait_microseconds` so that it does
+//! not wake for every few bytes that accrue.
+static uint64_t ApplyRateLimits(FTPClient *context, struct SendOperation *fs,
+                                uint64_t bytes_to_send,
+                                uint64_t *wait_microseconds) {
+  struct TokenBucket *buckets[] = {context->rate_limit, fs->rate_limit};
+  uint64_t now = FTPClockMicroseconds();
+  uint64_t allowance = bytes_to_send;
+  *wait_microseconds = 0;
+  for (size_t i = 0; i < sizeof(buckets) / sizeof(buckets[0]); ++i) {
+    struct TokenBucket *bucket = buckets[i];
+    if (!bucket) {
+      continue;
+    }
+    RefillTokenBucket(bucket, now);
+
+    uint64_t wake_bytes =
+        bucket->bytes_per_second * RATE_LIMIT_WAKE_MICROSECONDS / 1000000;
+    if (wake_bytes > bucket->burst_bytes) {
+      wake_bytes = bucket->burst_bytes;
+    }
+    if (wake_bytes > bytes_to_send) {
+      wake_bytes = bytes_to_send;
+    }
+    if (!wake_bytes) {
+      wake_bytes = 1;
+    }
+    if (bucket->tokens < wake_bytes) {
+      uint64_t needed = wake_bytes - bucket->tokens;
+      uint64_t wait = (needed * 1000000 + bucket->bytes_per_second - 1) /
+                      bucket->bytes_per_second;
+      if (wait > *wait_microseconds) {
+        *wait_microseconds = wait;
+      }
+    }
+    if (bucket->tokens < allowance) {
+      allowance = bucket->tokens;
+    }
+  }
+  return *wait_microseconds ? 0 : allowance;
+}
+
+//! Removes the tokens for data that has been written.
+static void ConsumeRateLimits(FTPClient *context, struct SendOperation *fs,
+                              uint64_t bytes_written) {
+  struct TokenBucket *buckets[] = {context->rate_limit, fs->rate_limit};
+  for (size_t i = 0; i < sizeof(buckets) / sizeof(buckets[0]); ++i) {
+    if (buckets[i]) {
+      buckets[i]->tokens -= bytes_written < buckets[i]->tokens
+                                ? bytes_written
+                                : buckets[i]->tokens;
+    }
+  }
+}
+
+//! Ranges of a striped upload, whose caller is notified once every range has
+//! completed.
+struct StripeSet {
+  //! Client the upload was submitted to, whose callback mode applies.
+  FTPClient *owner;
+  //! Number of operations that have not been freed.
+  size_t ref_count;
+  //! Number of ranges that have not completed.
+  size_t remaining;
+  //! Ranges after the first, which start once the server has accepted the
+  //! first and truncated the remote file.
+  struct SendOperation *held;
+  //! Copied buffer backing all ranges, freed with the set.
+  void *owned_buffer;
+  //! Progress reporting and rate limit shared by all ranges, freed with the
+  //! set.
+  struct ProgressState *progress;
+  struct TokenBucket *rate_limit;
+
+  //! Aggregated across all ranges. `result.filename` points at `filename`.
+  FTPClientTransferResult result;
+  char *filename;
+
+  void (*on_complete)(bool successful, void *userdata);
+  void *userdata;
+  FTPClientTransferResultCallback on_result;
+  void *on_result_userdata;
+};
+
+//! Waits until the executor no longer touches the read-ahead buffers of the
+//! given operation or the poller they wake.
+static void AwaitReadAheadFills(struct SendOperation *fs) {
+  for (uint32_t i = 0; i < READ_AHEAD_BUFFER_COUNT; ++i) {
+    struct ReadAheadBuffer *rab = fs->read_ahead + i;
+    while (atomic_load(&rab->state) == READ_AHEAD_STATE_FILLING ||
+           atomic_load(&rab->waking)) {
+      FTPThreadYield();
+    }
+  }
+}
+
+//! Points the read-ahead wakeups of the client's operations at `poller`, which
+//! may be NULL, once fills in progress have woken the previous one.
+static void RetargetReadAheadWakeups(FTPClient *context, FTPPoller *poller) {
+  bool can_wake = poller && FTPPollerEnableWakeup(poller);
+  for (struct SendOperation *fs = context->active_head; fs; fs = fs->next) {
+    if (fs->read_ahead) {
+      AwaitReadAheadFills(fs);
+      fs->read_ahead_poller = can_wake ? poller : NULL;
+    }
+  }
+}
+
+//! Releases the local file of a file-backed operation along with the zero-copy
+//! or read-ahead state used to send it.
+static void ReleaseFileSource(struct SendOperation *send_operation) {
+  if (send_operation->read_ahead) {
+    // The executor may still be reading into one of the buffers.
+    AwaitReadAheadFills(send_operation);
+    for (uint32_t i = 0; i < READ_AHEAD_BUFFER_COUNT; ++i) {
+      free(send_operation->read_ahead[i].data);
+    }
+    free(send_operation->read_ahead);
+    send_operation->read_ahead = NULL;
+    if (!send_operation->buffer_owned) {
+      send_operation->buffer = NULL;
+    }
+  }
+
+  if (send_operation->read_file) {
+    fclose(send_operation->read_file);
+    send_operation->read_file = NULL;
+  }
+
+#ifdef ZERO_COPY_SENDFILE
+  if (send_operation->sendfile_file) {
+    fclose(send_operation->sendfile_file);
+    send_operation->sendfile_file = NULL;
+  }
+#endif
+#ifdef ZERO_COPY_MMAP
+  if (send_operation->mapping_length) {
+    munmap((void *)send_operation->buffer, send_operation->mapping_length);
+    send_operation->buffer = NULL;
+    send_operation->mapping_length = 0;
+  }
+#endif
+}
+
 static void FreeSendOperation(struct SendOperation *send_operation) {
   if (!send_operation) {
     return;
@@ -86,16 +824,41 @@ static void FreeSendOperation(struct SendOperation *send_operation) {
     send_operation->socket = -1;
   }
 
-  if (send_operation->read_file) {
-    fclose(send_operation->read_file);
-    send_operation->read_file = NULL;
-  }
+  ReleaseFileSource(send_operation);
 
   if (send_operation->buffer_owned) {
     free((void *)send_operation->buffer);
     send_operation->buffer = NULL;
   }
 
+  FTPClientPayloadRelease(&send_operation->payload);
+
+  free(send_operation->segments);
+  send_operation->segments = NULL;
+
+  free(send_operation->local_filename);
+  send_operation->local_filename = NULL;
+
+  struct StripeSet *set = send_operation->stripe_set;
+  if (set) {
+    // Ranges still held for the first can no longer start.
+    while (!send_operation->range_start && set->held) {
+      struct SendOperation *held = set->held;
+      set->held = held->next;
+      FreeSendOperation(held);
+    }
+    if (!--set->ref_count) {
+      free(set->progress);
+      free(set->rate_limit);
+      free(set->owned_buffer);
+      free(set->filename);
+      free(set);
+    }
+  } else {
+    free(send_operation->progress);
+    free(send_operation->rate_limit);
+  }
+
   if (send_operation->filename) {
     free(send_operation->filename);
     send_operation->filename = NULL;
@@ -103,18 +866,374 @@ static void FreeSendOperation(struct SendOperation *send_operation) {
   free(send_operation);
 }
 
+//! Removes the given operation from the list starting at `head`. On success,
+//! `previous_out` (if given) receives the operation that preceded it.
+static bool UnlinkSendOperation(struct SendOperation **head,
+                                struct SendOperation **previous_out,
+                                struct SendOperation *send_operation) {
+  struct SendOperation *previous = NULL;
+  for (struct SendOperation *op = *head; op; previous = op, op = op->next) {
+    if (op != send_operation) {
+      continue;
+    }
+    if (previous) {
+      previous->next = op->next;
+    } else {
+      *head = op->next;
+    }
+    op->next = NULL;
+    if (previous_out) {
+      *previous_out = previous;
+    }
+    return true;
+  }
+  return false;
+}
+
+//! Returns the pending FIFO for the priority of the given operation.
+static struct PendingQueue *GetPendingQueue(FTPClient *context,
+                                            const struct SendOperation *fs) {
+  return &context->pending[fs->priority - FTP_CLIENT_PRIORITY_URGENT];
+}
+
+//! Adds the given operation to the end of the pending FIFO of its priority,
+//! or to the front if it is to be started again ahead of the others.
+static void QueuePendingOperation(FTPClient *context, struct SendOperation *fs,
+                                  bool front) {
+  struct PendingQueue *queue = GetPendingQueue(context, fs);
+  if (front) {
+    fs->next = queue->head;
+    queue->head = fs;
+    if (!queue->tail) {
+      queue->tail = fs;
+    }
+  } else {
+    fs->next = NULL;
+    if (queue->tail) {
+      queue->tail->next = fs;
+    } else {
+      queue->head = fs;
+    }
+    queue->tail = fs;
+  }
+  ++context->pending_count;
+  context->pending_bytes += fs->queued_bytes;
+}
+
+//! Unregisters and closes the data connection of the given operation.
+static void CloseDataSocket(FTPClient *context, struct SendOperation *fs) {
+  if (fs->socket < 0) {
+    return;
+  }
+  if (context->poller) {
+    FTPPollerRemove(context->poller, fs->socket);
+  }
+  close(fs->socket);
+  fs->socket = -1;
+  fs->poll_interest = 0;
+  Trace(context, FTP_CLIENT_TRACE_EVENT_DATA_CLOSED, fs->id, fs->bytes_sent,
+        NULL, 0);
+}
+
+//! Detaches the given operation from the commands awaiting replies, whose
+//! replies are then ignored.
+static void ForgetPendingReplies(FTPClient *context,
+                                 struct SendOperation *send_operation) {
+  for (struct PendingReply *reply = context->reply_head; reply;
+       reply = reply->next) {
+    if (reply->operation == send_operation) {
+      reply->operation = NULL;
+    }
+  }
+}
+
 static void FindAndFreeSendOperation(FTPClient *context,
                                      struct SendOperation *send_operation) {
-  for (size_t i = 0; i < MAX_SEND_OPERATIONS; ++i) {
-    if (context->file_send_buffer[i] == send_operation) {
-      context->file_send_buffer[i] = NULL;
-      break;
+  CloseDataSocket(context, send_operation);
+  ForgetPendingReplies(context, send_operation);
+
+  if (UnlinkSendOperation(&context->active_head, NULL, send_operation)) {
+    --context->active_count;
+  } else {
+    struct PendingQueue *queue = GetPendingQueue(context, send_operation);
+    struct SendOperation *previous = NULL;
+    if (UnlinkSendOperation(&queue->head, &previous, send_operation)) {
+      if (queue->tail == send_operation) {
+        queue->tail = previous;
+      }
+      --context->pending_count;
+      context->pending_bytes -= send_operation->queued_bytes;
     }
   }
 
   FreeSendOperation(send_operation);
 }
 
+//! Completion callbacks of an operation, queued for FTPClientDispatchCallbacks
+//! in FTP_CLIENT_CALLBACK_MODE_DEFERRED.
+struct DeferredCompletion {
+  FTPMPSCQueueNode node;
+
+  bool successful;
+  void (*on_complete)(bool successful, void *userdata);
+  void *userdata;
+
+  FTPClientTransferResultCallback on_result;
+  void *on_result_userdata;
+  //! `filename` points at `filename_storage`.
+  FTPClientTransferResult result;
+  char filename_storage[];
+};
+
+static void InvokeCompletionCallbacks(
+    bool successful, void (*on_complete)(bool successful, void *userdata),
+    void *userdata, FTPClientTransferResultCallback on_result,
+    const FTPClientTransferResult *result, void *on_result_userdata) {
+  if (on_complete) {
+    on_complete(successful, userdata);
+  }
+  if (on_result) {
+    on_result(result, on_result_userdata);
+  }
+}
+
+//! Invokes the given completion callbacks, or queues them if the client
+//! defers callbacks.
+static void NotifyCompletion(
+    FTPClient *context, const FTPClientTransferResult *result,
+    void (*on_complete)(bool successful, void *userdata), void *userdata,
+    FTPClientTransferResultCallback on_result, void *on_result_userdata) {
+  // Falls back to invoking the callbacks immediately if allocation fails.
+  struct DeferredCompletion *deferred = NULL;
+  if (context->callback_mode == FTP_CLIENT_CALLBACK_MODE_DEFERRED) {
+    size_t filename_size = strlen(result->filename) + 1;
+    deferred = (struct DeferredCompletion *)malloc(sizeof(*deferred) +
+                                                   filename_size);
+    if (deferred) {
+      memcpy(deferred->filename_storage, result->filename, filename_size);
+    }
+  }
+  if (!deferred) {
+    InvokeCompletionCallbacks(result->successful, on_complete, userdata,
+                              on_result, result, on_result_userdata);
+    return;
+  }
+
+  deferred->successful = result->successful;
+  deferred->on_complete = on_complete;
+  deferred->userdata = userdata;
+  deferred->on_result = on_result;
+  deferred->on_result_userdata = on_result_userdata;
+  deferred->result = *result;
+  deferred->result.filename = deferred->filename_storage;
+  FTPMPSCQueuePush(&context->deferred_completions, &deferred->node);
+}
+
+//! Accounts for a completed range of a striped upload and notifies the caller
+//! once every range has completed. The first failure determines the reported
+//! reply code.
+static void CompleteStripe(struct SendOperation *fs, bool successful,
+                           int reply_code) {
+  struct StripeSet *set = fs->stripe_set;
+  FTPClientTransferResult *result = &set->result;
+  result->bytes_sent += fs->bytes_sent;
+  if (result->successful) {
+    result->successful = successful;
+    result->reply_code = reply_code;
+  }
+
+  if (!fs->range_start) {
+    // The first range is the one that starts the others.
+    result->timings.pasv_reply = fs->timings.pasv_reply;
+    result->timings.data_connected = fs->timings.data_connected;
+    while (!successful && set->held) {
+      struct SendOperation *held = set->held;
+      set->held = held->next;
+      FreeSendOperation(held);
+      --set->remaining;
+    }
+  }
+  if (fs->timings.last_byte_sent > result->timings.last_byte_sent) {
+    result->timings.last_byte_sent = fs->timings.last_byte_sent;
+  }
+  if (fs->timings.final_reply > result->timings.final_reply) {
+    result->timings.final_reply = fs->timings.final_reply;
+  }
+
+  if (--set->remaining || (!set->on_complete && !set->on_result)) {
+    return;
+  }
+  NotifyCompletion(set->owner, result, set->on_complete, set->userdata,
+                   set->on_result, set->on_result_userdata);
+}
+
+//! Invokes the completion callbacks of the given operation, at most once, or
+//! queues them if the client defers callbacks. `reply_code` is the server's
+//! final reply, or 0 if the operation failed before one arrived.
+static void NotifySendOperationComplete(FTPClient *context,
+                                        struct SendOperation *fs,
+                                        bool successful, int reply_code) {
+  if (fs->completion_notified) {
+    return;
+  }
+  fs->completion_notified = true;
+  CountCompletion(context, fs, successful);
+  if (fs->stripe_set) {
+    CompleteStripe(fs, successful, reply_code);
+    return;
+  }
+  if (!fs->on_complete && !fs->on_result) {
+    return;
+  }
+
+  FTPClientTransferResult result;
+  result.filename = fs->filename;
+  result.append = fs->append;
+  result.successful = successful;
+  result.reply_code = reply_code;
+  result.bytes_sent = fs->bytes_sent;
+  result.timings = fs->timings;
+  result.operation_id = fs->id;
+  NotifyCompletion(context, &result, fs->on_complete, fs->userdata,
+                   fs->on_result, fs->on_result_userdata);
+}
+
+//! Closes the data connection of a failed operation and notifies the caller.
+static void AbortSendOperation(FTPClient *context, struct SendOperation *fs,
+                               int reply_code) {
+  CloseDataSocket(context, fs);
+  NotifySendOperationComplete(context, fs, false, reply_code);
+}
+
+static void FreeSendOperationList(struct SendOperation *head) {
+  while (head) {
+    struct SendOperation *next = head->next;
+    FreeSendOperation(head);
+    head = next;
+  }
+}
+
+struct ReadAheadJob {
+  void (*work)(void *work_context);
+  void *work_context;
+  struct ReadAheadJob *next;
+};
+
+//! Thread that runs read-ahead jobs for the default executor.
+struct ReadAheadWorker {
+  FTPThread thread;
+  FTPMutex mutex;
+  FTPCondition condition;
+
+  struct ReadAheadJob *head;
+  struct ReadAheadJob *tail;
+  bool stop;
+};
+
+static int ReadAheadWorkerThreadProc(void *arg) {
+  struct ReadAheadWorker *worker = (struct ReadAheadWorker *)arg;
+
+  FTPMutexLock(&worker->mutex);
+  while (true) {
+    while (!worker->head && !worker->stop) {
+      FTPConditionWait(&worker->condition, &worker->mutex);
+    }
+
+    struct ReadAheadJob *job = worker->head;
+    if (!job) {
+      break;
+    }
+    worker->head = job->next;
+    if (!worker->head) {
+      worker->tail = NULL;
+    }
+
+    FTPMutexUnlock(&worker->mutex);
+    job->work(job->work_context);
+    free(job);
+    FTPMutexLock(&worker->mutex);
+  }
+  FTPMutexUnlock(&worker->mutex);
+
+  return 0;
+}
+
+static struct ReadAheadWorker *CreateReadAheadWorker(void) {
+  struct ReadAheadWorker *worker =
+      (struct ReadAheadWorker *)calloc(1, sizeof(*worker));
+  if (!worker) {
+    return NULL;
+  }
+
+  if (!FTPMutexInit(&worker->mutex)) {
+    free(worker);
+    return NULL;
+  }
+  if (!FTPConditionInit(&worker->condition)) {
+    FTPMutexDestroy(&worker->mutex);
+    free(worker);
+    return NULL;
+  }
+  if (!FTPThreadCreate(&worker->thread, ReadAheadWorkerThreadProc, worker)) {
+    FTPConditionDestroy(&worker->condition);
+    FTPMutexDestroy(&worker->mutex);
+    free(worker);
+    return NULL;
+  }
+
+  return worker;
+}
+
+//! Stops the given worker after it has run all of its pending jobs.
+static void DestroyReadAheadWorker(struct ReadAheadWorker *worker) {
+  if (!worker) {
+    return;
+  }
+
+  FTPMutexLock(&worker->mutex);
+  worker->stop = true;
+  FTPConditionSignal(&worker->condition);
+  FTPMutexUnlock(&worker->mutex);
+
+  FTPThreadJoin(worker->thread);
+  FTPConditionDestroy(&worker->condition);
+  FTPMutexDestroy(&worker->mutex);
+  free(worker);
+}
+
+//! Executor that queues work on the FTPClient's read-ahead worker thread,
+//! falling back to running it inline if the thread cannot be started.
+static void DefaultReadAheadExecutor(void (*work)(void *work_context),
+                                     void *work_context,
+                                     void *executor_userdata) {
+  FTPClient *context = (FTPClient *)executor_userdata;
+  if (!context->read_ahead_worker) {
+    context->read_ahead_worker = CreateReadAheadWorker();
+  }
+
+  struct ReadAheadJob *job = NULL;
+  if (context->read_ahead_worker) {
+    job = (struct ReadAheadJob *)calloc(1, sizeof(*job));
+  }
+  if (!job) {
+    work(work_context);
+    return;
+  }
+  job->work = work;
+  job->work_context = work_context;
+
+  struct ReadAheadWorker *worker = context->read_ahead_worker;
+  FTPMutexLock(&worker->mutex);
+  if (worker->tail) {
+    worker->tail->next = job;
+  } else {
+    worker->head = job;
+  }
+  worker->tail = job;
+  FTPConditionSignal(&worker->condition);
+  FTPMutexUnlock(&worker->mutex);
+}
+
 FTPClientInitStatus FTPClientInit(FTPClient **context,
                                   uint32_t ipv4_ip_host_ordered,
                                   uint16_t port_host_ordered,
@@ -131,6 +1250,22 @@ FTPClientInitStatus FTPClientInit(FTPClient **context,
   FTPClient *client = *context;
   client->control_socket = -1;
   client->state = FTP_CLIENT_STATE_DISCONNECTED;
+  client->chunk_size = DEFAULT_CHUNK_SIZE;
+  client->chunk_mode = FTP_CLIENT_CHUNK_MODE_FIXED;
+  client->read_ahead_executor = DefaultReadAheadExecutor;
+  client->read_ahead_executor_userdata = client;
+  client->max_active_operations = DEFAULT_MAX_ACTIVE_OPERATIONS;
+  client->min_stripe_size = DEFAULT_MIN_STRIPE_SIZE;
+  client->default_priority = FTP_CLIENT_PRIORITY_NORMAL;
+  FTPClientPriorityPolicyInit(&client->priority_policy);
+  client->jitter_state =
+      (uint32_t)(FTPClockMicroseconds() ^ (uintptr_t)client) | 1;
+  FTPMPSCQueueInit(&client->submissions);
+  FTPMPSCQueueInit(&client->deferred_completions);
+#ifdef FTP_CLIENT_ENABLE_STATS
+  client->stats = &client->stats_storage;
+#endif
+  client->scheduler = &client->scheduler_storage;
 
   client->control_sockaddr.sin_family = AF_INET;
   client->control_sockaddr.sin_addr.s_addr = htonl(ipv4_ip_host_ordered);
@@ -160,24 +1295,122 @@ FTPClientInitStatus FTPClientInit(FTPClient **context,
   return FTP_CLIENT_INIT_STATUS_SUCCESS;
 }
 
-void FTPClientDestroy(FTPClient **context) {
-  if (!context || !*context) {
-    return;
+//! Moves submitted operations to the end of the pending FIFOs.
+static void DrainSubmissions(FTPClient *context) {
+  FTPMPSCQueueNode *node;
+  while ((node = FTPMPSCQueuePop(&context->submissions))) {
+    struct SendOperation *fs =
+        (struct SendOperation *)((char *)node -
+                                 offsetof(struct SendOperation, submission));
+    fs->id = ++context->last_operation_id;
+    QueuePendingOperation(context, fs, false);
   }
+}
 
-  FTPClientClose(*context);
+struct FTPClientGroup {
+  FTPPoller *poller;
 
-  if ((*context)->username) {
-    free((*context)->username);
-  }
-  if ((*context)->password) {
-    free((*context)->password);
-  }
+  FTPClient **clients;
+  size_t client_count;
+  size_t client_capacity;
 
-  for (size_t i = 0; i < MAX_SEND_OPERATIONS; ++i) {
-    FreeSendOperation((*context)->file_send_buffer[i]);
-    (*context)->file_send_buffer[i] = NULL;
+  struct PriorityScheduler scheduler;
+};
+
+//! Unregisters the client's sockets from the given poller.
+static void RemoveSocketsFromPoller(FTPClient *context, FTPPoller *poller) {
+  if (!poller) {
+    return;
+  }
+  if (context->control_socket >= 0) {
+    FTPPollerRemove(poller, context->control_socket);
+  }
+  for (struct SendOperation *fs = context->active_head; fs; fs = fs->next) {
+    if (fs->socket >= 0) {
+      FTPPollerRemove(poller, fs->socket);
+    }
+  }
+}
+
+//! Removes the client from its group's membership list.
+static void UnlinkGroupMember(FTPClient *context) {
+  FTPClientGroup *group = context->group;
+  for (size_t i = 0; i < group->client_count; ++i) {
+    if (group->clients[i] == context) {
+      group->clients[i] = group->clients[--group->client_count];
+      break;
+    }
+  }
+  context->group = NULL;
+  context->poller = NULL;
+  context->scheduler = &context->scheduler_storage;
+}
+
+//! Whether the client has a control connection or is waiting to reconnect
+//! one.
+static bool HasSession(const FTPClient *context) {
+  return context->control_socket >= 0 || context->reconnect_deadline;
+}
+
+//! Closes and frees the stripe sessions of the given client, abandoning the
+//! ranges they were sending.
+static void DestroyStripeSessions(FTPClient *context) {
+  for (size_t i = 0; i < context->stripe_session_count; ++i) {
+    FTPClient *session = context->stripe_sessions[i];
+    RemoveSocketsFromPoller(session, session->poller);
+    session->poller = NULL;
+    FTPClientDestroy(&session);
+  }
+  free(context->stripe_sessions);
+  context->stripe_sessions = NULL;
+  context->stripe_session_count = 0;
+}
+
+void FTPClientDestroy(FTPClient **context) {
+  if (!context || !*context) {
+    return;
+  }
+
+  if (atomic_load_explicit(&(*context)->worker_running,
+                           memory_order_acquire)) {
+    FTPClientStopWorker(*context);
+  }
+
+  if ((*context)->group) {
+    RemoveSocketsFromPoller(*context, (*context)->poller);
+    UnlinkGroupMember(*context);
+  }
+  DestroyStripeSessions(*context);
+  FTPClientClose(*context);
+
+  if ((*context)->username) {
+    free((*context)->username);
   }
+  if ((*context)->password) {
+    free((*context)->password);
+  }
+
+  FreeSendOperationList((*context)->active_head);
+  (*context)->active_head = NULL;
+  DrainSubmissions(*context);
+  for (size_t i = 0; i < PRIORITY_COUNT; ++i) {
+    FreeSendOperationList((*context)->pending[i].head);
+    (*context)->pending[i].head = NULL;
+  }
+
+  while ((*context)->reply_head) {
+    struct PendingReply *next = (*context)->reply_head->next;
+    free((*context)->reply_head);
+    (*context)->reply_head = next;
+  }
+
+  FTPMPSCQueueNode *node;
+  while ((node = FTPMPSCQueuePop(&(*context)->deferred_completions))) {
+    free(node);
+  }
+
+  DestroyReadAheadWorker((*context)->read_ahead_worker);
+  FTPPollerDestroy((*context)->poller);
 
   free(*context);
   *context = NULL;
@@ -185,24 +1418,34 @@ void FTPClientDestroy(FTPClient **context) {
 
 void FTPClientClose(FTPClient *context) {
   if (context->control_socket >= 0) {
+    if (context->poller) {
+      FTPPollerRemove(context->poller, context->control_socket);
+    }
     close(context->control_socket);
     context->control_socket = -1;
+    context->control_interest = 0;
   }
+  context->state = FTP_CLIENT_STATE_DISCONNECTED;
+  context->reconnect_deadline = 0;
 }
 
-FTPClientConnectStatus FTPClientConnect(FTPClient *context,
-                                        uint32_t timeout_milliseconds) {
+FTPClientConnectStatus FTPClientStartConnect(FTPClient *context,
+                                             uint32_t timeout_milliseconds) {
   if (!context) {
     return FTP_CLIENT_CONNECT_STATUS_INVALID_CONTEXT;
   }
-  if (FTPClientIsFullyConnected(context)) {
+  if (context->control_socket >= 0) {
     return FTP_CLIENT_CONNECT_STATUS_SUCCESS;
   }
+  context->last_errno = 0;
 
-  if (context->control_socket >= 0) {
-    FTPClientClose(context);
+  if (!context->poller) {
+    context->poller = FTPPollerCreate(context->poller_backend);
+    if (!context->poller) {
+      context->last_errno = errno;
+      return FTP_CLIENT_CONNECT_STATUS_SOCKET_CREATE_FAILED;
+    }
   }
-  context->last_errno = 0;
 
   context->control_socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
   if (context->control_socket < 0) {
@@ -212,46 +1455,149 @@ FTPClientConnectStatus FTPClientConnect(FTPClient *context,
 
   if (fcntl(context->control_socket, F_SETFL, O_NONBLOCK) < 0) {
     context->last_errno = errno;
+    FTPClientClose(context);
+    return FTP_CLIENT_CONNECT_STATUS_SOCKET_CREATE_FAILED;
+  }
+
+  // Completion of connect() is signaled by writability.
+  if (!FTPPollerSet(context->poller, context->control_socket,
+                    FTP_POLLER_EVENT_WRITE, context, NULL)) {
+    context->last_errno = errno;
+    FTPClientClose(context);
     return FTP_CLIENT_CONNECT_STATUS_SOCKET_CREATE_FAILED;
   }
+  context->control_interest = FTP_POLLER_EVENT_WRITE;
 
   if (connect(context->control_socket,
               (struct sockaddr *)&context->control_sockaddr,
               sizeof(struct sockaddr)) < 0 &&
       errno != EWOULDBLOCK && errno != EINPROGRESS) {
     context->last_errno = errno;
-    close(context->control_socket);
-    context->control_socket = -1;
+    FTPClientClose(context);
     return FTP_CLIENT_CONNECT_STATUS_CONNECT_FAILED;
   }
 
-  fd_set fdset;
-  FD_ZERO(&fdset);
-  FD_SET(context->control_socket, &fdset);
+  context->recv_buffer_len = 0;
+  context->recv_buffer[0] = 0;
+  context->multiline_reply_code = 0;
+  context->skip_line_remainder = false;
+  context->state = FTP_CLIENT_STATE_CONNECTING;
+  context->reconnect_deadline = 0;
+  context->last_control_activity = FTPClockMicroseconds();
 
-  struct timeval tv;
   if (!timeout_milliseconds) {
     timeout_milliseconds = DEFAULT_CONNECT_TIMEOUT_MILLISECONDS;
   }
-  tv.tv_sec = timeout_milliseconds / 1000;
-  tv.tv_usec = (timeout_milliseconds % 1000) * 1000;
+  context->connect_deadline =
+      FTPClockMicroseconds() + (uint64_t)timeout_milliseconds * 1000;
 
-  if (select(context->control_socket + 1, &fdset, NULL, NULL, &tv) == 1) {
-    int so_error;
-    socklen_t len = sizeof(so_error);
-    getsockopt(context->control_socket, SOL_SOCKET, SO_ERROR, &so_error, &len);
+  return FTP_CLIENT_CONNECT_STATUS_SUCCESS;
+}
 
-    if (!so_error) {
-      context->state = FTP_CLIENT_STATE_CONNECTED_AWAIT_220;
-      return FTP_CLIENT_CONNECT_STATUS_SUCCESS;
-    }
+//! Registers interest in writability of the control connection while it is
+//! connecting or commands are buffered for it.
+static bool UpdateControlInterest(FTPClient *context) {
+  uint32_t interest = FTP_POLLER_EVENT_READ;
+  if (context->state == FTP_CLIENT_STATE_CONNECTING) {
+    interest = FTP_POLLER_EVENT_WRITE;
+  } else if (context->send_buffer_len) {
+    interest |= FTP_POLLER_EVENT_WRITE;
+  }
+  if (interest == context->control_interest) {
+    return true;
+  }
+  if (!FTPPollerSet(context->poller, context->control_socket, interest,
+                    context, NULL)) {
+    context->last_errno = errno;
+    return false;
+  }
+  context->control_interest = interest;
+  return true;
+}
 
+//! Handles readiness of the control socket while connect() is in progress.
+static FTPClientProcessStatus CompleteConnect(FTPClient *context) {
+  int so_error = 0;
+  socklen_t len = sizeof(so_error);
+  if (getsockopt(context->control_socket, SOL_SOCKET, SO_ERROR, &so_error,
+                 &len) < 0) {
+    so_error = errno;
+  }
+
+  if (so_error) {
     context->last_errno = so_error;
-    return FTP_CLIENT_CONNECT_STATUS_CONNECT_FAILED;
+    FTPClientClose(context);
+    return FTP_CLIENT_PROCESS_STATUS_CONNECT_FAILED;
   }
 
-  context->last_errno = 0;
-  return FTP_CLIENT_CONNECT_STATUS_CONNECT_TIMEOUT;
+  context->state = FTP_CLIENT_STATE_CONNECTED_AWAIT_220;
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+FTPClientConnectStatus FTPClientConnect(FTPClient *context,
+                                        uint32_t timeout_milliseconds) {
+  if (!context) {
+    return FTP_CLIENT_CONNECT_STATUS_INVALID_CONTEXT;
+  }
+  if (FTPClientIsFullyConnected(context)) {
+    return FTP_CLIENT_CONNECT_STATUS_SUCCESS;
+  }
+
+  if (context->control_socket >= 0) {
+    FTPClientClose(context);
+  }
+
+  FTPClientConnectStatus status =
+      FTPClientStartConnect(context, timeout_milliseconds);
+  if (status != FTP_CLIENT_CONNECT_STATUS_SUCCESS) {
+    return status;
+  }
+
+  // Wait for the connection to be established and for the server's welcome
+  // to arrive.
+  for (;;) {
+    uint64_t now = FTPClockMicroseconds();
+    if (now >= context->connect_deadline) {
+      FTPClientClose(context);
+      context->last_errno = 0;
+      return FTP_CLIENT_CONNECT_STATUS_CONNECT_TIMEOUT;
+    }
+
+    uint32_t remaining =
+        (uint32_t)((context->connect_deadline - now + 999) / 1000);
+    FTPPollerEvent *events;
+    int event_count = FTPPollerWait(context->poller, remaining, &events);
+    if (event_count < 0) {
+      context->last_errno = errno;
+      FTPClientClose(context);
+      return FTP_CLIENT_CONNECT_STATUS_CONNECT_FAILED;
+    }
+
+    uint32_t control_events = 0;
+    for (int i = 0; i < event_count; ++i) {
+      if (events[i].owner == context && !events[i].userdata) {
+        control_events |= events[i].events;
+      }
+    }
+    if (!control_events) {
+      continue;
+    }
+
+    if (context->state != FTP_CLIENT_STATE_CONNECTING) {
+      break;
+    }
+    if (CompleteConnect(context) != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+      return FTP_CLIENT_CONNECT_STATUS_CONNECT_FAILED;
+    }
+    if (!UpdateControlInterest(context)) {
+      FTPClientClose(context);
+      return FTP_CLIENT_CONNECT_STATUS_CONNECT_FAILED;
+    }
+  }
+
+  // Login is driven by FTPClientProcess without a deadline.
+  context->connect_deadline = 0;
+  return FTP_CLIENT_CONNECT_STATUS_SUCCESS;
 }
 
 bool FTPClientIsFullyConnected(FTPClient *context) {
@@ -271,10 +1617,17 @@ bool FTPClientIsFullyConnected(FTPClient *context) {
   }                                          \
   context->send_buffer_len += (BYTES_WRITTEN);
 
+//! Marks login as complete, which resets the reconnect backoff.
+static void CompleteLogin(FTPClient *context) {
+  context->state = FTP_CLIENT_STATE_FULLY_CONNECTED;
+  context->logged_in = true;
+  context->reconnect_attempts = 0;
+}
+
 //! Handle response to welcome message.
 static FTPClientProcessStatus Handle220(FTPClient *context) {
   if (!context->username) {
-    context->state = FTP_CLIENT_STATE_FULLY_CONNECTED;
+    CompleteLogin(context);
   } else {
     context->state = FTP_CLIENT_STATE_USERNAME_AWAIT_331;
 
@@ -290,8 +1643,7 @@ static FTPClientProcessStatus Handle220(FTPClient *context) {
 //! Handle response to USER.
 static FTPClientProcessStatus Handle331(FTPClient *context) {
   if (!context->password) {
-    close(context->control_socket);
-    context->control_socket = -1;
+    FTPClientClose(context);
     context->state = FTP_CLIENT_STATE_PASSWORD_REJECTED;
     return false;
   }
@@ -317,25 +1669,195 @@ static FTPClientProcessStatus Handle230(FTPClient *context) {
 
 //! Handle response to `TYPE I`.
 static FTPClientProcessStatus Handle200(FTPClient *context) {
-  context->state = FTP_CLIENT_STATE_FULLY_CONNECTED;
+  CompleteLogin(context);
   return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
 }
 
-//! Handle PASV response.
-static FTPClientProcessStatus Handle227(FTPClient *context) {
-  struct SendOperation *send_op = NULL;
-  for (size_t i = 0; i < MAX_SEND_OPERATIONS; ++i) {
-    struct SendOperation *op = context->file_send_buffer[i];
-    if (op && op->socket < 0) {
-      send_op = op;
-      break;
+static struct PendingReply *CreatePendingReply(
+    PendingReplyKind kind, struct SendOperation *operation) {
+  struct PendingReply *reply = (struct PendingReply *)malloc(sizeof(*reply));
+  if (reply) {
+    reply->next = NULL;
+    reply->kind = kind;
+    reply->operation = operation;
+    reply->command_sent = false;
+  }
+  return reply;
+}
+
+//! Appends an entry for a just-queued command to the reply FIFO.
+static void AppendPendingReply(FTPClient *context,
+                               struct PendingReply *reply) {
+  if (context->reply_tail) {
+    context->reply_tail->next = reply;
+  } else {
+    context->reply_head = reply;
+  }
+  context->reply_tail = reply;
+}
+
+//! Removes and returns the oldest entry in the reply FIFO.
+static struct PendingReply *PopPendingReply(FTPClient *context) {
+  struct PendingReply *reply = context->reply_head;
+  if (reply) {
+    context->reply_head = reply->next;
+    if (!context->reply_head) {
+      context->reply_tail = NULL;
     }
   }
+  return reply;
+}
 
-  if (!send_op) {
-    return FTP_CLIENT_PROCESS_STATUS_BAD_STATE;
+//! Completes the given operation as failed due to the given reply.
+static void FailSendOperation(FTPClient *context, struct SendOperation *fs,
+                              int reply_code) {
+  AbortSendOperation(context, fs, reply_code);
+  FindAndFreeSendOperation(context, fs);
+}
+
+//! Returns an operation whose data connection has been closed to the state it
+//! was in before it was first activated. File-backed operations reopen their
+//! local file when activated again.
+static void RewindSendOperation(struct SendOperation *fs) {
+  if (fs->local_filename) {
+    ReleaseFileSource(fs);
+    fs->buffer_length = 0;
+    fs->read_ahead_next = 0;
+  }
+  fs->offset = 0;
+  fs->segment_index = 0;
+  fs->segment_offset = 0;
+  fs->awaiting_data = false;
+  fs->throttled = false;
+  fs->deficit = 0;
+  fs->descheduled = false;
+  AdjustProgress(fs, fs->resume_offset + fs->bytes_sent, 0);
+  fs->resume_offset = 0;
+  fs->interrupted = false;
+  fs->data_complete = false;
+  fs->chunk_writes = 0;
+  fs->chunk_largest_write = 0;
+  fs->bytes_sent = 0;
+
+  uint64_t submitted = fs->timings.submitted;
+  memset(&fs->timings, 0, sizeof(fs->timings));
+  fs->timings.submitted = submitted;
+}
+
+//! Repositions the given local file. Targets without 64-bit stdio offsets
+//! reject offsets beyond LONG_MAX rather than truncating them.
+static bool SeekLocalFile(FILE *file, uint64_t offset) {
+#ifdef HAVE_FSEEKO
+  off_t position = (off_t)offset;
+  if (position < 0 || (uint64_t)position != offset) {
+    errno = EINVAL;
+    return false;
+  }
+  return !fseeko(file, position, SEEK_SET);
+#else
+  if (offset > LONG_MAX) {
+    errno = EINVAL;
+    return false;
+  }
+  return !fseek(file, (long)offset, SEEK_SET);
+#endif
+}
+
+//! Returns the size of the given local file and rewinds it, or returns -1 if
+//! the size cannot be represented (e.g., beyond LONG_MAX without 64-bit stdio
+//! offsets) or the file is not seekable.
+static int64_t GetLocalFileSize(FILE *file) {
+#ifdef HAVE_FSEEKO
+  off_t size = -1;
+  if (!fseeko(file, 0, SEEK_END)) {
+    size = ftello(file);
+    fseeko(file, 0, SEEK_SET);
+  }
+#else
+  long size = -1;
+  if (!fseek(file, 0, SEEK_END)) {
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+  }
+#endif
+  return (int64_t)size;
+}
+
+//! Whether an interrupted transfer of the given operation may be resumed.
+//! Streams cannot be rewound, and appends have no reliable starting size.
+static bool CanResumeSendOperation(const struct SendOperation *fs) {
+  return fs->resume_attempts < fs->max_resume_attempts && !fs->fill &&
+         !fs->append;
+}
+
+//! Positions the source of an operation whose data has not yet been read at
+//! the given offset. Returns false if the offset is beyond the end of the
+//! source or the local file cannot be repositioned.
+static bool SeekSendOperation(struct SendOperation *fs, uint64_t offset) {
+  if (offset > fs->queued_bytes) {
+    return false;
+  }
+
+  if (fs->read_file) {
+    fs->read_position = offset;
+    return SeekLocalFile(fs->read_file, offset);
+  }
+
+  fs->offset = (ssize_t)offset;
+  if (fs->segments) {
+    size_t index = 0;
+    while (index < fs->segment_count && offset >= fs->segments[index].iov_len) {
+      offset -= fs->segments[index].iov_len;
+      ++index;
+    }
+    fs->segment_index = index;
+    fs->segment_offset = (size_t)offset;
+  }
+  return true;
+}
+
+//! Moves an active operation whose transfer was interrupted to the front of
+//! the pending FIFO of its priority to be resumed from the size of the remote
+//! file.
+static void RequeueForResume(FTPClient *context, struct SendOperation *fs) {
+  CloseDataSocket(context, fs);
+  ForgetPendingReplies(context, fs);
+  if (UnlinkSendOperation(&context->active_head, NULL, fs)) {
+    --context->active_count;
   }
 
+  RewindSendOperation(fs);
+  fs->resume = true;
+  ++fs->resume_attempts;
+  QueuePendingOperation(context, fs, true);
+}
+
+//! Queues STOR or APPE for the given operation.
+static FTPClientProcessStatus SendTransferCommand(
+    FTPClient *context, struct SendOperation *send_op) {
+  const char *command = send_op->append ? kAppendCommand : kStoreCommand;
+
+  RESERVE_SEND(send_buffer, send_buffer_size,
+               strlen(command) + strlen(send_op->filename) + 4)
+  struct PendingReply *reply =
+      CreatePendingReply(PENDING_REPLY_KIND_TRANSFER, send_op);
+  if (!reply) {
+    return FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_BUFFER_FAILED;
+  }
+  int bytes_written = snprintf(send_buffer, send_buffer_size, "%s %s\r\n",
+                               command, send_op->filename);
+  if (bytes_written <= 0) {
+    free(reply);
+  }
+  VALIDATE_SEND(bytes_written)
+  AppendPendingReply(context, reply);
+
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Handle PASV response for the given operation.
+static FTPClientProcessStatus Handle227(FTPClient *context,
+                                        struct SendOperation *send_op) {
   const char *data_info_start = strchr(context->recv_buffer, '(');
   if (!data_info_start || !strchr(data_info_start, ')')) {
     return FTP_CLIENT_PROCESS_PASV_RESPONSE_INVALID;
@@ -366,168 +1888,554 @@ static FTPClientProcessStatus Handle227(FTPClient *context) {
 #endif
   send_op->data_sockaddr.sin_port = htons((port[0] * 256 + port[1]) & 0xFFFF);
 
-  const char *command = send_op->append ? kAppendCommand : kStoreCommand;
+  uint64_t restart_offset = send_op->range_start + send_op->resume_offset;
+  if (!restart_offset) {
+    return SendTransferCommand(context, send_op);
+  }
 
-  RESERVE_SEND(send_buffer, send_buffer_size,
-               strlen(command) + strlen(send_op->filename))
-  int bytes_written = snprintf(send_buffer, send_buffer_size, "%s %s\r\n",
-                               command, send_op->filename);
+  // STOR is withheld until the server accepts the restart offset.
+  RESERVE_SEND(send_buffer, send_buffer_size, 28)
+  struct PendingReply *reply =
+      CreatePendingReply(PENDING_REPLY_KIND_REST, send_op);
+  if (!reply) {
+    return FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_BUFFER_FAILED;
+  }
+  int bytes_written = snprintf(send_buffer, send_buffer_size, "REST %llu\r\n",
+                               (unsigned long long)restart_offset);
+  if (bytes_written <= 0) {
+    free(reply);
+  }
   VALIDATE_SEND(bytes_written)
+  AppendPendingReply(context, reply);
+  context->pasv_outstanding = true;
 
   return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
 }
 
-static FTPClientProcessStatus Handle150(FTPClient *context) {
-  for (size_t i = 0; i < MAX_SEND_OPERATIONS; ++i) {
-    struct SendOperation *fs = context->file_send_buffer[i];
-    if (!fs || fs->socket >= 0) {
-      continue;
+//! Handle the reply to REST by sending STOR, from the start of the source if
+//! the server cannot restart the transfer. Ranges of striped uploads fail
+//! instead.
+static FTPClientProcessStatus Handle350(FTPClient *context,
+                                        struct SendOperation *send_op,
+                                        int reply_code) {
+  if (reply_code != 350) {
+    if (send_op->range_start) {
+      FailSendOperation(context, send_op, reply_code);
+      return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
     }
-
-    fs->socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (fs->socket < 0) {
-      context->last_errno = errno;
-      return FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_SOCKET_FAILED;
+    AdjustProgress(send_op, send_op->resume_offset, 0);
+    send_op->resume_offset = 0;
+    if (!SeekSendOperation(send_op, 0)) {
+      FailSendOperation(context, send_op, reply_code);
+      return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
     }
+  }
+  return SendTransferCommand(context, send_op);
+}
 
-    if (fcntl(fs->socket, F_SETFL, O_NONBLOCK) < 0) {
-      context->last_errno = errno;
-      return FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_SOCKET_FAILED;
+//! Returns the stripe session at the given index, which is at most the number
+//! of existing sessions, creating it if needed. Settings shared with the
+//! client are refreshed.
+static FTPClient *GetStripeSession(FTPClient *context, size_t index) {
+  if (index == context->stripe_session_count) {
+    FTPClient **sessions = (FTPClient **)realloc(
+        context->stripe_sessions, (index + 1) * sizeof(*sessions));
+    if (!sessions) {
+      return NULL;
     }
+    context->stripe_sessions = sessions;
 
-    if (connect(fs->socket, (struct sockaddr *)&fs->data_sockaddr,
-                sizeof(struct sockaddr)) < 0 &&
-        errno != EWOULDBLOCK && errno != EINPROGRESS) {
-      context->last_errno = errno;
-      close(fs->socket);
-      fs->socket = -1;
-      return FTP_CLIENT_PROCESS_STATUS_DATA_SOCKET_CONNECT_FAILED;
+    FTPClient *session;
+    if (FTPClientInit(&session, 0, 0, context->username,
+                      context->password) != FTP_CLIENT_INIT_STATUS_SUCCESS) {
+      return NULL;
     }
-
-    break;
+    session->control_sockaddr = context->control_sockaddr;
+    session->poller_backend = context->poller_backend;
+    session->poller = context->poller;
+#ifdef FTP_CLIENT_ENABLE_STATS
+    session->stats = context->stats;
+#endif
+    session->scheduler = context->scheduler;
+    session->trace_session = (uint32_t)index + 1;
+    sessions[context->stripe_session_count++] = session;
   }
 
-  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  FTPClient *session = context->stripe_sessions[index];
+  session->reconnect_policy = context->reconnect_policy;
+  session->on_trace = context->on_trace;
+  session->trace_userdata = context->trace_userdata;
+  session->rate_limit = context->rate_limit;
+  session->priority_policy = context->priority_policy;
+  session->read_ahead_executor = context->read_ahead_executor;
+  session->read_ahead_executor_userdata =
+      context->read_ahead_executor_userdata;
+  return session;
 }
 
-#undef VALIDATE_SEND
-#undef RESERVE_SEND
+//! Hands the held ranges of a striped upload to the stripe sessions, one range
+//! per session, connecting them if needed.
+static void StartStripes(FTPClient *context, struct StripeSet *set) {
+  for (size_t index = 0; set->held; ++index) {
+    struct SendOperation *fs = set->held;
+    set->held = fs->next;
+    fs->next = NULL;
+
+    FTPClient *session = GetStripeSession(context, index);
+    if (!session ||
+        (!HasSession(session) &&
+         FTPClientStartConnect(
+             session, session->reconnect_policy.connect_timeout_milliseconds) !=
+             FTP_CLIENT_CONNECT_STATUS_SUCCESS)) {
+      NotifySendOperationComplete(context, fs, false, 0);
+      FreeSendOperation(fs);
+      continue;
+    }
 
-static FTPClientProcessStatus ProcessResponse(FTPClient *context) {
-  if (context->recv_buffer_len < 3) {
-    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+    QueuePendingOperation(session, fs, false);
   }
+}
 
-  if (!strncmp(context->recv_buffer, "220", 3)) {
-    return Handle220(context);
+//! Handle the preliminary reply to STOR/APPE for the given operation by
+//! connecting its data socket.
+static FTPClientProcessStatus Handle150(FTPClient *context,
+                                        struct SendOperation *fs) {
+  if (fs->socket >= 0) {
+    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
   }
 
-  if (!strncmp(context->recv_buffer, "331", 3)) {
-    return Handle331(context);
+  fs->socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fs->socket < 0) {
+    context->last_errno = errno;
+    return FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_SOCKET_FAILED;
   }
 
-  if (!strncmp(context->recv_buffer, "230", 3)) {
-    return Handle230(context);
+  if (fcntl(fs->socket, F_SETFL, O_NONBLOCK) < 0) {
+    context->last_errno = errno;
+    return FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_SOCKET_FAILED;
   }
 
-  if (!strncmp(context->recv_buffer, "200", 3)) {
-    return Handle200(context);
+  // Completion of connect() is signaled by writability.
+  if (!FTPPollerSet(context->poller, fs->socket, FTP_POLLER_EVENT_WRITE,
+                    context, fs)) {
+    context->last_errno = errno;
+    close(fs->socket);
+    fs->socket = -1;
+    return FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_SOCKET_FAILED;
   }
+  fs->poll_interest = FTP_POLLER_EVENT_WRITE;
 
-  if (!strncmp(context->recv_buffer, "227", 3)) {
-    return Handle227(context);
+  if (connect(fs->socket, (struct sockaddr *)&fs->data_sockaddr,
+              sizeof(struct sockaddr)) < 0 &&
+      errno != EWOULDBLOCK && errno != EINPROGRESS) {
+    context->last_errno = errno;
+    CloseDataSocket(context, fs);
+    return FTP_CLIENT_PROCESS_STATUS_DATA_SOCKET_CONNECT_FAILED;
   }
+  Trace(context, FTP_CLIENT_TRACE_EVENT_DATA_CONNECT, fs->id, 0, NULL, 0);
 
-  if (!strncmp(context->recv_buffer, "150", 3)) {
-    return Handle150(context);
+  // The server has opened, and truncated, the remote file of a striped upload
+  // so its remaining ranges can be written concurrently.
+  if (fs->stripe_set && fs->stripe_set->held) {
+    StartStripes(context, fs->stripe_set);
   }
 
   return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
 }
 
-static FTPClientProcessStatus ReadControlSocket(FTPClient *context) {
-  ssize_t bytes_read = recv(context->control_socket,
-                            context->recv_buffer + context->recv_buffer_len,
-                            BUFFER_SIZE - context->recv_buffer_len, 0);
-  if (bytes_read < 0) {
-    context->last_errno = errno;
-    close(context->control_socket);
-    context->control_socket = -1;
-    return FTP_CLIENT_PROCESS_STATUS_READ_FAILED;
+//! Dispatches a reply received once logged in to the command at the head of
+//! the reply FIFO.
+static FTPClientProcessStatus HandleCommandReply(FTPClient *context,
+                                                 int reply_code) {
+  struct PendingReply *reply = context->reply_head;
+  if (!reply) {
+    // Unsolicited reply (e.g., a 421 before disconnect); nothing to match.
+    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
   }
-  if (!bytes_read) {
-    context->last_errno = 0;
-    close(context->control_socket);
-    context->control_socket = -1;
-    return FTP_CLIENT_PROCESS_STATUS_CLOSED;
+
+  if (reply_code < 200) {
+    if (reply->kind == PENDING_REPLY_KIND_TRANSFER && reply->operation &&
+        (reply_code == 125 || reply_code == 150)) {
+      return Handle150(context, reply->operation);
+    }
+    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
   }
 
-  context->recv_buffer_len += bytes_read;
+  PopPendingReply(context);
+  struct SendOperation *fs = reply->operation;
+  PendingReplyKind kind = reply->kind;
+  free(reply);
 
-  char *terminator = strstr(context->recv_buffer, "\r\n");
-  if (terminator) {
-    *terminator = 0;
+  if (!fs) {
+    if (kind == PENDING_REPLY_KIND_PASV || kind == PENDING_REPLY_KIND_REST) {
+      context->pasv_outstanding = false;
+    }
+    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  }
 
-    FTPClientProcessStatus result = ProcessResponse(context);
-    if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
-      close(context->control_socket);
-      context->control_socket = -1;
-      return result;
+  if (kind == PENDING_REPLY_KIND_SIZE) {
+    // Without a usable size the upload restarts from the beginning, which
+    // STOR truncates the remote file for.
+    unsigned long long remote_size = 0;
+    if (reply_code != 213 ||
+        sscanf(context->recv_buffer + 3, "%llu", &remote_size) != 1 ||
+        !SeekSendOperation(fs, remote_size)) {
+      remote_size = 0;
     }
+    AdjustProgress(fs, fs->resume_offset, remote_size);
+    fs->resume_offset = remote_size;
+    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  }
 
-    char *end_of_response = terminator + 2;
-    size_t response_length = end_of_response - context->recv_buffer;
-    size_t remaining = context->recv_buffer_len - response_length;
+  if (kind == PENDING_REPLY_KIND_REST) {
+    context->pasv_outstanding = false;
+    return Handle350(context, fs, reply_code);
+  }
 
-    if (remaining) {
-      memmove(context->recv_buffer, end_of_response, remaining);
+  if (kind == PENDING_REPLY_KIND_PASV) {
+    context->pasv_outstanding = false;
+    fs->timings.pasv_reply = FTPClockMicroseconds();
+    if (reply_code == 227) {
+      return Handle227(context, fs);
     }
-    context->recv_buffer_len = remaining;
+    FailSendOperation(context, fs, reply_code);
+    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  }
+
+  // The final reply to STOR/APPE confirms (or refutes) that the server has
+  // stored the data. A positive reply before all data was sent means the
+  // server cut the transfer short.
+  // Transient failures (4xx) and transfers cut short may be resumed.
+  fs->timings.final_reply = FTPClockMicroseconds();
+  if (reply_code >= 200 && reply_code < 300 && fs->data_complete &&
+      !fs->interrupted) {
+    NotifySendOperationComplete(context, fs, true, reply_code);
+    FindAndFreeSendOperation(context, fs);
+  } else if (reply_code < 500 && CanResumeSendOperation(fs)) {
+    RequeueForResume(context, fs);
+  } else {
+    FailSendOperation(context, fs, reply_code);
   }
 
   return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
 }
 
+#undef VALIDATE_SEND
+#undef RESERVE_SEND
+
+//! Returns the reply code at the start of the given line, or 0 if the line does
+//! not start with one.
+static int ParseReplyCode(const char *line) {
+  for (int i = 0; i < 3; ++i) {
+    if (line[i] < '0' || line[i] > '9') {
+      return 0;
+    }
+  }
+  return (line[0] - '0') * 100 + (line[1] - '0') * 10 + (line[2] - '0');
+}
+
+static FTPClientProcessStatus ProcessResponse(FTPClient *context) {
+  if (strlen(context->recv_buffer) < 3) {
+    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  }
+
+  if (context->state == FTP_CLIENT_STATE_FULLY_CONNECTED) {
+    return HandleCommandReply(context, ParseReplyCode(context->recv_buffer));
+  }
+
+  if (!strncmp(context->recv_buffer, "220", 3)) {
+    return Handle220(context);
+  }
+
+  if (!strncmp(context->recv_buffer, "331", 3)) {
+    return Handle331(context);
+  }
+
+  if (!strncmp(context->recv_buffer, "230", 3)) {
+    return Handle230(context);
+  }
+
+  if (!strncmp(context->recv_buffer, "200", 3)) {
+    return Handle200(context);
+  }
+
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Processes the NUL-terminated line at the start of `recv_buffer`, collapsing
+//! RFC 959 multi-line replies ("ddd-text" ... "ddd text") into their final
+//! line.
+static FTPClientProcessStatus ProcessResponseLine(FTPClient *context) {
+  const char *line = context->recv_buffer;
+  int reply_code = ParseReplyCode(line);
+
+  if (context->multiline_reply_code) {
+    if (reply_code != context->multiline_reply_code || line[3] == '-') {
+      return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+    }
+    context->multiline_reply_code = 0;
+    return ProcessResponse(context);
+  }
+
+  if (reply_code && line[3] == '-') {
+    context->multiline_reply_code = reply_code;
+    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  }
+
+  return ProcessResponse(context);
+}
+
+//! Reports the reply line at the start of `recv_buffer` to the trace callback.
+static void TraceReply(FTPClient *context) {
+  if (!context->on_trace) {
+    return;
+  }
+  const struct PendingReply *reply = context->reply_head;
+  uint64_t operation_id =
+      reply && reply->operation ? reply->operation->id : 0;
+  Trace(context, FTP_CLIENT_TRACE_EVENT_REPLY_RECEIVED, operation_id,
+        (uint64_t)ParseReplyCode(context->recv_buffer), context->recv_buffer,
+        strlen(context->recv_buffer));
+}
+
+static FTPClientProcessStatus ReadControlSocket(FTPClient *context) {
+  ssize_t bytes_read = recv(context->control_socket,
+                            context->recv_buffer + context->recv_buffer_len,
+                            BUFFER_SIZE - context->recv_buffer_len, 0);
+  if (bytes_read < 0) {
+    context->last_errno = errno;
+    FTPClientClose(context);
+    return FTP_CLIENT_PROCESS_STATUS_READ_FAILED;
+  }
+  if (!bytes_read) {
+    context->last_errno = 0;
+    FTPClientClose(context);
+    return FTP_CLIENT_PROCESS_STATUS_CLOSED;
+  }
+
+  context->recv_buffer_len += bytes_read;
+  context->recv_buffer[context->recv_buffer_len] = 0;
+  context->last_control_activity = FTPClockMicroseconds();
+  STATS_ADD(context, control.reads, 1);
+  STATS_ADD(context, control.bytes_read, bytes_read);
+
+  // Pipelined commands may have their replies delivered in a single segment,
+  // so handle every complete line before waiting for more data.
+  while (context->control_socket >= 0) {
+    char *terminator = strstr(context->recv_buffer, "\r\n");
+    if (!terminator) {
+      if (context->recv_buffer_len < BUFFER_SIZE) {
+        break;
+      }
+
+      // The line does not fit in the buffer. Handle its head, which carries
+      // the reply code, and discard the rest of it as it arrives. A trailing
+      // '\r' is retained in case it is the first half of the terminator.
+      bool keep_cr = context->recv_buffer[BUFFER_SIZE - 1] == '\r';
+      if (!context->skip_line_remainder) {
+        context->recv_buffer[BUFFER_SIZE - keep_cr] = 0;
+        TraceReply(context);
+        FTPClientProcessStatus result = ProcessResponseLine(context);
+        if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+          FTPClientClose(context);
+          return result;
+        }
+        context->skip_line_remainder = true;
+      }
+      context->recv_buffer[0] = '\r';
+      context->recv_buffer_len = keep_cr ? 1 : 0;
+      context->recv_buffer[context->recv_buffer_len] = 0;
+      break;
+    }
+
+    *terminator = 0;
+
+    if (context->skip_line_remainder) {
+      context->skip_line_remainder = false;
+    } else {
+      TraceReply(context);
+      FTPClientProcessStatus result = ProcessResponseLine(context);
+      if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+        FTPClientClose(context);
+        return result;
+      }
+    }
+
+    char *end_of_response = terminator + 2;
+    size_t response_length = end_of_response - context->recv_buffer;
+    size_t remaining = context->recv_buffer_len - response_length;
+
+    if (remaining) {
+      memmove(context->recv_buffer, end_of_response, remaining);
+      STATS_ADD(context, control_buffer_moved_bytes, remaining);
+    }
+    context->recv_buffer_len = remaining;
+    context->recv_buffer[remaining] = 0;
+  }
+
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Reports a command line that has been handed to the control connection to
+//! the trace callback. `line` includes the terminator.
+static void TraceCommand(FTPClient *context, const char *line, size_t length) {
+  static const char kMaskedPassword[] = "PASS ****";
+
+  // Every command queued once logged in awaits a reply, in order.
+  uint64_t operation_id = 0;
+  for (struct PendingReply *reply = context->reply_head; reply;
+       reply = reply->next) {
+    if (!reply->command_sent) {
+      reply->command_sent = true;
+      operation_id = reply->operation ? reply->operation->id : 0;
+      break;
+    }
+  }
+
+  if (!context->on_trace) {
+    return;
+  }
+  while (length && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+    --length;
+  }
+  if (length >= 5 && !strncmp(line, "PASS ", 5)) {
+    line = kMaskedPassword;
+    length = sizeof(kMaskedPassword) - 1;
+  }
+  Trace(context, FTP_CLIENT_TRACE_EVENT_COMMAND_SENT, operation_id, 0, line,
+        length);
+}
+
+//! Reports the command lines that start within the first `bytes_written`
+//! bytes of `send_buffer`, which have just been written.
+static void TraceWrittenCommands(FTPClient *context, size_t bytes_written) {
+  bool mid_line = context->send_mid_line;
+  context->send_mid_line = context->send_buffer[bytes_written - 1] != '\n';
+
+  size_t start = 0;
+  while (start < bytes_written) {
+    const char *line = context->send_buffer + start;
+    const char *end =
+        (const char *)memchr(line, '\n', context->send_buffer_len - start);
+    size_t length =
+        end ? (size_t)(end - line) + 1 : context->send_buffer_len - start;
+    if (!mid_line) {
+      TraceCommand(context, line, length);
+    }
+    mid_line = false;
+    start += length;
+  }
+}
+
 static FTPClientProcessStatus WriteControlSocket(FTPClient *context) {
   ssize_t bytes_written = write(context->control_socket, context->send_buffer,
                                 context->send_buffer_len);
   if (bytes_written < 0) {
     context->last_errno = errno;
-    close(context->control_socket);
-    context->control_socket = -1;
+    FTPClientClose(context);
     return FTP_CLIENT_PROCESS_STATUS_WRITE_FAILED;
   }
   if (!bytes_written) {
     context->last_errno = 0;
-    close(context->control_socket);
-    context->control_socket = -1;
+    FTPClientClose(context);
     return FTP_CLIENT_PROCESS_STATUS_CLOSED;
   }
 
+  STATS_COUNT_WRITE(context, control, context->send_buffer_len,
+                    (size_t)bytes_written);
+  TraceWrittenCommands(context, (size_t)bytes_written);
   size_t remaining = context->send_buffer_len - bytes_written;
   if (remaining) {
     memmove(context->send_buffer, context->send_buffer + bytes_written,
             remaining);
+    STATS_ADD(context, control_buffer_moved_bytes, remaining);
   }
   context->send_buffer_len = remaining;
+  context->last_control_activity = FTPClockMicroseconds();
 
   return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
 }
 
-static FTPClientProcessStatus PopulateSendBuffer(struct SendOperation *fs,
-                                                 int *errno_out) {
-  if (!fs->buffer) {
-    fs->buffer_length = FILE_BUFFER_SIZE;
-    fs->buffer = (char *)malloc(fs->buffer_length);
-    fs->buffer_owned = true;
+//! Adjusts the chunk size of an adaptive operation once its current chunk has
+//! been fully written.
+static void AdaptChunkSize(struct SendOperation *fs) {
+  if (!fs->adaptive_chunk_size) {
+    return;
+  }
 
-    if (!fs->buffer) {
+  if (fs->chunk_writes <= 1 && (size_t)fs->buffer_length == fs->chunk_size) {
+    // The socket accepted the whole chunk in a single write, so it can likely
+    // take more per wakeup. Never grow beyond what the send buffer can hold.
+    size_t limit = MAX_ADAPTIVE_CHUNK_SIZE;
+    int send_buffer_size = 0;
+    socklen_t len = sizeof(send_buffer_size);
+    if (!getsockopt(fs->socket, SOL_SOCKET, SO_SNDBUF, &send_buffer_size,
+                    &len) &&
+        send_buffer_size > 0 && (size_t)send_buffer_size < limit) {
+      limit = (size_t)send_buffer_size;
+    }
+
+    size_t grown = fs->chunk_size * 2;
+    if (grown > limit) {
+      grown = limit;
+    }
+    if (grown > fs->chunk_size) {
+      fs->chunk_size = grown;
+    }
+  } else if (fs->chunk_writes > 2) {
+    // The socket needed several wakeups to drain the chunk, so shrink it, but
+    // not below what the socket demonstrated it can accept in one write.
+    size_t shrunk = fs->chunk_size / 2;
+    if (shrunk < fs->chunk_largest_write) {
+      shrunk = fs->chunk_largest_write;
+    }
+    if (shrunk < MIN_ADAPTIVE_CHUNK_SIZE) {
+      shrunk = MIN_ADAPTIVE_CHUNK_SIZE;
+    }
+    if (shrunk < fs->chunk_size) {
+      fs->chunk_size = shrunk;
+    }
+  }
+}
+
+//! Prepares `buffer` to receive the next chunk of a file or stream.
+static FTPClientProcessStatus EnsureChunkBuffer(struct SendOperation *fs) {
+  AdaptChunkSize(fs);
+  fs->chunk_writes = 0;
+  fs->chunk_largest_write = 0;
+
+  if (!fs->buffer || fs->chunk_capacity != fs->chunk_size) {
+    void *buffer = realloc((void *)fs->buffer, fs->chunk_size);
+    if (!buffer) {
       return FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_BUFFER_FAILED;
     }
+    fs->buffer = buffer;
+    fs->buffer_owned = true;
+    fs->chunk_capacity = fs->chunk_size;
+  }
+
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Returns the number of bytes of the next chunk to be read from the
+//! operation's local file, which stops at the end of its range.
+static size_t NextChunkSize(const struct SendOperation *fs) {
+  if (fs->range_end && fs->range_end - fs->read_position < fs->chunk_size) {
+    return (size_t)(fs->range_end - fs->read_position);
+  }
+  return fs->chunk_size;
+}
+
+static FTPClientProcessStatus PopulateSendBuffer(struct SendOperation *fs,
+                                                 int *errno_out) {
+  FTPClientProcessStatus status = EnsureChunkBuffer(fs);
+  if (status != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+    return status;
   }
 
   size_t bytes_read =
-      fread((void *)fs->buffer, 1, FILE_BUFFER_SIZE, fs->read_file);
+      fread((void *)fs->buffer, 1, NextChunkSize(fs), fs->read_file);
+  fs->read_position += bytes_read;
   fs->offset = 0;
   fs->buffer_length = (ssize_t)bytes_read;
 
@@ -548,58 +2456,371 @@ static FTPClientProcessStatus PopulateSendBuffer(struct SendOperation *fs,
   return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
 }
 
-static FTPClientProcessStatus WriteDataSocket(struct SendOperation *fs,
-                                              int *errno_out) {
+//! Publishes a filled read-ahead buffer and wakes the thread driving its
+//! operation.
+static void CompleteReadAheadFill(struct ReadAheadBuffer *rab) {
+  // The operation may be freed as soon as the fill is seen to be complete, so
+  // `rab` is only touched through `waking` from here on.
+  FTPPoller *poller = rab->poller;
+  atomic_fetch_add(&rab->waking, 1);
+  atomic_store(&rab->state, READ_AHEAD_STATE_READY);
+  if (poller) {
+    FTPPollerWake(poller);
+  }
+  atomic_fetch_sub(&rab->waking, 1);
+}
+
+//! Reads the next chunk of a file into a read-ahead buffer. Invoked by the
+//! read-ahead executor.
+static void FillReadAheadBuffer(void *work_context) {
+  struct ReadAheadBuffer *rab = (struct ReadAheadBuffer *)work_context;
+
+  // The end of a range is reported as the end of the file.
+  if (!rab->request_size) {
+    rab->length = 0;
+    rab->error = 0;
+    rab->eof = true;
+    CompleteReadAheadFill(rab);
+    return;
+  }
+
+  if (rab->capacity != rab->request_size) {
+    char *data = (char *)realloc(rab->data, rab->request_size);
+    if (!data) {
+      rab->length = 0;
+      rab->error = ENOMEM;
+      CompleteReadAheadFill(rab);
+      return;
+    }
+    rab->data = data;
+    rab->capacity = rab->request_size;
+  }
+
+  rab->length = fread(rab->data, 1, rab->request_size, rab->read_file);
+  rab->error = 0;
+  rab->eof = false;
+  if (rab->length < rab->request_size) {
+    if (ferror(rab->read_file)) {
+      rab->error = errno ? errno : EIO;
+    } else {
+      rab->eof = true;
+    }
+  }
+
+  CompleteReadAheadFill(rab);
+}
+
+static void RequestReadAhead(struct SendOperation *fs, uint32_t index) {
+  struct ReadAheadBuffer *rab = fs->read_ahead + index;
+  rab->read_file = fs->read_file;
+  rab->request_size = NextChunkSize(fs);
+  rab->poller = fs->read_ahead_poller;
+  fs->read_position += rab->request_size;
+  atomic_store(&rab->state, READ_AHEAD_STATE_FILLING);
+  fs->read_ahead_executor(FillReadAheadBuffer, rab,
+                          fs->read_ahead_executor_userdata);
+}
+
+static bool IsReadAheadReady(const struct SendOperation *fs) {
+  return atomic_load(&fs->read_ahead[fs->read_ahead_next].state) ==
+         READ_AHEAD_STATE_READY;
+}
+
+//! Replaces the drained `buffer` with the next read-ahead buffer and starts
+//! filling the drained one. Sets `awaiting_data` if the next buffer is
+//! still being filled.
+static FTPClientProcessStatus SwapReadAheadBuffer(struct SendOperation *fs,
+                                                  int *errno_out) {
+  // The first chunk of a resumed upload is requested once the source has been
+  // positioned.
+  if (atomic_load(&fs->read_ahead[fs->read_ahead_next].state) ==
+      READ_AHEAD_STATE_EMPTY) {
+    RequestReadAhead(fs, fs->read_ahead_next);
+  }
+  if (!IsReadAheadReady(fs)) {
+    fs->awaiting_data = true;
+    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  }
+  fs->awaiting_data = false;
+
+  AdaptChunkSize(fs);
+  fs->chunk_writes = 0;
+  fs->chunk_largest_write = 0;
+
+  struct ReadAheadBuffer *next = fs->read_ahead + fs->read_ahead_next;
+  if (next->error) {
+    *errno_out = next->error;
+    fclose(fs->read_file);
+    fs->read_file = NULL;
+    return FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_FILE_READ_FAILED;
+  }
+
+  fs->buffer = next->data;
+  fs->buffer_length = (ssize_t)next->length;
+  fs->offset = 0;
+
+  uint32_t drained = fs->read_ahead_next ^ 1;
+  atomic_store(&fs->read_ahead[drained].state, READ_AHEAD_STATE_EMPTY);
+  fs->read_ahead_next = drained;
+
+  if (next->eof) {
+    fclose(fs->read_file);
+    fs->read_file = NULL;
+  } else {
+    RequestReadAhead(fs, drained);
+  }
+
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Asks the stream fill callback for the next chunk. Sets `awaiting_data` if
+//! the callback has nothing to send yet.
+static FTPClientProcessStatus PopulateStreamBuffer(struct SendOperation *fs) {
+  FTPClientProcessStatus status = EnsureChunkBuffer(fs);
+  if (status != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+    return status;
+  }
+
+  size_t bytes_written = 0;
+  FTPClientStreamStatus stream_status =
+      fs->fill((void *)fs->buffer, fs->chunk_size, &bytes_written,
+               fs->userdata);
+  if (stream_status == FTP_CLIENT_STREAM_STATUS_ERROR) {
+    return FTP_CLIENT_PROCESS_STATUS_STREAM_FILL_FAILED;
+  }
+  if (bytes_written > fs->chunk_size) {
+    bytes_written = fs->chunk_size;
+  }
+
+  fs->offset = 0;
+  fs->buffer_length = (ssize_t)bytes_written;
+  fs->stream_ended = stream_status == FTP_CLIENT_STREAM_STATUS_END;
+  fs->awaiting_data = !bytes_written && !fs->stream_ended;
+
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Whether the operation's source may produce data beyond `buffer`.
+static bool HasMoreSourceData(const struct SendOperation *fs) {
+  return fs->read_file || (fs->fill && !fs->stream_ended);
+}
+
+//! Refills `buffer` from the operation's source once it has been fully sent.
+static FTPClientProcessStatus RefillSendBuffer(struct SendOperation *fs,
+                                               int *errno_out) {
+  if (fs->fill) {
+    return PopulateStreamBuffer(fs);
+  }
+  if (fs->read_ahead) {
+    return SwapReadAheadBuffer(fs, errno_out);
+  }
+  return PopulateSendBuffer(fs, errno_out);
+}
+
+//! Checks whether an operation that is `awaiting_data` can make progress,
+//! clearing the flag if so.
+static FTPClientProcessStatus PollSendOperationSource(struct SendOperation *fs,
+                                                      int *errno_out) {
+  if (fs->fill) {
+    return PopulateStreamBuffer(fs);
+  }
+  if (fs->read_ahead && IsReadAheadReady(fs)) {
+    fs->awaiting_data = false;
+  }
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Writes as many of the remaining segments as the socket will accept and
+//! advances the segment cursor accordingly.
+static ssize_t WriteSegments(struct SendOperation *fs, size_t max_bytes) {
+  struct iovec iov[MAX_SEGMENTS_PER_WRITE];
+  int iov_count = 0;
+  for (size_t i = fs->segment_index;
+       i < fs->segment_count && iov_count < MAX_SEGMENTS_PER_WRITE; ++i) {
+    iov[iov_count++] = fs->segments[i];
+  }
+  iov[0].iov_base = (char *)iov[0].iov_base + fs->segment_offset;
+  iov[0].iov_len -= fs->segment_offset;
+
+  // Trim the segments to the number of bytes the caller allows.
+  int limited_count = 0;
+  while (limited_count < iov_count && max_bytes) {
+    if (iov[limited_count].iov_len > max_bytes) {
+      iov[limited_count].iov_len = max_bytes;
+    }
+    max_bytes -= iov[limited_count++].iov_len;
+  }
+  iov_count = limited_count;
+
+  ssize_t bytes_written = writev(fs->socket, iov, iov_count);
+  if (bytes_written <= 0) {
+    return bytes_written;
+  }
+
+  size_t remaining = (size_t)bytes_written;
+  while (remaining) {
+    size_t segment_remaining =
+        fs->segments[fs->segment_index].iov_len - fs->segment_offset;
+    if (remaining < segment_remaining) {
+      fs->segment_offset += remaining;
+      break;
+    }
+    remaining -= segment_remaining;
+    ++fs->segment_index;
+    fs->segment_offset = 0;
+  }
+
+  return bytes_written;
+}
+
+//! Writes up to `bytes_to_send` bytes of the operation's current data.
+static ssize_t WriteSendBuffer(struct SendOperation *fs,
+                               ssize_t bytes_to_send) {
+  if (fs->segments) {
+    return WriteSegments(fs, (size_t)bytes_to_send);
+  }
+#ifdef ZERO_COPY_SENDFILE
+  if (fs->sendfile_file) {
+    off_t file_offset = (off_t)fs->offset;
+    return sendfile(fs->socket, fileno(fs->sendfile_file), &file_offset,
+                    (size_t)bytes_to_send);
+  }
+#endif
+  return write(fs->socket, fs->buffer + fs->offset, bytes_to_send);
+}
+
+//! Closes the data connection once all data has been written. Completion is
+//! reported when the server's final reply arrives.
+static void FinishDataTransfer(FTPClient *context, struct SendOperation *fs) {
+  shutdown(fs->socket, O_RDWR);
+  CloseDataSocket(context, fs);
+  fs->data_complete = true;
+  fs->timings.last_byte_sent = FTPClockMicroseconds();
+  CheckProgressInterval(fs, true);
+}
+
+static FTPClientProcessStatus WriteDataSocket(FTPClient *context,
+                                              struct SendOperation *fs) {
   if (!fs || fs->socket < 0) {
     return FTP_CLIENT_PROCESS_STATUS_CLOSED;
   }
 
+  // The first writability of the non-blocking socket marks the completion of
+  // connect().
+  if (!fs->timings.data_connected) {
+    fs->timings.data_connected = FTPClockMicroseconds();
+    Trace(context, FTP_CLIENT_TRACE_EVENT_DATA_CONNECTED, fs->id, 0, NULL, 0);
+    if (fs->progress && !fs->progress->last_time) {
+      fs->progress->last_time = fs->timings.data_connected;
+    }
+  }
+  // Polled for writability again once the priority scheduler allows (see
+  // ScheduleDataConnections).
+  if (fs->descheduled) {
+    return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  }
+
   ssize_t bytes_to_send = fs->buffer_length - fs->offset;
-  if (!bytes_to_send && fs->read_file) {
-    FTPClientProcessStatus status = PopulateSendBuffer(fs, errno_out);
+  if (!bytes_to_send && HasMoreSourceData(fs)) {
+    FTPClientProcessStatus status =
+        RefillSendBuffer(fs, &context->last_errno);
     if (status != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+      AbortSendOperation(context, fs, 0);
       return status;
     }
+    if (fs->awaiting_data) {
+      return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+    }
     bytes_to_send = fs->buffer_length - fs->offset;
   }
 
   if (!bytes_to_send) {
-    shutdown(fs->socket, O_RDWR);
-    close(fs->socket);
-    fs->socket = -1;
-    if (fs->on_complete) {
-      fs->on_complete(true, fs->userdata);
-    }
+    FinishDataTransfer(context, fs);
     return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
   }
 
-  ssize_t bytes_written =
-      write(fs->socket, fs->buffer + fs->offset, bytes_to_send);
-  if (bytes_written < 0) {
-    *errno_out = errno;
-    close(fs->socket);
-    fs->socket = -1;
-    if (fs->on_complete) {
-      fs->on_complete(false, fs->userdata);
+  if (context->scheduler->fair_queueing) {
+    // A connection opened during the round waits for the next one.
+    if (!fs->deficit) {
+      fs->descheduled = true;
+      return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+    }
+    if (fs->deficit < (uint64_t)bytes_to_send) {
+      bytes_to_send = (ssize_t)fs->deficit;
+    }
+  }
+
+  if (context->rate_limit || fs->rate_limit) {
+    uint64_t wait_microseconds;
+    uint64_t allowance = ApplyRateLimits(context, fs, (uint64_t)bytes_to_send,
+                                         &wait_microseconds);
+    if (!allowance) {
+      // Polled for writability again once the limits allow (see
+      // PrepareClientForEvents).
+      fs->throttled = true;
+      return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+    }
+    if (allowance < (uint64_t)bytes_to_send) {
+      bytes_to_send = (ssize_t)allowance;
     }
+  }
 
+  ssize_t bytes_written = WriteSendBuffer(fs, bytes_to_send);
+  if (bytes_written < 0) {
+    context->last_errno = errno;
+    if (CanResumeSendOperation(fs)) {
+      // Resumed once the server's final reply to STOR arrives.
+      CloseDataSocket(context, fs);
+      fs->interrupted = true;
+      return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+    }
+    AbortSendOperation(context, fs, 0);
     return FTP_CLIENT_PROCESS_STATUS_DATA_SOCKET_EXCEPTION;
   }
 
+  if (bytes_written && !fs->bytes_sent) {
+    Trace(context, FTP_CLIENT_TRACE_EVENT_DATA_FIRST_BYTE, fs->id,
+          (uint64_t)bytes_written, NULL, 0);
+  }
+  if (bytes_written < bytes_to_send) {
+    Trace(context, FTP_CLIENT_TRACE_EVENT_DATA_PARTIAL_WRITE, fs->id,
+          (uint64_t)bytes_written, NULL, 0);
+  }
   fs->offset += bytes_written;
+  fs->bytes_sent += (uint64_t)bytes_written;
+  STATS_COUNT_WRITE(context, data, bytes_to_send, bytes_written);
+  CountDataThroughput(context, (size_t)bytes_written);
+  if (context->rate_limit || fs->rate_limit) {
+    ConsumeRateLimits(context, fs, (uint64_t)bytes_written);
+  }
+  if (context->scheduler->fair_queueing) {
+    fs->deficit -= (uint64_t)bytes_written;
+    fs->descheduled = !fs->deficit;
+    context->scheduler->round_activity = FTPClockMicroseconds();
+  }
+  if (fs->progress) {
+    // The time interval is checked once per FTPClientProcess iteration rather
+    // than per write.
+    fs->progress->bytes_sent += (uint64_t)bytes_written;
+    if (fs->progress->bytes_sent >= fs->progress->next_bytes) {
+      ReportProgress(fs, FTPClockMicroseconds());
+    }
+  }
+  ++fs->chunk_writes;
+  if ((size_t)bytes_written > fs->chunk_largest_write) {
+    fs->chunk_largest_write = (size_t)bytes_written;
+  }
 
   if (!bytes_written) {
-    shutdown(fs->socket, O_RDWR);
-    close(fs->socket);
-    fs->socket = -1;
-    if (fs->on_complete) {
-      fs->on_complete(true, fs->userdata);
-    }
+    FinishDataTransfer(context, fs);
   }
 
-  if (fs->offset == fs->buffer_length && fs->read_file) {
-    FTPClientProcessStatus status = PopulateSendBuffer(fs, errno_out);
+  if (fs->socket >= 0 && fs->offset == fs->buffer_length &&
+      HasMoreSourceData(fs)) {
+    FTPClientProcessStatus status =
+        RefillSendBuffer(fs, &context->last_errno);
     if (status != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+      AbortSendOperation(context, fs, 0);
       return status;
     }
   }
@@ -607,156 +2828,1613 @@ static FTPClientProcessStatus WriteDataSocket(struct SendOperation *fs,
   return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
 }
 
-FTPClientProcessStatus FTPClientProcess(FTPClient *context,
-                                        uint32_t timeout_milliseconds) {
-  if (context->control_socket < 0) {
-    return FTP_CLIENT_PROCESS_STATUS_CLOSED;
+#if defined(ZERO_COPY_SENDFILE) || defined(ZERO_COPY_MMAP)
+//! Sets the operation up to send `read_file` without copying it through
+//! `buffer`. Takes ownership of `read_file` on success. Non-regular files
+//! (e.g., pipes) are left to the stdio path.
+static bool PrepareZeroCopySend(struct SendOperation *fs, FILE *read_file) {
+  struct stat file_stat;
+  if (fstat(fileno(read_file), &file_stat) || !S_ISREG(file_stat.st_mode) ||
+      file_stat.st_size <= 0) {
+    return false;
   }
 
-  int max_fd = context->control_socket;
-
-  fd_set read_fds;
-  FD_ZERO(&read_fds);
-  FD_SET(context->control_socket, &read_fds);
-
-  fd_set write_fds;
-  FD_ZERO(&write_fds);
-  if (context->send_buffer_len) {
-    FD_SET(context->control_socket, &write_fds);
+#ifdef ZERO_COPY_SENDFILE
+  fs->sendfile_file = read_file;
+#else
+  void *mapping = mmap(NULL, (size_t)file_stat.st_size, PROT_READ,
+                       MAP_PRIVATE, fileno(read_file), 0);
+  if (mapping == MAP_FAILED) {
+    return false;
   }
-  for (size_t i = 0; i < MAX_SEND_OPERATIONS; ++i) {
-    struct SendOperation *fs = context->file_send_buffer[i];
-    if (!fs || fs->socket < 0) {
-      continue;
-    }
+  fclose(read_file);
+  fs->buffer = mapping;
+  fs->buffer_owned = false;
+  fs->mapping_length = (size_t)file_stat.st_size;
+#endif
 
-    FD_SET(fs->socket, &write_fds);
+  // Ranges of striped uploads are sent from their offset within the file.
+  uint64_t end = (uint64_t)file_stat.st_size;
+  if (fs->range_end && fs->range_end < end) {
+    end = fs->range_end;
+  }
+  fs->offset = (ssize_t)(fs->range_start < end ? fs->range_start : end);
+  fs->buffer_length = (ssize_t)end;
+  return true;
+}
+#endif
+
+//! Opens the local file of a file-backed operation and sets up the zero-copy
+//! or read-ahead machinery used to send it.
+static bool OpenFileSource(FTPClient *context, struct SendOperation *fs) {
+  FILE *read_file = fopen(fs->local_filename, "rb");
+  if (!read_file) {
+    context->last_errno = errno;
+    return false;
+  }
+
+#if defined(ZERO_COPY_SENDFILE) || defined(ZERO_COPY_MMAP)
+  if (!fs->disable_zero_copy && PrepareZeroCopySend(fs, read_file)) {
+    return true;
+  }
+#endif
+
+  fs->read_file = read_file;
+  fs->read_position = fs->range_start;
+  if (fs->range_start && !SeekLocalFile(read_file, fs->range_start)) {
+    context->last_errno = errno;
+    return false;
+  }
+  if (!fs->disable_read_ahead) {
+    fs->read_ahead = (struct ReadAheadBuffer *)calloc(
+        READ_AHEAD_BUFFER_COUNT, sizeof(struct ReadAheadBuffer));
+    if (!fs->read_ahead) {
+      return false;
+    }
+    fs->read_ahead_executor = context->read_ahead_executor;
+    fs->read_ahead_executor_userdata = context->read_ahead_executor_userdata;
+    if (FTPPollerEnableWakeup(context->poller)) {
+      fs->read_ahead_poller = context->poller;
+    }
+  }
+
+  return true;
+}
+
+typedef enum ActivateResult {
+  ACTIVATE_RESULT_STARTED,
+  //! The control send buffer is full; the operation should stay queued.
+  ACTIVATE_RESULT_DEFERRED,
+  //! The operation could not be started and has been completed as failed.
+  ACTIVATE_RESULT_FAILED,
+} ActivateResult;
+
+//! Queues the PASV command that initiates the given operation and moves it to
+//! the end of the active list.
+static ActivateResult ActivateSendOperation(FTPClient *context,
+                                            struct SendOperation *fs) {
+  static const char kPasvCommand[] = "PASV\r\n";
+  static const char kSizeCommand[] = "SIZE ";
+
+  // A resumed operation pipelines SIZE ahead of PASV; its reply positions the
+  // source before any data is read.
+  size_t size_command_length =
+      fs->resume ? sizeof(kSizeCommand) - 1 + strlen(fs->filename) + 2 : 0;
+  if (BUFFER_SIZE - context->send_buffer_len <
+      size_command_length + sizeof(kPasvCommand) - 1) {
+    return ACTIVATE_RESULT_DEFERRED;
+  }
+  struct PendingReply *size_reply = NULL;
+  if (fs->resume) {
+    size_reply = CreatePendingReply(PENDING_REPLY_KIND_SIZE, fs);
+    if (!size_reply) {
+      return ACTIVATE_RESULT_DEFERRED;
+    }
+  }
+  struct PendingReply *reply = CreatePendingReply(PENDING_REPLY_KIND_PASV, fs);
+  if (!reply) {
+    free(size_reply);
+    return ACTIVATE_RESULT_DEFERRED;
+  }
+
+  if (fs->local_filename && !OpenFileSource(context, fs)) {
+    free(size_reply);
+    free(reply);
+    NotifySendOperationComplete(context, fs, false, 0);
+    FreeSendOperation(fs);
+    return ACTIVATE_RESULT_FAILED;
+  }
+
+  if (size_reply) {
+    snprintf(context->send_buffer + context->send_buffer_len,
+             size_command_length + 1, "%s%s\r\n", kSizeCommand, fs->filename);
+    context->send_buffer_len += size_command_length;
+    AppendPendingReply(context, size_reply);
+  }
+  memcpy(context->send_buffer + context->send_buffer_len, kPasvCommand,
+         sizeof(kPasvCommand) - 1);
+  context->send_buffer_len += sizeof(kPasvCommand) - 1;
+  AppendPendingReply(context, reply);
+  context->pasv_outstanding = true;
+
+  struct SendOperation **tail = &context->active_head;
+  while (*tail) {
+    tail = &(*tail)->next;
+  }
+  fs->next = NULL;
+  *tail = fs;
+  ++context->active_count;
+
+  // Start reading the first chunk while the PASV exchange is in flight.
+  if (fs->read_ahead && !fs->resume) {
+    RequestReadAhead(fs, 0);
+  }
+  fs->resume = false;
+
+  return ACTIVATE_RESULT_STARTED;
+}
+
+//! Notifies the queue state callback when the pending queue crosses its high
+//! water mark, or drains back to half of it.
+static void UpdateQueueState(FTPClient *context) {
+  if (!context->on_queue_state) {
+    return;
+  }
+
+  if (!context->above_high_water) {
+    bool above = (context->high_water_operations &&
+                  context->pending_count > context->high_water_operations) ||
+                 (context->high_water_bytes &&
+                  context->pending_bytes > context->high_water_bytes);
+    if (above) {
+      context->above_high_water = true;
+      context->on_queue_state(true, context->queue_state_userdata);
+    }
+    return;
+  }
+
+  if (context->pending_count <= context->high_water_operations / 2 &&
+      context->pending_bytes <= context->high_water_bytes / 2) {
+    context->above_high_water = false;
+    context->on_queue_state(false, context->queue_state_userdata);
+  }
+}
+
+//! Creates an operation that sends the given range of the data of a pending
+//! operation. It shares nothing that is freed with the operation.
+static struct SendOperation *CreateStripe(const struct SendOperation *fs,
+                                          uint64_t start, uint64_t end) {
+  struct SendOperation *stripe =
+      (struct SendOperation *)malloc(sizeof(*stripe));
+  if (!stripe) {
+    return NULL;
+  }
+  *stripe = *fs;
+  stripe->next = NULL;
+  stripe->read_file = NULL;
+  stripe->buffer_owned = false;
+  stripe->on_complete = NULL;
+  stripe->userdata = NULL;
+  stripe->on_result = NULL;
+  stripe->on_result_userdata = NULL;
+  stripe->progress = NULL;
+  stripe->rate_limit = NULL;
+  stripe->range_start = start;
+  stripe->queued_bytes = end - start;
+
+  stripe->filename = strdup(fs->filename);
+  stripe->local_filename = NULL;
+  if (fs->local_filename) {
+    stripe->local_filename = strdup(fs->local_filename);
+    stripe->range_end = end;
+  } else {
+    stripe->buffer = (const char *)fs->buffer + start;
+    stripe->buffer_length = (ssize_t)(end - start);
+  }
+  if (!stripe->filename || (fs->local_filename && !stripe->local_filename)) {
+    free(stripe->filename);
+    free(stripe->local_filename);
+    free(stripe);
+    return NULL;
+  }
+
+  FTPClientPayloadRetain(stripe->payload);
+  return stripe;
+}
+
+//! Splits an operation that is about to start into the number of ranges given
+//! by its stripe count and minimum stripe size. The operation itself sends the
+//! first range, and the others are held until the server has accepted it.
+//! Operations that cannot be split are left as they are.
+static void SplitIntoStripes(FTPClient *context, struct SendOperation *fs) {
+  uint64_t stripe_count = fs->stripe_count;
+  fs->stripe_count = 0;
+  if (stripe_count < 2 || fs->stripe_set || fs->resume || fs->append ||
+      fs->fill || fs->segments || context->group) {
+    return;
+  }
+  uint64_t total = fs->queued_bytes;
+  if (stripe_count > total / context->min_stripe_size) {
+    stripe_count = total / context->min_stripe_size;
+  }
+  if (stripe_count < 2) {
+    return;
+  }
+
+  struct StripeSet *set = (struct StripeSet *)calloc(1, sizeof(*set));
+  if (!set) {
+    return;
+  }
+  set->filename = strdup(fs->filename);
+  if (!set->filename) {
+    free(set);
+    return;
+  }
+
+  uint64_t stripe_size = total / stripe_count;
+  struct SendOperation *held_tail = NULL;
+  for (uint64_t i = 1; i < stripe_count; ++i) {
+    uint64_t end = i + 1 == stripe_count ? total : (i + 1) * stripe_size;
+    struct SendOperation *stripe = CreateStripe(fs, i * stripe_size, end);
+    if (!stripe) {
+      FreeSendOperationList(set->held);
+      free(set->filename);
+      free(set);
+      return;
+    }
+    if (held_tail) {
+      held_tail->next = stripe;
+    } else {
+      set->held = stripe;
+    }
+    held_tail = stripe;
+  }
+
+  for (struct SendOperation *stripe = set->held; stripe;
+       stripe = stripe->next) {
+    stripe->stripe_set = set;
+    stripe->max_resume_attempts = 0;
+    stripe->progress = fs->progress;
+    stripe->rate_limit = fs->rate_limit;
+  }
+
+  set->owner = context;
+  set->ref_count = (size_t)stripe_count;
+  set->remaining = (size_t)stripe_count;
+  if (fs->buffer_owned) {
+    set->owned_buffer = (void *)fs->buffer;
+    fs->buffer_owned = false;
+  }
+  set->result.filename = set->filename;
+  set->result.successful = true;
+  set->result.timings.submitted = fs->timings.submitted;
+  set->result.operation_id = fs->id;
+  set->on_complete = fs->on_complete;
+  set->userdata = fs->userdata;
+  set->on_result = fs->on_result;
+  set->on_result_userdata = fs->on_result_userdata;
+  set->progress = fs->progress;
+  set->rate_limit = fs->rate_limit;
+
+  fs->on_complete = NULL;
+  fs->userdata = NULL;
+  fs->on_result = NULL;
+  fs->on_result_userdata = NULL;
+  fs->stripe_set = set;
+  fs->max_resume_attempts = 0;
+  if (fs->local_filename) {
+    fs->range_end = stripe_size;
+  } else {
+    fs->buffer_length = (ssize_t)stripe_size;
+  }
+  fs->queued_bytes = stripe_size;
+  context->pending_bytes -= total - stripe_size;
+}
+
+//! Whether an urgent upload is active on the given client.
+static bool HasActiveUrgent(const FTPClient *context) {
+  for (const struct SendOperation *fs = context->active_head; fs;
+       fs = fs->next) {
+    if (fs->priority == FTP_CLIENT_PRIORITY_URGENT) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//! Whether bulk uploads are to be held back for an urgent one.
+static bool PausesBulk(const FTPClient *context) {
+  return context->priority_policy.pause_bulk_while_urgent &&
+         (context->scheduler->urgent_in_flight || HasActiveUrgent(context));
+}
+
+//! Returns the FIFO of the most urgent pending operations, or NULL if there
+//! are none or they are bulk uploads held back for an urgent one.
+static struct PendingQueue *NextPendingQueue(FTPClient *context) {
+  for (size_t i = 0; i < PRIORITY_COUNT; ++i) {
+    if (context->pending[i].head) {
+      bool bulk = i + FTP_CLIENT_PRIORITY_URGENT == FTP_CLIENT_PRIORITY_BULK;
+      return bulk && PausesBulk(context) ? NULL : &context->pending[i];
+    }
+  }
+  return NULL;
+}
+
+//! Starts pending operations, most urgent first, until the active limit is
+//! reached. PASV commands are issued one at a time, so at most one operation
+//! is started per reply.
+static void PromotePendingOperations(FTPClient *context) {
+  struct PendingQueue *queue;
+  while (!context->pasv_outstanding &&
+         context->active_count < context->max_active_operations &&
+         FTPClientIsFullyConnected(context) &&
+         (queue = NextPendingQueue(context))) {
+    struct SendOperation *fs = queue->head;
+    queue->head = fs->next;
+    if (!queue->head) {
+      queue->tail = NULL;
+    }
+    fs->next = NULL;
+
+    SplitIntoStripes(context, fs);
+    // Accounted for before activation, which frees operations that fail.
+    --context->pending_count;
+    context->pending_bytes -= fs->queued_bytes;
+    if (ActivateSendOperation(context, fs) == ACTIVATE_RESULT_DEFERRED) {
+      QueuePendingOperation(context, fs, true);
+      break;
+    }
+  }
+
+  UpdateQueueState(context);
+}
+
+//! Hands a newly created operation to the thread driving the client. Safe to
+//! call from any thread.
+static bool EnqueueSendOperation(FTPClient *context,
+                                 struct SendOperation *fs) {
+  if (!fs->local_filename && fs->buffer_length > 0) {
+    fs->queued_bytes = (uint64_t)fs->buffer_length;
+  }
+  if (fs->progress) {
+    fs->progress->total_bytes = fs->queued_bytes;
+  }
+
+  FTPMPSCQueuePush(&context->submissions, &fs->submission);
+  if (atomic_load_explicit(&context->worker_running, memory_order_acquire)) {
+    FTPPollerWake(context->poller);
+  }
+  return true;
+}
+
+//! Moves submitted operations to the pending FIFO and starts as many as the
+//! active limit allows.
+static void AcceptSubmissions(FTPClient *context) {
+  DrainSubmissions(context);
+  PromotePendingOperations(context);
+}
+
+//! Registers interest in writability of an operation's data connection unless
+//! it is waiting for its source to produce data.
+static bool UpdateDataInterest(FTPClient *context, struct SendOperation *fs) {
+  if (fs->socket < 0) {
+    return true;
+  }
+  uint32_t interest = fs->awaiting_data || fs->throttled || fs->descheduled
+                          ? 0
+                          : FTP_POLLER_EVENT_WRITE;
+  if (interest == fs->poll_interest) {
+    return true;
+  }
+  if (!FTPPollerSet(context->poller, fs->socket, interest, context, fs)) {
+    context->last_errno = errno;
+    return false;
+  }
+  fs->poll_interest = interest;
+  return true;
+}
+
+//! Whether an operation that was in flight when the control connection was
+//! lost can be sent again from the start. Streams cannot be rewound, and an
+//! append that has sent data may already have been partially applied. Nor can
+//! the first range of a striped upload once the others have started, as STOR
+//! would truncate them.
+static bool CanReplaySendOperation(const struct SendOperation *fs) {
+  return !fs->fill && !(fs->append && fs->bytes_sent) &&
+         !(fs->stripe_set && !fs->range_start && !fs->stripe_set->held);
+}
+
+//! Discards the state of a lost control connection. Uploads that were in
+//! flight are returned to the front of the pending FIFOs, in the order they
+//! were started, to be reissued once logged in again; those that cannot be
+//! replayed fail.
+static void RequeueActiveOperations(FTPClient *context) {
+  while (context->reply_head) {
+    free(PopPendingReply(context));
+  }
+  context->pasv_outstanding = false;
+  context->send_buffer_len = 0;
+  context->send_mid_line = false;
+
+  // Collected in reverse so that pushing each to the front of its FIFO
+  // restores the order they were started in.
+  struct SendOperation *replay = NULL;
+
+  struct SendOperation *fs = context->active_head;
+  context->active_head = NULL;
+  context->active_count = 0;
+  while (fs) {
+    struct SendOperation *next = fs->next;
+    fs->next = NULL;
+    CloseDataSocket(context, fs);
+
+    if (!CanReplaySendOperation(fs)) {
+      AbortSendOperation(context, fs, 0);
+      FreeSendOperation(fs);
+    } else {
+      bool resume = fs->bytes_sent && CanResumeSendOperation(fs);
+      RewindSendOperation(fs);
+      if (resume) {
+        fs->resume = true;
+        ++fs->resume_attempts;
+      }
+      fs->next = replay;
+      replay = fs;
+    }
+    fs = next;
+  }
+
+  while (replay) {
+    struct SendOperation *next = replay->next;
+    QueuePendingOperation(context, replay, true);
+    replay = next;
+  }
+}
+
+//! Returns the delay before the given reconnect attempt (counting from 1):
+//! the initial delay doubled per previous attempt, capped at the maximum and
+//! randomly shortened by up to the jitter percentage.
+static uint32_t ComputeReconnectDelay(FTPClient *context, uint32_t attempt) {
+  const FTPClientReconnectPolicy *policy = &context->reconnect_policy;
+  uint64_t delay = policy->initial_delay_milliseconds;
+  for (uint32_t i = 1; i < attempt && delay < policy->max_delay_milliseconds;
+       ++i) {
+    delay *= 2;
+  }
+  if (delay > policy->max_delay_milliseconds) {
+    delay = policy->max_delay_milliseconds;
+  }
+
+  uint32_t jitter_percent =
+      policy->jitter_percent > 100 ? 100 : policy->jitter_percent;
+  uint64_t jitter_range = delay * jitter_percent / 100;
+  if (jitter_range) {
+    uint32_t x = context->jitter_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    context->jitter_state = x;
+    delay -= x % (jitter_range + 1);
+  }
+  return (uint32_t)delay;
+}
+
+//! Whether the given status reports that the control connection was lost or
+//! could not be reestablished, as opposed to a protocol or local failure.
+static bool IsConnectionLoss(FTPClientProcessStatus status) {
+  switch (status) {
+    case FTP_CLIENT_PROCESS_STATUS_READ_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_WRITE_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_CLOSED:
+    case FTP_CLIENT_PROCESS_STATUS_CONNECT_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_CONNECT_TIMEOUT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+//! Schedules a reconnect if `status` reports the loss of a control connection
+//! that had logged in and the reconnect policy allows another attempt.
+//! Returns the status to report to the caller, which is
+//! FTP_CLIENT_PROCESS_STATUS_SUCCESS if the loss is being handled.
+static FTPClientProcessStatus ReconnectIfLost(FTPClient *context,
+                                              FTPClientProcessStatus status) {
+  if (!IsConnectionLoss(status) || context->control_socket >= 0 ||
+      !context->logged_in || !context->reconnect_policy.max_attempts) {
+    return status;
+  }
+
+  RequeueActiveOperations(context);
+  if (context->reconnect_attempts >= context->reconnect_policy.max_attempts) {
+    return status;
+  }
+
+  uint32_t delay =
+      ComputeReconnectDelay(context, ++context->reconnect_attempts);
+  context->reconnect_deadline =
+      FTPClockMicroseconds() + (uint64_t)delay * 1000 + 1;
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Queues a NOOP if the idle control connection is due a keepalive. Updates
+//! `timer_milliseconds` with the time until the next one otherwise.
+static void SendKeepalive(FTPClient *context, uint32_t *timer_milliseconds) {
+  static const char kNoopCommand[] = "NOOP\r\n";
+  uint32_t interval = context->reconnect_policy.keepalive_interval_milliseconds;
+  if (!interval || !FTPClientIsFullyConnected(context) ||
+      context->active_head || context->pending_count || context->reply_head ||
+      context->send_buffer_len) {
+    return;
+  }
+
+  uint64_t now = FTPClockMicroseconds();
+  uint64_t due = context->last_control_activity + (uint64_t)interval * 1000;
+  if (now < due) {
+    uint32_t remaining = (uint32_t)((due - now + 999) / 1000);
+    if (!*timer_milliseconds || remaining < *timer_milliseconds) {
+      *timer_milliseconds = remaining;
+    }
+    return;
+  }
+
+  struct PendingReply *reply =
+      CreatePendingReply(PENDING_REPLY_KIND_NOOP, NULL);
+  if (!reply) {
+    return;
+  }
+  memcpy(context->send_buffer, kNoopCommand, sizeof(kNoopCommand) - 1);
+  context->send_buffer_len = sizeof(kNoopCommand) - 1;
+  AppendPendingReply(context, reply);
+}
+
+//! Returns the bytes an upload of the given priority may write per round.
+static uint64_t PriorityQuantum(const FTPClient *context,
+                                FTPClientPriority priority) {
+  const FTPClientPriorityPolicy *policy = &context->priority_policy;
+  uint32_t weight = policy->bulk_weight;
+  if (priority == FTP_CLIENT_PRIORITY_URGENT) {
+    weight = policy->urgent_weight;
+  } else if (priority == FTP_CLIENT_PRIORITY_NORMAL) {
+    weight = policy->normal_weight;
+  }
+  return (uint64_t)(weight ? weight : 1) * policy->quantum_bytes;
+}
+
+//! Whether the data connection of the given operation is held back for an
+//! urgent upload.
+static bool IsHeldForUrgent(const FTPClient *context,
+                            const struct SendOperation *fs) {
+  return fs->priority == FTP_CLIENT_PRIORITY_BULK && PausesBulk(context);
+}
+
+//! Clients whose data connections are scheduled together: a client and its
+//! stripe sessions, or the members of a group.
+struct ScheduleDomain {
+  FTPClient *first;
+  FTPClient **others;
+  size_t other_count;
+};
+
+static FTPClient *GetDomainClient(const struct ScheduleDomain *domain,
+                                  size_t index) {
+  return index ? domain->others[index - 1] : domain->first;
+}
+
+//! Shares the data connections of the given clients between priorities by
+//! deficit round robin while more than one priority is sending, and holds
+//! back those of bulk uploads while an urgent one is active if the policy of
+//! their client asks for it. A new round grants every sending connection its
+//! quantum once none that has data on the way has any left, or those that do
+//! have stalled.
+static void ScheduleDataConnections(const struct ScheduleDomain *domain,
+                                    struct PriorityScheduler *scheduler,
+                                    uint32_t *timer_milliseconds) {
+  size_t client_count = domain->other_count + 1;
+  scheduler->urgent_in_flight = false;
+  for (size_t i = 0; i < client_count && !scheduler->urgent_in_flight; ++i) {
+    scheduler->urgent_in_flight = HasActiveUrgent(GetDomainClient(domain, i));
+  }
+
+  bool sending[PRIORITY_COUNT] = {false};
+  size_t sending_priorities = 0;
+  for (size_t i = 0; i < client_count; ++i) {
+    FTPClient *client = GetDomainClient(domain, i);
+    for (struct SendOperation *fs = client->active_head; fs; fs = fs->next) {
+      size_t index = fs->priority - FTP_CLIENT_PRIORITY_URGENT;
+      if (fs->socket >= 0 && !sending[index] &&
+          !IsHeldForUrgent(client, fs)) {
+        sending[index] = true;
+        ++sending_priorities;
+      }
+    }
+  }
+  bool was_fair_queueing = scheduler->fair_queueing;
+  scheduler->fair_queueing = sending_priorities > 1;
+
+  uint64_t now = FTPClockMicroseconds();
+  bool new_round = false;
+  if (scheduler->fair_queueing) {
+    new_round = !was_fair_queueing || now - scheduler->round_activity >=
+                                          PRIORITY_ROUND_STALL_MICROSECONDS;
+    bool deficit_left = false;
+    for (size_t i = 0; i < client_count && !new_round && !deficit_left; ++i) {
+      FTPClient *client = GetDomainClient(domain, i);
+      for (struct SendOperation *fs = client->active_head;
+           fs && !deficit_left; fs = fs->next) {
+        // Waiting on a rate limit or on read-ahead of a local file is brief,
+        // whereas a stream may produce nothing for a long time.
+        deficit_left = fs->socket >= 0 && fs->deficit &&
+                       !(fs->awaiting_data && fs->fill) &&
+                       !IsHeldForUrgent(client, fs);
+      }
+    }
+    new_round = new_round || !deficit_left;
+    if (new_round) {
+      scheduler->round_activity = now;
+    }
+  }
+
+  bool waiting = false;
+  for (size_t i = 0; i < client_count; ++i) {
+    FTPClient *client = GetDomainClient(domain, i);
+    for (struct SendOperation *fs = client->active_head; fs; fs = fs->next) {
+      if (fs->socket < 0) {
+        continue;
+      }
+      bool held = IsHeldForUrgent(client, fs);
+      if (!scheduler->fair_queueing || held) {
+        fs->descheduled = held;
+        continue;
+      }
+      if (new_round) {
+        fs->deficit = PriorityQuantum(client, fs->priority);
+      }
+      fs->descheduled = !fs->deficit;
+      waiting = waiting || fs->descheduled;
+    }
+  }
+
+  if (waiting) {
+    uint64_t round_end =
+        scheduler->round_activity + PRIORITY_ROUND_STALL_MICROSECONDS;
+    uint32_t wait = (uint32_t)((round_end - now + 999) / 1000);
+    if (!*timer_milliseconds || wait < *timer_milliseconds) {
+      *timer_milliseconds = wait;
+    }
+  }
+}
+
+//! Enforces the login deadline, starts queued uploads, checks the sources of
+//! uploads that are waiting for data and brings the registered interest up to
+//! date. `timer_milliseconds` receives the time until the client must be
+//! processed again regardless of socket readiness, or 0.
+static FTPClientProcessStatus PrepareClientForEvents(
+    FTPClient *context, uint32_t *timer_milliseconds) {
+  *timer_milliseconds = 0;
+
+  if (context->reconnect_deadline) {
+    uint64_t now = FTPClockMicroseconds();
+    if (now < context->reconnect_deadline) {
+      *timer_milliseconds =
+          (uint32_t)((context->reconnect_deadline - now + 999) / 1000);
+      return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+    }
+    if (FTPClientStartConnect(
+            context, context->reconnect_policy.connect_timeout_milliseconds) !=
+        FTP_CLIENT_CONNECT_STATUS_SUCCESS) {
+      FTPClientClose(context);
+      return FTP_CLIENT_PROCESS_STATUS_CONNECT_FAILED;
+    }
+  }
+
+  if (context->connect_deadline &&
+      context->state < FTP_CLIENT_STATE_FULLY_CONNECTED) {
+    uint64_t now = FTPClockMicroseconds();
+    if (now >= context->connect_deadline) {
+      FTPClientClose(context);
+      context->last_errno = ETIMEDOUT;
+      return FTP_CLIENT_PROCESS_STATUS_CONNECT_TIMEOUT;
+    }
+    *timer_milliseconds =
+        (uint32_t)((context->connect_deadline - now + 999) / 1000);
+  }
+
+  AcceptSubmissions(context);
+  SendKeepalive(context, timer_milliseconds);
+
+  struct SendOperation *next = NULL;
+  for (struct SendOperation *fs = context->active_head; fs; fs = next) {
+    next = fs->next;
+    if (fs->socket < 0) {
+      continue;
+    }
+    CheckProgressInterval(fs, false);
+    if (fs->throttled) {
+      uint64_t wait_microseconds;
+      if (ApplyRateLimits(context, fs, UINT64_MAX, &wait_microseconds)) {
+        fs->throttled = false;
+      } else {
+        uint32_t wait = (uint32_t)((wait_microseconds + 999) / 1000);
+        if (!*timer_milliseconds || wait < *timer_milliseconds) {
+          *timer_milliseconds = wait;
+        }
+      }
+    }
+    if (!fs->awaiting_data) {
+      if (!UpdateDataInterest(context, fs)) {
+        return FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED;
+      }
+      continue;
+    }
+
+    // Don't spin on a writable socket while its next chunk is being produced.
+    FTPClientProcessStatus result =
+        PollSendOperationSource(fs, &context->last_errno);
+    if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+      AbortSendOperation(context, fs, 0);
+      FindAndFreeSendOperation(context, fs);
+      return result;
+    }
+    // Completed read-ahead fills wake the poller where it supports wakeups.
+    if (fs->awaiting_data && (fs->fill || !fs->read_ahead_poller)) {
+      uint32_t interval = fs->fill ? STREAM_POLL_INTERVAL_MILLISECONDS
+                                   : READ_AHEAD_POLL_INTERVAL_MILLISECONDS;
+      if (!*timer_milliseconds || interval < *timer_milliseconds) {
+        *timer_milliseconds = interval;
+      }
+    }
+    if (!UpdateDataInterest(context, fs)) {
+      return FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED;
+    }
+  }
+
+  if (!UpdateControlInterest(context)) {
+    return FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED;
+  }
+
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Handles the events in a batch produced by the poller that belong to the
+//! given client.
+static FTPClientProcessStatus DispatchClientEvents(FTPClient *context,
+                                                   FTPPollerEvent *events,
+                                                   int event_count) {
+  // Handle the control connection first, as replies may retire operations
+  // whose data connections are also in this batch. Removing a socket from the
+  // poller clears its pending events.
+  uint32_t control_events = 0;
+  for (int i = 0; i < event_count; ++i) {
+    if (events[i].owner == context && !events[i].userdata) {
+      control_events |= events[i].events;
+    }
+  }
+
+  if (context->state == FTP_CLIENT_STATE_CONNECTING) {
+    return control_events ? CompleteConnect(context)
+                          : FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  }
+
+  if (control_events & FTP_POLLER_EVENT_READ) {
+    FTPClientProcessStatus result = ReadControlSocket(context);
+    if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+      return result;
+    }
+    // Pipeline the next PASV behind any STOR/APPE queued by the replies.
+    PromotePendingOperations(context);
+  }
+
+  if (context->control_socket >= 0 && context->send_buffer_len &&
+      (control_events & FTP_POLLER_EVENT_WRITE)) {
+    FTPClientProcessStatus result = WriteControlSocket(context);
+    if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+      return result;
+    }
+  }
+
+  for (int i = 0; i < event_count; ++i) {
+    struct SendOperation *fs = (struct SendOperation *)events[i].userdata;
+    if (!fs || events[i].owner != context ||
+        !(events[i].events & FTP_POLLER_EVENT_WRITE) || fs->socket < 0) {
+      continue;
+    }
+
+    FTPClientProcessStatus result = WriteDataSocket(context, fs);
+    if (fs->socket < 0 && !fs->data_complete && !fs->interrupted) {
+      FindAndFreeSendOperation(context, fs);
+    } else if (!UpdateDataInterest(context, fs)) {
+      return FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED;
+    }
+    if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+      return result;
+    }
+  }
+
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Fails the ranges queued on a stripe session whose connection could not be
+//! recovered, and closes it. It is reconnected for the next striped upload.
+static void FailStripeSession(FTPClient *session) {
+  RequeueActiveOperations(session);
+  for (size_t i = 0; i < PRIORITY_COUNT; ++i) {
+    while (session->pending[i].head) {
+      struct SendOperation *fs = session->pending[i].head;
+      NotifySendOperationComplete(session, fs, false, 0);
+      FindAndFreeSendOperation(session, fs);
+    }
+  }
+  FTPClientClose(session);
+}
+
+//! Prepares the client, as by PrepareClientForEvents, along with its stripe
+//! sessions.
+static FTPClientProcessStatus PrepareForEvents(FTPClient *context,
+                                               uint32_t *timer_milliseconds) {
+  // Members of a group are scheduled together by FTPClientGroupProcess.
+  *timer_milliseconds = 0;
+  if (!context->group) {
+    struct ScheduleDomain domain = {context, context->stripe_sessions,
+                                    context->stripe_session_count};
+    ScheduleDataConnections(&domain, context->scheduler, timer_milliseconds);
+  }
+  uint32_t client_timer;
+  FTPClientProcessStatus result =
+      PrepareClientForEvents(context, &client_timer);
+  if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+    return result;
+  }
+  if (client_timer &&
+      (!*timer_milliseconds || client_timer < *timer_milliseconds)) {
+    *timer_milliseconds = client_timer;
+  }
+
+  for (size_t i = 0; i < context->stripe_session_count; ++i) {
+    FTPClient *session = context->stripe_sessions[i];
+    if (!HasSession(session)) {
+      continue;
+    }
+    uint32_t session_timer;
+    if (ReconnectIfLost(session, PrepareClientForEvents(
+                                     session, &session_timer)) !=
+        FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+      FailStripeSession(session);
+      continue;
+    }
+    if (session_timer &&
+        (!*timer_milliseconds || session_timer < *timer_milliseconds)) {
+      *timer_milliseconds = session_timer;
+    }
+  }
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Handles a batch of readiness events produced by the poller, which is shared
+//! by the client and its stripe sessions.
+static FTPClientProcessStatus DispatchEvents(FTPClient *context,
+                                             FTPPollerEvent *events,
+                                             int event_count) {
+  for (size_t i = 0; i < context->stripe_session_count; ++i) {
+    FTPClient *session = context->stripe_sessions[i];
+    if (HasSession(session) &&
+        FTPClientProcessStatusIsError(ReconnectIfLost(
+            session, DispatchClientEvents(session, events, event_count)))) {
+      FailStripeSession(session);
+    }
+  }
+  return DispatchClientEvents(context, events, event_count);
+}
+
+FTPClientProcessStatus FTPClientProcess(FTPClient *context,
+                                        uint32_t timeout_milliseconds) {
+  if (context->group) {
+    return FTP_CLIENT_PROCESS_STATUS_BAD_STATE;
+  }
+  if (!HasSession(context)) {
+    return FTP_CLIENT_PROCESS_STATUS_CLOSED;
+  }
+
+  uint32_t timer_milliseconds;
+  FTPClientProcessStatus result = ReconnectIfLost(
+      context, PrepareForEvents(context, &timer_milliseconds));
+  if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+    return result;
+  }
+
+  if (!timeout_milliseconds) {
+    timeout_milliseconds = DEFAULT_PROCESS_TIMEOUT_MILLISECONDS;
+  }
+  if (timer_milliseconds && timeout_milliseconds > timer_milliseconds) {
+    timeout_milliseconds = timer_milliseconds;
+  }
+
+  FTPPollerEvent *events;
+  const int event_count =
+      FTPPollerWait(context->poller, timeout_milliseconds, &events);
+  STATS_ADD(context, poll_waits, 1);
+
+  if (event_count < 0) {
+    context->last_errno = errno;
+    return FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED;
+  }
+  if (!event_count) {
+    STATS_ADD(context, poll_timeouts, 1);
+    return FTP_CLIENT_PROCESS_STATUS_TIMEOUT;
+  }
+  STATS_ADD(context, poll_wakeups, 1);
+
+  return ReconnectIfLost(context,
+                         DispatchEvents(context, events, event_count));
+}
+
+//! Whether an operation of the client or its stripe sessions is waiting on a
+//! read-ahead fill.
+static bool IsAwaitingReadAhead(FTPClient *context) {
+  for (size_t i = 0; i <= context->stripe_session_count; ++i) {
+    FTPClient *client = i ? context->stripe_sessions[i - 1] : context;
+    for (struct SendOperation *fs = client->active_head; fs; fs = fs->next) {
+      if (fs->awaiting_data && fs->read_ahead) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+FTPClientProcessStatus FTPClientGetPollDescriptors(
+    FTPClient *context, FTPClientPollDescriptor *descriptors,
+    size_t max_descriptors, size_t *descriptor_count,
+    uint32_t *timeout_milliseconds) {
+  if (descriptor_count) {
+    *descriptor_count = 0;
+  }
+  if (timeout_milliseconds) {
+    *timeout_milliseconds = FTP_CLIENT_NO_DEADLINE;
+  }
+  if (!context || !HasSession(context)) {
+    return FTP_CLIENT_PROCESS_STATUS_CLOSED;
+  }
+  if (context->group) {
+    return FTP_CLIENT_PROCESS_STATUS_BAD_STATE;
+  }
+
+  uint32_t timer_milliseconds;
+  FTPClientProcessStatus result = ReconnectIfLost(
+      context, PrepareForEvents(context, &timer_milliseconds));
+  if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+    return result;
+  }
+
+  // The caller cannot see the wakeups of completed read-ahead fills.
+  if (IsAwaitingReadAhead(context) &&
+      (!timer_milliseconds ||
+       timer_milliseconds > READ_AHEAD_POLL_INTERVAL_MILLISECONDS)) {
+    timer_milliseconds = READ_AHEAD_POLL_INTERVAL_MILLISECONDS;
+  }
+
+  size_t count =
+      FTPPollerGetInterest(context->poller, descriptors, max_descriptors);
+  if (descriptor_count) {
+    *descriptor_count = count;
+  }
+  if (timeout_milliseconds && timer_milliseconds) {
+    *timeout_milliseconds = timer_milliseconds;
+  }
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+FTPClientProcessStatus FTPClientProcessReady(
+    FTPClient *context, const FTPClientPollDescriptor *ready,
+    size_t ready_count) {
+  if (!context || !HasSession(context)) {
+    return FTP_CLIENT_PROCESS_STATUS_CLOSED;
+  }
+  if (context->group) {
+    return FTP_CLIENT_PROCESS_STATUS_BAD_STATE;
+  }
+
+  FTPPollerEvent *events;
+  const int event_count =
+      FTPPollerCollect(context->poller, ready, ready_count, &events);
+  if (event_count < 0) {
+    context->last_errno = errno;
+    return FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED;
+  }
+  if (!event_count) {
+    return FTP_CLIENT_PROCESS_STATUS_TIMEOUT;
+  }
+
+  return ReconnectIfLost(context,
+                         DispatchEvents(context, events, event_count));
+}
+
+//! Registers the client's sockets, with their current interest, with `poller`
+//! and unregisters them from the client's current poller. Read-ahead fills
+//! wake `poller` from then on. The client's `poller` is not modified.
+static bool MoveSocketsToPoller(FTPClient *context, FTPPoller *poller) {
+  bool moved = context->control_socket < 0 ||
+               FTPPollerSet(poller, context->control_socket,
+                            context->control_interest, context, NULL);
+  for (struct SendOperation *fs = context->active_head; fs && moved;
+       fs = fs->next) {
+    moved = fs->socket < 0 ||
+            FTPPollerSet(poller, fs->socket, fs->poll_interest, context, fs);
+  }
+
+  if (!moved) {
+    RemoveSocketsFromPoller(context, poller);
+    return false;
+  }
+  RemoveSocketsFromPoller(context, context->poller);
+  RetargetReadAheadWakeups(context, poller);
+  return true;
+}
+
+FTPClientGroup *FTPClientGroupCreate(FTPClientPollerBackend backend) {
+  FTPClientGroup *group = (FTPClientGroup *)calloc(1, sizeof(*group));
+  if (!group) {
+    return NULL;
+  }
+
+  group->poller = FTPPollerCreate(backend);
+  if (!group->poller) {
+    free(group);
+    return NULL;
+  }
+  // Without wakeups, FTPClientGroupWake reports that waits run to completion.
+  FTPPollerEnableWakeup(group->poller);
+  return group;
+}
+
+bool FTPClientGroupWake(FTPClientGroup *group) {
+  return group && FTPPollerWake(group->poller);
+}
+
+void FTPClientGroupDestroy(FTPClientGroup **group) {
+  if (!group || !*group) {
+    return;
+  }
+
+  while ((*group)->client_count) {
+    FTPClient *context = (*group)->clients[0];
+    if (!FTPClientGroupRemove(*group, context)) {
+      // The client's sockets could not be moved to a poller of its own, so
+      // drop its connections instead.
+      RemoveSocketsFromPoller(context, (*group)->poller);
+      RetargetReadAheadWakeups(context, NULL);
+      for (struct SendOperation *fs = context->active_head; fs;
+           fs = fs->next) {
+        if (fs->socket >= 0) {
+          close(fs->socket);
+          fs->socket = -1;
+        }
+      }
+      UnlinkGroupMember(context);
+      FTPClientClose(context);
+    }
+  }
+
+  FTPPollerDestroy((*group)->poller);
+  free((*group)->clients);
+  free(*group);
+  *group = NULL;
+}
+
+bool FTPClientGroupAdd(FTPClientGroup *group, FTPClient *context) {
+  if (!group || !context || context->group || context->stripe_session_count) {
+    return false;
+  }
+
+  if (group->client_count == group->client_capacity) {
+    size_t capacity = group->client_capacity ? group->client_capacity * 2 : 8;
+    FTPClient **clients =
+        (FTPClient **)realloc(group->clients, capacity * sizeof(*clients));
+    if (!clients) {
+      return false;
+    }
+    group->clients = clients;
+    group->client_capacity = capacity;
+  }
+
+  if (!MoveSocketsToPoller(context, group->poller)) {
+    context->last_errno = errno;
+    return false;
+  }
+
+  FTPPollerDestroy(context->poller);
+  context->poller = group->poller;
+  context->group = group;
+  context->scheduler = &group->scheduler;
+  group->clients[group->client_count++] = context;
+  return true;
+}
+
+bool FTPClientGroupRemove(FTPClientGroup *group, FTPClient *context) {
+  if (!group || !context || context->group != group) {
+    return false;
+  }
+
+  // Clients without sockets create their own poller on the next connect.
+  FTPPoller *poller = NULL;
+  bool has_sockets = context->control_socket >= 0;
+  for (struct SendOperation *fs = context->active_head; fs && !has_sockets;
+       fs = fs->next) {
+    has_sockets = fs->socket >= 0;
+  }
+  if (has_sockets) {
+    poller = FTPPollerCreate(context->poller_backend);
+    if (!poller || !MoveSocketsToPoller(context, poller)) {
+      context->last_errno = errno;
+      FTPPollerDestroy(poller);
+      return false;
+    }
+  } else {
+    RetargetReadAheadWakeups(context, NULL);
+  }
+
+  UnlinkGroupMember(context);
+  context->poller = poller;
+  return true;
+}
+
+static int CompareEventOwners(const void *a, const void *b) {
+  uintptr_t owner_a = (uintptr_t)((const FTPPollerEvent *)a)->owner;
+  uintptr_t owner_b = (uintptr_t)((const FTPPollerEvent *)b)->owner;
+  return (owner_a > owner_b) - (owner_a < owner_b);
+}
+
+FTPClientProcessStatus FTPClientGroupProcess(
+    FTPClientGroup *group, uint32_t timeout_milliseconds,
+    FTPClientGroupStatusCallback on_error, void *userdata) {
+  if (!group) {
+    return FTP_CLIENT_PROCESS_STATUS_BAD_STATE;
+  }
+
+  uint32_t timer_milliseconds = 0;
+  if (group->client_count) {
+    struct ScheduleDomain domain = {group->clients[0], group->clients + 1,
+                                    group->client_count - 1};
+    ScheduleDataConnections(&domain, &group->scheduler, &timer_milliseconds);
+  }
+  for (size_t i = 0; i < group->client_count; ++i) {
+    FTPClient *context = group->clients[i];
+    if (!HasSession(context)) {
+      continue;
+    }
+
+    uint32_t client_timer;
+    FTPClientProcessStatus result =
+        ReconnectIfLost(context, PrepareForEvents(context, &client_timer));
+    if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+      if (on_error) {
+        on_error(context, result, userdata);
+      }
+      continue;
+    }
+    if (client_timer &&
+        (!timer_milliseconds || client_timer < timer_milliseconds)) {
+      timer_milliseconds = client_timer;
+    }
+  }
+
+  if (!timeout_milliseconds) {
+    timeout_milliseconds = DEFAULT_PROCESS_TIMEOUT_MILLISECONDS;
+  }
+  if (timer_milliseconds && timeout_milliseconds > timer_milliseconds) {
+    timeout_milliseconds = timer_milliseconds;
+  }
+
+  FTPPollerEvent *events;
+  const int event_count =
+      FTPPollerWait(group->poller, timeout_milliseconds, &events);
+  if (event_count < 0) {
+    return FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED;
+  }
+  if (!event_count) {
+    return FTP_CLIENT_PROCESS_STATUS_TIMEOUT;
+  }
+
+  // Dispatch each ready client once with its contiguous run of events.
+  qsort(events, (size_t)event_count, sizeof(*events), CompareEventOwners);
+  int run_start = 0;
+  while (run_start < event_count) {
+    FTPClient *context = (FTPClient *)events[run_start].owner;
+    int run_end = run_start + 1;
+    while (run_end < event_count && events[run_end].owner == context) {
+      ++run_end;
+    }
+
+    FTPClientProcessStatus result = ReconnectIfLost(
+        context,
+        DispatchEvents(context, events + run_start, run_end - run_start));
+    if (FTPClientProcessStatusIsError(result) && on_error) {
+      on_error(context, result, userdata);
+    }
+    run_start = run_end;
+  }
+
+  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+}
+
+//! Whether the given status only reports the failure of a single upload,
+//! which has already been reported through its callbacks.
+static bool IsUploadFailure(FTPClientProcessStatus status) {
+  switch (status) {
+    case FTP_CLIENT_PROCESS_PASV_RESPONSE_INVALID:
+    case FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_SOCKET_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_BUFFER_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_FILE_READ_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_STREAM_FILL_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_DATA_SOCKET_CONNECT_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_DATA_SOCKET_EXCEPTION:
+      return true;
+    default:
+      return false;
+  }
+}
+
+//! Drives the client until asked to stop or the control connection is lost
+//! beyond what the reconnect policy recovers. Failed uploads do not stop it.
+static int WorkerThreadProc(void *arg) {
+  FTPClient *context = (FTPClient *)arg;
+  const uint32_t wait_milliseconds = context->worker_interruptible
+                                         ? WORKER_WAIT_MILLISECONDS
+                                         : WORKER_POLL_INTERVAL_MILLISECONDS;
+
+  FTPClientProcessStatus status = FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  while (!atomic_load_explicit(&context->worker_stop, memory_order_acquire)) {
+    status = FTPClientProcess(context, wait_milliseconds);
+    if (FTPClientProcessStatusIsError(status) &&
+        !(IsUploadFailure(status) && FTPClientIsFullyConnected(context))) {
+      break;
+    }
+    status = FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  }
+
+  context->worker_status = status;
+  return 0;
+}
+
+bool FTPClientStartWorker(FTPClient *context,
+                          uint32_t connect_timeout_milliseconds) {
+  if (!context || context->group ||
+      atomic_load_explicit(&context->worker_running, memory_order_acquire)) {
+    return false;
+  }
+
+  if (FTPClientStartConnect(context, connect_timeout_milliseconds) !=
+      FTP_CLIENT_CONNECT_STATUS_SUCCESS) {
+    return false;
+  }
+  context->worker_interruptible = FTPPollerEnableWakeup(context->poller);
+
+  context->worker_status = FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  atomic_store_explicit(&context->worker_stop, false, memory_order_relaxed);
+  atomic_store_explicit(&context->worker_running, true, memory_order_release);
+  if (!FTPThreadCreate(&context->worker_thread, WorkerThreadProc, context)) {
+    atomic_store_explicit(&context->worker_running, false,
+                          memory_order_release);
+    return false;
+  }
+  return true;
+}
+
+FTPClientProcessStatus FTPClientStopWorker(FTPClient *context) {
+  if (!context ||
+      !atomic_load_explicit(&context->worker_running, memory_order_acquire)) {
+    return FTP_CLIENT_PROCESS_STATUS_BAD_STATE;
+  }
+
+  atomic_store_explicit(&context->worker_stop, true, memory_order_release);
+  FTPPollerWake(context->poller);
+  FTPThreadJoin(context->worker_thread);
+  atomic_store_explicit(&context->worker_running, false, memory_order_release);
+  return context->worker_status;
+}
+
+void FTPClientReconnectPolicyInit(FTPClientReconnectPolicy *policy) {
+  if (!policy) {
+    return;
+  }
+  policy->max_attempts = DEFAULT_RECONNECT_MAX_ATTEMPTS;
+  policy->initial_delay_milliseconds =
+      DEFAULT_RECONNECT_INITIAL_DELAY_MILLISECONDS;
+  policy->max_delay_milliseconds = DEFAULT_RECONNECT_MAX_DELAY_MILLISECONDS;
+  policy->jitter_percent = DEFAULT_RECONNECT_JITTER_PERCENT;
+  policy->connect_timeout_milliseconds = 0;
+  policy->keepalive_interval_milliseconds = 0;
+}
+
+void FTPClientSetReconnectPolicy(FTPClient *context,
+                                 const FTPClientReconnectPolicy *policy) {
+  if (!context) {
+    return;
+  }
+  if (policy) {
+    context->reconnect_policy = *policy;
+  } else {
+    memset(&context->reconnect_policy, 0, sizeof(context->reconnect_policy));
+  }
+  if (!context->reconnect_policy.max_attempts) {
+    context->reconnect_deadline = 0;
+  }
+}
+
+void FTPClientSetCallbackMode(FTPClient *context, FTPClientCallbackMode mode) {
+  if (context) {
+    context->callback_mode = mode;
+  }
+}
+
+size_t FTPClientDispatchCallbacks(FTPClient *context) {
+  if (!context) {
+    return 0;
+  }
+
+  size_t dispatched = 0;
+  FTPMPSCQueueNode *node;
+  while ((node = FTPMPSCQueuePop(&context->deferred_completions))) {
+    struct DeferredCompletion *deferred = (struct DeferredCompletion *)node;
+    InvokeCompletionCallbacks(deferred->successful, deferred->on_complete,
+                              deferred->userdata, deferred->on_result,
+                              &deferred->result, deferred->on_result_userdata);
+    free(deferred);
+    ++dispatched;
+  }
+  return dispatched;
+}
+
+bool FTPClientHasSendPending(FTPClient *context) {
+  if (!context) {
+    return false;
+  }
+  DrainSubmissions(context);
+  for (size_t i = 0; i < context->stripe_session_count; ++i) {
+    FTPClient *session = context->stripe_sessions[i];
+    if (session->active_head || session->pending_count) {
+      return true;
+    }
+  }
+  return context->send_buffer_len || context->active_head ||
+         context->pending_count || !FTPMPSCQueueIsEmpty(&context->submissions);
+}
+
+bool FTPClientProcessStatusIsError(FTPClientProcessStatus status) {
+  return status != FTP_CLIENT_PROCESS_STATUS_SUCCESS &&
+         status != FTP_CLIENT_PROCESS_STATUS_TIMEOUT;
+}
+
+void FTPClientSendOptionsInit(FTPClientSendOptions *options) {
+  if (!options) {
+    return;
+  }
+  memset(options, 0, sizeof(*options));
+  options->chunk_mode = FTP_CLIENT_CHUNK_MODE_DEFAULT;
+}
+
+void FTPClientSetChunkSize(FTPClient *context, size_t chunk_size) {
+  if (!context) {
+    return;
+  }
+  context->chunk_size = chunk_size ? chunk_size : DEFAULT_CHUNK_SIZE;
+}
+
+void FTPClientSetMaxResumeAttempts(FTPClient *context,
+                                   uint32_t max_resume_attempts) {
+  if (context) {
+    context->max_resume_attempts = max_resume_attempts;
+  }
+}
+
+void FTPClientSetStriping(FTPClient *context, size_t stripe_count,
+                          size_t min_stripe_size) {
+  if (!context) {
+    return;
+  }
+  context->stripe_count = stripe_count;
+  context->min_stripe_size =
+      min_stripe_size ? min_stripe_size : DEFAULT_MIN_STRIPE_SIZE;
+}
+
+void FTPClientSetRateLimit(FTPClient *context, uint64_t bytes_per_second,
+                           uint64_t burst_bytes) {
+  if (!context) {
+    return;
+  }
+  context->rate_limit = NULL;
+  if (bytes_per_second) {
+    InitTokenBucket(&context->rate_limit_storage, bytes_per_second,
+                    burst_bytes);
+    context->rate_limit = &context->rate_limit_storage;
+  }
+  for (size_t i = 0; i < context->stripe_session_count; ++i) {
+    context->stripe_sessions[i]->rate_limit = context->rate_limit;
+  }
+}
+
+void FTPClientPriorityPolicyInit(FTPClientPriorityPolicy *policy) {
+  if (!policy) {
+    return;
+  }
+  policy->urgent_weight = DEFAULT_URGENT_WEIGHT;
+  policy->normal_weight = DEFAULT_NORMAL_WEIGHT;
+  policy->bulk_weight = DEFAULT_BULK_WEIGHT;
+  policy->quantum_bytes = DEFAULT_PRIORITY_QUANTUM_BYTES;
+  policy->pause_bulk_while_urgent = false;
+}
+
+void FTPClientSetPriorityPolicy(FTPClient *context,
+                                const FTPClientPriorityPolicy *policy) {
+  if (!context) {
+    return;
+  }
+  if (policy) {
+    context->priority_policy = *policy;
+  } else {
+    FTPClientPriorityPolicyInit(&context->priority_policy);
+  }
+  if (!context->priority_policy.quantum_bytes) {
+    context->priority_policy.quantum_bytes = DEFAULT_PRIORITY_QUANTUM_BYTES;
+  }
+  for (size_t i = 0; i < context->stripe_session_count; ++i) {
+    context->stripe_sessions[i]->priority_policy = context->priority_policy;
+  }
+}
 
-    if (fs->socket > max_fd) {
-      max_fd = fs->socket;
-    }
+void FTPClientSetDefaultPriority(FTPClient *context,
+                                 FTPClientPriority priority) {
+  if (!context) {
+    return;
   }
+  context->default_priority = priority >= FTP_CLIENT_PRIORITY_URGENT &&
+                                      priority <= FTP_CLIENT_PRIORITY_BULK
+                                  ? priority
+                                  : FTP_CLIENT_PRIORITY_NORMAL;
+}
 
-  struct timeval tv;
-  if (!timeout_milliseconds) {
-    timeout_milliseconds = DEFAULT_PROCESS_TIMEOUT_MILLISECONDS;
+void FTPClientSetChunkMode(FTPClient *context, FTPClientChunkMode chunk_mode) {
+  if (!context) {
+    return;
   }
-  tv.tv_sec = timeout_milliseconds / 1000;
-  tv.tv_usec = (timeout_milliseconds % 1000) * 1000;
+  context->chunk_mode = chunk_mode == FTP_CLIENT_CHUNK_MODE_DEFAULT
+                            ? FTP_CLIENT_CHUNK_MODE_FIXED
+                            : chunk_mode;
+}
 
-  const int select_response =
-      select(max_fd + 1, &read_fds, &write_fds, NULL, &tv);
+void FTPClientSetReadAheadExecutor(FTPClient *context,
+                                   FTPClientReadAheadExecutor executor,
+                                   void *executor_userdata) {
+  if (!context) {
+    return;
+  }
 
-  if (select_response < 0) {
-    context->last_errno = errno;
-    return FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED;
+  if (!executor) {
+    executor = DefaultReadAheadExecutor;
+    executor_userdata = context;
   }
-  if (!select_response) {
-    return FTP_CLIENT_PROCESS_STATUS_TIMEOUT;
+  context->read_ahead_executor = executor;
+  context->read_ahead_executor_userdata = executor_userdata;
+}
+
+//! Allocates a SendOperation and applies the settings common to all upload
+//! sources. The operation is not linked into the client until it is passed to
+//! EnqueueSendOperation.
+static struct SendOperation *CreateSendOperation(
+    FTPClient *context, const char *filename,
+    const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata,
+    bool append) {
+  if (!context || !filename) {
+    return NULL;
   }
 
-  if (FD_ISSET(context->control_socket, &read_fds)) {
-    FTPClientProcessStatus result = ReadControlSocket(context);
-    if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
-      return result;
-    }
+  struct SendOperation *send_operation =
+      (struct SendOperation *)calloc(1, sizeof(*send_operation));
+  if (!send_operation) {
+    return NULL;
   }
 
-  if (context->send_buffer_len &&
-      FD_ISSET(context->control_socket, &write_fds)) {
-    FTPClientProcessStatus result = WriteControlSocket(context);
-    if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
-      return result;
+  send_operation->socket = -1;
+  send_operation->append = append;
+  send_operation->userdata = userdata;
+  send_operation->on_complete = on_complete;
+  send_operation->on_result = context->on_transfer_result;
+  send_operation->on_result_userdata = context->transfer_result_userdata;
+  send_operation->timings.submitted = FTPClockMicroseconds();
+
+  send_operation->chunk_size = context->chunk_size;
+  FTPClientChunkMode chunk_mode = context->chunk_mode;
+  if (options) {
+    if (options->chunk_size) {
+      send_operation->chunk_size = options->chunk_size;
+    }
+    if (options->chunk_mode != FTP_CLIENT_CHUNK_MODE_DEFAULT) {
+      chunk_mode = options->chunk_mode;
     }
   }
-
-  for (size_t i = 0; i < MAX_SEND_OPERATIONS; ++i) {
-    struct SendOperation *fs = context->file_send_buffer[i];
-    if (!fs || fs->socket < 0) {
-      continue;
+  send_operation->adaptive_chunk_size =
+      chunk_mode == FTP_CLIENT_CHUNK_MODE_ADAPTIVE;
+  send_operation->max_resume_attempts = context->max_resume_attempts;
+  send_operation->stripe_count = context->stripe_count;
+  send_operation->priority = context->default_priority;
+  if (options) {
+    send_operation->disable_read_ahead = options->disable_read_ahead;
+    send_operation->disable_zero_copy = options->disable_zero_copy;
+    if (options->max_resume_attempts) {
+      send_operation->max_resume_attempts = options->max_resume_attempts;
     }
-
-    if (FD_ISSET(fs->socket, &write_fds)) {
-      FTPClientProcessStatus result = WriteDataSocket(fs, &context->last_errno);
-      if (result != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
-        return result;
-      }
-      if (fs->offset >= fs->buffer_length) {
-        FindAndFreeSendOperation(context, fs);
-      }
+    if (options->stripe_count) {
+      send_operation->stripe_count = options->stripe_count;
+    }
+    if (options->priority >= FTP_CLIENT_PRIORITY_URGENT &&
+        options->priority <= FTP_CLIENT_PRIORITY_BULK) {
+      send_operation->priority = options->priority;
     }
   }
 
-  return FTP_CLIENT_PROCESS_STATUS_SUCCESS;
-}
-
-bool FTPClientHasSendPending(FTPClient *context) {
-  if (!context) {
-    return false;
-  }
-  if (context->send_buffer_len) {
-    return true;
+  send_operation->filename = strdup(filename);
+  if (!send_operation->filename) {
+    FreeSendOperation(send_operation);
+    return NULL;
   }
-  for (size_t i = 0; i < MAX_SEND_OPERATIONS; ++i) {
-    if (context->file_send_buffer[i]) {
-      return true;
+
+  if (options && options->on_progress) {
+    struct ProgressState *progress =
+        (struct ProgressState *)calloc(1, sizeof(*progress));
+    if (!progress) {
+      FreeSendOperation(send_operation);
+      return NULL;
+    }
+    progress->callback = options->on_progress;
+    progress->userdata = options->progress_userdata;
+    progress->interval_bytes = options->progress_interval_bytes;
+    progress->interval_microseconds =
+        (uint64_t)options->progress_interval_milliseconds * 1000;
+    if (!progress->interval_bytes && !progress->interval_microseconds) {
+      progress->interval_microseconds =
+          DEFAULT_PROGRESS_INTERVAL_MILLISECONDS * 1000;
     }
+    progress->next_bytes =
+        progress->interval_bytes ? progress->interval_bytes : UINT64_MAX;
+    send_operation->progress = progress;
   }
 
-  return false;
-}
+  if (options && options->rate_limit_bytes_per_second) {
+    send_operation->rate_limit =
+        (struct TokenBucket *)malloc(sizeof(*send_operation->rate_limit));
+    if (!send_operation->rate_limit) {
+      FreeSendOperation(send_operation);
+      return NULL;
+    }
+    InitTokenBucket(send_operation->rate_limit,
+                    options->rate_limit_bytes_per_second,
+                    options->rate_limit_burst_bytes);
+  }
 
-bool FTPClientProcessStatusIsError(FTPClientProcessStatus status) {
-  return status != FTP_CLIENT_PROCESS_STATUS_SUCCESS &&
-         status != FTP_CLIENT_PROCESS_STATUS_TIMEOUT;
+  return send_operation;
 }
 
+//! Uploads `buffer`.
 static bool SendBuffer(FTPClient *context, const char *filename,
-                       const void *buffer, size_t buffer_len, FILE *read_file,
+                       const void *buffer, size_t buffer_len,
+                       const FTPClientSendOptions *options,
                        void (*on_complete)(bool successful, void *userdata),
                        void *userdata, bool copy_buffer, bool append) {
-  if (!FTPClientIsFullyConnected(context) || !filename) {
-    return false;
-  }
-
-  if (!read_file && (!buffer || !buffer_len)) {
+  if (!buffer || !buffer_len) {
     return false;
   }
 
-  struct SendOperation *send_operation = NULL;
-  for (size_t i = 0; i < MAX_SEND_OPERATIONS; ++i) {
-    if (!context->file_send_buffer[i]) {
-      send_operation =
-          (struct SendOperation *)calloc(1, sizeof(*send_operation));
-      if (!send_operation) {
-        return false;
-      }
-      context->file_send_buffer[i] = send_operation;
-      break;
-    }
-  }
-
+  struct SendOperation *send_operation = CreateSendOperation(
+      context, filename, options, on_complete, userdata, append);
   if (!send_operation) {
     return false;
   }
 
-  send_operation->socket = -1;
-  send_operation->read_file = read_file;
-  send_operation->append = append;
-
-  char *send_buffer = context->send_buffer + context->send_buffer_len;
-  size_t send_buffer_available = BUFFER_SIZE - context->send_buffer_len;
-
-  send_operation->filename = strdup(filename);
-  if (!send_operation->filename) {
-    FindAndFreeSendOperation(context, send_operation);
-    return false;
-  }
-
   if (copy_buffer) {
     void *copied_buffer = calloc(1, buffer_len);
     if (!copied_buffer) {
-      FindAndFreeSendOperation(context, send_operation);
+      FreeSendOperation(send_operation);
       return false;
     }
     memcpy(copied_buffer, buffer, buffer_len);
@@ -769,21 +4447,111 @@ static bool SendBuffer(FTPClient *context, const char *filename,
   }
   send_operation->offset = 0;
   send_operation->buffer_length = buffer_len;
-  send_operation->userdata = userdata;
-  send_operation->on_complete = on_complete;
 
-  if (send_buffer_available < 6) {
-    FindAndFreeSendOperation(context, send_operation);
+  return EnqueueSendOperation(context, send_operation);
+}
+
+//! Uploads the concatenation of the given segments without copying them.
+static bool SendIov(FTPClient *context, const char *filename,
+                    const FTPClientIOVec *segments, size_t segment_count,
+                    const FTPClientSendOptions *options,
+                    void (*on_complete)(bool successful, void *userdata),
+                    void *userdata, bool append) {
+  if (!segments || !segment_count) {
     return false;
   }
-  int bytes_written = snprintf(send_buffer, send_buffer_available, "PASV\r\n");
-  if (bytes_written <= 0) {
-    FindAndFreeSendOperation(context, send_operation);
+
+  size_t total_length = 0;
+  size_t non_empty_segments = 0;
+  for (size_t i = 0; i < segment_count; ++i) {
+    if (!segments[i].length) {
+      continue;
+    }
+    if (!segments[i].base) {
+      return false;
+    }
+    total_length += segments[i].length;
+    ++non_empty_segments;
+  }
+  if (!total_length) {
     return false;
   }
-  context->send_buffer_len += bytes_written;
 
-  return true;
+  struct SendOperation *send_operation = CreateSendOperation(
+      context, filename, options, on_complete, userdata, append);
+  if (!send_operation) {
+    return false;
+  }
+
+  send_operation->segments =
+      (struct iovec *)calloc(non_empty_segments, sizeof(struct iovec));
+  if (!send_operation->segments) {
+    FreeSendOperation(send_operation);
+    return false;
+  }
+  for (size_t i = 0; i < segment_count; ++i) {
+    if (!segments[i].length) {
+      continue;
+    }
+    struct iovec *segment =
+        send_operation->segments + send_operation->segment_count++;
+    segment->iov_base = (void *)segments[i].base;
+    segment->iov_len = segments[i].length;
+  }
+  send_operation->offset = 0;
+  send_operation->buffer_length = (ssize_t)total_length;
+
+  return EnqueueSendOperation(context, send_operation);
+}
+
+//! Uploads the data produced by `fill`.
+static bool SendStream(FTPClient *context, const char *filename,
+                       FTPClientStreamFillCallback fill,
+                       const FTPClientSendOptions *options,
+                       void (*on_complete)(bool successful, void *userdata),
+                       void *userdata, bool append) {
+  if (!fill) {
+    return false;
+  }
+
+  struct SendOperation *send_operation = CreateSendOperation(
+      context, filename, options, on_complete, userdata, append);
+  if (!send_operation) {
+    return false;
+  }
+
+  send_operation->fill = fill;
+  send_operation->offset = 0;
+  send_operation->buffer_length = 0;
+
+  return EnqueueSendOperation(context, send_operation);
+}
+
+//! Uploads the content of the given payload, holding a reference to it until
+//! the operation is freed.
+static bool SendPayload(FTPClient *context, const char *filename,
+                        FTPClientPayload *payload,
+                        const FTPClientSendOptions *options,
+                        void (*on_complete)(bool successful, void *userdata),
+                        void *userdata, bool append) {
+  if (!payload) {
+    return false;
+  }
+
+  struct SendOperation *send_operation = CreateSendOperation(
+      context, filename, options, on_complete, userdata, append);
+  if (!send_operation) {
+    return false;
+  }
+
+  FTPClientPayloadRetain(payload);
+  send_operation->payload = payload;
+  send_operation->buffer = payload->data;
+  send_operation->buffer_owned = false;
+  send_operation->offset = 0;
+  send_operation->buffer_length = (ssize_t)payload->length;
+
+  return EnqueueSendOperation(context, send_operation);
 }
 
 bool FTPClientCopyAndSendBuffer(FTPClient *context, const char *filename,
@@ -803,10 +4571,22 @@ bool FTPClientSendBuffer(FTPClient *context, const char *filename,
                     userdata, false, false);
 }
 
-bool FTPClientSendFile(FTPClient *context, const char *local_filename,
-                       const char *remote_filename,
-                       void (*on_complete)(bool successful, void *userdata),
-                       void *userdata) {
+bool FTPClientSendBufferWithOptions(
+    FTPClient *context, const char *filename, const void *buffer,
+    size_t buffer_len, const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata) {
+  return SendBuffer(context, filename, buffer, buffer_len, options,
+                    on_complete, userdata, false, false);
+}
+
+//! Uploads the content of the given local file. The file is only opened here
+//! to determine its size; it is reopened once the operation starts, so queued
+//! uploads do not hold a descriptor.
+static bool SendFile(FTPClient *context, const char *local_filename,
+                     const char *remote_filename,
+                     const FTPClientSendOptions *options,
+                     void (*on_complete)(bool successful, void *userdata),
+                     void *userdata, bool append) {
   if (!local_filename) {
     return false;
   }
@@ -815,9 +4595,40 @@ bool FTPClientSendFile(FTPClient *context, const char *local_filename,
   if (!read_file) {
     return false;
   }
+  int64_t file_size = GetLocalFileSize(read_file);
+  fclose(read_file);
 
-  return SendBuffer(context, remote_filename ? remote_filename : local_filename,
-                    NULL, 0, read_file, on_complete, userdata, false, false);
+  struct SendOperation *send_operation = CreateSendOperation(
+      context, remote_filename ? remote_filename : local_filename, options,
+      on_complete, userdata, append);
+  if (!send_operation) {
+    return false;
+  }
+
+  send_operation->local_filename = strdup(local_filename);
+  if (!send_operation->local_filename) {
+    FreeSendOperation(send_operation);
+    return false;
+  }
+  send_operation->queued_bytes = file_size > 0 ? (uint64_t)file_size : 0;
+
+  return EnqueueSendOperation(context, send_operation);
+}
+
+bool FTPClientSendFile(FTPClient *context, const char *local_filename,
+                       const char *remote_filename,
+                       void (*on_complete)(bool successful, void *userdata),
+                       void *userdata) {
+  return SendFile(context, local_filename, remote_filename, NULL, on_complete,
+                  userdata, false);
+}
+
+bool FTPClientSendFileWithOptions(
+    FTPClient *context, const char *local_filename, const char *remote_filename,
+    const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata) {
+  return SendFile(context, local_filename, remote_filename, options,
+                  on_complete, userdata, false);
 }
 
 bool FTPClientCopyAndAppendBuffer(FTPClient *context, const char *filename,
@@ -837,21 +4648,345 @@ bool FTPClientAppendBuffer(FTPClient *context, const char *filename,
                     userdata, false, true);
 }
 
+bool FTPClientAppendBufferWithOptions(
+    FTPClient *context, const char *filename, const void *buffer,
+    size_t buffer_len, const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata) {
+  return SendBuffer(context, filename, buffer, buffer_len, options,
+                    on_complete, userdata, false, true);
+}
+
 bool FTPClientAppendFile(FTPClient *context, const char *local_filename,
                          const char *remote_filename,
                          void (*on_complete)(bool successful, void *userdata),
                          void *userdata) {
-  if (!local_filename) {
+  return SendFile(context, local_filename, remote_filename, NULL, on_complete,
+                  userdata, true);
+}
+
+bool FTPClientAppendFileWithOptions(
+    FTPClient *context, const char *local_filename, const char *remote_filename,
+    const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata) {
+  return SendFile(context, local_filename, remote_filename, options,
+                  on_complete, userdata, true);
+}
+
+bool FTPClientSendIov(FTPClient *context, const char *filename,
+                      const FTPClientIOVec *segments, size_t segment_count,
+                      void (*on_complete)(bool successful, void *userdata),
+                      void *userdata) {
+  return SendIov(context, filename, segments, segment_count, NULL, on_complete,
+                 userdata, false);
+}
+
+bool FTPClientSendIovWithOptions(
+    FTPClient *context, const char *filename, const FTPClientIOVec *segments,
+    size_t segment_count, const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata) {
+  return SendIov(context, filename, segments, segment_count, options,
+                 on_complete, userdata, false);
+}
+
+bool FTPClientAppendIov(FTPClient *context, const char *filename,
+                        const FTPClientIOVec *segments, size_t segment_count,
+                        void (*on_complete)(bool successful, void *userdata),
+                        void *userdata) {
+  return SendIov(context, filename, segments, segment_count, NULL, on_complete,
+                 userdata, true);
+}
+
+bool FTPClientAppendIovWithOptions(
+    FTPClient *context, const char *filename, const FTPClientIOVec *segments,
+    size_t segment_count, const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata) {
+  return SendIov(context, filename, segments, segment_count, options,
+                 on_complete, userdata, true);
+}
+
+bool FTPClientSendStream(FTPClient *context, const char *filename,
+                         FTPClientStreamFillCallback fill,
+                         const FTPClientSendOptions *options,
+                         void (*on_complete)(bool successful, void *userdata),
+                         void *userdata) {
+  return SendStream(context, filename, fill, options, on_complete, userdata,
+                    false);
+}
+
+bool FTPClientAppendStream(FTPClient *context, const char *filename,
+                           FTPClientStreamFillCallback fill,
+                           const FTPClientSendOptions *options,
+                           void (*on_complete)(bool successful, void *userdata),
+                           void *userdata) {
+  return SendStream(context, filename, fill, options, on_complete, userdata,
+                    true);
+}
+
+FTPClientPayload *FTPClientPayloadCreate(const void *buffer,
+                                         size_t buffer_len) {
+  if (!buffer || !buffer_len) {
+    return NULL;
+  }
+
+  FTPClientPayload *payload =
+      (FTPClientPayload *)malloc(sizeof(*payload) + buffer_len);
+  if (!payload) {
+    return NULL;
+  }
+
+  atomic_init(&payload->ref_count, 1);
+  payload->length = buffer_len;
+  memcpy(payload->data, buffer, buffer_len);
+  return payload;
+}
+
+void FTPClientPayloadRetain(FTPClientPayload *payload) {
+  if (!payload) {
+    return;
+  }
+  atomic_fetch_add_explicit(&payload->ref_count, 1, memory_order_relaxed);
+}
+
+void FTPClientPayloadRelease(FTPClientPayload **payload) {
+  if (!payload || !*payload) {
+    return;
+  }
+
+  if (atomic_fetch_sub_explicit(&(*payload)->ref_count, 1,
+                                memory_order_acq_rel) == 1) {
+    free(*payload);
+  }
+  *payload = NULL;
+}
+
+bool FTPClientSendPayload(FTPClient *context, const char *filename,
+                          FTPClientPayload *payload,
+                          void (*on_complete)(bool successful, void *userdata),
+                          void *userdata) {
+  return SendPayload(context, filename, payload, NULL, on_complete, userdata,
+                     false);
+}
+
+bool FTPClientSendPayloadWithOptions(
+    FTPClient *context, const char *filename, FTPClientPayload *payload,
+    const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata) {
+  return SendPayload(context, filename, payload, options, on_complete,
+                     userdata, false);
+}
+
+bool FTPClientAppendPayload(FTPClient *context, const char *filename,
+                            FTPClientPayload *payload,
+                            void (*on_complete)(bool successful,
+                                                void *userdata),
+                            void *userdata) {
+  return SendPayload(context, filename, payload, NULL, on_complete, userdata,
+                     true);
+}
+
+bool FTPClientAppendPayloadWithOptions(
+    FTPClient *context, const char *filename, FTPClientPayload *payload,
+    const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata) {
+  return SendPayload(context, filename, payload, options, on_complete,
+                     userdata, true);
+}
+
+void FTPClientSetMaxActiveOperations(FTPClient *context,
+                                     size_t max_active_operations) {
+  if (!context) {
+    return;
+  }
+  context->max_active_operations = max_active_operations
+                                       ? max_active_operations
+                                       : DEFAULT_MAX_ACTIVE_OPERATIONS;
+}
+
+void FTPClientGetQueuedUploads(FTPClient *context, size_t *operations,
+                               uint64_t *bytes) {
+  if (context) {
+    DrainSubmissions(context);
+  }
+  if (operations) {
+    *operations = context ? context->pending_count : 0;
+  }
+  if (bytes) {
+    *bytes = context ? context->pending_bytes : 0;
+  }
+}
+
+#ifdef FTP_CLIENT_ENABLE_STATS
+//! Adds the queue depths of the given client to `stats`.
+static void AddQueueStats(FTPClient *context, FTPClientStats *stats) {
+  DrainSubmissions(context);
+  stats->queued_operations += context->pending_count;
+  stats->queued_bytes += context->pending_bytes;
+  stats->in_flight_operations += context->active_count;
+  for (struct SendOperation *fs = context->active_head; fs; fs = fs->next) {
+    if (fs->queued_bytes > fs->resume_offset + fs->bytes_sent) {
+      stats->in_flight_bytes +=
+          fs->queued_bytes - fs->resume_offset - fs->bytes_sent;
+    }
+  }
+}
+#endif
+
+bool FTPClientGetStats(FTPClient *context, FTPClientStats *stats) {
+  if (!stats) {
+    return false;
+  }
+  memset(stats, 0, sizeof(*stats));
+#ifdef FTP_CLIENT_ENABLE_STATS
+  if (!context) {
     return false;
   }
 
-  FILE *read_file = fopen(local_filename, "rb");
-  if (!read_file) {
+  const struct ClientStats *client_stats = context->stats;
+  *stats = client_stats->counters;
+  AddQueueStats(context, stats);
+  for (size_t i = 0; i < context->stripe_session_count; ++i) {
+    AddQueueStats(context->stripe_sessions[i], stats);
+  }
+
+  // A window that has stayed open for long is measured as it stands so that
+  // the rate decays while idle.
+  uint64_t elapsed = FTPClockMicroseconds() - client_stats->window_start;
+  stats->current_bytes_per_second = client_stats->window_bytes_per_second;
+  if (client_stats->window_start &&
+      elapsed >= 2 * THROUGHPUT_WINDOW_MICROSECONDS) {
+    stats->current_bytes_per_second =
+        client_stats->window_bytes * 1000000 / elapsed;
+  }
+  if (client_stats->transfer_microseconds) {
+    stats->average_transfer_bytes_per_second =
+        stats->completed_bytes * 1000000 /
+        client_stats->transfer_microseconds;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void FTPClientSetQueueHighWaterMark(FTPClient *context,
+                                    size_t high_water_operations,
+                                    uint64_t high_water_bytes,
+                                    FTPClientQueueStateCallback callback,
+                                    void *userdata) {
+  if (!context) {
+    return;
+  }
+  context->high_water_operations = high_water_operations;
+  context->high_water_bytes = high_water_bytes;
+  context->on_queue_state = callback;
+  context->queue_state_userdata = userdata;
+  context->above_high_water = false;
+  UpdateQueueState(context);
+}
+
+void FTPClientSetTransferResultCallback(
+    FTPClient *context, FTPClientTransferResultCallback callback,
+    void *userdata) {
+  if (!context) {
+    return;
+  }
+  context->on_transfer_result = callback;
+  context->transfer_result_userdata = userdata;
+}
+
+void FTPClientSetTraceCallback(FTPClient *context,
+                               FTPClientTraceCallback callback,
+                               void *userdata) {
+  if (!context) {
+    return;
+  }
+  context->on_trace = callback;
+  context->trace_userdata = userdata;
+  for (size_t i = 0; i < context->stripe_session_count; ++i) {
+    context->stripe_sessions[i]->on_trace = callback;
+    context->stripe_sessions[i]->trace_userdata = userdata;
+  }
+}
+
+const char *FTPClientTraceEventTypeName(FTPClientTraceEventType type) {
+  switch (type) {
+    case FTP_CLIENT_TRACE_EVENT_COMMAND_SENT:
+      return "command_sent";
+    case FTP_CLIENT_TRACE_EVENT_REPLY_RECEIVED:
+      return "reply_received";
+    case FTP_CLIENT_TRACE_EVENT_DATA_CONNECT:
+      return "data_connect";
+    case FTP_CLIENT_TRACE_EVENT_DATA_CONNECTED:
+      return "data_connected";
+    case FTP_CLIENT_TRACE_EVENT_DATA_FIRST_BYTE:
+      return "data_first_byte";
+    case FTP_CLIENT_TRACE_EVENT_DATA_PARTIAL_WRITE:
+      return "data_partial_write";
+    case FTP_CLIENT_TRACE_EVENT_DATA_CLOSED:
+      return "data_closed";
+  }
+  return "unknown";
+}
+
+int FTPClientFormatTraceEvent(const FTPClientTraceEvent *event, char *buffer,
+                              size_t buffer_size) {
+  int header_length = snprintf(
+      buffer, buffer_size, "%llu\t%u\t%llu\t%s\t%llu\t",
+      (unsigned long long)event->timestamp, (unsigned int)event->session,
+      (unsigned long long)event->operation_id,
+      FTPClientTraceEventTypeName(event->type),
+      (unsigned long long)event->value);
+  if (header_length < 0) {
+    return header_length;
+  }
+
+  // Copies the text followed by the terminator, truncating as snprintf does.
+  size_t length = (size_t)header_length;
+  for (size_t i = 0; i <= event->text_length; ++i) {
+    char c = '\n';
+    if (i < event->text_length) {
+      c = event->text[i];
+      if ((unsigned char)c < ' ' || c == 0x7F) {
+        c = ' ';
+      }
+    }
+    if (length + 1 < buffer_size) {
+      buffer[length] = c;
+    }
+    ++length;
+  }
+  if (buffer_size) {
+    buffer[length < buffer_size ? length : buffer_size - 1] = 0;
+  }
+  return (int)length;
+}
+
+bool FTPClientSetPollerBackend(FTPClient *context,
+                               FTPClientPollerBackend backend) {
+  if (!context || context->control_socket >= 0 || context->active_head ||
+      context->group || !FTPPollerBackendIsSupported(backend)) {
     return false;
   }
+  for (size_t i = 0; i < context->stripe_session_count; ++i) {
+    FTPClient *session = context->stripe_sessions[i];
+    if (HasSession(session) || session->active_head) {
+      return false;
+    }
+  }
+
+  // Idle stripe sessions are reopened on the new poller when next needed.
+  DestroyStripeSessions(context);
+  FTPPollerDestroy(context->poller);
+  context->poller = NULL;
+  context->poller_backend = backend;
+  return true;
+}
 
-  return SendBuffer(context, remote_filename ? remote_filename : local_filename,
-                    NULL, 0, read_file, on_complete, userdata, false, true);
+FTPClientPollerBackend FTPClientGetPollerBackend(FTPClient *context) {
+  if (!context) {
+    return FTP_CLIENT_POLLER_BACKEND_DEFAULT;
+  }
+  return FTPPollerResolveBackend(context->poller_backend);
 }
 
 int FTPClientErrno(FTPClient *context) {
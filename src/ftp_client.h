@@ -44,9 +44,23 @@ typedef enum FTPClientConnectStatus {
   FTP_CLIENT_CONNECT_STATUS_CONNECT_TIMEOUT = 3001,
 } FTPClientConnectStatus;
 
+//! Connects the control connection, blocking until the server's welcome
+//! arrives or `timeout_milliseconds` (0 selects a 20 second default) elapse.
+//! Login then proceeds in FTPClientProcess.
 FTPClientConnectStatus FTPClientConnect(FTPClient *context,
                                         uint32_t timeout_milliseconds);
 
+//! Starts connecting without blocking. The connection and login are then
+//! driven by FTPClientProcess (or FTPClientProcessReady), which fails with
+//! FTP_CLIENT_PROCESS_STATUS_CONNECT_FAILED or
+//! FTP_CLIENT_PROCESS_STATUS_CONNECT_TIMEOUT if the server cannot be reached
+//! or login has not completed within `timeout_milliseconds` (0 selects a 20
+//! second default). Does nothing if the control connection is already open.
+//!
+//! Uploads may be submitted at any time; they start once logged in.
+FTPClientConnectStatus FTPClientStartConnect(FTPClient *context,
+                                             uint32_t timeout_milliseconds);
+
 typedef enum FTPClientProcessStatus {
   FTP_CLIENT_PROCESS_STATUS_SUCCESS = 0,
   FTP_CLIENT_PROCESS_STATUS_TIMEOUT = 1,
@@ -57,9 +71,12 @@ typedef enum FTPClientProcessStatus {
   FTP_CLIENT_PROCESS_STATUS_SOCKET_EXCEPTION = 1003,
   FTP_CLIENT_PROCESS_STATUS_CLOSED = 2000,
   FTP_CLIENT_PROCESS_PASV_RESPONSE_INVALID = 2001,
+  FTP_CLIENT_PROCESS_STATUS_CONNECT_FAILED = 3000,
+  FTP_CLIENT_PROCESS_STATUS_CONNECT_TIMEOUT = 3001,
   FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_SOCKET_FAILED = 5000,
   FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_BUFFER_FAILED = 5001,
   FTP_CLIENT_PROCESS_STATUS_CREATE_DATA_FILE_READ_FAILED = 5002,
+  FTP_CLIENT_PROCESS_STATUS_STREAM_FILL_FAILED = 5003,
   FTP_CLIENT_PROCESS_STATUS_DATA_SOCKET_CONNECT_FAILED = 6000,
   FTP_CLIENT_PROCESS_STATUS_DATA_SOCKET_EXCEPTION = 6001,
   FTP_CLIENT_PROCESS_BUFFER_OVERFLOW = 8000,
@@ -68,12 +85,285 @@ typedef enum FTPClientProcessStatus {
 FTPClientProcessStatus FTPClientProcess(FTPClient *context,
                                         uint32_t timeout_milliseconds);
 
+//! Readiness flags used by FTPClientPollDescriptor.
+#define FTP_CLIENT_EVENT_READ 0x1
+#define FTP_CLIENT_EVENT_WRITE 0x2
+
+//! Deadline reported by FTPClientGetPollDescriptors when no timer is pending.
+#define FTP_CLIENT_NO_DEADLINE UINT32_MAX
+
+//! A socket of the FTPClient together with the FTP_CLIENT_EVENT_* flags that
+//! are of interest (or, when passed to FTPClientProcessReady, that are ready).
+typedef struct FTPClientPollDescriptor {
+  int fd;
+  uint32_t events;
+} FTPClientPollDescriptor;
+
+//! Prepares the client to be driven by an external event loop in place of
+//! FTPClientProcess.
+//!
+//! Fills `descriptors` with up to `max_descriptors` sockets and the events the
+//! client is waiting for; `descriptor_count` receives the total number, which
+//! may exceed `max_descriptors`. `timeout_milliseconds` receives the longest
+//! the caller may wait before calling FTPClientProcessReady even if no socket
+//! is ready, or FTP_CLIENT_NO_DEADLINE.
+//!
+//! Must be called before every wait, as the set of sockets and their interest
+//! change as commands are issued and transfers progress.
+FTPClientProcessStatus FTPClientGetPollDescriptors(
+    FTPClient *context, FTPClientPollDescriptor *descriptors,
+    size_t max_descriptors, size_t *descriptor_count,
+    uint32_t *timeout_milliseconds);
+
+//! Advances the client given the readiness of its sockets as determined by an
+//! external event loop. Never blocks. Descriptors that do not belong to the
+//! client are ignored. Returns FTP_CLIENT_PROCESS_STATUS_TIMEOUT if none of
+//! the descriptors were ready, which is expected when the deadline reported by
+//! FTPClientGetPollDescriptors expires.
+FTPClientProcessStatus FTPClientProcessReady(
+    FTPClient *context, const FTPClientPollDescriptor *ready,
+    size_t ready_count);
+
 bool FTPClientIsFullyConnected(FTPClient *context);
 
 bool FTPClientHasSendPending(FTPClient *context);
 
 bool FTPClientProcessStatusIsError(FTPClientProcessStatus status);
 
+//! Governs how a client recovers when its control connection is lost after
+//! login has completed, e.g., because the server closed an idle session.
+//!
+//! Instead of failing with FTP_CLIENT_PROCESS_STATUS_CLOSED (or another
+//! connection error), FTPClientProcess keeps succeeding while it waits out a
+//! backoff delay, reconnects and logs in again. Uploads that were in flight
+//! are then restarted from the beginning ahead of those still queued, except
+//! streamed uploads and appends that had already sent data, which fail as the
+//! server may hold part of them. The error is reported once `max_attempts`
+//! consecutive reconnects have failed; queued uploads are kept and start if
+//! the client is connected again.
+typedef struct FTPClientReconnectPolicy {
+  //! Consecutive reconnects attempted before giving up. 0 disables
+  //! reconnecting, which is the default for new clients.
+  uint32_t max_attempts;
+  //! Delay before the first reconnect, doubled for each further attempt up to
+  //! `max_delay_milliseconds`.
+  uint32_t initial_delay_milliseconds;
+  uint32_t max_delay_milliseconds;
+  //! Each delay is shortened by a random amount of up to this percentage so
+  //! that clients that were disconnected together do not reconnect in
+  //! lockstep.
+  uint32_t jitter_percent;
+  //! Time allowed for each reconnect to connect and log in. 0 selects the
+  //! FTPClientStartConnect default.
+  uint32_t connect_timeout_milliseconds;
+  //! Sends NOOP once the control connection has been idle for this long with
+  //! no uploads queued so that it stays open for the next upload. 0 disables
+  //! keepalives.
+  uint32_t keepalive_interval_milliseconds;
+} FTPClientReconnectPolicy;
+
+//! Populates the given FTPClientReconnectPolicy with default values, which
+//! enable reconnecting (8 attempts from 250 ms up to 30 s with 25% jitter)
+//! but not keepalives.
+void FTPClientReconnectPolicyInit(FTPClientReconnectPolicy *policy);
+
+//! Sets the reconnect policy of the client. A NULL `policy` disables
+//! reconnecting and keepalives and cancels a pending reconnect.
+void FTPClientSetReconnectPolicy(FTPClient *context,
+                                 const FTPClientReconnectPolicy *policy);
+
+typedef enum FTPClientChunkMode {
+  //! Use the mode configured on the FTPClient.
+  FTP_CLIENT_CHUNK_MODE_DEFAULT = 0,
+  //! Always read chunks of the configured size.
+  FTP_CLIENT_CHUNK_MODE_FIXED,
+  //! Start at the configured size and grow or shrink the chunk based on how
+  //! much data the data socket accepts per write.
+  FTP_CLIENT_CHUNK_MODE_ADAPTIVE,
+} FTPClientChunkMode;
+
+typedef enum FTPClientPriority {
+  //! Use the priority configured via FTPClientSetDefaultPriority.
+  FTP_CLIENT_PRIORITY_DEFAULT = 0,
+  //! Started ahead of all other queued uploads.
+  FTP_CLIENT_PRIORITY_URGENT,
+  FTP_CLIENT_PRIORITY_NORMAL,
+  //! Started once no urgent or normal uploads are queued.
+  FTP_CLIENT_PRIORITY_BULK,
+} FTPClientPriority;
+
+typedef struct FTPClientProgress {
+  //! Remote filename. Only valid for the duration of the callback.
+  const char *filename;
+  //! Bytes of the remote file written so far, including those that a resumed
+  //! upload skipped.
+  uint64_t bytes_sent;
+  //! Size of the upload, or 0 if it is unknown (e.g., for streams).
+  uint64_t total_bytes;
+  //! Rate at which data was sent since the previous report.
+  uint64_t bytes_per_second;
+} FTPClientProgress;
+
+//! Invoked with the progress of an upload while its data is being sent.
+typedef void (*FTPClientProgressCallback)(const FTPClientProgress *progress,
+                                          void *userdata);
+
+//! Per-operation settings for uploads.
+typedef struct FTPClientSendOptions {
+  //! Number of bytes read from a local file per chunk. 0 uses the value
+  //! configured via FTPClientSetChunkSize.
+  size_t chunk_size;
+
+  FTPClientChunkMode chunk_mode;
+
+  //! Read local files on the thread calling FTPClientProcess instead of
+  //! prefetching chunks through the read-ahead executor.
+  bool disable_read_ahead;
+
+  //! Read regular local files through stdio instead of handing them to the OS
+  //! via sendfile() or mmap(). Has no effect on nxdk, which always uses stdio.
+  bool disable_zero_copy;
+
+  //! Number of times the upload is resumed after its transfer is interrupted.
+  //! 0 uses the value configured via FTPClientSetMaxResumeAttempts.
+  uint32_t max_resume_attempts;
+
+  //! Number of ranges the upload is split into and sent concurrently. 0 uses
+  //! the value configured via FTPClientSetStriping.
+  size_t stripe_count;
+
+  //! Optional callback that receives the progress of the upload, aggregated
+  //! across the ranges of a striped upload. It is invoked on the thread
+  //! driving the client regardless of the callback mode, once
+  //! `progress_interval_bytes` bytes have been sent or
+  //! `progress_interval_milliseconds` have passed with data sent since the
+  //! previous report, and whenever a data connection finishes sending. A zero
+  //! interval disables the corresponding trigger; if both are 0, progress is
+  //! reported every 250 milliseconds.
+  FTPClientProgressCallback on_progress;
+  void *progress_userdata;
+  uint64_t progress_interval_bytes;
+  uint32_t progress_interval_milliseconds;
+
+  //! Limits the rate at which the upload's data is written, across all of its
+  //! ranges, in addition to any limit set via FTPClientSetRateLimit. 0 leaves
+  //! the upload unlimited. See FTPClientSetRateLimit for the burst size.
+  uint64_t rate_limit_bytes_per_second;
+  uint64_t rate_limit_burst_bytes;
+
+  //! Priority of the upload. FTP_CLIENT_PRIORITY_DEFAULT uses the value
+  //! configured via FTPClientSetDefaultPriority.
+  FTPClientPriority priority;
+} FTPClientSendOptions;
+
+//! Populates the given FTPClientSendOptions with default values.
+void FTPClientSendOptionsInit(FTPClientSendOptions *options);
+
+//! Sets the default number of bytes read from local files per chunk for
+//! subsequently created upload operations. 0 restores the library default.
+void FTPClientSetChunkSize(FTPClient *context, size_t chunk_size);
+
+//! Sets the default number of times subsequently created uploads are resumed
+//! after their transfer is interrupted, i.e., the data connection fails, the
+//! server reports a transient (4xx) failure or the control connection is lost
+//! and reestablished (see FTPClientReconnectPolicy). A resumed upload asks for
+//! the size of the remote file with SIZE and continues from there with REST,
+//! falling back to the start if the server supports neither. Streams and
+//! appends are never resumed, nor are files larger than LONG_MAX bytes on
+//! targets without 64-bit stdio offsets (e.g., nxdk). The default of 0 fails
+//! interrupted uploads.
+void FTPClientSetMaxResumeAttempts(FTPClient *context,
+                                   uint32_t max_resume_attempts);
+
+//! Sets the default number of byte ranges that subsequently created uploads
+//! of buffers and local files are split into, along with the smallest range
+//! worth splitting off (0 selects 1 MiB). Each range after the first is sent
+//! with REST and STOR over an additional control connection that the client
+//! opens to the same server and keeps for later striped uploads, so up to
+//! `stripe_count` transfers of the file run concurrently. The ranges start
+//! once the server has accepted the first one, which truncates the remote
+//! file, and the upload completes once all of them have. Striped uploads are
+//! never resumed, and uploads of clients that belong to an FTPClientGroup,
+//! appends, streams and segment lists are never striped. The default of 0 (or
+//! 1) sends every upload over a single data connection.
+void FTPClientSetStriping(FTPClient *context, size_t stripe_count,
+                          size_t min_stripe_size);
+
+//! Limits the rate at which the client writes upload data, summed across all
+//! of its data connections including those of its striping connections, to
+//! `bytes_per_second` using a token bucket that holds up to `burst_bytes`
+//! (0 selects 100 milliseconds' worth, and at least 4 KiB). Data connections
+//! that are out of tokens are not polled for writability, and
+//! FTPClientProcess waits no longer than until they may write again. A
+//! `bytes_per_second` of 0 removes the limit.
+void FTPClientSetRateLimit(FTPClient *context, uint64_t bytes_per_second,
+                           uint64_t burst_bytes);
+
+//! Determines how uploads of different priorities share a client.
+//!
+//! Queued uploads are started in order of priority, and in the order they
+//! were queued within a priority. As servers handle one transfer at a time
+//! per control connection, data connections send concurrently across the
+//! striping connections of a client or the clients of an FTPClientGroup,
+//! which are scheduled together. While data connections of more than one
+//! priority are sending, each is allowed to write `quantum_bytes` times the
+//! weight of its priority per round (deficit round robin), and waits without
+//! being polled once it has used its share until the others have used theirs
+//! or have not been able to write for 250 milliseconds.
+typedef struct FTPClientPriorityPolicy {
+  //! Relative shares of the data written per round. 0 is treated as 1.
+  uint32_t urgent_weight;
+  uint32_t normal_weight;
+  uint32_t bulk_weight;
+  //! Bytes written per round for each unit of weight. 0 selects 8 KiB.
+  size_t quantum_bytes;
+  //! Holds back the data connections of bulk uploads, and the start of queued
+  //! ones, while an urgent upload is active on the client or its striping
+  //! connections.
+  bool pause_bulk_while_urgent;
+} FTPClientPriorityPolicy;
+
+//! Populates the given FTPClientPriorityPolicy with default values: weights
+//! of 8, 4 and 1 for urgent, normal and bulk uploads, an 8 KiB quantum and no
+//! pausing.
+void FTPClientPriorityPolicyInit(FTPClientPriorityPolicy *policy);
+
+//! Sets the priority policy of the client. A NULL `policy` restores the
+//! defaults.
+void FTPClientSetPriorityPolicy(FTPClient *context,
+                                const FTPClientPriorityPolicy *policy);
+
+//! Sets the priority of subsequently created uploads that do not specify one,
+//! including those of buffers, segments, streams and payloads. Defaults to
+//! FTP_CLIENT_PRIORITY_NORMAL, which FTP_CLIENT_PRIORITY_DEFAULT restores.
+void FTPClientSetDefaultPriority(FTPClient *context,
+                                 FTPClientPriority priority);
+
+//! Sets the default chunk mode for subsequently created upload operations.
+void FTPClientSetChunkMode(FTPClient *context, FTPClientChunkMode chunk_mode);
+
+//! Runs `work(work_context)`, typically on a thread other than the one calling
+//! FTPClientProcess. Used to perform the blocking reads that fill read-ahead
+//! buffers for file uploads.
+typedef void (*FTPClientReadAheadExecutor)(void (*work)(void *work_context),
+                                           void *work_context,
+                                           void *executor_userdata);
+
+//! Sets the executor used to fill read-ahead buffers for subsequently created
+//! upload operations. Passing NULL restores the default, which performs reads
+//! on a worker thread owned by the FTPClient.
+void FTPClientSetReadAheadExecutor(FTPClient *context,
+                                   FTPClientReadAheadExecutor executor,
+                                   void *executor_userdata);
+
+// Upload submission functions (FTPClientSend*, FTPClientAppend* and
+// FTPClientCopyAnd*) may be called from any thread without locking. Uploads
+// submitted from other threads are picked up by the next FTPClientProcess (or
+// equivalent) call; their callbacks are invoked on that thread. All other
+// functions must be called from the thread that drives the client, and the
+// setters that affect newly submitted uploads must not run concurrently with
+// submissions.
+
 bool FTPClientSendBuffer(FTPClient *context, const char *filename,
                          const void *buffer, size_t buffer_len,
                          void (*on_complete)(bool successful, void *userdata),
@@ -106,6 +396,448 @@ bool FTPClientAppendFile(FTPClient *context, const char *local_filename,
                          void (*on_complete)(bool successful, void *userdata),
                          void *userdata);
 
+//! Uploads `buffer` using the given `options`, which may be NULL. Options that
+//! only concern local files (e.g., `chunk_size`) are ignored.
+bool FTPClientSendBufferWithOptions(
+    FTPClient *context, const char *filename, const void *buffer,
+    size_t buffer_len, const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata);
+
+//! Appends `buffer` to the remote file using the given `options`, which may be
+//! NULL. See FTPClientSendBufferWithOptions.
+bool FTPClientAppendBufferWithOptions(
+    FTPClient *context, const char *filename, const void *buffer,
+    size_t buffer_len, const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata);
+
+//! Uploads the given local file using the given `options`, which may be NULL.
+bool FTPClientSendFileWithOptions(
+    FTPClient *context, const char *local_filename, const char *remote_filename,
+    const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata);
+
+//! Appends the given local file to the remote file using the given `options`,
+//! which may be NULL.
+bool FTPClientAppendFileWithOptions(
+    FTPClient *context, const char *local_filename, const char *remote_filename,
+    const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata);
+
+//! Describes one contiguous piece of a scatter-gather upload.
+typedef struct FTPClientIOVec {
+  const void *base;
+  size_t length;
+} FTPClientIOVec;
+
+//! Uploads the concatenation of the given segments without copying their
+//! content. The segment array is copied, but the memory each segment points at
+//! must remain valid until the operation completes.
+bool FTPClientSendIov(FTPClient *context, const char *filename,
+                      const FTPClientIOVec *segments, size_t segment_count,
+                      void (*on_complete)(bool successful, void *userdata),
+                      void *userdata);
+
+//! Appends the concatenation of the given segments to the remote file. See
+//! FTPClientSendIov.
+bool FTPClientAppendIov(FTPClient *context, const char *filename,
+                        const FTPClientIOVec *segments, size_t segment_count,
+                        void (*on_complete)(bool successful, void *userdata),
+                        void *userdata);
+
+//! Uploads the concatenation of the given segments using the given `options`,
+//! which may be NULL. See FTPClientSendIov and FTPClientSendBufferWithOptions.
+bool FTPClientSendIovWithOptions(
+    FTPClient *context, const char *filename, const FTPClientIOVec *segments,
+    size_t segment_count, const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata);
+
+//! Appends the concatenation of the given segments to the remote file using
+//! the given `options`, which may be NULL. See FTPClientSendIovWithOptions.
+bool FTPClientAppendIovWithOptions(
+    FTPClient *context, const char *filename, const FTPClientIOVec *segments,
+    size_t segment_count, const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata);
+
+typedef enum FTPClientStreamStatus {
+  //! More data may follow. Returning this without writing any bytes indicates
+  //! that no data is available yet; the callback will be polled again.
+  FTP_CLIENT_STREAM_STATUS_CONTINUE,
+  //! The bytes written (if any) are the last in the stream.
+  FTP_CLIENT_STREAM_STATUS_END,
+  //! The stream failed; the upload is aborted.
+  FTP_CLIENT_STREAM_STATUS_ERROR,
+} FTPClientStreamStatus;
+
+//! Writes up to `buffer_len` bytes of upload data into `buffer` and sets
+//! `bytes_written` to the number of bytes produced. Called from
+//! FTPClientProcess whenever the data connection can accept more data.
+typedef FTPClientStreamStatus (*FTPClientStreamFillCallback)(
+    void *buffer, size_t buffer_len, size_t *bytes_written, void *userdata);
+
+//! Uploads data of unknown length produced by `fill`. `options`, which may be
+//! NULL, controls the size of the buffer handed to `fill`. `userdata` is passed
+//! to both `fill` and `on_complete`.
+bool FTPClientSendStream(FTPClient *context, const char *filename,
+                         FTPClientStreamFillCallback fill,
+                         const FTPClientSendOptions *options,
+                         void (*on_complete)(bool successful, void *userdata),
+                         void *userdata);
+
+//! Appends data produced by `fill` to the remote file. See
+//! FTPClientSendStream.
+bool FTPClientAppendStream(FTPClient *context, const char *filename,
+                           FTPClientStreamFillCallback fill,
+                           const FTPClientSendOptions *options,
+                           void (*on_complete)(bool successful, void *userdata),
+                           void *userdata);
+
+//! Immutable, reference-counted copy of a buffer that may be uploaded by any
+//! number of operations, across any number of FTPClient instances, without
+//! being copied again.
+typedef struct FTPClientPayload FTPClientPayload;
+
+//! Creates a payload holding a copy of the given buffer. The caller owns the
+//! returned reference and must release it via FTPClientPayloadRelease.
+FTPClientPayload *FTPClientPayloadCreate(const void *buffer, size_t buffer_len);
+
+//! Adds a reference to the given payload.
+void FTPClientPayloadRetain(FTPClientPayload *payload);
+
+//! Drops a reference to the given payload, freeing it once no references
+//! remain, and sets `*payload` to NULL.
+void FTPClientPayloadRelease(FTPClientPayload **payload);
+
+//! Uploads the content of the given payload. The operation holds its own
+//! reference, so the caller may release theirs immediately.
+bool FTPClientSendPayload(FTPClient *context, const char *filename,
+                          FTPClientPayload *payload,
+                          void (*on_complete)(bool successful, void *userdata),
+                          void *userdata);
+
+//! Appends the content of the given payload to the remote file. See
+//! FTPClientSendPayload.
+bool FTPClientAppendPayload(FTPClient *context, const char *filename,
+                            FTPClientPayload *payload,
+                            void (*on_complete)(bool successful,
+                                                void *userdata),
+                            void *userdata);
+
+//! Uploads the content of the given payload using the given `options`, which
+//! may be NULL. See FTPClientSendPayload and FTPClientSendBufferWithOptions.
+bool FTPClientSendPayloadWithOptions(
+    FTPClient *context, const char *filename, FTPClientPayload *payload,
+    const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata);
+
+//! Appends the content of the given payload to the remote file using the given
+//! `options`, which may be NULL. See FTPClientSendPayloadWithOptions.
+bool FTPClientAppendPayloadWithOptions(
+    FTPClient *context, const char *filename, FTPClientPayload *payload,
+    const FTPClientSendOptions *options,
+    void (*on_complete)(bool successful, void *userdata), void *userdata);
+
+//! Sets the maximum number of uploads that may have a data connection open or
+//! opening at once. Further uploads wait in a FIFO and are started as active
+//! ones complete. 0 restores the default of 4.
+void FTPClientSetMaxActiveOperations(FTPClient *context,
+                                     size_t max_active_operations);
+
+//! Retrieves the number of uploads that have not been started yet, i.e., that
+//! wait for an active slot or for the next FTPClientProcess call, and the
+//! number of bytes they will send. Streamed uploads count as zero bytes. Does
+//! not start any uploads.
+void FTPClientGetQueuedUploads(FTPClient *context, size_t *operations,
+                               uint64_t *bytes);
+
+//! Invoked with `above_high_water` = true when the upload queue grows beyond
+//! its high water mark and with false once it has drained to half of it.
+typedef void (*FTPClientQueueStateCallback)(bool above_high_water,
+                                            void *userdata);
+
+//! Sets the high water mark for the queue of uploads waiting for an active
+//! slot. The mark is exceeded when more than `high_water_operations` uploads
+//! or more than `high_water_bytes` bytes are queued; a value of 0 disables the
+//! corresponding limit. Passing a NULL `callback` disables notifications.
+void FTPClientSetQueueHighWaterMark(FTPClient *context,
+                                    size_t high_water_operations,
+                                    uint64_t high_water_bytes,
+                                    FTPClientQueueStateCallback callback,
+                                    void *userdata);
+
+typedef struct FTPClientSocketStats {
+  //! Successful recv() calls and the number of bytes they returned. Data
+  //! connections are only written to.
+  uint64_t reads;
+  uint64_t bytes_read;
+  //! Successful write(), writev() and sendfile() calls, those that accepted
+  //! fewer bytes than were offered, and the number of bytes they accepted.
+  uint64_t writes;
+  uint64_t partial_writes;
+  uint64_t bytes_written;
+} FTPClientSocketStats;
+
+typedef struct FTPClientStats {
+  //! Uploads that have not been started yet and the number of bytes they will
+  //! send, as reported by FTPClientGetQueuedUploads.
+  uint64_t queued_operations;
+  uint64_t queued_bytes;
+  //! Active uploads and the number of their bytes that have not been written
+  //! yet. Streamed uploads count as zero bytes.
+  uint64_t in_flight_operations;
+  uint64_t in_flight_bytes;
+  //! Uploads whose completion has been reported, and the number of bytes sent
+  //! by the successful ones. The ranges of a striped upload count separately.
+  uint64_t completed_operations;
+  uint64_t failed_operations;
+  uint64_t completed_bytes;
+
+  FTPClientSocketStats control;
+  FTPClientSocketStats data;
+
+  //! Readiness waits performed by FTPClientProcess, and those that returned
+  //! with sockets ready or timed out.
+  uint64_t poll_waits;
+  uint64_t poll_wakeups;
+  uint64_t poll_timeouts;
+
+  //! Bytes moved within the control connection's buffers to discard replies
+  //! that have been handled and commands that have been sent.
+  uint64_t control_buffer_moved_bytes;
+
+  //! Rate at which data was written to data connections over the last quarter
+  //! second or so.
+  uint64_t current_bytes_per_second;
+  //! Bytes sent by successful uploads divided by the total time between their
+  //! data connection being established and their last byte being written.
+  uint64_t average_transfer_bytes_per_second;
+} FTPClientStats;
+
+//! Retrieves counters describing the client's activity since it was created,
+//! including that of its striping connections (see FTPClientSetStriping).
+//! Must be called from the thread driving the client. Returns false and
+//! zeroes `stats` if the library was built without FTP_CLIENT_ENABLE_STATS,
+//! in which case the counters are not maintained at all.
+bool FTPClientGetStats(FTPClient *context, FTPClientStats *stats);
+
+//! Monotonic timestamps, in microseconds, of the milestones of a single
+//! upload. Only differences between values are meaningful. Milestones that
+//! were not reached are 0.
+typedef struct FTPClientTransferTimings {
+  //! The upload was submitted to the FTPClient.
+  uint64_t submitted;
+  //! The reply to PASV was received.
+  uint64_t pasv_reply;
+  //! The data connection was established.
+  uint64_t data_connected;
+  //! The last byte was written and the data connection closed.
+  uint64_t last_byte_sent;
+  //! The final reply to STOR/APPE was received.
+  uint64_t final_reply;
+} FTPClientTransferTimings;
+
+typedef struct FTPClientTransferResult {
+  //! Remote filename. Only valid for the duration of the callback.
+  const char *filename;
+  bool append;
+  bool successful;
+  //! The server's final reply to PASV or STOR/APPE (e.g., 226, 451, 552), or
+  //! 0 if the upload failed locally before a reply was received.
+  int reply_code;
+  uint64_t bytes_sent;
+  FTPClientTransferTimings timings;
+  //! Identifies the upload in trace events (see FTPClientSetTraceCallback).
+  uint64_t operation_id;
+} FTPClientTransferResult;
+
+typedef void (*FTPClientTransferResultCallback)(
+    const FTPClientTransferResult *result, void *userdata);
+
+//! Sets a callback that receives the detailed result of every subsequently
+//! submitted upload, immediately after its `on_complete` callback.
+//!
+//! Uploads complete once the server's final reply to STOR/APPE arrives rather
+//! than when the local data connection closes.
+void FTPClientSetTransferResultCallback(
+    FTPClient *context, FTPClientTransferResultCallback callback,
+    void *userdata);
+
+//! Kinds of events reported to an FTPClientTraceCallback.
+typedef enum FTPClientTraceEventType {
+  //! A command line was handed to the control connection. `text` holds the
+  //! line without its terminator, with the argument to PASS masked.
+  FTP_CLIENT_TRACE_EVENT_COMMAND_SENT = 0,
+  //! A reply line was received on the control connection, including each line
+  //! of a multi-line reply. `text` holds the line and `value` its reply code,
+  //! or 0 if it has none.
+  FTP_CLIENT_TRACE_EVENT_REPLY_RECEIVED,
+  //! connect() was issued for a data connection.
+  FTP_CLIENT_TRACE_EVENT_DATA_CONNECT,
+  //! The data connection became writable, completing connect().
+  FTP_CLIENT_TRACE_EVENT_DATA_CONNECTED,
+  //! The first write to the data connection succeeded. `value` holds the
+  //! number of bytes it accepted.
+  FTP_CLIENT_TRACE_EVENT_DATA_FIRST_BYTE,
+  //! A write to the data connection accepted fewer bytes than were offered.
+  //! `value` holds the number of bytes it accepted.
+  FTP_CLIENT_TRACE_EVENT_DATA_PARTIAL_WRITE,
+  //! The data connection was closed. `value` holds the number of bytes sent
+  //! over it.
+  FTP_CLIENT_TRACE_EVENT_DATA_CLOSED,
+} FTPClientTraceEventType;
+
+typedef struct FTPClientTraceEvent {
+  FTPClientTraceEventType type;
+  //! Monotonic time in microseconds, comparable with FTPClientTransferTimings.
+  uint64_t timestamp;
+  //! The upload the event relates to, matching
+  //! FTPClientTransferResult::operation_id, or 0 for login and keepalive
+  //! traffic. The ranges of a striped upload share the id of the upload.
+  uint64_t operation_id;
+  //! 0 for the client's own connections, or 1 + the index of the striping
+  //! connection (see FTPClientSetStriping) the event occurred on.
+  uint32_t session;
+  uint64_t value;
+  //! Not NUL-terminated and only valid for the duration of the callback. NULL
+  //! for data connection events.
+  const char *text;
+  size_t text_length;
+} FTPClientTraceEvent;
+
+typedef void (*FTPClientTraceCallback)(const FTPClientTraceEvent *event,
+                                       void *userdata);
+
+//! Sets a callback that receives protocol and data connection events as they
+//! occur, including those of the client's striping connections. The callback
+//! is invoked on the thread driving the client and should return quickly.
+//! Passing a NULL `callback` disables tracing.
+void FTPClientSetTraceCallback(FTPClient *context,
+                               FTPClientTraceCallback callback,
+                               void *userdata);
+
+//! Returns a short name for the given event type, e.g. "command_sent".
+const char *FTPClientTraceEventTypeName(FTPClientTraceEventType type);
+
+//! Formats the given event as a single line of tab-separated fields, as read
+//! by the ftp_trace_to_chrome host tool:
+//!   timestamp, session, operation_id, type name, value, text
+//! Control characters within the text are replaced with spaces. Behaves like
+//! snprintf, returning the length of the complete line.
+int FTPClientFormatTraceEvent(const FTPClientTraceEvent *event, char *buffer,
+                              size_t buffer_size);
+
+//! Mechanism used to wait for socket readiness.
+typedef enum FTPClientPollerBackend {
+  //! epoll on Linux hosts, poll on other hosts, and select on nxdk.
+  FTP_CLIENT_POLLER_BACKEND_DEFAULT = 0,
+  //! Available everywhere. Limited to descriptors below FD_SETSIZE.
+  FTP_CLIENT_POLLER_BACKEND_SELECT,
+  //! Host builds only.
+  FTP_CLIENT_POLLER_BACKEND_POLL,
+  //! Linux host builds only.
+  FTP_CLIENT_POLLER_BACKEND_EPOLL,
+} FTPClientPollerBackend;
+
+//! Selects the mechanism used by FTPClientConnect and FTPClientProcess to wait
+//! for socket readiness. Returns false if the backend is not available in this
+//! build, the control connection or a striping connection (see
+//! FTPClientSetStriping) is open, or uploads are in flight.
+bool FTPClientSetPollerBackend(FTPClient *context,
+                               FTPClientPollerBackend backend);
+
+//! Returns the backend that is (or will be) used by the given client, with
+//! FTP_CLIENT_POLLER_BACKEND_DEFAULT resolved to the concrete backend.
+FTPClientPollerBackend FTPClientGetPollerBackend(FTPClient *context);
+
+//! Starts connecting (as by FTPClientStartConnect, if not already connected)
+//! and starts a thread owned by the client that drives it continuously,
+//! taking the place of calls to FTPClientProcess. Uploads submitted while it
+//! runs interrupt its wait so that they start immediately, except on nxdk,
+//! where the worker polls for them every few milliseconds.
+//!
+//! While the worker runs, only the upload submission functions,
+//! FTPClientDispatchCallbacks and FTPClientStopWorker may be called. Returns
+//! false if a worker is already running, the client belongs to a
+//! FTPClientGroup, or connecting or starting the thread fails.
+bool FTPClientStartWorker(FTPClient *context,
+                          uint32_t connect_timeout_milliseconds);
+
+//! Stops the worker started by FTPClientStartWorker, leaving the connection
+//! and any in-flight uploads in place to be driven by the caller. Returns
+//! FTP_CLIENT_PROCESS_STATUS_SUCCESS if the worker was still running, the
+//! error status that stopped it early (e.g., the connection was lost), or
+//! FTP_CLIENT_PROCESS_STATUS_BAD_STATE if no worker was started. Failures of
+//! individual uploads are reported through their callbacks and do not stop
+//! the worker.
+FTPClientProcessStatus FTPClientStopWorker(FTPClient *context);
+
+//! Selects the thread on which upload completion callbacks (`on_complete` and
+//! the transfer result callback) are invoked.
+typedef enum FTPClientCallbackMode {
+  //! Invoked on the thread driving the client, i.e., inside FTPClientProcess
+  //! or on the worker thread.
+  FTP_CLIENT_CALLBACK_MODE_DIRECT = 0,
+  //! Queued and invoked by FTPClientDispatchCallbacks on the caller's thread.
+  FTP_CLIENT_CALLBACK_MODE_DEFERRED,
+} FTPClientCallbackMode;
+
+//! Sets how completion callbacks of subsequently finished uploads are invoked.
+//! Must not be called while a worker is running.
+void FTPClientSetCallbackMode(FTPClient *context, FTPClientCallbackMode mode);
+
+//! Invokes queued completion callbacks in FTP_CLIENT_CALLBACK_MODE_DEFERRED
+//! and returns how many uploads were reported. May be called from any single
+//! thread, including while a worker is running. Callbacks that have not been
+//! dispatched when the client is destroyed are dropped.
+size_t FTPClientDispatchCallbacks(FTPClient *context);
+
+//! A set of clients driven together by FTPClientGroupProcess, which waits on
+//! all of their sockets at once and dispatches only the clients that are
+//! ready. Members must not be driven with FTPClientProcess,
+//! FTPClientGetPollDescriptors or FTPClientProcessReady, which fail with
+//! FTP_CLIENT_PROCESS_STATUS_BAD_STATE, and should be connected with
+//! FTPClientStartConnect rather than the blocking FTPClientConnect.
+typedef struct FTPClientGroup FTPClientGroup;
+
+//! Creates an empty group that waits using the given backend. Returns NULL if
+//! the backend is not available in this build or on allocation failure.
+FTPClientGroup *FTPClientGroupCreate(FTPClientPollerBackend backend);
+
+//! Destroys a group. Remaining members are removed as by FTPClientGroupRemove
+//! and must be destroyed by the caller. Members whose connections cannot be
+//! moved out of the group are closed.
+void FTPClientGroupDestroy(FTPClientGroup **group);
+
+//! Adds a client to the group. Its open connections and in-flight uploads are
+//! carried over. Returns false if the client already belongs to a group, has
+//! opened striping connections (see FTPClientSetStriping) or on allocation
+//! failure. Destroying a client removes it from its group.
+bool FTPClientGroupAdd(FTPClientGroup *group, FTPClient *context);
+
+//! Removes a client from the group so that it may be driven on its own again.
+//! Returns false if the client is not a member or on allocation failure.
+bool FTPClientGroupRemove(FTPClientGroup *group, FTPClient *context);
+
+//! Makes a FTPClientGroupProcess wait that is in progress on another thread
+//! (or the next one) return promptly. Returns false if waits cannot be
+//! interrupted in this build (nxdk).
+bool FTPClientGroupWake(FTPClientGroup *group);
+
+//! Invoked by FTPClientGroupProcess for each member whose processing failed,
+//! with the status FTPClientProcess would have returned for it. The callback
+//! may close `context` but must not destroy it or modify the group.
+typedef void (*FTPClientGroupStatusCallback)(FTPClient *context,
+                                             FTPClientProcessStatus status,
+                                             void *userdata);
+
+//! Performs the equivalent of FTPClientProcess on every member with an open
+//! control connection using a single wait of up to `timeout_milliseconds`.
+//! Per-client failures are reported through `on_error`, which may be NULL.
+//! Returns FTP_CLIENT_PROCESS_STATUS_TIMEOUT if no socket became ready and
+//! FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED if the wait itself failed.
+FTPClientProcessStatus FTPClientGroupProcess(
+    FTPClientGroup *group, uint32_t timeout_milliseconds,
+    FTPClientGroupStatusCallback on_error, void *userdata);
+
 //! Retrieves the `errno` value related to the most recent failure.
 int FTPClientErrno(FTPClient *context);
 
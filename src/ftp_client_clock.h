@@ -0,0 +1,34 @@
+#ifndef FTP_CLIENT_CLOCK_H
+#define FTP_CLIENT_CLOCK_H
+
+// Monotonic clock used internally by the FTP client for timestamps and
+// deadlines.
+
+#include <stdint.h>
+
+#ifdef NXDK
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+//! Returns the current time in microseconds relative to an arbitrary, fixed
+//! epoch. Only differences between values are meaningful.
+static inline uint64_t FTPClockMicroseconds(void) {
+#ifdef NXDK
+  LARGE_INTEGER counter;
+  LARGE_INTEGER frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  uint64_t ticks = (uint64_t)counter.QuadPart;
+  uint64_t ticks_per_second = (uint64_t)frequency.QuadPart;
+  return (ticks / ticks_per_second) * 1000000 +
+         (ticks % ticks_per_second) * 1000000 / ticks_per_second;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+#endif
+}
+
+#endif  // FTP_CLIENT_CLOCK_H
@@ -0,0 +1,580 @@
+#include "ftp_client_engine.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ftp_client_clock.h"
+#include "ftp_client_thread.h"
+
+#define DEFAULT_OPERATIONS_PER_SESSION 4
+#define DEFAULT_RECONNECT_DELAY_MILLISECONDS 1000
+//! Maximum time for a worker to block between events when submissions can
+//! interrupt the wait.
+#define ENGINE_WAIT_MILLISECONDS 1000
+//! Maximum time for a worker to block between events when waits cannot be
+//! interrupted (nxdk).
+#define ENGINE_POLL_INTERVAL_MILLISECONDS 10
+
+struct EngineSession;
+
+//! An upload queued with the engine.
+struct EngineJob {
+  //! Links in the in-flight list of `session`.
+  struct EngineJob *prev;
+  struct EngineJob *next;
+  struct EngineSession *session;
+
+  char *filename;
+  //! Set for file uploads, in which case `buffer` is unused.
+  char *local_filename;
+  const void *buffer;
+  size_t buffer_len;
+
+  void (*on_complete)(bool successful, void *userdata);
+  void *userdata;
+};
+
+struct EngineWorker;
+
+struct EngineSession {
+  struct EngineWorker *worker;
+  //! NULL while waiting to reconnect.
+  FTPClient *client;
+  //! FTPClockMicroseconds() after which `client` should be recreated.
+  uint64_t reconnect_at;
+  //! Set by the group status callback; handled once the group is idle.
+  bool failed;
+
+  struct EngineJob *in_flight_head;
+  size_t in_flight_count;
+};
+
+struct EngineWorker {
+  FTPClientEngine *engine;
+  FTPThread thread;
+  FTPClientGroup *group;
+
+  struct EngineSession *sessions;
+  size_t session_count;
+
+  //! Ring buffer of queued jobs. The owner takes from the front and thieves
+  //! from the back.
+  FTPMutex mutex;
+  struct EngineJob **jobs;
+  size_t job_capacity;
+  size_t job_head;
+  size_t job_count;
+
+  //! Whether the worker found no job for a free session slot before its last
+  //! wait.
+  atomic_bool idle;
+};
+
+struct FTPClientEngine {
+  //! Copy of the creation options. `username` and `password` point at
+  //! engine-owned copies used whenever a session (re)connects.
+  FTPClientEngineOptions options;
+
+  struct EngineWorker *workers;
+  size_t worker_count;
+  //! Number of workers whose thread was started.
+  size_t started_count;
+  atomic_size_t next_worker;
+  atomic_bool stop;
+
+  atomic_uint_fast64_t completed_operations;
+  atomic_uint_fast64_t failed_operations;
+  atomic_uint_fast64_t stolen_operations;
+};
+
+static void FreeEngineJob(struct EngineJob *job) {
+  free(job->filename);
+  free(job->local_filename);
+  free(job);
+}
+
+static bool PushJob(struct EngineWorker *worker, struct EngineJob *job) {
+  FTPMutexLock(&worker->mutex);
+  if (worker->job_count == worker->job_capacity) {
+    size_t capacity = worker->job_capacity ? worker->job_capacity * 2 : 64;
+    struct EngineJob **jobs =
+        (struct EngineJob **)malloc(capacity * sizeof(*jobs));
+    if (!jobs) {
+      FTPMutexUnlock(&worker->mutex);
+      return false;
+    }
+    for (size_t i = 0; i < worker->job_count; ++i) {
+      jobs[i] = worker->jobs[(worker->job_head + i) % worker->job_capacity];
+    }
+    free(worker->jobs);
+    worker->jobs = jobs;
+    worker->job_capacity = capacity;
+    worker->job_head = 0;
+  }
+
+  worker->jobs[(worker->job_head + worker->job_count) %
+               worker->job_capacity] = job;
+  ++worker->job_count;
+  FTPMutexUnlock(&worker->mutex);
+  return true;
+}
+
+//! Removes the oldest job (`from_front`) or the newest one.
+static struct EngineJob *TakeJob(struct EngineWorker *worker,
+                                 bool from_front) {
+  FTPMutexLock(&worker->mutex);
+  struct EngineJob *job = NULL;
+  if (worker->job_count) {
+    size_t index = worker->job_head;
+    if (from_front) {
+      worker->job_head = (worker->job_head + 1) % worker->job_capacity;
+    } else {
+      index = (worker->job_head + worker->job_count - 1) %
+              worker->job_capacity;
+    }
+    job = worker->jobs[index];
+    --worker->job_count;
+  }
+  FTPMutexUnlock(&worker->mutex);
+  return job;
+}
+
+//! Takes the next job for `worker`, stealing from the other workers once its
+//! own queue is empty.
+static struct EngineJob *NextJob(struct EngineWorker *worker) {
+  struct EngineJob *job = TakeJob(worker, true);
+  if (job) {
+    return job;
+  }
+
+  FTPClientEngine *engine = worker->engine;
+  size_t self = (size_t)(worker - engine->workers);
+  for (size_t i = 1; i < engine->worker_count && !job; ++i) {
+    job = TakeJob(engine->workers + (self + i) % engine->worker_count, false);
+  }
+  if (job) {
+    atomic_fetch_add_explicit(&engine->stolen_operations, 1,
+                              memory_order_relaxed);
+  }
+  return job;
+}
+
+static void UnlinkInFlightJob(struct EngineJob *job) {
+  struct EngineSession *session = job->session;
+  if (job->prev) {
+    job->prev->next = job->next;
+  } else {
+    session->in_flight_head = job->next;
+  }
+  if (job->next) {
+    job->next->prev = job->prev;
+  }
+  --session->in_flight_count;
+}
+
+static void FinishJob(struct EngineJob *job, bool successful) {
+  FTPClientEngine *engine = job->session->worker->engine;
+  atomic_fetch_add_explicit(successful ? &engine->completed_operations
+                                       : &engine->failed_operations,
+                            1, memory_order_relaxed);
+  if (job->on_complete) {
+    job->on_complete(successful, job->userdata);
+  }
+  FreeEngineJob(job);
+}
+
+static void OnJobComplete(bool successful, void *userdata) {
+  struct EngineJob *job = (struct EngineJob *)userdata;
+  UnlinkInFlightJob(job);
+  FinishJob(job, successful);
+}
+
+//! Hands `job` to the session's client.
+static void StartJob(struct EngineSession *session, struct EngineJob *job) {
+  job->session = session;
+  job->prev = NULL;
+  job->next = session->in_flight_head;
+  if (job->next) {
+    job->next->prev = job;
+  }
+  session->in_flight_head = job;
+  ++session->in_flight_count;
+
+  bool started;
+  if (job->local_filename) {
+    started = FTPClientSendFile(session->client, job->local_filename,
+                                job->filename, OnJobComplete, job);
+  } else {
+    started = FTPClientSendBuffer(session->client, job->filename, job->buffer,
+                                  job->buffer_len, OnJobComplete, job);
+  }
+  if (!started) {
+    OnJobComplete(false, job);
+  }
+}
+
+static void ConnectSession(struct EngineSession *session) {
+  struct EngineWorker *worker = session->worker;
+  const FTPClientEngineOptions *options = &worker->engine->options;
+
+  session->failed = false;
+  if (FTPClientInit(&session->client, options->ipv4_ip_host_ordered,
+                    options->port_host_ordered, options->username,
+                    options->password) != FTP_CLIENT_INIT_STATUS_SUCCESS) {
+    session->client = NULL;
+  } else {
+    FTPClientSetMaxActiveOperations(session->client,
+                                    options->operations_per_session);
+    if (!FTPClientGroupAdd(worker->group, session->client) ||
+        FTPClientStartConnect(session->client,
+                              options->connect_timeout_milliseconds) !=
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS) {
+      FTPClientDestroy(&session->client);
+    }
+  }
+
+  if (!session->client) {
+    session->reconnect_at =
+        FTPClockMicroseconds() +
+        (uint64_t)options->reconnect_delay_milliseconds * 1000;
+  }
+}
+
+//! Fails the uploads handed to a session whose connection was lost and
+//! schedules a reconnect.
+static void ResetSession(struct EngineSession *session) {
+  FTPClientDestroy(&session->client);
+  while (session->in_flight_head) {
+    struct EngineJob *job = session->in_flight_head;
+    UnlinkInFlightJob(job);
+    FinishJob(job, false);
+  }
+  session->failed = false;
+  session->reconnect_at =
+      FTPClockMicroseconds() +
+      (uint64_t)session->worker->engine->options.reconnect_delay_milliseconds *
+          1000;
+}
+
+//! Whether the given status reports the loss of a session's control
+//! connection, as opposed to the failure of one of its uploads.
+static bool IsControlConnectionLoss(FTPClientProcessStatus status) {
+  switch (status) {
+    case FTP_CLIENT_PROCESS_STATUS_READ_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_WRITE_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_SOCKET_EXCEPTION:
+    case FTP_CLIENT_PROCESS_STATUS_CLOSED:
+    case FTP_CLIENT_PROCESS_STATUS_CONNECT_FAILED:
+    case FTP_CLIENT_PROCESS_STATUS_CONNECT_TIMEOUT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+//! Resets the session of a client whose control connection was lost. Failed
+//! uploads have already been reported through their own callbacks and leave
+//! the session running.
+static void OnSessionError(FTPClient *context, FTPClientProcessStatus status,
+                           void *userdata) {
+  if (!IsControlConnectionLoss(status) && FTPClientIsFullyConnected(context)) {
+    return;
+  }
+
+  struct EngineWorker *worker = (struct EngineWorker *)userdata;
+  for (size_t i = 0; i < worker->session_count; ++i) {
+    if (worker->sessions[i].client == context) {
+      worker->sessions[i].failed = true;
+      FTPClientClose(context);
+      return;
+    }
+  }
+}
+
+static int EngineWorkerThreadProc(void *arg) {
+  struct EngineWorker *worker = (struct EngineWorker *)arg;
+  FTPClientEngine *engine = worker->engine;
+  const size_t operations_per_session = engine->options.operations_per_session;
+  const uint32_t wait_milliseconds = FTPClientGroupWake(worker->group)
+                                         ? ENGINE_WAIT_MILLISECONDS
+                                         : ENGINE_POLL_INTERVAL_MILLISECONDS;
+
+  while (!atomic_load_explicit(&engine->stop, memory_order_acquire)) {
+    uint64_t now = FTPClockMicroseconds();
+    bool starved = false;
+    for (size_t i = 0; i < worker->session_count; ++i) {
+      struct EngineSession *session = worker->sessions + i;
+      if (!session->client) {
+        if (now >= session->reconnect_at) {
+          ConnectSession(session);
+        }
+        continue;
+      }
+      if (!FTPClientIsFullyConnected(session->client)) {
+        continue;
+      }
+
+      while (!starved &&
+             session->in_flight_count < operations_per_session) {
+        struct EngineJob *job = NextJob(worker);
+        if (!job) {
+          starved = true;
+          break;
+        }
+        StartJob(session, job);
+      }
+    }
+    atomic_store_explicit(&worker->idle, starved, memory_order_release);
+
+    FTPClientGroupProcess(worker->group, wait_milliseconds, OnSessionError,
+                          worker);
+
+    for (size_t i = 0; i < worker->session_count; ++i) {
+      if (worker->sessions[i].failed) {
+        ResetSession(worker->sessions + i);
+      }
+    }
+  }
+
+  // Uploads still in flight at shutdown are dropped without notification.
+  for (size_t i = 0; i < worker->session_count; ++i) {
+    struct EngineSession *session = worker->sessions + i;
+    FTPClientDestroy(&session->client);
+    while (session->in_flight_head) {
+      struct EngineJob *job = session->in_flight_head;
+      session->in_flight_head = job->next;
+      FreeEngineJob(job);
+    }
+    session->in_flight_count = 0;
+  }
+  return 0;
+}
+
+void FTPClientEngineOptionsInit(FTPClientEngineOptions *options) {
+  if (!options) {
+    return;
+  }
+  memset(options, 0, sizeof(*options));
+  options->worker_count = 1;
+  options->sessions_per_worker = 1;
+  options->operations_per_session = DEFAULT_OPERATIONS_PER_SESSION;
+  options->poller_backend = FTP_CLIENT_POLLER_BACKEND_DEFAULT;
+  options->reconnect_delay_milliseconds = DEFAULT_RECONNECT_DELAY_MILLISECONDS;
+}
+
+static void DestroyWorkerResources(struct EngineWorker *worker) {
+  FTPClientGroupDestroy(&worker->group);
+  free(worker->sessions);
+  for (size_t i = 0; i < worker->job_count; ++i) {
+    FreeEngineJob(
+        worker->jobs[(worker->job_head + i) % worker->job_capacity]);
+  }
+  free(worker->jobs);
+  FTPMutexDestroy(&worker->mutex);
+}
+
+FTPClientEngine *FTPClientEngineCreate(const FTPClientEngineOptions *options) {
+  if (!options || !options->port_host_ordered) {
+    return NULL;
+  }
+
+  FTPClientEngine *engine = (FTPClientEngine *)calloc(1, sizeof(*engine));
+  if (!engine) {
+    return NULL;
+  }
+  engine->options = *options;
+  if (!engine->options.worker_count) {
+    engine->options.worker_count = 1;
+  }
+  if (!engine->options.sessions_per_worker) {
+    engine->options.sessions_per_worker = 1;
+  }
+  if (!engine->options.operations_per_session) {
+    engine->options.operations_per_session = DEFAULT_OPERATIONS_PER_SESSION;
+  }
+  if (!engine->options.reconnect_delay_milliseconds) {
+    engine->options.reconnect_delay_milliseconds =
+        DEFAULT_RECONNECT_DELAY_MILLISECONDS;
+  }
+  engine->options.username = options->username ? strdup(options->username)
+                                                : NULL;
+  engine->options.password = options->password ? strdup(options->password)
+                                                : NULL;
+  engine->workers = (struct EngineWorker *)calloc(
+      engine->options.worker_count, sizeof(*engine->workers));
+  if ((options->username && !engine->options.username) ||
+      (options->password && !engine->options.password) || !engine->workers) {
+    FTPClientEngineDestroy(&engine);
+    return NULL;
+  }
+
+  bool created = true;
+  for (size_t i = 0; i < engine->options.worker_count && created; ++i) {
+    struct EngineWorker *worker = engine->workers + i;
+    worker->engine = engine;
+    if (!FTPMutexInit(&worker->mutex)) {
+      created = false;
+      break;
+    }
+    ++engine->worker_count;
+
+    worker->group = FTPClientGroupCreate(options->poller_backend);
+    worker->sessions = (struct EngineSession *)calloc(
+        engine->options.sessions_per_worker, sizeof(*worker->sessions));
+    created = worker->group && worker->sessions;
+    if (!created) {
+      break;
+    }
+    worker->session_count = engine->options.sessions_per_worker;
+
+    for (size_t j = 0; j < worker->session_count; ++j) {
+      worker->sessions[j].worker = worker;
+      ConnectSession(worker->sessions + j);
+    }
+  }
+
+  for (size_t i = 0; i < engine->worker_count && created; ++i) {
+    struct EngineWorker *worker = engine->workers + i;
+    created = FTPThreadCreate(&worker->thread, EngineWorkerThreadProc, worker);
+    if (created) {
+      ++engine->started_count;
+    }
+  }
+
+  if (!created) {
+    FTPClientEngineDestroy(&engine);
+  }
+  return engine;
+}
+
+void FTPClientEngineDestroy(FTPClientEngine **engine) {
+  if (!engine || !*engine) {
+    return;
+  }
+
+  FTPClientEngine *e = *engine;
+  atomic_store_explicit(&e->stop, true, memory_order_release);
+  for (size_t i = 0; i < e->started_count; ++i) {
+    FTPClientGroupWake(e->workers[i].group);
+  }
+  for (size_t i = 0; i < e->started_count; ++i) {
+    FTPThreadJoin(e->workers[i].thread);
+  }
+
+  for (size_t i = 0; i < e->worker_count; ++i) {
+    struct EngineWorker *worker = e->workers + i;
+    if (i >= e->started_count && worker->sessions) {
+      for (size_t j = 0; j < worker->session_count; ++j) {
+        FTPClientDestroy(&worker->sessions[j].client);
+      }
+    }
+    DestroyWorkerResources(worker);
+  }
+  free(e->workers);
+  free((char *)e->options.username);
+  free((char *)e->options.password);
+  free(e);
+  *engine = NULL;
+}
+
+//! Queues `job` round-robin and wakes the workers that may pick it up.
+static bool SubmitJob(FTPClientEngine *engine, struct EngineJob *job) {
+  size_t index =
+      atomic_fetch_add_explicit(&engine->next_worker, 1,
+                                memory_order_relaxed) %
+      engine->worker_count;
+  struct EngineWorker *worker = engine->workers + index;
+  if (!PushJob(worker, job)) {
+    FreeEngineJob(job);
+    return false;
+  }
+
+  FTPClientGroupWake(worker->group);
+  // Let a worker that ran dry steal the job if the target is still busy.
+  for (size_t i = 1; i < engine->worker_count; ++i) {
+    struct EngineWorker *idle =
+        engine->workers + (index + i) % engine->worker_count;
+    if (atomic_load_explicit(&idle->idle, memory_order_acquire)) {
+      FTPClientGroupWake(idle->group);
+      break;
+    }
+  }
+  return true;
+}
+
+static struct EngineJob *CreateEngineJob(
+    const char *filename, void (*on_complete)(bool successful, void *userdata),
+    void *userdata) {
+  struct EngineJob *job = (struct EngineJob *)calloc(1, sizeof(*job));
+  if (!job) {
+    return NULL;
+  }
+  job->filename = strdup(filename);
+  if (!job->filename) {
+    free(job);
+    return NULL;
+  }
+  job->on_complete = on_complete;
+  job->userdata = userdata;
+  return job;
+}
+
+bool FTPClientEngineSendBuffer(FTPClientEngine *engine, const char *filename,
+                               const void *buffer, size_t buffer_len,
+                               void (*on_complete)(bool successful,
+                                                   void *userdata),
+                               void *userdata) {
+  if (!engine || !filename || !buffer || !buffer_len) {
+    return false;
+  }
+
+  struct EngineJob *job = CreateEngineJob(filename, on_complete, userdata);
+  if (!job) {
+    return false;
+  }
+  job->buffer = buffer;
+  job->buffer_len = buffer_len;
+  return SubmitJob(engine, job);
+}
+
+bool FTPClientEngineSendFile(FTPClientEngine *engine,
+                             const char *local_filename,
+                             const char *remote_filename,
+                             void (*on_complete)(bool successful,
+                                                 void *userdata),
+                             void *userdata) {
+  if (!engine || !local_filename) {
+    return false;
+  }
+
+  struct EngineJob *job =
+      CreateEngineJob(remote_filename ? remote_filename : local_filename,
+                      on_complete, userdata);
+  if (!job) {
+    return false;
+  }
+  job->local_filename = strdup(local_filename);
+  if (!job->local_filename) {
+    FreeEngineJob(job);
+    return false;
+  }
+  return SubmitJob(engine, job);
+}
+
+void FTPClientEngineGetStats(FTPClientEngine *engine,
+                             FTPClientEngineStats *stats) {
+  if (!stats) {
+    return;
+  }
+  memset(stats, 0, sizeof(*stats));
+  if (!engine) {
+    return;
+  }
+  stats->completed_operations = atomic_load_explicit(
+      &engine->completed_operations, memory_order_relaxed);
+  stats->failed_operations =
+      atomic_load_explicit(&engine->failed_operations, memory_order_relaxed);
+  stats->stolen_operations =
+      atomic_load_explicit(&engine->stolen_operations, memory_order_relaxed);
+}
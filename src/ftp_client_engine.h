@@ -0,0 +1,92 @@
+#ifndef FTP_CLIENT_ENGINE_H
+#define FTP_CLIENT_ENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ftp_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! Uploads to a single server over many control connections, which are
+//! spread across worker threads that each drive their share with one
+//! FTPClientGroup.
+//!
+//! Uploads are queued with the worker chosen round-robin at submission and
+//! are handed to one of its sessions once that session has a free slot.
+//! Workers that run out of queued uploads steal the most recently queued
+//! uploads of other workers.
+typedef struct FTPClientEngine FTPClientEngine;
+
+typedef struct FTPClientEngineOptions {
+  uint32_t ipv4_ip_host_ordered;
+  uint16_t port_host_ordered;
+  const char *username;
+  const char *password;
+
+  //! Number of worker threads. 0 selects 1.
+  size_t worker_count;
+  //! Control connections opened by each worker. 0 selects 1.
+  size_t sessions_per_worker;
+  //! Uploads handed to a session at once. Uploads beyond this remain queued
+  //! in the engine, where idle workers may steal them. 0 selects 4.
+  size_t operations_per_session;
+
+  FTPClientPollerBackend poller_backend;
+  //! Time allowed for each session to connect and log in. 0 selects the
+  //! FTPClientStartConnect default.
+  uint32_t connect_timeout_milliseconds;
+  //! Delay before a session that failed is reconnected. 0 selects 1 second.
+  uint32_t reconnect_delay_milliseconds;
+} FTPClientEngineOptions;
+
+typedef struct FTPClientEngineStats {
+  uint64_t completed_operations;
+  uint64_t failed_operations;
+  //! Uploads that were started by a worker other than the one they were
+  //! queued with.
+  uint64_t stolen_operations;
+} FTPClientEngineStats;
+
+//! Populates the given FTPClientEngineOptions with default values.
+void FTPClientEngineOptionsInit(FTPClientEngineOptions *options);
+
+//! Creates an engine and starts its workers, which connect immediately.
+//! Returns NULL on invalid options or if resources could not be allocated.
+FTPClientEngine *FTPClientEngineCreate(const FTPClientEngineOptions *options);
+
+//! Stops the workers and closes all sessions. Uploads that have not completed
+//! are abandoned without invoking their callbacks, as with FTPClientDestroy.
+void FTPClientEngineDestroy(FTPClientEngine **engine);
+
+//! Queues an upload of `buffer`, which must remain valid until `on_complete`
+//! is invoked. May be called from any thread. Callbacks are invoked on a
+//! worker thread.
+bool FTPClientEngineSendBuffer(FTPClientEngine *engine, const char *filename,
+                               const void *buffer, size_t buffer_len,
+                               void (*on_complete)(bool successful,
+                                                   void *userdata),
+                               void *userdata);
+
+//! Queues an upload of the given local file. The file is opened once a
+//! session starts the upload. See FTPClientEngineSendBuffer.
+bool FTPClientEngineSendFile(FTPClientEngine *engine,
+                             const char *local_filename,
+                             const char *remote_filename,
+                             void (*on_complete)(bool successful,
+                                                 void *userdata),
+                             void *userdata);
+
+//! Retrieves counters aggregated across all workers. May be called from any
+//! thread.
+void FTPClientEngineGetStats(FTPClientEngine *engine,
+                             FTPClientEngineStats *stats);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // FTP_CLIENT_ENGINE_H
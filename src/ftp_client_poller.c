@@ -0,0 +1,672 @@
+#include "ftp_client_poller.h"
+
+#include <errno.h>
+#include <lwip/sockets.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "configure.h"
+
+#ifndef NXDK
+#include <sys/select.h>
+#if defined(HAVE_POLL)
+#include <poll.h>
+#define POLLER_HAVE_POLL
+#endif
+#if defined(HAVE_EPOLL)
+#include <sys/epoll.h>
+#define POLLER_HAVE_EPOLL
+#endif
+// Wakeups use an eventfd where available and a self-pipe otherwise. lwIP on
+// nxdk offers neither, so waits there cannot be interrupted.
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(HAVE_EVENTFD)
+#include <sys/eventfd.h>
+#endif
+#define POLLER_HAVE_WAKEUP
+#endif
+
+struct FTPPollerEntry {
+  int fd;
+  uint32_t events;
+  void *owner;
+  void *userdata;
+};
+
+struct FTPPoller {
+  FTPClientPollerBackend backend;
+
+  //! Registered sockets, densely packed.
+  struct FTPPollerEntry *entries;
+  size_t entry_count;
+  size_t entry_capacity;
+
+  //! Maps a file descriptor to 1 + its index in `entries`, or 0 if it is not
+  //! registered.
+  size_t *slots;
+  size_t slot_count;
+
+  //! Results of the most recent wait. Only grown when a wait starts, as
+  //! sockets may be registered while the results are being dispatched.
+  FTPPollerEvent *ready;
+  size_t ready_count;
+  size_t ready_capacity;
+
+  // FTP_CLIENT_POLLER_BACKEND_SELECT
+  fd_set read_fds;
+  fd_set write_fds;
+  int max_fd;
+
+#ifdef POLLER_HAVE_POLL
+  //! Parallel to `entries`. Sockets without interest have a negative `fd`,
+  //! which poll() ignores.
+  struct pollfd *pollfds;
+#endif
+
+#ifdef POLLER_HAVE_EPOLL
+  int epoll_fd;
+  struct epoll_event *epoll_events;
+#endif
+
+  //! Descriptor registered for reading that FTPPollerWake makes readable, or
+  //! -1. The same as `wakeup_write_fd` when backed by an eventfd.
+  int wakeup_read_fd;
+  int wakeup_write_fd;
+};
+
+bool FTPPollerBackendIsSupported(FTPClientPollerBackend backend) {
+  switch (backend) {
+    case FTP_CLIENT_POLLER_BACKEND_DEFAULT:
+    case FTP_CLIENT_POLLER_BACKEND_SELECT:
+      return true;
+    case FTP_CLIENT_POLLER_BACKEND_POLL:
+#ifdef POLLER_HAVE_POLL
+      return true;
+#else
+      return false;
+#endif
+    case FTP_CLIENT_POLLER_BACKEND_EPOLL:
+#ifdef POLLER_HAVE_EPOLL
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+FTPClientPollerBackend FTPPollerResolveBackend(FTPClientPollerBackend backend) {
+  if (backend != FTP_CLIENT_POLLER_BACKEND_DEFAULT) {
+    return backend;
+  }
+#if defined(POLLER_HAVE_EPOLL)
+  return FTP_CLIENT_POLLER_BACKEND_EPOLL;
+#elif defined(POLLER_HAVE_POLL)
+  return FTP_CLIENT_POLLER_BACKEND_POLL;
+#else
+  return FTP_CLIENT_POLLER_BACKEND_SELECT;
+#endif
+}
+
+FTPPoller *FTPPollerCreate(FTPClientPollerBackend backend) {
+  if (!FTPPollerBackendIsSupported(backend)) {
+    return NULL;
+  }
+
+  FTPPoller *poller = (FTPPoller *)calloc(1, sizeof(*poller));
+  if (!poller) {
+    return NULL;
+  }
+  poller->backend = FTPPollerResolveBackend(backend);
+  FD_ZERO(&poller->read_fds);
+  FD_ZERO(&poller->write_fds);
+  poller->max_fd = -1;
+  poller->wakeup_read_fd = -1;
+  poller->wakeup_write_fd = -1;
+
+#ifdef POLLER_HAVE_EPOLL
+  poller->epoll_fd = -1;
+  if (poller->backend == FTP_CLIENT_POLLER_BACKEND_EPOLL) {
+    poller->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (poller->epoll_fd < 0) {
+      free(poller);
+      return NULL;
+    }
+  }
+#endif
+
+  return poller;
+}
+
+void FTPPollerDestroy(FTPPoller *poller) {
+  if (!poller) {
+    return;
+  }
+
+#ifdef POLLER_HAVE_WAKEUP
+  if (poller->wakeup_read_fd >= 0) {
+    close(poller->wakeup_read_fd);
+  }
+  if (poller->wakeup_write_fd >= 0 &&
+      poller->wakeup_write_fd != poller->wakeup_read_fd) {
+    close(poller->wakeup_write_fd);
+  }
+#endif
+#ifdef POLLER_HAVE_EPOLL
+  if (poller->epoll_fd >= 0) {
+    close(poller->epoll_fd);
+  }
+  free(poller->epoll_events);
+#endif
+#ifdef POLLER_HAVE_POLL
+  free(poller->pollfds);
+#endif
+  free(poller->ready);
+  free(poller->slots);
+  free(poller->entries);
+  free(poller);
+}
+
+static struct FTPPollerEntry *FindEntry(FTPPoller *poller, int fd) {
+  if (fd < 0 || (size_t)fd >= poller->slot_count || !poller->slots[fd]) {
+    return NULL;
+  }
+  return poller->entries + poller->slots[fd] - 1;
+}
+
+//! Grows the per-entry arrays so that one more socket may be registered.
+static bool ReserveEntry(FTPPoller *poller, int fd) {
+  if ((size_t)fd >= poller->slot_count) {
+    size_t slot_count = poller->slot_count ? poller->slot_count : 16;
+    while ((size_t)fd >= slot_count) {
+      slot_count *= 2;
+    }
+    size_t *slots =
+        (size_t *)realloc(poller->slots, slot_count * sizeof(*slots));
+    if (!slots) {
+      return false;
+    }
+    memset(slots + poller->slot_count, 0,
+           (slot_count - poller->slot_count) * sizeof(*slots));
+    poller->slots = slots;
+    poller->slot_count = slot_count;
+  }
+
+  if (poller->entry_count < poller->entry_capacity) {
+    return true;
+  }
+
+  size_t capacity = poller->entry_capacity ? poller->entry_capacity * 2 : 8;
+  struct FTPPollerEntry *entries = (struct FTPPollerEntry *)realloc(
+      poller->entries, capacity * sizeof(*entries));
+  if (!entries) {
+    return false;
+  }
+  poller->entries = entries;
+
+#ifdef POLLER_HAVE_POLL
+  if (poller->backend == FTP_CLIENT_POLLER_BACKEND_POLL) {
+    struct pollfd *pollfds = (struct pollfd *)realloc(
+        poller->pollfds, capacity * sizeof(*pollfds));
+    if (!pollfds) {
+      return false;
+    }
+    poller->pollfds = pollfds;
+  }
+#endif
+#ifdef POLLER_HAVE_EPOLL
+  if (poller->backend == FTP_CLIENT_POLLER_BACKEND_EPOLL) {
+    struct epoll_event *epoll_events = (struct epoll_event *)realloc(
+        poller->epoll_events, capacity * sizeof(*epoll_events));
+    if (!epoll_events) {
+      return false;
+    }
+    poller->epoll_events = epoll_events;
+  }
+#endif
+
+  poller->entry_capacity = capacity;
+  return true;
+}
+
+#ifdef POLLER_HAVE_POLL
+static short ToPollEvents(uint32_t events) {
+  return (short)(((events & FTP_POLLER_EVENT_READ) ? POLLIN : 0) |
+                 ((events & FTP_POLLER_EVENT_WRITE) ? POLLOUT : 0));
+}
+#endif
+
+#ifdef POLLER_HAVE_EPOLL
+//! Applies a change of interest to the kernel's interest list. Sockets without
+//! interest are removed from it entirely so that a hangup on an idle socket
+//! does not wake every wait.
+static bool UpdateEpoll(FTPPoller *poller, int fd, uint32_t old_events,
+                        uint32_t new_events) {
+  if (!old_events && !new_events) {
+    return true;
+  }
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = ((new_events & FTP_POLLER_EVENT_READ) ? EPOLLIN : 0) |
+                 ((new_events & FTP_POLLER_EVENT_WRITE) ? EPOLLOUT : 0);
+  event.data.fd = fd;
+
+  int op = !old_events   ? EPOLL_CTL_ADD
+           : !new_events ? EPOLL_CTL_DEL
+                         : EPOLL_CTL_MOD;
+  return !epoll_ctl(poller->epoll_fd, op, fd, &event);
+}
+#endif
+
+static void UpdateSelectSets(FTPPoller *poller, int fd, uint32_t events) {
+  if (events & FTP_POLLER_EVENT_READ) {
+    FD_SET(fd, &poller->read_fds);
+  } else {
+    FD_CLR(fd, &poller->read_fds);
+  }
+  if (events & FTP_POLLER_EVENT_WRITE) {
+    FD_SET(fd, &poller->write_fds);
+  } else {
+    FD_CLR(fd, &poller->write_fds);
+  }
+}
+
+bool FTPPollerSet(FTPPoller *poller, int fd, uint32_t events, void *owner,
+                  void *userdata) {
+  if (fd < 0 || (poller->backend == FTP_CLIENT_POLLER_BACKEND_SELECT &&
+                 fd >= FD_SETSIZE)) {
+    errno = EINVAL;
+    return false;
+  }
+
+  struct FTPPollerEntry *entry = FindEntry(poller, fd);
+  if (!entry) {
+    if (!ReserveEntry(poller, fd)) {
+      errno = ENOMEM;
+      return false;
+    }
+    entry = poller->entries + poller->entry_count;
+    entry->fd = fd;
+    entry->events = 0;
+#ifdef POLLER_HAVE_POLL
+    if (poller->backend == FTP_CLIENT_POLLER_BACKEND_POLL) {
+      struct pollfd *pfd = poller->pollfds + poller->entry_count;
+      pfd->fd = -1;
+      pfd->events = 0;
+      pfd->revents = 0;
+    }
+#endif
+    ++poller->entry_count;
+    poller->slots[fd] = poller->entry_count;
+  }
+
+  switch (poller->backend) {
+    case FTP_CLIENT_POLLER_BACKEND_POLL:
+#ifdef POLLER_HAVE_POLL
+    {
+      struct pollfd *pfd = poller->pollfds + (entry - poller->entries);
+      pfd->fd = events ? fd : -1;
+      pfd->events = ToPollEvents(events);
+    }
+#endif
+      break;
+
+    case FTP_CLIENT_POLLER_BACKEND_EPOLL:
+#ifdef POLLER_HAVE_EPOLL
+      if (!UpdateEpoll(poller, fd, entry->events, events)) {
+        int error = errno;
+        if (!entry->events) {
+          FTPPollerRemove(poller, fd);
+        }
+        errno = error;
+        return false;
+      }
+#endif
+      break;
+
+    default:
+      UpdateSelectSets(poller, fd, events);
+      if (fd > poller->max_fd) {
+        poller->max_fd = fd;
+      }
+      break;
+  }
+
+  entry->events = events;
+  entry->owner = owner;
+  entry->userdata = userdata;
+  return true;
+}
+
+void FTPPollerRemove(FTPPoller *poller, int fd) {
+  struct FTPPollerEntry *entry = FindEntry(poller, fd);
+  if (!entry) {
+    return;
+  }
+
+  switch (poller->backend) {
+    case FTP_CLIENT_POLLER_BACKEND_EPOLL:
+#ifdef POLLER_HAVE_EPOLL
+      UpdateEpoll(poller, fd, entry->events, 0);
+#endif
+      break;
+
+    case FTP_CLIENT_POLLER_BACKEND_SELECT:
+      UpdateSelectSets(poller, fd, 0);
+      if (fd == poller->max_fd) {
+        poller->max_fd = -1;
+        for (size_t i = 0; i < poller->entry_count; ++i) {
+          if (poller->entries[i].fd != fd &&
+              poller->entries[i].fd > poller->max_fd) {
+            poller->max_fd = poller->entries[i].fd;
+          }
+        }
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  // Keep the entries packed by moving the last one into the vacated slot.
+  size_t index = (size_t)(entry - poller->entries);
+  size_t last = poller->entry_count - 1;
+  if (index != last) {
+    poller->entries[index] = poller->entries[last];
+    poller->slots[poller->entries[index].fd] = index + 1;
+#ifdef POLLER_HAVE_POLL
+    if (poller->backend == FTP_CLIENT_POLLER_BACKEND_POLL) {
+      poller->pollfds[index] = poller->pollfds[last];
+    }
+#endif
+  }
+  poller->slots[fd] = 0;
+  poller->entry_count = last;
+
+  // The socket may be closed and its descriptor reused before the rest of the
+  // current batch is dispatched.
+  for (size_t i = 0; i < poller->ready_count; ++i) {
+    if (poller->ready[i].fd == fd) {
+      poller->ready[i].events = 0;
+    }
+  }
+}
+
+//! Grows `ready` to hold a result for every registered socket and starts a new
+//! batch. Returns false and sets errno on failure.
+static bool StartBatch(FTPPoller *poller, FTPPollerEvent **events) {
+  poller->ready_count = 0;
+  if (poller->ready_capacity < poller->entry_count) {
+    FTPPollerEvent *ready = (FTPPollerEvent *)realloc(
+        poller->ready, poller->entry_capacity * sizeof(*ready));
+    if (!ready) {
+      errno = ENOMEM;
+      return false;
+    }
+    poller->ready = ready;
+    poller->ready_capacity = poller->entry_capacity;
+  }
+  *events = poller->ready;
+  return true;
+}
+
+//! Adds a result for the given entry, restricted to its registered interest.
+static void AddReadyEvent(FTPPoller *poller, const struct FTPPollerEntry *entry,
+                          uint32_t events) {
+  events &= entry->events;
+  if (!events) {
+    return;
+  }
+  FTPPollerEvent *event = poller->ready + poller->ready_count++;
+  event->fd = entry->fd;
+  event->events = events;
+  event->owner = entry->owner;
+  event->userdata = entry->userdata;
+}
+
+static int WaitSelect(FTPPoller *poller, uint32_t timeout_milliseconds) {
+  fd_set read_fds = poller->read_fds;
+  fd_set write_fds = poller->write_fds;
+
+  struct timeval tv;
+  tv.tv_sec = timeout_milliseconds / 1000;
+  tv.tv_usec = (timeout_milliseconds % 1000) * 1000;
+
+  int result = select(poller->max_fd + 1, &read_fds, &write_fds, NULL, &tv);
+  if (result <= 0) {
+    return result;
+  }
+
+  for (size_t i = 0; i < poller->entry_count; ++i) {
+    const struct FTPPollerEntry *entry = poller->entries + i;
+    uint32_t events = 0;
+    if (FD_ISSET(entry->fd, &read_fds)) {
+      events |= FTP_POLLER_EVENT_READ;
+    }
+    if (FD_ISSET(entry->fd, &write_fds)) {
+      events |= FTP_POLLER_EVENT_WRITE;
+    }
+    AddReadyEvent(poller, entry, events);
+  }
+  return (int)poller->ready_count;
+}
+
+#ifdef POLLER_HAVE_POLL
+static int WaitPoll(FTPPoller *poller, uint32_t timeout_milliseconds) {
+  int result =
+      poll(poller->pollfds, poller->entry_count, (int)timeout_milliseconds);
+  if (result <= 0) {
+    return result;
+  }
+
+  for (size_t i = 0; i < poller->entry_count; ++i) {
+    short revents = poller->pollfds[i].revents;
+    if (!revents) {
+      continue;
+    }
+    uint32_t events = 0;
+    if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+      events = FTP_POLLER_EVENT_READ | FTP_POLLER_EVENT_WRITE;
+    }
+    if (revents & POLLIN) {
+      events |= FTP_POLLER_EVENT_READ;
+    }
+    if (revents & POLLOUT) {
+      events |= FTP_POLLER_EVENT_WRITE;
+    }
+    AddReadyEvent(poller, poller->entries + i, events);
+  }
+  return (int)poller->ready_count;
+}
+#endif
+
+#ifdef POLLER_HAVE_EPOLL
+static int WaitEpoll(FTPPoller *poller, uint32_t timeout_milliseconds) {
+  if (!poller->entry_count) {
+    // epoll_wait() rejects a zero-sized result buffer.
+    struct epoll_event unused;
+    return epoll_wait(poller->epoll_fd, &unused, 1, (int)timeout_milliseconds);
+  }
+
+  int result = epoll_wait(poller->epoll_fd, poller->epoll_events,
+                          (int)poller->entry_count, (int)timeout_milliseconds);
+  for (int i = 0; i < result; ++i) {
+    const struct epoll_event *event = poller->epoll_events + i;
+    struct FTPPollerEntry *entry = FindEntry(poller, event->data.fd);
+    if (!entry) {
+      continue;
+    }
+    uint32_t events = 0;
+    if (event->events & (EPOLLERR | EPOLLHUP)) {
+      events = FTP_POLLER_EVENT_READ | FTP_POLLER_EVENT_WRITE;
+    }
+    if (event->events & EPOLLIN) {
+      events |= FTP_POLLER_EVENT_READ;
+    }
+    if (event->events & EPOLLOUT) {
+      events |= FTP_POLLER_EVENT_WRITE;
+    }
+    AddReadyEvent(poller, entry, events);
+  }
+  return result <= 0 ? result : (int)poller->ready_count;
+}
+#endif
+
+//! Consumes pending wakeups and removes the wakeup descriptor from the current
+//! batch.
+static int ConsumeWakeup(FTPPoller *poller, int result) {
+  if (result <= 0 || poller->wakeup_read_fd < 0) {
+    return result;
+  }
+
+  for (size_t i = 0; i < poller->ready_count; ++i) {
+    if (poller->ready[i].fd != poller->wakeup_read_fd) {
+      continue;
+    }
+#ifdef POLLER_HAVE_WAKEUP
+    char buffer[64];
+    while (read(poller->wakeup_read_fd, buffer, sizeof(buffer)) > 0) {
+    }
+#endif
+    poller->ready[i] = poller->ready[--poller->ready_count];
+    break;
+  }
+  return (int)poller->ready_count;
+}
+
+int FTPPollerWait(FTPPoller *poller, uint32_t timeout_milliseconds,
+                  FTPPollerEvent **events) {
+  if (!StartBatch(poller, events)) {
+    return -1;
+  }
+
+  int result;
+  switch (poller->backend) {
+#ifdef POLLER_HAVE_POLL
+    case FTP_CLIENT_POLLER_BACKEND_POLL:
+      result = WaitPoll(poller, timeout_milliseconds);
+      break;
+#endif
+#ifdef POLLER_HAVE_EPOLL
+    case FTP_CLIENT_POLLER_BACKEND_EPOLL:
+      result = WaitEpoll(poller, timeout_milliseconds);
+      break;
+#endif
+    default:
+      result = WaitSelect(poller, timeout_milliseconds);
+      break;
+  }
+  return ConsumeWakeup(poller, result);
+}
+
+bool FTPPollerEnableWakeup(FTPPoller *poller) {
+  if (poller->wakeup_read_fd >= 0) {
+    return true;
+  }
+
+#ifdef POLLER_HAVE_WAKEUP
+  int fds[2];
+#if defined(HAVE_EVENTFD)
+  fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fds[0] < 0) {
+    return false;
+  }
+  fds[1] = fds[0];
+#else
+  if (pipe(fds)) {
+    return false;
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK) < 0 ||
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC) < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      return false;
+    }
+  }
+#endif
+
+  if (!FTPPollerSet(poller, fds[0], FTP_POLLER_EVENT_READ, NULL, NULL)) {
+    int error = errno;
+    close(fds[0]);
+    if (fds[1] != fds[0]) {
+      close(fds[1]);
+    }
+    errno = error;
+    return false;
+  }
+  poller->wakeup_read_fd = fds[0];
+  poller->wakeup_write_fd = fds[1];
+  return true;
+#else
+  errno = ENOSYS;
+  return false;
+#endif
+}
+
+bool FTPPollerWake(FTPPoller *poller) {
+#ifdef POLLER_HAVE_WAKEUP
+  if (poller->wakeup_write_fd < 0) {
+    return false;
+  }
+  // A full pipe or a saturated eventfd already guarantees a wakeup.
+#if defined(HAVE_EVENTFD)
+  uint64_t value = 1;
+#else
+  char value = 1;
+#endif
+  ssize_t result = write(poller->wakeup_write_fd, &value, sizeof(value));
+  (void)result;
+  return true;
+#else
+  (void)poller;
+  return false;
+#endif
+}
+
+size_t FTPPollerGetInterest(const FTPPoller *poller,
+                            FTPClientPollDescriptor *descriptors,
+                            size_t max_descriptors) {
+  size_t count = 0;
+  for (size_t i = 0; i < poller->entry_count; ++i) {
+    const struct FTPPollerEntry *entry = poller->entries + i;
+    if (!entry->events || entry->fd == poller->wakeup_read_fd) {
+      continue;
+    }
+    if (descriptors && count < max_descriptors) {
+      descriptors[count].fd = entry->fd;
+      descriptors[count].events = entry->events;
+    }
+    ++count;
+  }
+  return count;
+}
+
+int FTPPollerCollect(FTPPoller *poller, const FTPClientPollDescriptor *ready,
+                     size_t ready_count, FTPPollerEvent **events) {
+  if (!StartBatch(poller, events)) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < ready_count; ++i) {
+    const struct FTPPollerEntry *entry = FindEntry(poller, ready[i].fd);
+    if (!entry || entry->fd == poller->wakeup_read_fd) {
+      continue;
+    }
+
+    // Merge duplicates so that each socket is dispatched at most once.
+    bool merged = false;
+    for (size_t j = 0; j < poller->ready_count && !merged; ++j) {
+      if (poller->ready[j].fd == entry->fd) {
+        poller->ready[j].events |= ready[i].events & entry->events;
+        merged = true;
+      }
+    }
+    if (!merged) {
+      AddReadyEvent(poller, entry, ready[i].events);
+    }
+  }
+  return (int)poller->ready_count;
+}
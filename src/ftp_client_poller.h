@@ -0,0 +1,87 @@
+#ifndef FTP_CLIENT_POLLER_H
+#define FTP_CLIENT_POLLER_H
+
+// Socket readiness notification used internally by the FTP client.
+//
+// Interest is registered once per socket and updated only when it changes, so
+// the per-wait cost depends on the backend rather than on rebuilding the
+// interest set: select() and poll() still scan every registered socket in the
+// kernel and when collecting results, while epoll only reports ready ones.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ftp_client.h"
+
+// Matches the public FTP_CLIENT_EVENT_* flags.
+#define FTP_POLLER_EVENT_READ FTP_CLIENT_EVENT_READ
+#define FTP_POLLER_EVENT_WRITE FTP_CLIENT_EVENT_WRITE
+
+typedef struct FTPPoller FTPPoller;
+
+typedef struct FTPPollerEvent {
+  int fd;
+  //! FTP_POLLER_EVENT_* flags that are ready. Errors and hangups are reported
+  //! as readiness for every registered event so that the subsequent
+  //! read/write surfaces them. Cleared if the socket is removed while the
+  //! batch is being dispatched.
+  uint32_t events;
+  void *owner;
+  void *userdata;
+} FTPPollerEvent;
+
+//! Returns whether the given backend is available in this build.
+//! FTP_CLIENT_POLLER_BACKEND_DEFAULT is always available.
+bool FTPPollerBackendIsSupported(FTPClientPollerBackend backend);
+
+//! Resolves FTP_CLIENT_POLLER_BACKEND_DEFAULT to the preferred backend.
+FTPClientPollerBackend FTPPollerResolveBackend(FTPClientPollerBackend backend);
+
+//! Creates a poller using the given backend. Returns NULL if the backend is
+//! unsupported or resources could not be allocated.
+FTPPoller *FTPPollerCreate(FTPClientPollerBackend backend);
+
+void FTPPollerDestroy(FTPPoller *poller);
+
+//! Registers `fd` or replaces its interest, owner and userdata. An `events`
+//! value of 0 keeps the socket registered without waiting on it. `owner`
+//! identifies the client the socket belongs to when a poller is shared.
+//! Returns false and sets errno on failure.
+bool FTPPollerSet(FTPPoller *poller, int fd, uint32_t events, void *owner,
+                  void *userdata);
+
+//! Unregisters `fd`. Must be called before the socket is closed.
+void FTPPollerRemove(FTPPoller *poller, int fd);
+
+//! Waits up to `timeout_milliseconds` for registered sockets to become ready.
+//! Returns the number of entries in `*events`, which remain valid until the
+//! next call, or -1 and sets errno on failure.
+int FTPPollerWait(FTPPoller *poller, uint32_t timeout_milliseconds,
+                  FTPPollerEvent **events);
+
+//! Registers an internal descriptor that FTPPollerWake makes readable so that
+//! a wait can be interrupted from another thread. Wakeups are consumed by
+//! FTPPollerWait and never reported as events. Returns false and sets errno if
+//! unsupported (e.g., on nxdk) or on failure.
+bool FTPPollerEnableWakeup(FTPPoller *poller);
+
+//! Causes the current or next FTPPollerWait to return promptly. Safe to call
+//! from any thread once FTPPollerEnableWakeup has succeeded. Returns false
+//! without doing anything otherwise.
+bool FTPPollerWake(FTPPoller *poller);
+
+//! Copies up to `max_descriptors` registered sockets that have interest into
+//! `descriptors`. Returns the total number of such sockets.
+size_t FTPPollerGetInterest(const FTPPoller *poller,
+                            FTPClientPollDescriptor *descriptors,
+                            size_t max_descriptors);
+
+//! Builds a batch of events from readiness determined by the caller (e.g., an
+//! external event loop) in place of FTPPollerWait. Unregistered sockets are
+//! ignored and events are restricted to the registered interest. Returns -1
+//! and sets errno on failure.
+int FTPPollerCollect(FTPPoller *poller, const FTPClientPollDescriptor *ready,
+                     size_t ready_count, FTPPollerEvent **events);
+
+#endif  // FTP_CLIENT_POLLER_H
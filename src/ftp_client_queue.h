@@ -0,0 +1,90 @@
+#ifndef FTP_CLIENT_QUEUE_H
+#define FTP_CLIENT_QUEUE_H
+
+// Intrusive multi-producer single-consumer queue used internally by the FTP
+// client to accept uploads from any thread.
+//
+// Producers push with a single atomic exchange and never wait on each other or
+// on the consumer. The consumer may briefly observe a push that has swapped
+// the head but not yet linked its predecessor, in which case FTPMPSCQueuePop
+// returns NULL and the node is returned by a later call.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//! Link embedded in each queued item.
+typedef struct FTPMPSCQueueNode {
+  _Atomic(struct FTPMPSCQueueNode *) next;
+} FTPMPSCQueueNode;
+
+typedef struct FTPMPSCQueue {
+  //! Most recently pushed node. Written by producers.
+  _Atomic(FTPMPSCQueueNode *) head;
+  //! Oldest node not yet popped. Owned by the consumer.
+  FTPMPSCQueueNode *tail;
+  //! Placeholder that keeps the queue non-empty so that producers never touch
+  //! `tail`.
+  FTPMPSCQueueNode stub;
+} FTPMPSCQueue;
+
+static inline void FTPMPSCQueueInit(FTPMPSCQueue *queue) {
+  atomic_init(&queue->stub.next, NULL);
+  atomic_init(&queue->head, &queue->stub);
+  queue->tail = &queue->stub;
+}
+
+//! Appends `node`. Safe to call from any thread.
+static inline void FTPMPSCQueuePush(FTPMPSCQueue *queue,
+                                    FTPMPSCQueueNode *node) {
+  atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+  FTPMPSCQueueNode *prev =
+      atomic_exchange_explicit(&queue->head, node, memory_order_acq_rel);
+  atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+//! Removes and returns the oldest node, or NULL if the queue is empty or the
+//! oldest push has not completed. Must only be called by the consumer.
+static inline FTPMPSCQueueNode *FTPMPSCQueuePop(FTPMPSCQueue *queue) {
+  FTPMPSCQueueNode *tail = queue->tail;
+  FTPMPSCQueueNode *next =
+      atomic_load_explicit(&tail->next, memory_order_acquire);
+
+  if (tail == &queue->stub) {
+    if (!next) {
+      return NULL;
+    }
+    queue->tail = next;
+    tail = next;
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+  }
+
+  if (next) {
+    queue->tail = next;
+    return tail;
+  }
+
+  // `tail` is the last linked node. Unless a producer is mid-push, re-insert
+  // the stub behind it so that it can be detached.
+  if (tail != atomic_load_explicit(&queue->head, memory_order_acquire)) {
+    return NULL;
+  }
+  FTPMPSCQueuePush(queue, &queue->stub);
+
+  next = atomic_load_explicit(&tail->next, memory_order_acquire);
+  if (next) {
+    queue->tail = next;
+    return tail;
+  }
+  return NULL;
+}
+
+//! Returns whether the queue has no nodes, including ones whose push is in
+//! progress. Must only be called by the consumer.
+static inline bool FTPMPSCQueueIsEmpty(FTPMPSCQueue *queue) {
+  return queue->tail == &queue->stub &&
+         atomic_load_explicit(&queue->head, memory_order_acquire) ==
+             &queue->stub;
+}
+
+#endif  // FTP_CLIENT_QUEUE_H
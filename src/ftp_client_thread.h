@@ -0,0 +1,134 @@
+#ifndef FTP_CLIENT_THREAD_H
+#define FTP_CLIENT_THREAD_H
+
+// Minimal threading primitives used internally by the FTP client. nxdk
+// provides C11 threads while the host builds use pthreads (C11 threads are not
+// available on macOS).
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef NXDK
+#include <threads.h>
+
+typedef thrd_t FTPThread;
+typedef mtx_t FTPMutex;
+typedef cnd_t FTPCondition;
+#else
+#include <pthread.h>
+#include <sched.h>
+
+typedef pthread_t FTPThread;
+typedef pthread_mutex_t FTPMutex;
+typedef pthread_cond_t FTPCondition;
+#endif
+
+typedef int (*FTPThreadProc)(void *arg);
+
+#ifdef NXDK
+
+static inline bool FTPThreadCreate(FTPThread *thread, FTPThreadProc proc,
+                                   void *arg) {
+  return thrd_create(thread, proc, arg) == thrd_success;
+}
+
+static inline void FTPThreadJoin(FTPThread thread) { thrd_join(thread, NULL); }
+
+static inline void FTPThreadYield(void) { thrd_yield(); }
+
+static inline bool FTPMutexInit(FTPMutex *mutex) {
+  return mtx_init(mutex, mtx_plain) == thrd_success;
+}
+
+static inline void FTPMutexDestroy(FTPMutex *mutex) { mtx_destroy(mutex); }
+
+static inline void FTPMutexLock(FTPMutex *mutex) { mtx_lock(mutex); }
+
+static inline void FTPMutexUnlock(FTPMutex *mutex) { mtx_unlock(mutex); }
+
+static inline bool FTPConditionInit(FTPCondition *condition) {
+  return cnd_init(condition) == thrd_success;
+}
+
+static inline void FTPConditionDestroy(FTPCondition *condition) {
+  cnd_destroy(condition);
+}
+
+static inline void FTPConditionWait(FTPCondition *condition, FTPMutex *mutex) {
+  cnd_wait(condition, mutex);
+}
+
+static inline void FTPConditionSignal(FTPCondition *condition) {
+  cnd_signal(condition);
+}
+
+#else
+
+struct FTPThreadStart {
+  FTPThreadProc proc;
+  void *arg;
+};
+
+static inline void *FTPThreadTrampoline(void *start_ptr) {
+  struct FTPThreadStart start = *(struct FTPThreadStart *)start_ptr;
+  free(start_ptr);
+  start.proc(start.arg);
+  return NULL;
+}
+
+static inline bool FTPThreadCreate(FTPThread *thread, FTPThreadProc proc,
+                                   void *arg) {
+  struct FTPThreadStart *start =
+      (struct FTPThreadStart *)malloc(sizeof(*start));
+  if (!start) {
+    return false;
+  }
+  start->proc = proc;
+  start->arg = arg;
+
+  if (pthread_create(thread, NULL, FTPThreadTrampoline, start)) {
+    free(start);
+    return false;
+  }
+  return true;
+}
+
+static inline void FTPThreadJoin(FTPThread thread) {
+  pthread_join(thread, NULL);
+}
+
+static inline void FTPThreadYield(void) { sched_yield(); }
+
+static inline bool FTPMutexInit(FTPMutex *mutex) {
+  return !pthread_mutex_init(mutex, NULL);
+}
+
+static inline void FTPMutexDestroy(FTPMutex *mutex) {
+  pthread_mutex_destroy(mutex);
+}
+
+static inline void FTPMutexLock(FTPMutex *mutex) { pthread_mutex_lock(mutex); }
+
+static inline void FTPMutexUnlock(FTPMutex *mutex) {
+  pthread_mutex_unlock(mutex);
+}
+
+static inline bool FTPConditionInit(FTPCondition *condition) {
+  return !pthread_cond_init(condition, NULL);
+}
+
+static inline void FTPConditionDestroy(FTPCondition *condition) {
+  pthread_cond_destroy(condition);
+}
+
+static inline void FTPConditionWait(FTPCondition *condition, FTPMutex *mutex) {
+  pthread_cond_wait(condition, mutex);
+}
+
+static inline void FTPConditionSignal(FTPCondition *condition) {
+  pthread_cond_signal(condition);
+}
+
+#endif  // NXDK
+
+#endif  // FTP_CLIENT_THREAD_H
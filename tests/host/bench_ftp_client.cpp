@@ -0,0 +1,473 @@
+// Host benchmarks for the FTP client.
+//
+// Usage: bench_ftp_client [benchmark_name ...]
+// Runs every benchmark if no names are given.
+
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fake_ftp_server.h"
+#include "ftp_client.h"
+#include "ftp_client_engine.h"
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint32_t kProcessTimeoutMilliseconds = 1;
+
+static double MillisecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+//! Returns the user + system CPU time consumed by the calling thread.
+static double ThreadCPUMilliseconds() {
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) * 1000.0 +
+         static_cast<double>(ts.tv_nsec) / 1000000.0;
+}
+
+//! Creates a client connected and logged in to the given server.
+static FTPClient *ConnectClient(const FakeFTPServer &server) {
+  FTPClient *context;
+  if (FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), server.port(),
+                    "user", "pass") != FTP_CLIENT_INIT_STATUS_SUCCESS) {
+    return nullptr;
+  }
+  if (FTPClientConnect(context, 1000) != FTP_CLIENT_CONNECT_STATUS_SUCCESS) {
+    FTPClientDestroy(&context);
+    return nullptr;
+  }
+
+  auto start = Clock::now();
+  while (!FTPClientIsFullyConnected(context)) {
+    if (FTPClientProcessStatusIsError(FTPClientProcess(context, 10)) ||
+        MillisecondsSince(start) > 5000) {
+      FTPClientDestroy(&context);
+      return nullptr;
+    }
+  }
+  return context;
+}
+
+struct LoopStats {
+  double elapsed_milliseconds{0};
+  //! Longest interval between successive returns from FTPClientProcess,
+  //! i.e., the longest time the application loop was blocked.
+  double max_stall_milliseconds{0};
+  //! Total time spent inside FTPClientProcess beyond its select timeout,
+  //! i.e., time the application loop was blocked on work other than waiting
+  //! for sockets.
+  double blocked_milliseconds{0};
+  bool failed{false};
+};
+
+//! Pumps the given client until `done` returns true.
+static LoopStats RunUntil(FTPClient *context,
+                          const std::function<bool()> &done) {
+  LoopStats stats;
+  auto start = Clock::now();
+  auto last_return = start;
+  while (!done()) {
+    auto call_start = Clock::now();
+    auto status = FTPClientProcess(context, kProcessTimeoutMilliseconds);
+    auto now = Clock::now();
+    double stall =
+        std::chrono::duration<double, std::milli>(now - last_return).count();
+    if (stall > stats.max_stall_milliseconds) {
+      stats.max_stall_milliseconds = stall;
+    }
+    double excess =
+        std::chrono::duration<double, std::milli>(now - call_start).count() -
+        kProcessTimeoutMilliseconds;
+    if (excess > 0) {
+      stats.blocked_milliseconds += excess;
+    }
+    last_return = now;
+
+    if (FTPClientProcessStatusIsError(status)) {
+      stats.failed = true;
+      break;
+    }
+  }
+  stats.elapsed_milliseconds = MillisecondsSince(start);
+  return stats;
+}
+
+static void SetFlagCallback(bool successful, void *userdata) {
+  *static_cast<bool *>(userdata) = true;
+}
+
+//! Uploads a file whose reads stall like a slow disk to a server that drains
+//! the data connection at a similar pace, with and without read-ahead.
+static void BenchmarkReadAhead() {
+  static constexpr size_t kChunkSize = 64 * 1024;
+  static constexpr size_t kChunkCount = 128;
+  static constexpr auto kDiskLatency = std::chrono::milliseconds(3);
+  static constexpr auto kNetworkLatency = std::chrono::milliseconds(3);
+
+  printf("read_ahead: %zu x %zu KiB chunks, %lld ms disk latency, %lld ms "
+         "network latency per chunk\n",
+         kChunkCount, kChunkSize / 1024,
+         static_cast<long long>(kDiskLatency.count()),
+         static_cast<long long>(kNetworkLatency.count()));
+
+  FakeFTPServer::Options server_options;
+  server_options.data_recv_chunk_size = kChunkSize;
+  server_options.data_recv_delay = kNetworkLatency;
+  server_options.data_receive_buffer_size = static_cast<int>(kChunkSize);
+  server_options.store_data = false;
+
+  for (bool read_ahead : {false, true}) {
+    FakeFTPServer server(server_options);
+    if (!server.Start()) {
+      printf("  failed to start server\n");
+      return;
+    }
+
+    // A FIFO whose writer sleeps between chunks stands in for a slow disk.
+    std::string fifo_path = "/tmp/bench_ftp_client_read_ahead_" +
+                            std::to_string(getpid()) + ".fifo";
+    unlink(fifo_path.c_str());
+    if (mkfifo(fifo_path.c_str(), 0600)) {
+      printf("  failed to create fifo: %s\n", strerror(errno));
+      return;
+    }
+
+    std::thread disk_thread([&fifo_path]() {
+      std::vector<char> chunk(kChunkSize, 'x');
+      FILE *fifo = fopen(fifo_path.c_str(), "wb");
+      if (!fifo) {
+        return;
+      }
+      for (size_t i = 0; i < kChunkCount; ++i) {
+        std::this_thread::sleep_for(kDiskLatency);
+        fwrite(chunk.data(), 1, chunk.size(), fifo);
+        fflush(fifo);
+      }
+      fclose(fifo);
+    });
+
+    FTPClient *context = ConnectClient(server);
+    if (!context) {
+      printf("  failed to connect\n");
+      disk_thread.join();
+      unlink(fifo_path.c_str());
+      return;
+    }
+
+    FTPClientSendOptions options;
+    FTPClientSendOptionsInit(&options);
+    options.chunk_size = kChunkSize;
+    options.disable_read_ahead = !read_ahead;
+
+    bool completed = false;
+    FTPClientSendFileWithOptions(context, fifo_path.c_str(), "bench.bin",
+                                 &options, SetFlagCallback, &completed);
+    auto stats = RunUntil(context, [&completed]() { return completed; });
+
+    disk_thread.join();
+    unlink(fifo_path.c_str());
+    FTPClientDestroy(&context);
+
+    printf(
+        "  read_ahead=%-3s elapsed %8.1f ms  loop blocked %8.1f ms  max loop "
+        "stall %6.1f ms%s\n",
+        read_ahead ? "on" : "off", stats.elapsed_milliseconds,
+        stats.blocked_milliseconds, stats.max_stall_milliseconds,
+        stats.failed ? "  FAILED" : "");
+  }
+}
+
+//! Uploads a large regular file through the stdio path and through the
+//! sendfile()/mmap() path, reporting the CPU time spent by the thread driving
+//! FTPClientProcess.
+static void BenchmarkZeroCopy() {
+  static constexpr size_t kFileSize = 512 * 1024 * 1024;
+  static constexpr size_t kChunkSize = 64 * 1024;
+  static constexpr double kGiB = 1024.0 * 1024.0 * 1024.0;
+
+  printf("zero_copy: %zu MiB regular file\n", kFileSize / (1024 * 1024));
+
+  std::string file_path =
+      "/tmp/bench_ftp_client_zero_copy_" + std::to_string(getpid()) + ".bin";
+  {
+    std::vector<char> chunk(kChunkSize);
+    for (size_t i = 0; i < chunk.size(); ++i) {
+      chunk[i] = static_cast<char>(i * 31);
+    }
+    std::ofstream outfile(file_path, std::ios::binary);
+    for (size_t written = 0; written < kFileSize; written += chunk.size()) {
+      outfile.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+    }
+    if (!outfile) {
+      printf("  failed to create %s\n", file_path.c_str());
+      unlink(file_path.c_str());
+      return;
+    }
+  }
+
+  FakeFTPServer::Options server_options;
+  server_options.data_recv_chunk_size = 256 * 1024;
+  server_options.store_data = false;
+
+  for (bool zero_copy : {false, true}) {
+    FakeFTPServer server(server_options);
+    if (!server.Start()) {
+      printf("  failed to start server\n");
+      break;
+    }
+
+    FTPClient *context = ConnectClient(server);
+    if (!context) {
+      printf("  failed to connect\n");
+      break;
+    }
+
+    // Reads are kept on this thread so that the stdio copy is attributed to
+    // the measured thread.
+    FTPClientSendOptions options;
+    FTPClientSendOptionsInit(&options);
+    options.chunk_size = kChunkSize;
+    options.disable_read_ahead = true;
+    options.disable_zero_copy = !zero_copy;
+
+    bool completed = false;
+    double cpu_start = ThreadCPUMilliseconds();
+    FTPClientSendFileWithOptions(context, file_path.c_str(), "bench.bin",
+                                 &options, SetFlagCallback, &completed);
+    auto stats = RunUntil(context, [&completed]() { return completed; });
+    double cpu_milliseconds = ThreadCPUMilliseconds() - cpu_start;
+    FTPClientDestroy(&context);
+
+    double gib = static_cast<double>(kFileSize) / kGiB;
+    printf(
+        "  %-9s elapsed %8.1f ms  client CPU %8.1f ms  (%7.1f ms/GiB, %6.2f "
+        "GiB/s)%s\n",
+        zero_copy ? "zero-copy" : "stdio", stats.elapsed_milliseconds,
+        cpu_milliseconds, cpu_milliseconds / gib,
+        gib / (stats.elapsed_milliseconds / 1000.0),
+        stats.failed ? "  FAILED" : "");
+  }
+
+  unlink(file_path.c_str());
+}
+
+//! Submits uploads from a growing number of producer threads while the
+//! calling thread drains them, reporting the aggregate submission rate. The
+//! client is never connected so that only the submission path is measured.
+static void BenchmarkSubmission() {
+  static constexpr size_t kUploadCount = 100000;
+  static constexpr char kBuffer[] = "submission benchmark";
+
+  printf("submission: %zu uploads per run\n", kUploadCount);
+
+  for (size_t producer_count : {1, 2, 4, 8}) {
+    FTPClient *context;
+    if (FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), 21, "user",
+                      "pass") != FTP_CLIENT_INIT_STATUS_SUCCESS) {
+      printf("  failed to create client\n");
+      return;
+    }
+    FTPClientSetMaxActiveOperations(context, 1);
+
+    std::atomic<bool> start{false};
+    std::atomic<size_t> failures{0};
+    std::vector<std::thread> producers;
+    const size_t per_producer = kUploadCount / producer_count;
+    for (size_t i = 0; i < producer_count; ++i) {
+      producers.emplace_back([&]() {
+        while (!start) {
+          std::this_thread::yield();
+        }
+        for (size_t j = 0; j < per_producer; ++j) {
+          if (!FTPClientSendBuffer(context, "bench.bin", kBuffer,
+                                   sizeof(kBuffer), nullptr, nullptr)) {
+            ++failures;
+          }
+        }
+      });
+    }
+
+    const size_t expected = per_producer * producer_count;
+    size_t drained = 0;
+    auto run_start = Clock::now();
+    start = true;
+    while (drained + failures < expected) {
+      FTPClientGetQueuedUploads(context, &drained, nullptr);
+    }
+    double elapsed = MillisecondsSince(run_start);
+    for (auto &producer : producers) {
+      producer.join();
+    }
+    FTPClientDestroy(&context);
+
+    printf("  producers=%zu elapsed %8.1f ms  %6.2f M submissions/s%s\n",
+           producer_count, elapsed,
+           static_cast<double>(expected) / elapsed / 1000.0,
+           failures ? "  FAILED" : "");
+  }
+}
+
+//! Uploads many in-memory files through FTPClientEngine with an increasing
+//! number of worker threads, reporting the aggregate throughput.
+static void BenchmarkEngineScaling() {
+  static constexpr size_t kUploadCount = 4000;
+  static constexpr size_t kUploadSize = 64 * 1024;
+  static constexpr size_t kSessionsPerWorker = 4;
+  static constexpr double kMiB = 1024.0 * 1024.0;
+
+  size_t max_workers = std::thread::hardware_concurrency();
+  if (max_workers < 1) {
+    max_workers = 1;
+  } else if (max_workers > 16) {
+    max_workers = 16;
+  }
+
+  printf("engine_scaling: %zu x %zu KiB uploads, %zu sessions per worker\n",
+         kUploadCount, kUploadSize / 1024, kSessionsPerWorker);
+
+  std::vector<char> buffer(kUploadSize, 'e');
+  FakeFTPServer::Options server_options;
+  server_options.data_recv_chunk_size = 256 * 1024;
+  server_options.store_data = false;
+
+  for (size_t workers = 1; workers <= max_workers; workers *= 2) {
+    FakeFTPServer server(server_options);
+    if (!server.Start()) {
+      printf("  failed to start server\n");
+      return;
+    }
+
+    FTPClientEngineOptions options;
+    FTPClientEngineOptionsInit(&options);
+    options.ipv4_ip_host_ordered = ntohl(inet_addr("127.0.0.1"));
+    options.port_host_ordered = server.port();
+    options.username = "user";
+    options.password = "pass";
+    options.worker_count = workers;
+    options.sessions_per_worker = kSessionsPerWorker;
+    FTPClientEngine *engine = FTPClientEngineCreate(&options);
+    if (!engine) {
+      printf("  failed to create engine\n");
+      return;
+    }
+
+    std::atomic<size_t> finished{0};
+    auto start = Clock::now();
+    for (size_t i = 0; i < kUploadCount; ++i) {
+      FTPClientEngineSendBuffer(
+          engine, "bench.bin", buffer.data(), buffer.size(),
+          [](bool successful, void *userdata) {
+            ++*static_cast<std::atomic<size_t> *>(userdata);
+          },
+          &finished);
+    }
+    while (finished < kUploadCount && MillisecondsSince(start) < 60000) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double elapsed = MillisecondsSince(start);
+
+    FTPClientEngineStats stats;
+    FTPClientEngineGetStats(engine, &stats);
+    FTPClientEngineDestroy(&engine);
+
+    double mib = static_cast<double>(stats.completed_operations) *
+                 static_cast<double>(kUploadSize) / kMiB;
+    printf(
+        "  workers=%-2zu elapsed %8.1f ms  %8.1f MiB/s  %8.0f uploads/s  "
+        "stolen %6llu%s\n",
+        workers, elapsed, mib / (elapsed / 1000.0),
+        static_cast<double>(stats.completed_operations) / (elapsed / 1000.0),
+        static_cast<unsigned long long>(stats.stolen_operations),
+        stats.failed_operations || finished < kUploadCount ? "  FAILED" : "");
+  }
+}
+
+//! Uploads a single large buffer split into an increasing number of ranges to a
+//! server whose data connections each drain at a limited rate, as over a link
+//! with high latency, reporting the throughput of the upload.
+static void BenchmarkStriping() {
+  static constexpr size_t kUploadSize = 64 * 1024 * 1024;
+  static constexpr size_t kMinStripeSize = 1024 * 1024;
+  static constexpr auto kNetworkLatency = std::chrono::milliseconds(2);
+  static constexpr double kMiB = 1024.0 * 1024.0;
+
+  printf("striping: %zu MiB buffer, %lld ms per 64 KiB received\n",
+         kUploadSize / (1024 * 1024),
+         static_cast<long long>(kNetworkLatency.count()));
+
+  std::vector<char> buffer(kUploadSize, 's');
+  FakeFTPServer::Options server_options;
+  server_options.data_recv_chunk_size = 64 * 1024;
+  server_options.data_recv_delay = kNetworkLatency;
+  server_options.data_receive_buffer_size = 64 * 1024;
+  server_options.store_data = false;
+
+  for (size_t stripe_count : {1, 2, 4, 8}) {
+    FakeFTPServer server(server_options);
+    if (!server.Start()) {
+      printf("  failed to start server\n");
+      return;
+    }
+
+    FTPClient *context = ConnectClient(server);
+    if (!context) {
+      printf("  failed to connect\n");
+      return;
+    }
+    FTPClientSetStriping(context, stripe_count, kMinStripeSize);
+
+    bool completed = false;
+    FTPClientSendBuffer(context, "bench.bin", buffer.data(), buffer.size(),
+                        SetFlagCallback, &completed);
+    auto stats = RunUntil(context, [&completed]() { return completed; });
+    FTPClientDestroy(&context);
+
+    printf("  stripes=%zu elapsed %8.1f ms  %8.1f MiB/s%s\n", stripe_count,
+           stats.elapsed_milliseconds,
+           static_cast<double>(kUploadSize) / kMiB /
+               (stats.elapsed_milliseconds / 1000.0),
+           stats.failed || server.total_bytes_received() != kUploadSize
+               ? "  FAILED"
+               : "");
+  }
+}
+
+struct Benchmark {
+  const char *name;
+  void (*run)();
+};
+
+static const Benchmark kBenchmarks[] = {
+    {"read_ahead", BenchmarkReadAhead},
+    {"zero_copy", BenchmarkZeroCopy},
+    {"submission", BenchmarkSubmission},
+    {"engine_scaling", BenchmarkEngineScaling},
+    {"striping", BenchmarkStriping},
+};
+
+int main(int argc, char **argv) {
+  for (const auto &benchmark : kBenchmarks) {
+    bool selected = argc < 2;
+    for (int i = 1; i < argc && !selected; ++i) {
+      selected = !strcmp(argv[i], benchmark.name);
+    }
+    if (selected) {
+      benchmark.run();
+    }
+  }
+  return 0;
+}
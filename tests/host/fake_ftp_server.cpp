@@ -0,0 +1,334 @@
+#include "fake_ftp_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static constexpr int kPollIntervalMilliseconds = 100;
+
+FakeFTPServer::FakeFTPServer() : FakeFTPServer(Options{}) {}
+
+FakeFTPServer::FakeFTPServer(const Options &options) : options_(options) {}
+
+FakeFTPServer::~FakeFTPServer() { Stop(); }
+
+bool FakeFTPServer::Start() {
+  server_socket_ = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (server_socket_ < 0) {
+    return false;
+  }
+
+  int opt = 1;
+  setsockopt(server_socket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = 0;
+#ifdef __APPLE__
+  addr.sin_len = sizeof(addr);
+#endif
+
+  socklen_t addr_len = sizeof(addr);
+  if (bind(server_socket_, reinterpret_cast<sockaddr *>(&addr), addr_len) ||
+      getsockname(server_socket_, reinterpret_cast<sockaddr *>(&addr),
+                  &addr_len) ||
+      listen(server_socket_, SOMAXCONN)) {
+    close(server_socket_);
+    server_socket_ = -1;
+    return false;
+  }
+  port_ = ntohs(addr.sin_port);
+
+  running_ = true;
+  accept_thread_ = std::thread(&FakeFTPServer::AcceptThreadProc, this);
+  return true;
+}
+
+void FakeFTPServer::Stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+
+  accept_thread_.join();
+  close(server_socket_);
+  server_socket_ = -1;
+
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard lock(sessions_mutex_);
+    threads.swap(session_threads_);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+std::string FakeFTPServer::GetFile(const std::string &filename) {
+  std::lock_guard lock(files_mutex_);
+  auto it = files_.find(filename);
+  return it == files_.end() ? std::string() : it->second;
+}
+
+size_t FakeFTPServer::GetFileSize(const std::string &filename) {
+  std::lock_guard lock(files_mutex_);
+  auto it = file_sizes_.find(filename);
+  return it == file_sizes_.end() ? 0 : it->second;
+}
+
+void FakeFTPServer::AcceptThreadProc() {
+  while (running_) {
+    pollfd pfd{server_socket_, POLLIN, 0};
+    if (poll(&pfd, 1, kPollIntervalMilliseconds) <= 0) {
+      continue;
+    }
+
+    int client_socket = accept(server_socket_, nullptr, nullptr);
+    if (client_socket < 0) {
+      continue;
+    }
+    // Otherwise the final reply to a transfer is held back until the client's
+    // delayed ACK of the preliminary reply.
+    int opt = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    ++sessions_accepted_;
+    std::lock_guard lock(sessions_mutex_);
+    session_threads_.emplace_back(&FakeFTPServer::SessionThreadProc, this,
+                                  client_socket);
+  }
+}
+
+void FakeFTPServer::SessionThreadProc(int client_socket) {
+  Session session;
+  std::string pending;
+
+  if (SendAll(client_socket, "220 Fake FTP server ready.\r\n")) {
+    while (running_) {
+      pollfd pfd{client_socket, POLLIN, 0};
+      int poll_result = poll(&pfd, 1, kPollIntervalMilliseconds);
+      if (poll_result < 0) {
+        break;
+      }
+      if (!poll_result) {
+        continue;
+      }
+
+      char buffer[1024];
+      ssize_t bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
+      if (bytes_received <= 0) {
+        break;
+      }
+      pending.append(buffer, bytes_received);
+
+      bool keep_running = true;
+      size_t terminator;
+      while (keep_running &&
+             (terminator = pending.find("\r\n")) != std::string::npos) {
+        std::string command = pending.substr(0, terminator);
+        pending.erase(0, terminator + 2);
+        keep_running = HandleCommand(client_socket, command, session);
+      }
+      if (!keep_running) {
+        break;
+      }
+    }
+  }
+
+  if (session.pasv_socket >= 0) {
+    close(session.pasv_socket);
+  }
+  shutdown(client_socket, SHUT_RDWR);
+  close(client_socket);
+}
+
+bool FakeFTPServer::HandleCommand(int client_socket, const std::string &command,
+                                  Session &session) {
+  if (!command.compare(0, 4, "USER")) {
+    return SendAll(client_socket, "331 User name okay, send password.\r\n");
+  }
+  if (!command.compare(0, 4, "PASS")) {
+    return SendAll(client_socket, "230 User logged in, proceed.\r\n");
+  }
+  if (!command.compare(0, 4, "TYPE")) {
+    return SendAll(client_socket, "200 Switching to Binary mode.\r\n");
+  }
+  if (!command.compare(0, 4, "NOOP")) {
+    ++noop_commands_;
+    return SendAll(client_socket, "200 NOOP ok.\r\n");
+  }
+  if (!command.compare(0, 4, "SIZE")) {
+    std::lock_guard lock(files_mutex_);
+    auto file_size = file_sizes_.find(command.substr(5));
+    if (file_size == file_sizes_.end()) {
+      return SendAll(client_socket, "550 No such file.\r\n");
+    }
+    return SendAll(client_socket,
+                   "213 " + std::to_string(file_size->second) + "\r\n");
+  }
+  if (!command.compare(0, 4, "REST")) {
+    ++rest_commands_;
+    session.restart_offset = std::stoul(command.substr(5));
+    return SendAll(client_socket, "350 Restarting at " +
+                                      std::to_string(session.restart_offset) +
+                                      ".\r\n");
+  }
+  if (!command.compare(0, 4, "QUIT")) {
+    SendAll(client_socket, "221 Goodbye.\r\n");
+    return false;
+  }
+
+  if (!command.compare(0, 4, "PASV")) {
+    if (session.pasv_socket >= 0) {
+      close(session.pasv_socket);
+    }
+    int &pasv_socket = session.pasv_socket;
+    pasv_socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (pasv_socket < 0 ||
+        bind(pasv_socket, reinterpret_cast<sockaddr *>(&addr), addr_len) ||
+        getsockname(pasv_socket, reinterpret_cast<sockaddr *>(&addr),
+                    &addr_len) ||
+        listen(pasv_socket, 1)) {
+      return SendAll(client_socket, "425 Can't open data connection.\r\n");
+    }
+
+    int data_port = ntohs(addr.sin_port);
+    return SendAll(client_socket, "227 Entering Passive Mode (127,0,0,1," +
+                                      std::to_string(data_port / 256) + "," +
+                                      std::to_string(data_port % 256) +
+                                      ").\r\n");
+  }
+
+  if (!command.compare(0, 4, "STOR") || !command.compare(0, 4, "APPE")) {
+    if (++session.transfers == options_.drop_session_at_transfer) {
+      return false;
+    }
+    bool append = command[0] == 'A';
+    ReceiveFile(client_socket, session, command.substr(5), append);
+    return true;
+  }
+
+  return SendAll(client_socket, "502 Command not implemented.\r\n");
+}
+
+void FakeFTPServer::ReceiveFile(int client_socket, Session &session,
+                                const std::string &filename, bool append) {
+  size_t restart_offset = session.restart_offset;
+  session.restart_offset = 0;
+  int &pasv_socket = session.pasv_socket;
+  if (pasv_socket < 0) {
+    SendAll(client_socket, "425 Use PASV first.\r\n");
+    return;
+  }
+
+  // As with common servers, the file is opened, and truncated unless the
+  // transfer restarts at an offset, before the transfer is confirmed.
+  size_t position = restart_offset;
+  {
+    std::lock_guard lock(files_mutex_);
+    if (append) {
+      position = file_sizes_[filename];
+    } else if (!restart_offset) {
+      files_[filename].clear();
+      file_sizes_[filename] = 0;
+    }
+  }
+  SendAll(client_socket, "150 Go ahead.\r\n");
+
+  int data_socket = accept(pasv_socket, nullptr, nullptr);
+  close(pasv_socket);
+  pasv_socket = -1;
+  if (data_socket < 0) {
+    SendAll(client_socket, "425 Can't open data connection.\r\n");
+    return;
+  }
+
+  if (options_.data_receive_buffer_size) {
+    setsockopt(data_socket, SOL_SOCKET, SO_RCVBUF,
+               &options_.data_receive_buffer_size,
+               sizeof(options_.data_receive_buffer_size));
+  }
+
+  // Only the first upload to reach the drop offset is cut short.
+  size_t drop_remaining = 0;
+  if (options_.drop_data_at_offset && !data_dropped_ &&
+      position < options_.drop_data_at_offset) {
+    drop_remaining = options_.drop_data_at_offset - position;
+  }
+
+  std::vector<char> buffer(options_.data_recv_chunk_size);
+  ssize_t bytes_received;
+  for (;;) {
+    size_t recv_size = buffer.size();
+    if (drop_remaining && drop_remaining < recv_size) {
+      recv_size = drop_remaining;
+    }
+    bytes_received = recv(data_socket, buffer.data(), recv_size, 0);
+    if (bytes_received <= 0) {
+      break;
+    }
+    {
+      std::lock_guard lock(files_mutex_);
+      if (options_.store_data) {
+        std::string &file = files_[filename];
+        if (file.size() < position + bytes_received) {
+          file.resize(position + bytes_received);
+        }
+        file.replace(position, bytes_received, buffer.data(), bytes_received);
+      }
+      position += bytes_received;
+      file_sizes_[filename] = std::max(file_sizes_[filename], position);
+    }
+    total_bytes_received_ += bytes_received;
+
+    if (drop_remaining) {
+      drop_remaining -= bytes_received;
+      if (!drop_remaining && !data_dropped_.exchange(true)) {
+        // Reset rather than close so that the sender's writes fail.
+        linger reset{1, 0};
+        setsockopt(data_socket, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        close(data_socket);
+        SendAll(client_socket, "426 Connection closed; transfer aborted.\r\n");
+        return;
+      }
+    }
+
+    if (options_.data_recv_delay.count()) {
+      std::this_thread::sleep_for(options_.data_recv_delay);
+    }
+  }
+
+  close(data_socket);
+  ++completed_transfers_;
+  SendAll(client_socket, "226 Transfer complete.\r\n");
+}
+
+bool FakeFTPServer::SendAll(int sock, const std::string &data) {
+  const char *send_head = data.data();
+  size_t remaining = data.size();
+  while (remaining) {
+    ssize_t bytes_written = send(sock, send_head, remaining, MSG_NOSIGNAL);
+    if (bytes_written <= 0) {
+      return false;
+    }
+    send_head += bytes_written;
+    remaining -= bytes_written;
+  }
+  return true;
+}
@@ -0,0 +1,111 @@
+#ifndef FAKE_FTP_SERVER_H
+#define FAKE_FTP_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Minimal multi-session FTP server used by the benchmarks and stress tests.
+//!
+//! Each control connection is serviced by its own thread and handles
+//! USER/PASS/TYPE/PASV/STOR/APPE/SIZE/REST/NOOP/QUIT. Received files are kept
+//! in memory keyed by remote filename.
+class FakeFTPServer {
+ public:
+  struct Options {
+    //! Number of bytes read from a data connection per recv().
+    size_t data_recv_chunk_size{64 * 1024};
+    //! Delay applied after each recv() on a data connection, used to simulate
+    //! a slow link.
+    std::chrono::microseconds data_recv_delay{0};
+    //! SO_RCVBUF applied to accepted data connections. 0 keeps the default.
+    int data_receive_buffer_size{0};
+    //! Whether received file content should be retained. When false only the
+    //! byte counts are tracked.
+    bool store_data{true};
+    //! When non-zero, each session closes its control connection without
+    //! replying upon receiving its Nth STOR/APPE, simulating a dropped
+    //! connection mid-transfer.
+    size_t drop_session_at_transfer{0};
+    //! When non-zero, the first upload to reach this many bytes has its data
+    //! connection reset at that point and is answered with 426.
+    size_t drop_data_at_offset{0};
+  };
+
+  FakeFTPServer();
+  explicit FakeFTPServer(const Options &options);
+  ~FakeFTPServer();
+
+  //! Starts listening on an ephemeral loopback port.
+  bool Start();
+  void Stop();
+
+  [[nodiscard]] uint16_t port() const { return port_; }
+
+  //! Returns the content received for the given remote filename.
+  std::string GetFile(const std::string &filename);
+
+  //! Returns the number of bytes received for the given remote filename.
+  size_t GetFileSize(const std::string &filename);
+
+  [[nodiscard]] size_t total_bytes_received() const {
+    return total_bytes_received_;
+  }
+
+  [[nodiscard]] size_t completed_transfers() const {
+    return completed_transfers_;
+  }
+
+  [[nodiscard]] size_t sessions_accepted() const { return sessions_accepted_; }
+
+  [[nodiscard]] size_t noop_commands() const { return noop_commands_; }
+
+  [[nodiscard]] size_t rest_commands() const { return rest_commands_; }
+
+ private:
+  //! State of a single control connection.
+  struct Session {
+    int pasv_socket{-1};
+    //! Number of STOR/APPE commands received.
+    size_t transfers{0};
+    //! Offset set by REST for the next STOR.
+    size_t restart_offset{0};
+  };
+
+  void AcceptThreadProc();
+  void SessionThreadProc(int client_socket);
+
+  bool HandleCommand(int client_socket, const std::string &command,
+                     Session &session);
+  void ReceiveFile(int client_socket, Session &session,
+                   const std::string &filename, bool append);
+
+  static bool SendAll(int sock, const std::string &data);
+
+  Options options_;
+  int server_socket_{-1};
+  uint16_t port_{0};
+  std::atomic<bool> running_{false};
+
+  std::thread accept_thread_;
+  std::mutex sessions_mutex_;
+  std::vector<std::thread> session_threads_;
+
+  std::mutex files_mutex_;
+  std::map<std::string, std::string> files_;
+  std::map<std::string, size_t> file_sizes_;
+
+  std::atomic<size_t> total_bytes_received_{0};
+  std::atomic<size_t> completed_transfers_{0};
+  std::atomic<size_t> sessions_accepted_{0};
+  std::atomic<size_t> noop_commands_{0};
+  std::atomic<size_t> rest_commands_{0};
+  std::atomic<bool> data_dropped_{false};
+};
+
+#endif  // FAKE_FTP_SERVER_H
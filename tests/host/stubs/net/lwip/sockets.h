@@ -2,5 +2,6 @@
 #define SOCKETS_H
 
 #include <fcntl.h>
+#include <sys/uio.h>
 
 #endif  // SOCKETS_H
@@ -2,19 +2,31 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/fcntl.h>
+#include <sys/resource.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <csignal>
 #include <fstream>
 #include <future>
+#include <map>
+#include <mutex>
+#include <set>
 #include <thread>
 
+#include "fake_ftp_server.h"
 #include "ftp_client.h"
+#include "ftp_client_engine.h"
 #include "guard_flag.h"
 
 using ::testing::ElementsAre;
+using ::testing::IsEmpty;
 
 static constexpr uint32_t kSelectTimeoutMilliseconds = 500;
 static constexpr auto kTestTimeout = std::chrono::seconds(10);
@@ -70,6 +82,54 @@ TEST(RuntimeConfig, ftp_client_connect__with_invalid_context__returns_error) {
             FTP_CLIENT_CONNECT_STATUS_INVALID_CONTEXT);
 }
 
+TEST(RuntimeConfig, ftp_client_set_poller_backend__selects_backend) {
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, 0x7F000001, 21, nullptr, nullptr),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+
+  EXPECT_NE(FTPClientGetPollerBackend(context),
+            FTP_CLIENT_POLLER_BACKEND_DEFAULT);
+  EXPECT_TRUE(
+      FTPClientSetPollerBackend(context, FTP_CLIENT_POLLER_BACKEND_SELECT));
+  EXPECT_EQ(FTPClientGetPollerBackend(context),
+            FTP_CLIENT_POLLER_BACKEND_SELECT);
+
+  FTPClientDestroy(&context);
+}
+
+TEST(RuntimeConfig,
+     ftp_client_start_connect__with_refused_connection__fails_in_process) {
+  // Reserve an ephemeral port and release it so that nothing listens on it.
+  int reserved = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+  ASSERT_GE(reserved, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  socklen_t addr_len = sizeof(addr);
+  ASSERT_EQ(bind(reserved, reinterpret_cast<sockaddr *>(&addr), addr_len), 0);
+  ASSERT_EQ(
+      getsockname(reserved, reinterpret_cast<sockaddr *>(&addr), &addr_len),
+      0);
+  close(reserved);
+
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), ntohs(addr.sin_port),
+                "username", "password");
+  ASSERT_EQ(FTPClientStartConnect(context, 1000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+  EXPECT_FALSE(FTPClientIsFullyConnected(context));
+
+  auto status = FTP_CLIENT_PROCESS_STATUS_TIMEOUT;
+  for (int i = 0; i < 100 && status == FTP_CLIENT_PROCESS_STATUS_TIMEOUT;
+       ++i) {
+    status = FTPClientProcess(context, 10);
+  }
+  EXPECT_EQ(status, FTP_CLIENT_PROCESS_STATUS_CONNECT_FAILED);
+  EXPECT_EQ(FTPClientErrno(context), ECONNREFUSED);
+
+  FTPClientDestroy(&context);
+}
+
 class FTPServerFixture : public ::testing::Test {
  public:
   int server_socket{-1};
@@ -83,6 +143,12 @@ class FTPServerFixture : public ::testing::Test {
   GuardFlag test_completed;
 
   std::string received_data;
+  //! Data received per remote filename.
+  std::map<std::string, std::string> received_files;
+  //! Remote filenames for which STOR/APPE is refused.
+  std::set<std::string> rejected_filenames;
+  //! Final reply sent once a data connection has been drained.
+  std::string transfer_complete_reply{"226 Transfer complete.\r\n"};
 
   GuardFlag server_ready;
   GuardFlag connection_quiescent;
@@ -193,6 +259,7 @@ class FTPServerFixture : public ::testing::Test {
       SendAll(client_socket, response.c_str(), response.size());
     }
 
+    std::string pending_commands;
     while (true) {
       char buffer[1024];
 
@@ -217,29 +284,17 @@ class FTPServerFixture : public ::testing::Test {
         break;
       }
 
-      std::string command(buffer, bytes_received);
-
-      if (command.find("USER") != std::string::npos) {
-        user_events.emplace_back(command);
-        auto response = on_user(command);
-        SendAll(client_socket, response.c_str(), response.size());
-      } else if (command.find("PASS") != std::string::npos) {
-        pass_events.emplace_back(command);
-        auto response = on_password(command);
-        SendAll(client_socket, response.c_str(), response.size());
-      } else if (command.find("TYPE I") != std::string::npos) {
-        type_events.emplace_back(command);
-        SendAll(client_socket, "200 Switching to Binary mode.\r\n", 31);
-      } else if (command.find("PASV") != std::string::npos) {
-        OnPasv(client_socket);
-      } else if (command.find("STOR") != std::string::npos) {
-        stor_events.emplace_back(command);
-        OnStore(client_socket);
-      } else if (command.find("APPE") != std::string::npos) {
-        appe_events.emplace_back(command);
-        OnAppend(client_socket);
-      } else if (command.find("QUIT") != std::string::npos) {
-        SendAll(client_socket, "221 Goodbye.\r\n", 14);
+      // Pipelined commands may arrive in a single segment.
+      pending_commands.append(buffer, bytes_received);
+      size_t terminator;
+      bool quit = false;
+      while (!quit && (terminator = pending_commands.find("\r\n")) !=
+                          std::string::npos) {
+        std::string command = pending_commands.substr(0, terminator + 2);
+        pending_commands.erase(0, terminator + 2);
+        quit = !HandleCommand(client_socket, command);
+      }
+      if (quit) {
         break;
       }
     }
@@ -249,6 +304,45 @@ class FTPServerFixture : public ::testing::Test {
     close(client_socket);
   }
 
+  //! Handles a single command, returning false if the session should end.
+  bool HandleCommand(int client_socket, const std::string &command) {
+    if (command.find("USER") != std::string::npos) {
+      user_events.emplace_back(command);
+      auto response = on_user(command);
+      SendAll(client_socket, response.c_str(), response.size());
+    } else if (command.find("PASS") != std::string::npos) {
+      pass_events.emplace_back(command);
+      auto response = on_password(command);
+      SendAll(client_socket, response.c_str(), response.size());
+    } else if (command.find("TYPE I") != std::string::npos) {
+      type_events.emplace_back(command);
+      SendAll(client_socket, "200 Switching to Binary mode.\r\n", 31);
+    } else if (command.find("PASV") != std::string::npos) {
+      OnPasv(client_socket);
+    } else if ((!command.compare(0, 4, "STOR") ||
+                !command.compare(0, 4, "APPE")) &&
+               rejected_filenames.count(
+                   command.substr(5, command.size() - 7))) {
+      close(data_socket);
+      data_socket = -1;
+      SendAll(client_socket, "553 Requested action not taken.\r\n", 33);
+    } else if (command.find("STOR") != std::string::npos) {
+      stor_events.emplace_back(command);
+      OnStore(client_socket);
+      received_files[command.substr(5, command.size() - 7)] = received_data;
+    } else if (command.find("APPE") != std::string::npos) {
+      appe_events.emplace_back(command);
+      auto received_before = received_data.size();
+      OnAppend(client_socket);
+      received_files[command.substr(5, command.size() - 7)] +=
+          received_data.substr(received_before);
+    } else if (command.find("QUIT") != std::string::npos) {
+      SendAll(client_socket, "221 Goodbye.\r\n", 14);
+      return false;
+    }
+    return true;
+  }
+
   void OnPasv(int client_socket) {
     if (data_socket < 0) {
       data_socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -302,7 +396,8 @@ class FTPServerFixture : public ::testing::Test {
     close(data_client_socket);
     close(data_socket);
     data_socket = -1;
-    SendAll(client_socket, "226 Transfer complete.\r\n", 24);
+    SendAll(client_socket, transfer_complete_reply.c_str(),
+            transfer_complete_reply.size());
   }
 
   void OnAppend(int client_socket) {
@@ -324,7 +419,8 @@ class FTPServerFixture : public ::testing::Test {
     close(data_client_socket);
     close(data_socket);
     data_socket = -1;
-    SendAll(client_socket, "226 Transfer complete.\r\n", 24);
+    SendAll(client_socket, transfer_complete_reply.c_str(),
+            transfer_complete_reply.size());
   }
 
   static void SendAll(int sock, const void *buffer, size_t buffer_len) {
@@ -414,6 +510,56 @@ TEST_F(FTPServerFixture, ftp_client_connect__sends_username_and_password) {
   FTPClientDestroy(&context);
 }
 
+TEST_F(FTPServerFixture, ftp_client_connect__with_multiline_replies__logs_in) {
+  on_connect = [](const sockaddr_in *) {
+    return std::string(
+        "220-Welcome to the test FTP server\r\n"
+        "220-This banner spans\r\n"
+        " several lines, some without a reply code.\r\n"
+        "220 Ready\r\n");
+  };
+  on_password = [](const std::string &) {
+    return std::string(
+        "230-Logged in.\r\n"
+        "230 Proceed.\r\n");
+  };
+
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_THAT(user_events, ElementsAre("USER username\r\n"));
+  EXPECT_THAT(pass_events, ElementsAre("PASS password\r\n"));
+  EXPECT_THAT(type_events, ElementsAre("TYPE I\r\n"));
+
+  EXPECT_TRUE(FTPClientIsFullyConnected(context));
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture, ftp_client_connect__with_overlong_reply__logs_in) {
+  on_connect = [](const sockaddr_in *) {
+    return "220 " + std::string(4000, 'x') + "\r\n";
+  };
+
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_THAT(user_events, ElementsAre("USER username\r\n"));
+  EXPECT_TRUE(FTPClientIsFullyConnected(context));
+
+  FTPClientDestroy(&context);
+}
+
 TEST_F(FTPServerFixture, ftp_client_send_buffer) {
   FTPClient *context;
   FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
@@ -745,3 +891,2617 @@ TEST_F(FTPServerFixture, TestFTPClientAppendFile) {
 
   FTPClientDestroy(&context);
 }
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSendFileWithOptions__with_small_chunk_size__sends_everything) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  auto temp_filename = testing::TempDir() + "this_is_a_test_file.txt";
+  std::string buffer;
+  {
+    std::stringstream builder;
+    for (auto i = 0; i < 112; ++i) {
+      builder << "abcdefghijklmnopqrstuvwxyz1234567890\n";
+    }
+
+    buffer = builder.str();
+  }
+
+  std::ofstream outfile(temp_filename);
+  outfile << buffer;
+  outfile.close();
+
+  FTPClientSendOptions options;
+  FTPClientSendOptionsInit(&options);
+  options.chunk_size = 100;
+  options.chunk_mode = FTP_CLIENT_CHUNK_MODE_FIXED;
+  options.disable_zero_copy = true;
+
+  bool send_completed = false;
+  EXPECT_TRUE(FTPClientSendFileWithOptions(
+      context, temp_filename.c_str(), "remoteFile", &options,
+      SendCompletedCallback, &send_completed));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(received_data, buffer);
+  EXPECT_TRUE(send_completed);
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSendFile__with_adaptive_chunk_mode__sends_everything) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  FTPClientSetChunkMode(context, FTP_CLIENT_CHUNK_MODE_ADAPTIVE);
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  auto temp_filename = testing::TempDir() + "this_is_a_test_file.txt";
+  std::string buffer;
+  {
+    std::stringstream builder;
+    for (auto i = 0; i < 16384; ++i) {
+      builder << "abcdefghijklmnopqrstuvwxyz1234567890\n";
+    }
+
+    buffer = builder.str();
+  }
+
+  std::ofstream outfile(temp_filename);
+  outfile << buffer;
+  outfile.close();
+
+  FTPClientSendOptions options;
+  FTPClientSendOptionsInit(&options);
+  options.disable_zero_copy = true;
+
+  bool send_completed = false;
+  EXPECT_TRUE(FTPClientSendFileWithOptions(
+      context, temp_filename.c_str(), "remoteFile", &options,
+      SendCompletedCallback, &send_completed));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(received_data, buffer);
+  EXPECT_TRUE(send_completed);
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture, TestFTPClientSendFile__with_large_file__sends_all) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  auto temp_filename = testing::TempDir() + "this_is_a_large_test_file.bin";
+  std::string buffer;
+  buffer.reserve(4 * 1024 * 1024);
+  for (size_t i = 0; i < 4 * 1024 * 1024; ++i) {
+    buffer.push_back(static_cast<char>(i * 31 + (i >> 12)));
+  }
+
+  std::ofstream outfile(temp_filename, std::ios::binary);
+  outfile << buffer;
+  outfile.close();
+
+  bool send_completed = false;
+  EXPECT_TRUE(FTPClientSendFile(context, temp_filename.c_str(), "remoteFile",
+                                SendCompletedCallback, &send_completed));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(received_data.size(), buffer.size());
+  EXPECT_TRUE(received_data == buffer);
+  EXPECT_TRUE(send_completed);
+
+  FTPClientDestroy(&context);
+}
+
+static void InlineReadAheadExecutor(void (*work)(void *work_context),
+                                    void *work_context,
+                                    void *executor_userdata) {
+  ++*reinterpret_cast<int *>(executor_userdata);
+  work(work_context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSendFile__with_read_ahead_executor__uses_executor) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  int executor_calls = 0;
+  FTPClientSetReadAheadExecutor(context, InlineReadAheadExecutor,
+                                &executor_calls);
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  auto temp_filename = testing::TempDir() + "this_is_a_test_file.txt";
+  std::string buffer;
+  {
+    std::stringstream builder;
+    for (auto i = 0; i < 112; ++i) {
+      builder << "abcdefghijklmnopqrstuvwxyz1234567890\n";
+    }
+
+    buffer = builder.str();
+  }
+
+  std::ofstream outfile(temp_filename);
+  outfile << buffer;
+  outfile.close();
+
+  FTPClientSendOptions options;
+  FTPClientSendOptionsInit(&options);
+  options.chunk_size = 1024;
+  options.disable_zero_copy = true;
+
+  bool send_completed = false;
+  EXPECT_TRUE(FTPClientSendFileWithOptions(
+      context, temp_filename.c_str(), "remoteFile", &options,
+      SendCompletedCallback, &send_completed));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(received_data, buffer);
+  EXPECT_TRUE(send_completed);
+  // One fill per 1 KiB chunk plus the fill that observes the end of file.
+  EXPECT_EQ(executor_calls, 5);
+
+  FTPClientDestroy(&context);
+}
+
+//! Runs each fill on its own thread after a delay that simulates a slow disk.
+static void SlowReadAheadExecutor(void (*work)(void *work_context),
+                                  void *work_context, void *executor_userdata) {
+  auto delay =
+      *reinterpret_cast<std::chrono::milliseconds *>(executor_userdata);
+  std::thread([work, work_context, delay]() {
+    std::this_thread::sleep_for(delay);
+    work(work_context);
+  }).detach();
+}
+
+TEST(FTPClientReadAhead,
+     ftp_client_process__with_slow_fills__waits_for_wakeup) {
+  static constexpr size_t kChunkSize = 16 * 1024;
+  static constexpr size_t kChunkCount = 8;
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  auto temp_filename = testing::TempDir() + "ftp_client_slow_fill_source.bin";
+  std::string content(kChunkSize * kChunkCount, 's');
+  {
+    std::ofstream outfile(temp_filename, std::ios::binary);
+    outfile << content;
+  }
+
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  auto delay = std::chrono::milliseconds(20);
+  FTPClientSetReadAheadExecutor(context, SlowReadAheadExecutor, &delay);
+  ASSERT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  FTPClientSendOptions options;
+  FTPClientSendOptionsInit(&options);
+  options.chunk_size = kChunkSize;
+  options.disable_zero_copy = true;
+  bool send_completed = false;
+  EXPECT_TRUE(FTPClientSendFileWithOptions(
+      context, temp_filename.c_str(), "slow_fill", &options,
+      SendCompletedCallback, &send_completed));
+
+  size_t iterations = 0;
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while (!send_completed && std::chrono::steady_clock::now() < deadline) {
+    FTPClientProcess(context, 1000);
+    ++iterations;
+  }
+  EXPECT_TRUE(send_completed);
+  // Polling for each fill would take about one iteration per millisecond.
+  EXPECT_LT(iterations, kChunkCount * delay.count() / 4);
+
+  FTPClientDestroy(&context);
+  server.Stop();
+  EXPECT_EQ(server.GetFile("slow_fill"), content);
+  std::remove(temp_filename.c_str());
+}
+
+TEST_F(FTPServerFixture, TestFTPClientSendIov__sends_concatenated_segments) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  const char header[] = "HEADER\n";
+  const char ring_tail[] = "wrapped ring ";
+  const char ring_head[] = "buffer content\n";
+  const char trailer[] = "TRAILER";
+  const FTPClientIOVec segments[] = {
+      {header, strlen(header)},
+      {ring_tail, strlen(ring_tail)},
+      {nullptr, 0},
+      {ring_head, strlen(ring_head)},
+      {trailer, strlen(trailer)},
+  };
+
+  bool send_completed = false;
+  EXPECT_TRUE(FTPClientSendIov(context, "test.txt", segments,
+                               sizeof(segments) / sizeof(segments[0]),
+                               SendCompletedCallback, &send_completed));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(received_data, "HEADER\nwrapped ring buffer content\nTRAILER");
+  EXPECT_THAT(stor_events, ElementsAre("STOR test.txt\r\n"));
+  EXPECT_TRUE(send_completed);
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientAppendIov__with_many_segments__sends_everything) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  std::vector<std::string> pieces;
+  std::string expected;
+  for (auto i = 0; i < 100; ++i) {
+    pieces.emplace_back(std::string(i * 97, 'a' + (i % 26)));
+    expected += pieces.back();
+  }
+  std::vector<FTPClientIOVec> segments;
+  for (const auto &piece : pieces) {
+    segments.push_back({piece.data(), piece.size()});
+  }
+
+  EXPECT_TRUE(FTPClientAppendIov(context, "test.txt", segments.data(),
+                                 segments.size(), nullptr, nullptr));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(received_data, expected);
+  EXPECT_THAT(appe_events, ElementsAre("APPE test.txt\r\n"));
+
+  FTPClientDestroy(&context);
+}
+
+struct StreamState {
+  std::vector<std::string> chunks;
+  size_t next_chunk{0};
+  //! Number of times to report that no data is available before producing each
+  //! chunk.
+  int stalls_per_chunk{0};
+  int stalls_remaining{0};
+  bool fail_after_chunks{false};
+  int fill_calls{0};
+  bool completed{false};
+  bool successful{false};
+};
+
+static FTPClientStreamStatus FillFromStreamState(void *buffer,
+                                                 size_t buffer_len,
+                                                 size_t *bytes_written,
+                                                 void *userdata) {
+  auto state = reinterpret_cast<StreamState *>(userdata);
+  ++state->fill_calls;
+  *bytes_written = 0;
+
+  if (state->next_chunk == state->chunks.size()) {
+    return state->fail_after_chunks ? FTP_CLIENT_STREAM_STATUS_ERROR
+                                    : FTP_CLIENT_STREAM_STATUS_END;
+  }
+  if (state->stalls_remaining) {
+    --state->stalls_remaining;
+    return FTP_CLIENT_STREAM_STATUS_CONTINUE;
+  }
+
+  const auto &chunk = state->chunks[state->next_chunk++];
+  EXPECT_LE(chunk.size(), buffer_len);
+  memcpy(buffer, chunk.data(), chunk.size());
+  *bytes_written = chunk.size();
+  state->stalls_remaining = state->stalls_per_chunk;
+  return FTP_CLIENT_STREAM_STATUS_CONTINUE;
+}
+
+static void StreamCompletedCallback(bool successful, void *userdata) {
+  auto state = reinterpret_cast<StreamState *>(userdata);
+  state->completed = true;
+  state->successful = successful;
+}
+
+TEST_F(FTPServerFixture, TestFTPClientSendStream__sends_all_produced_data) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  StreamState state;
+  std::string expected;
+  for (auto i = 0; i < 8; ++i) {
+    state.chunks.emplace_back(std::string(100 + i * 50, 'a' + i));
+    expected += state.chunks.back();
+  }
+  state.stalls_per_chunk = 2;
+  state.stalls_remaining = 2;
+
+  FTPClientSendOptions options;
+  FTPClientSendOptionsInit(&options);
+  options.chunk_size = 512;
+
+  EXPECT_TRUE(FTPClientSendStream(context, "stream.bin", FillFromStreamState,
+                                  &options, StreamCompletedCallback, &state));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(received_data, expected);
+  EXPECT_THAT(stor_events, ElementsAre("STOR stream.bin\r\n"));
+  EXPECT_TRUE(state.completed);
+  EXPECT_TRUE(state.successful);
+  // Each chunk is preceded by two empty polls, plus the final END.
+  EXPECT_EQ(state.fill_calls, 8 * 3 + 1);
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture, TestFTPClientAppendStream__with_fill_error__fails) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  StreamState state;
+  state.chunks.emplace_back("partial");
+  state.fail_after_chunks = true;
+
+  EXPECT_TRUE(FTPClientAppendStream(context, "stream.bin", FillFromStreamState,
+                                    nullptr, StreamCompletedCallback, &state));
+
+  EXPECT_EQ(ProcessLoop(context, 100),
+            FTP_CLIENT_PROCESS_STATUS_STREAM_FILL_FAILED);
+  EXPECT_TRUE(state.completed);
+  EXPECT_FALSE(state.successful);
+  EXPECT_FALSE(FTPClientHasSendPending(context));
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_THAT(appe_events, ElementsAre("APPE stream.bin\r\n"));
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSendPayload__to_several_files__shares_one_copy) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  std::string source(64 * 1024, 'p');
+  FTPClientPayload *payload =
+      FTPClientPayloadCreate(source.data(), source.size());
+  ASSERT_NE(payload, nullptr);
+  // The payload owns its own copy of the data.
+  source.assign(source.size(), 'x');
+
+  bool first_completed = false;
+  EXPECT_TRUE(FTPClientSendPayload(context, "first.bin", payload,
+                                   SendCompletedCallback, &first_completed));
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+  connection_quiescent.ClearAndAwait();
+  EXPECT_TRUE(first_completed);
+  EXPECT_EQ(received_data, std::string(64 * 1024, 'p'));
+
+  // The in-flight operation keeps the payload alive after the caller releases
+  // its reference.
+  received_data.clear();
+  bool second_completed = false;
+  EXPECT_TRUE(FTPClientAppendPayload(context, "second.bin", payload,
+                                     SendCompletedCallback, &second_completed));
+  FTPClientPayloadRelease(&payload);
+  EXPECT_EQ(payload, nullptr);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+  connection_quiescent.ClearAndAwait();
+  EXPECT_TRUE(second_completed);
+  EXPECT_EQ(received_data, std::string(64 * 1024, 'p'));
+
+  EXPECT_THAT(stor_events, ElementsAre("STOR first.bin\r\n"));
+  EXPECT_THAT(appe_events, ElementsAre("APPE second.bin\r\n"));
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientAppendBuffer__beyond_active_limit__queues_in_order) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  FTPClientSetMaxActiveOperations(context, 1);
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  std::vector<std::string> contents;
+  std::vector<std::string> expected_events;
+  std::string expected;
+  for (auto i = 0; i < 10; ++i) {
+    contents.emplace_back(std::string(10 + i, 'a' + i));
+    expected += contents.back();
+    expected_events.emplace_back("APPE file" + std::to_string(i) + "\r\n");
+  }
+
+  int completed = 0;
+  auto on_complete = [](bool successful, void *userdata) {
+    EXPECT_TRUE(successful);
+    ++*reinterpret_cast<int *>(userdata);
+  };
+  for (auto i = 0; i < 10; ++i) {
+    auto filename = "file" + std::to_string(i);
+    EXPECT_TRUE(FTPClientAppendBuffer(context, filename.c_str(),
+                                      contents[i].data(), contents[i].size(),
+                                      on_complete, &completed));
+  }
+
+  size_t queued_operations = 0;
+  uint64_t queued_bytes = 0;
+  FTPClientGetQueuedUploads(context, &queued_operations, &queued_bytes);
+  EXPECT_EQ(queued_operations, 10);
+  EXPECT_EQ(queued_bytes, expected.size());
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(received_data, expected);
+  EXPECT_EQ(appe_events, expected_events);
+  EXPECT_EQ(completed, 10);
+  FTPClientGetQueuedUploads(context, &queued_operations, &queued_bytes);
+  EXPECT_EQ(queued_operations, 0);
+  EXPECT_EQ(queued_bytes, 0);
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSendFile__queued_file_removed__fails_upload) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  FTPClientSetMaxActiveOperations(context, 1);
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  std::string filenames[2];
+  const char buffer[] = "This is the content of the file.";
+  for (auto i = 0; i < 2; ++i) {
+    filenames[i] =
+        testing::TempDir() + "queued_file_" + std::to_string(i) + ".txt";
+    std::ofstream outfile(filenames[i]);
+    outfile << buffer;
+  }
+
+  std::map<int, bool> results;
+  struct Completion {
+    std::map<int, bool> *results;
+    int index;
+  } completions[2] = {{&results, 0}, {&results, 1}};
+  auto on_complete = [](bool successful, void *userdata) {
+    auto completion = reinterpret_cast<Completion *>(userdata);
+    (*completion->results)[completion->index] = successful;
+  };
+  for (auto i = 0; i < 2; ++i) {
+    EXPECT_TRUE(FTPClientSendFile(context, filenames[i].c_str(), nullptr,
+                                  on_complete, &completions[i]));
+  }
+
+  // Queued files are reopened on activation, which only happens once the
+  // client is driven; queries do not start them.
+  EXPECT_TRUE(FTPClientHasSendPending(context));
+  size_t queued_operations = 0;
+  uint64_t queued_bytes = 0;
+  FTPClientGetQueuedUploads(context, &queued_operations, &queued_bytes);
+  EXPECT_EQ(queued_operations, 2);
+  std::remove(filenames[1].c_str());
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  EXPECT_EQ(results, (std::map<int, bool>{{0, true}, {1, false}}));
+  FTPClientGetQueuedUploads(context, &queued_operations, &queued_bytes);
+  EXPECT_EQ(queued_operations, 0);
+  EXPECT_EQ(queued_bytes, 0);
+
+  FTPClientDestroy(&context);
+  std::remove(filenames[0].c_str());
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSetQueueHighWaterMark__notifies_on_crossings) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  FTPClientSetMaxActiveOperations(context, 1);
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  std::vector<bool> notifications;
+  FTPClientSetQueueHighWaterMark(
+      context, 2, 0,
+      [](bool above_high_water, void *userdata) {
+        reinterpret_cast<std::vector<bool> *>(userdata)->push_back(
+            above_high_water);
+      },
+      &notifications);
+
+  const char buffer[] = "queued";
+  for (auto i = 0; i < 6; ++i) {
+    auto filename = "file" + std::to_string(i);
+    EXPECT_TRUE(FTPClientSendBuffer(context, filename.c_str(), buffer,
+                                    strlen(buffer), nullptr, nullptr));
+  }
+  // Submissions are accepted at the start of the next process step.
+  EXPECT_THAT(notifications, IsEmpty());
+  FTPClientProcess(context, 1);
+  EXPECT_THAT(notifications, ElementsAre(true));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(stor_events.size(), 6);
+  EXPECT_THAT(notifications, ElementsAre(true, false));
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientAppendFile__beyond_active_limit__reopens_queued_files) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  FTPClientSetMaxActiveOperations(context, 1);
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  std::string expected;
+  for (auto i = 0; i < 3; ++i) {
+    auto temp_filename =
+        testing::TempDir() + "queued_file_" + std::to_string(i) + ".txt";
+    std::string content(1000 * (i + 1), '0' + i);
+    std::ofstream outfile(temp_filename);
+    outfile << content;
+    outfile.close();
+    expected += content;
+
+    EXPECT_TRUE(FTPClientAppendFile(context, temp_filename.c_str(),
+                                    "remoteFile", nullptr, nullptr));
+  }
+
+  size_t queued_operations = 0;
+  uint64_t queued_bytes = 0;
+  FTPClientGetQueuedUploads(context, &queued_operations, &queued_bytes);
+  EXPECT_EQ(queued_operations, 3);
+  EXPECT_EQ(queued_bytes, 6000);
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(received_data, expected);
+  EXPECT_EQ(appe_events.size(), 3);
+
+  FTPClientDestroy(&context);
+}
+
+struct CompletionRecord {
+  std::map<std::string, bool> results;
+};
+
+struct CompletionContext {
+  CompletionRecord *record;
+  std::string filename;
+};
+
+static void RecordCompletionCallback(bool successful, void *userdata) {
+  auto context = reinterpret_cast<CompletionContext *>(userdata);
+  context->record->results[context->filename] = successful;
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSendBuffer__many_concurrent__matches_replies_to_uploads) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  FTPClientSetMaxActiveOperations(context, 8);
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  static constexpr int kUploadCount = 64;
+  CompletionRecord record;
+  std::vector<std::string> contents;
+  std::vector<CompletionContext> completions;
+  contents.reserve(kUploadCount);
+  completions.reserve(kUploadCount);
+  for (auto i = 0; i < kUploadCount; ++i) {
+    auto filename = "file" + std::to_string(i);
+    contents.emplace_back(filename + ":" +
+                          std::string(100 + i * 37, 'a' + i % 26));
+    completions.push_back({&record, filename});
+    EXPECT_TRUE(FTPClientSendBuffer(context, filename.c_str(),
+                                    contents.back().data(),
+                                    contents.back().size(),
+                                    RecordCompletionCallback,
+                                    &completions.back()));
+  }
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(stor_events.size(), kUploadCount);
+  ASSERT_EQ(record.results.size(), kUploadCount);
+  for (auto i = 0; i < kUploadCount; ++i) {
+    auto filename = "file" + std::to_string(i);
+    EXPECT_EQ(received_files[filename], contents[i]) << filename;
+    EXPECT_TRUE(record.results[filename]) << filename;
+  }
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSendBuffer__with_rejected_store__fails_only_that_upload) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  rejected_filenames.insert("file1");
+
+  CompletionRecord record;
+  std::vector<std::string> contents;
+  std::vector<CompletionContext> completions;
+  completions.reserve(3);
+  for (auto i = 0; i < 3; ++i) {
+    auto filename = "file" + std::to_string(i);
+    contents.emplace_back("content of " + filename);
+    completions.push_back({&record, filename});
+  }
+  for (auto i = 0; i < 3; ++i) {
+    EXPECT_TRUE(FTPClientSendBuffer(
+        context, completions[i].filename.c_str(), contents[i].data(),
+        contents[i].size(), RecordCompletionCallback, &completions[i]));
+  }
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_THAT(stor_events, ElementsAre("STOR file0\r\n", "STOR file2\r\n"));
+  EXPECT_EQ(received_files["file0"], contents[0]);
+  EXPECT_EQ(received_files["file2"], contents[2]);
+  ASSERT_EQ(record.results.size(), 3);
+  EXPECT_TRUE(record.results["file0"]);
+  EXPECT_FALSE(record.results["file1"]);
+  EXPECT_TRUE(record.results["file2"]);
+
+  FTPClientDestroy(&context);
+}
+
+struct TransferResultRecord {
+  std::vector<FTPClientTransferResult> results;
+  std::vector<std::string> filenames;
+  //! Whether on_complete had been invoked when the result arrived.
+  std::vector<bool> completed_first;
+  bool completed{false};
+  bool successful{false};
+};
+
+static void RecordTransferResult(const FTPClientTransferResult *result,
+                                 void *userdata) {
+  auto record = reinterpret_cast<TransferResultRecord *>(userdata);
+  record->results.push_back(*result);
+  record->filenames.emplace_back(result->filename);
+  record->completed_first.push_back(record->completed);
+}
+
+static void RecordTransferCompletion(bool successful, void *userdata) {
+  auto record = reinterpret_cast<TransferResultRecord *>(userdata);
+  record->completed = true;
+  record->successful = successful;
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSendBuffer__completes_on_final_reply_with_timings) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  TransferResultRecord record;
+  FTPClientSetTransferResultCallback(context, RecordTransferResult, &record);
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  const char buffer[] = "Test buffer";
+  EXPECT_TRUE(FTPClientSendBuffer(context, "test.txt", buffer, strlen(buffer),
+                                  RecordTransferCompletion, &record));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_TRUE(record.completed);
+  EXPECT_TRUE(record.successful);
+  ASSERT_EQ(record.results.size(), 1);
+  EXPECT_THAT(record.filenames, ElementsAre("test.txt"));
+  EXPECT_THAT(record.completed_first, ElementsAre(true));
+
+  const auto &transfer = record.results.front();
+  EXPECT_TRUE(transfer.successful);
+  EXPECT_FALSE(transfer.append);
+  EXPECT_EQ(transfer.reply_code, 226);
+  EXPECT_EQ(transfer.bytes_sent, strlen(buffer));
+  const auto &timings = transfer.timings;
+  EXPECT_NE(timings.submitted, 0);
+  EXPECT_LE(timings.submitted, timings.pasv_reply);
+  EXPECT_LE(timings.pasv_reply, timings.data_connected);
+  EXPECT_LE(timings.data_connected, timings.last_byte_sent);
+  EXPECT_LE(timings.last_byte_sent, timings.final_reply);
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSendBuffer__with_failed_final_reply__reports_failure) {
+  transfer_complete_reply = "451 Requested action aborted.\r\n";
+
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  TransferResultRecord record;
+  FTPClientSetTransferResultCallback(context, RecordTransferResult, &record);
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  const char buffer[] = "Test buffer";
+  EXPECT_TRUE(FTPClientAppendBuffer(context, "test.txt", buffer,
+                                    strlen(buffer), RecordTransferCompletion,
+                                    &record));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_EQ(received_data, buffer);
+  EXPECT_TRUE(record.completed);
+  EXPECT_FALSE(record.successful);
+  ASSERT_EQ(record.results.size(), 1);
+  EXPECT_FALSE(record.results.front().successful);
+  EXPECT_TRUE(record.results.front().append);
+  EXPECT_EQ(record.results.front().reply_code, 451);
+  EXPECT_NE(record.results.front().timings.final_reply, 0);
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture, TestFTPClientSendBuffer__with_select_backend__sends) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_TRUE(
+      FTPClientSetPollerBackend(context, FTP_CLIENT_POLLER_BACKEND_SELECT));
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+  EXPECT_FALSE(
+      FTPClientSetPollerBackend(context, FTP_CLIENT_POLLER_BACKEND_POLL));
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  const char buffer[] = "Test buffer";
+  bool send_succeeded = false;
+  EXPECT_TRUE(FTPClientSendBuffer(context, "test.txt", buffer, strlen(buffer),
+                                  SendCompletedCallback, &send_succeeded));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_TRUE(send_succeeded);
+  EXPECT_EQ(received_data, buffer);
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientSendBuffer__with_poll_backend__sends_beyond_fd_setsize) {
+  rlimit limit{};
+  getrlimit(RLIMIT_NOFILE, &limit);
+  if (limit.rlim_cur <= FD_SETSIZE + 16) {
+    limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, FD_SETSIZE * 2);
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  if (limit.rlim_cur <= FD_SETSIZE + 16) {
+    GTEST_SKIP() << "RLIMIT_NOFILE is too low to exceed FD_SETSIZE";
+  }
+
+  // Occupy every descriptor below FD_SETSIZE so that the client's sockets
+  // cannot be watched by select().
+  std::vector<int> filler;
+  int fd;
+  while ((fd = dup(STDIN_FILENO)) >= 0 && fd < FD_SETSIZE) {
+    filler.push_back(fd);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_TRUE(
+      FTPClientSetPollerBackend(context, FTP_CLIENT_POLLER_BACKEND_SELECT));
+  EXPECT_EQ(FTPClientConnect(context, 300),
+            FTP_CLIENT_CONNECT_STATUS_SOCKET_CREATE_FAILED);
+
+  ASSERT_TRUE(
+      FTPClientSetPollerBackend(context, FTP_CLIENT_POLLER_BACKEND_POLL));
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(ProcessLoop(context, 100)));
+
+  const char buffer[] = "Test buffer";
+  bool send_succeeded = false;
+  EXPECT_TRUE(FTPClientSendBuffer(context, "test.txt", buffer, strlen(buffer),
+                                  SendCompletedCallback, &send_succeeded));
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_TRUE(send_succeeded);
+  EXPECT_EQ(received_data, buffer);
+
+  FTPClientDestroy(&context);
+  for (int filler_fd : filler) {
+    close(filler_fd);
+  }
+}
+
+//! Drives the client from a poll() loop via FTPClientGetPollDescriptors and
+//! FTPClientProcessReady until `done` returns true.
+static FTPClientProcessStatus ExternalProcessLoop(
+    FTPClient *context, const std::function<bool()> &done) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!done() && std::chrono::steady_clock::now() < deadline) {
+    FTPClientPollDescriptor descriptors[8];
+    size_t descriptor_count = 0;
+    uint32_t timeout = 0;
+    auto status = FTPClientGetPollDescriptors(
+        context, descriptors, 8, &descriptor_count, &timeout);
+    if (status != FTP_CLIENT_PROCESS_STATUS_SUCCESS) {
+      return status;
+    }
+    EXPECT_LE(descriptor_count, 8);
+
+    std::vector<pollfd> pollfds;
+    for (size_t i = 0; i < descriptor_count; ++i) {
+      short events = 0;
+      if (descriptors[i].events & FTP_CLIENT_EVENT_READ) {
+        events |= POLLIN;
+      }
+      if (descriptors[i].events & FTP_CLIENT_EVENT_WRITE) {
+        events |= POLLOUT;
+      }
+      pollfds.push_back({descriptors[i].fd, events, 0});
+    }
+    int poll_timeout = timeout == FTP_CLIENT_NO_DEADLINE
+                           ? 50
+                           : std::min<int>(50, static_cast<int>(timeout));
+    if (poll(pollfds.data(), pollfds.size(), poll_timeout) < 0) {
+      return FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED;
+    }
+
+    std::vector<FTPClientPollDescriptor> ready;
+    for (const auto &pfd : pollfds) {
+      uint32_t events = 0;
+      if (pfd.revents & (POLLIN | POLLERR | POLLHUP)) {
+        events |= FTP_CLIENT_EVENT_READ;
+      }
+      if (pfd.revents & (POLLOUT | POLLERR | POLLHUP)) {
+        events |= FTP_CLIENT_EVENT_WRITE;
+      }
+      if (events) {
+        ready.push_back({pfd.fd, events});
+      }
+    }
+
+    status = FTPClientProcessReady(context, ready.data(), ready.size());
+    if (FTPClientProcessStatusIsError(status)) {
+      return status;
+    }
+  }
+  return done() ? FTP_CLIENT_PROCESS_STATUS_SUCCESS
+                : FTP_CLIENT_PROCESS_STATUS_TIMEOUT;
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientProcessReady__driven_by_external_loop__sends) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  EXPECT_EQ(ExternalProcessLoop(context,
+                                [context]() {
+                                  return FTPClientIsFullyConnected(context);
+                                }),
+            FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+
+  // Idle: only the control connection is watched and there is no deadline.
+  FTPClientPollDescriptor descriptors[4];
+  size_t descriptor_count = 0;
+  uint32_t timeout = 0;
+  EXPECT_EQ(FTPClientGetPollDescriptors(context, descriptors, 4,
+                                        &descriptor_count, &timeout),
+            FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+  ASSERT_EQ(descriptor_count, 1);
+  EXPECT_EQ(descriptors[0].events, FTP_CLIENT_EVENT_READ);
+  EXPECT_EQ(timeout, FTP_CLIENT_NO_DEADLINE);
+
+  // Unknown descriptors are ignored.
+  FTPClientPollDescriptor bogus{descriptors[0].fd + 1000,
+                                FTP_CLIENT_EVENT_READ};
+  EXPECT_EQ(FTPClientProcessReady(context, &bogus, 1),
+            FTP_CLIENT_PROCESS_STATUS_TIMEOUT);
+
+  const char buffer[] = "Test buffer";
+  TransferResultRecord record;
+  EXPECT_TRUE(FTPClientSendBuffer(context, "test.txt", buffer, strlen(buffer),
+                                  RecordTransferCompletion, &record));
+
+  EXPECT_EQ(
+      ExternalProcessLoop(context, [&record]() { return record.completed; }),
+      FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_TRUE(record.successful);
+  EXPECT_EQ(received_data, buffer);
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientGetPollDescriptors__with_stalled_stream__reports_deadline) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientConnect(context, 300), FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+  EXPECT_EQ(ExternalProcessLoop(context,
+                                [context]() {
+                                  return FTPClientIsFullyConnected(context);
+                                }),
+            FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+
+  StreamState state;
+  state.chunks.emplace_back("stream data");
+  state.stalls_remaining = 1000000;
+  EXPECT_TRUE(FTPClientSendStream(context, "stream.bin", FillFromStreamState,
+                                  nullptr, StreamCompletedCallback, &state));
+
+  EXPECT_EQ(ExternalProcessLoop(context,
+                                [&state]() { return state.fill_calls > 0; }),
+            FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+
+  // While the stream has nothing to send its data connection is not watched,
+  // but the client must be called back to poll the stream again.
+  FTPClientPollDescriptor descriptors[4];
+  size_t descriptor_count = 0;
+  uint32_t timeout = FTP_CLIENT_NO_DEADLINE;
+  EXPECT_EQ(FTPClientGetPollDescriptors(context, descriptors, 4,
+                                        &descriptor_count, &timeout),
+            FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+  EXPECT_EQ(descriptor_count, 1);
+  EXPECT_NE(timeout, FTP_CLIENT_NO_DEADLINE);
+  EXPECT_LE(timeout, 100);
+
+  state.stalls_remaining = 0;
+  EXPECT_EQ(
+      ExternalProcessLoop(context, [&state]() { return state.completed; }),
+      FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_TRUE(state.successful);
+  EXPECT_EQ(received_data, "stream data");
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientStartConnect__with_upload_queued_first__sends_after_login) {
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+
+  const char buffer[] = "Test buffer";
+  bool send_succeeded = false;
+  EXPECT_TRUE(FTPClientSendBuffer(context, "test.txt", buffer, strlen(buffer),
+                                  SendCompletedCallback, &send_succeeded));
+
+  ASSERT_EQ(FTPClientStartConnect(context, 1000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+  EXPECT_FALSE(FTPClientIsFullyConnected(context));
+  // A second call while connecting is a no-op.
+  EXPECT_EQ(FTPClientStartConnect(context, 1000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  auto result = ProcessLoop(context, 100);
+  EXPECT_FALSE(FTPClientProcessStatusIsError(result))
+      << "  " << strerror(errno);
+
+  connection_quiescent.ClearAndAwait();
+  EXPECT_TRUE(FTPClientIsFullyConnected(context));
+  EXPECT_THAT(user_events, ElementsAre("USER username\r\n"));
+  EXPECT_TRUE(send_succeeded);
+  EXPECT_EQ(received_data, buffer);
+
+  FTPClientDestroy(&context);
+}
+
+TEST_F(FTPServerFixture,
+       TestFTPClientStartConnect__without_welcome__times_out_in_process) {
+  on_connect = [](const sockaddr_in *) { return std::string(); };
+
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), control_port,
+                "username", "password");
+  ASSERT_EQ(FTPClientStartConnect(context, 200),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  auto start = std::chrono::steady_clock::now();
+  auto status = FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  while (!FTPClientProcessStatusIsError(status)) {
+    status = FTPClientProcess(context, 1000);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  EXPECT_EQ(status, FTP_CLIENT_PROCESS_STATUS_CONNECT_TIMEOUT);
+  EXPECT_FALSE(FTPClientIsFullyConnected(context));
+  EXPECT_LT(elapsed, std::chrono::milliseconds(900));
+  EXPECT_EQ(FTPClientProcess(context, 10), FTP_CLIENT_PROCESS_STATUS_CLOSED);
+
+  FTPClientDestroy(&context);
+}
+
+struct GroupErrorRecord {
+  FTPClient *context;
+  FTPClientProcessStatus status;
+};
+
+static void RecordGroupError(FTPClient *context, FTPClientProcessStatus status,
+                             void *userdata) {
+  static_cast<std::vector<GroupErrorRecord> *>(userdata)->push_back(
+      {context, status});
+}
+
+TEST(RuntimeConfig,
+     ftp_client_group_process__with_refused_connection__reports_member) {
+  int reserved = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+  ASSERT_GE(reserved, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  socklen_t addr_len = sizeof(addr);
+  ASSERT_EQ(bind(reserved, reinterpret_cast<sockaddr *>(&addr), addr_len), 0);
+  ASSERT_EQ(
+      getsockname(reserved, reinterpret_cast<sockaddr *>(&addr), &addr_len),
+      0);
+  close(reserved);
+
+  FTPClientGroup *group =
+      FTPClientGroupCreate(FTP_CLIENT_POLLER_BACKEND_DEFAULT);
+  ASSERT_NE(group, nullptr);
+
+  FTPClient *context;
+  FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), ntohs(addr.sin_port),
+                "username", "password");
+  ASSERT_EQ(FTPClientStartConnect(context, 1000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+  ASSERT_TRUE(FTPClientGroupAdd(group, context));
+  EXPECT_FALSE(FTPClientGroupAdd(group, context));
+  EXPECT_EQ(FTPClientProcess(context, 10),
+            FTP_CLIENT_PROCESS_STATUS_BAD_STATE);
+
+  std::vector<GroupErrorRecord> errors;
+  for (int i = 0; i < 100 && errors.empty(); ++i) {
+    FTPClientGroupProcess(group, 10, RecordGroupError, &errors);
+  }
+  ASSERT_EQ(errors.size(), 1);
+  EXPECT_EQ(errors[0].context, context);
+  EXPECT_EQ(errors[0].status, FTP_CLIENT_PROCESS_STATUS_CONNECT_FAILED);
+  EXPECT_EQ(FTPClientErrno(context), ECONNREFUSED);
+
+  // Closed members are skipped.
+  EXPECT_EQ(FTPClientGroupProcess(group, 10, RecordGroupError, &errors),
+            FTP_CLIENT_PROCESS_STATUS_TIMEOUT);
+  EXPECT_EQ(errors.size(), 1);
+
+  EXPECT_TRUE(FTPClientGroupRemove(group, context));
+  EXPECT_EQ(FTPClientProcess(context, 10), FTP_CLIENT_PROCESS_STATUS_CLOSED);
+
+  FTPClientDestroy(&context);
+  FTPClientGroupDestroy(&group);
+  EXPECT_EQ(group, nullptr);
+}
+
+TEST(FTPClientGroupStress,
+     ftp_client_group_process__with_hundreds_of_clients__sends_all) {
+  // Each client holds a control and a data connection, each mirrored by the
+  // server, plus the server's passive listener.
+  static constexpr size_t kMaxClients = 256;
+  static constexpr size_t kDescriptorsPerClient = 5;
+  rlimit limit{};
+  ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &limit), 0);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  getrlimit(RLIMIT_NOFILE, &limit);
+  const size_t client_count =
+      std::min(kMaxClients, (limit.rlim_cur - 64) / kDescriptorsPerClient);
+  ASSERT_GE(client_count, 100);
+
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClientGroup *group =
+      FTPClientGroupCreate(FTP_CLIENT_POLLER_BACKEND_DEFAULT);
+  ASSERT_NE(group, nullptr);
+
+  std::vector<FTPClient *> clients(client_count);
+  std::vector<std::string> payloads(client_count);
+  CompletionRecord record;
+  std::vector<CompletionContext> completions(client_count);
+  for (size_t i = 0; i < client_count; ++i) {
+    ASSERT_EQ(FTPClientInit(&clients[i], ntohl(inet_addr("127.0.0.1")),
+                            server.port(), "username", "password"),
+              FTP_CLIENT_INIT_STATUS_SUCCESS);
+    ASSERT_EQ(FTPClientStartConnect(clients[i], 10000),
+              FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+    ASSERT_TRUE(FTPClientGroupAdd(group, clients[i]));
+
+    payloads[i] = "Payload for client " + std::to_string(i);
+    completions[i] = {&record, "client_" + std::to_string(i) + ".txt"};
+    ASSERT_TRUE(FTPClientSendBuffer(
+        clients[i], completions[i].filename.c_str(), payloads[i].data(),
+        payloads[i].size(), RecordCompletionCallback, &completions[i]));
+  }
+
+  std::vector<GroupErrorRecord> errors;
+  auto all_completed = [&record, client_count]() {
+    return record.results.size() == client_count;
+  };
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while (!all_completed() && errors.empty() &&
+         std::chrono::steady_clock::now() < deadline) {
+    auto status = FTPClientGroupProcess(group, 100, RecordGroupError, &errors);
+    ASSERT_NE(status, FTP_CLIENT_PROCESS_STATUS_SELECT_FAILED);
+  }
+  EXPECT_TRUE(errors.empty());
+  ASSERT_TRUE(all_completed());
+
+  for (size_t i = 0; i < client_count; ++i) {
+    EXPECT_TRUE(record.results[completions[i].filename]) << "client " << i;
+    FTPClientDestroy(&clients[i]);
+  }
+  FTPClientGroupDestroy(&group);
+  server.Stop();
+
+  for (size_t i = 0; i < client_count; ++i) {
+    EXPECT_EQ(server.GetFile(completions[i].filename), payloads[i]);
+  }
+}
+
+TEST(FTPClientQueue, ftp_client_send_file__beyond_rlimit_nofile__queues_all) {
+  static constexpr rlim_t kDescriptorLimit = 128;
+  static constexpr size_t kUploadCount = 2 * kDescriptorLimit;
+  rlimit original_limit{};
+  ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &original_limit), 0);
+  if (original_limit.rlim_cur < kDescriptorLimit) {
+    GTEST_SKIP() << "RLIMIT_NOFILE is already below the tested limit";
+  }
+
+  auto temp_filename = testing::TempDir() + "ftp_client_rlimit_source.txt";
+  {
+    std::ofstream outfile(temp_filename);
+    outfile << "queued";
+  }
+
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+
+  // Queued files must not hold a descriptor while they wait.
+  rlimit limit = original_limit;
+  limit.rlim_cur = kDescriptorLimit;
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &limit), 0);
+
+  CompletionRecord record;
+  std::vector<CompletionContext> completions(kUploadCount);
+  size_t submitted = 0;
+  for (size_t i = 0; i < kUploadCount; ++i) {
+    completions[i] = {&record, "queued_" + std::to_string(i) + ".txt"};
+    if (!FTPClientSendFile(context, temp_filename.c_str(),
+                           completions[i].filename.c_str(),
+                           RecordCompletionCallback, &completions[i])) {
+      break;
+    }
+    ++submitted;
+  }
+  EXPECT_EQ(submitted, kUploadCount);
+  EXPECT_TRUE(FTPClientHasSendPending(context));
+
+  if (FTPClientStartConnect(context, 5000) ==
+      FTP_CLIENT_CONNECT_STATUS_SUCCESS) {
+    auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+    while (record.results.size() < submitted &&
+           std::chrono::steady_clock::now() < deadline) {
+      FTPClientProcess(context, kSelectTimeoutMilliseconds);
+    }
+  }
+  setrlimit(RLIMIT_NOFILE, &original_limit);
+
+  ASSERT_EQ(record.results.size(), submitted);
+  for (const auto &result : record.results) {
+    EXPECT_TRUE(result.second) << result.first;
+  }
+
+  FTPClientDestroy(&context);
+  server.Stop();
+  std::remove(temp_filename.c_str());
+}
+
+TEST(FTPClientSubmission,
+     ftp_client_send_buffer__from_producer_threads__sends_all) {
+  static constexpr int kProducerCount = 4;
+  static constexpr int kUploadsPerProducer = 32;
+  static constexpr size_t kUploadCount = kProducerCount * kUploadsPerProducer;
+
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  FTPClientSetMaxActiveOperations(context, 8);
+  ASSERT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  // Completion callbacks run on this thread, so the record needs no locking.
+  CompletionRecord record;
+  std::vector<CompletionContext> completions(kUploadCount);
+  for (size_t i = 0; i < kUploadCount; ++i) {
+    completions[i] = {&record, "upload_" + std::to_string(i)};
+  }
+
+  std::atomic<int> submit_failures{0};
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < kProducerCount; ++producer) {
+    producers.emplace_back([&, producer]() {
+      for (int i = 0; i < kUploadsPerProducer; ++i) {
+        auto &completion = completions[producer * kUploadsPerProducer + i];
+        std::string content = completion.filename + " content";
+        if (!FTPClientCopyAndSendBuffer(
+                context, completion.filename.c_str(), content.data(),
+                content.size(), RecordCompletionCallback, &completion)) {
+          ++submit_failures;
+        }
+      }
+    });
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  auto status = FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  while (record.results.size() < kUploadCount &&
+         !FTPClientProcessStatusIsError(status) &&
+         std::chrono::steady_clock::now() < deadline) {
+    status = FTPClientProcess(context, 10);
+  }
+  for (auto &producer : producers) {
+    producer.join();
+  }
+
+  EXPECT_FALSE(FTPClientProcessStatusIsError(status)) << status;
+  EXPECT_EQ(submit_failures, 0);
+  ASSERT_EQ(record.results.size(), kUploadCount);
+  FTPClientDestroy(&context);
+  server.Stop();
+
+  for (const auto &completion : completions) {
+    EXPECT_TRUE(record.results[completion.filename]) << completion.filename;
+    EXPECT_EQ(server.GetFile(completion.filename),
+              completion.filename + " content");
+  }
+}
+
+TEST(FTPClientWorker, ftp_client_start_worker__sends_without_process_calls) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  ASSERT_TRUE(FTPClientStartWorker(context, 5000));
+  EXPECT_FALSE(FTPClientStartWorker(context, 5000));
+
+  // Each upload is submitted only after the previous one completed, so every
+  // one of them has to wake the idle worker.
+  static constexpr int kUploadCount = 8;
+  for (int i = 0; i < kUploadCount; ++i) {
+    std::promise<bool> completed;
+    auto filename = "worker_" + std::to_string(i);
+    ASSERT_TRUE(FTPClientCopyAndSendBuffer(
+        context, filename.c_str(), filename.data(), filename.size(),
+        [](bool successful, void *userdata) {
+          static_cast<std::promise<bool> *>(userdata)->set_value(successful);
+        },
+        &completed));
+
+    auto future = completed.get_future();
+    ASSERT_EQ(future.wait_for(kTestTimeout), std::future_status::ready);
+    EXPECT_TRUE(future.get());
+  }
+
+  EXPECT_EQ(FTPClientStopWorker(context), FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+  EXPECT_EQ(FTPClientStopWorker(context), FTP_CLIENT_PROCESS_STATUS_BAD_STATE);
+  EXPECT_TRUE(FTPClientIsFullyConnected(context));
+  FTPClientDestroy(&context);
+  server.Stop();
+
+  for (int i = 0; i < kUploadCount; ++i) {
+    auto filename = "worker_" + std::to_string(i);
+    EXPECT_EQ(server.GetFile(filename), filename);
+  }
+}
+
+TEST(FTPClientWorker, ftp_client_start_worker__after_failed_upload__continues) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  ASSERT_TRUE(FTPClientStartWorker(context, 5000));
+
+  auto on_complete = [](bool successful, void *userdata) {
+    static_cast<std::promise<bool> *>(userdata)->set_value(successful);
+  };
+  std::promise<bool> stream_completed;
+  ASSERT_TRUE(FTPClientSendStream(
+      context, "failing_stream",
+      [](void *, size_t, size_t *bytes_written, void *) {
+        *bytes_written = 0;
+        return FTP_CLIENT_STREAM_STATUS_ERROR;
+      },
+      nullptr, on_complete, &stream_completed));
+  auto stream_future = stream_completed.get_future();
+  ASSERT_EQ(stream_future.wait_for(kTestTimeout), std::future_status::ready);
+  EXPECT_FALSE(stream_future.get());
+
+  const char buffer[] = "after failure";
+  std::promise<bool> buffer_completed;
+  ASSERT_TRUE(FTPClientSendBuffer(context, "after_failure.txt", buffer,
+                                  strlen(buffer), on_complete,
+                                  &buffer_completed));
+  auto buffer_future = buffer_completed.get_future();
+  ASSERT_EQ(buffer_future.wait_for(kTestTimeout), std::future_status::ready);
+  EXPECT_TRUE(buffer_future.get());
+
+  EXPECT_EQ(FTPClientStopWorker(context), FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+  FTPClientDestroy(&context);
+  server.Stop();
+  EXPECT_EQ(server.GetFile("after_failure.txt"), buffer);
+}
+
+TEST(FTPClientWorker,
+     ftp_client_dispatch_callbacks__in_deferred_mode__runs_on_caller) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  FTPClientSetCallbackMode(context, FTP_CLIENT_CALLBACK_MODE_DEFERRED);
+  TransferResultRecord record;
+  FTPClientSetTransferResultCallback(context, RecordTransferResult, &record);
+  ASSERT_TRUE(FTPClientStartWorker(context, 5000));
+
+  struct CallbackThread {
+    bool called{false};
+    std::thread::id thread_id;
+  } callback_thread;
+  const char buffer[] = "deferred";
+  ASSERT_TRUE(FTPClientSendBuffer(
+      context, "deferred.txt", buffer, strlen(buffer),
+      [](bool successful, void *userdata) {
+        auto state = static_cast<CallbackThread *>(userdata);
+        state->called = successful;
+        state->thread_id = std::this_thread::get_id();
+      },
+      &callback_thread));
+
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  size_t dispatched = 0;
+  while (!dispatched && std::chrono::steady_clock::now() < deadline) {
+    dispatched = FTPClientDispatchCallbacks(context);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(dispatched, 1);
+  EXPECT_TRUE(callback_thread.called);
+  EXPECT_EQ(callback_thread.thread_id, std::this_thread::get_id());
+  ASSERT_EQ(record.results.size(), 1);
+  EXPECT_EQ(record.filenames[0], "deferred.txt");
+  EXPECT_EQ(record.results[0].reply_code, 226);
+
+  EXPECT_EQ(FTPClientStopWorker(context), FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+  FTPClientDestroy(&context);
+}
+
+TEST(FTPClientEngine, ftp_client_engine_send_buffer__sends_all_across_workers) {
+  static constexpr size_t kUploadCount = 200;
+
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClientEngineOptions options;
+  FTPClientEngineOptionsInit(&options);
+  options.ipv4_ip_host_ordered = ntohl(inet_addr("127.0.0.1"));
+  options.port_host_ordered = server.port();
+  options.username = "username";
+  options.password = "password";
+  options.worker_count = 3;
+  options.sessions_per_worker = 2;
+  options.operations_per_session = 2;
+  FTPClientEngine *engine = FTPClientEngineCreate(&options);
+  ASSERT_NE(engine, nullptr);
+
+  struct Completions {
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t succeeded{0};
+    size_t failed{0};
+  } completions;
+  std::vector<std::string> contents(kUploadCount);
+  for (size_t i = 0; i < kUploadCount; ++i) {
+    contents[i] = "engine upload " + std::to_string(i);
+    ASSERT_TRUE(FTPClientEngineSendBuffer(
+        engine, ("engine_" + std::to_string(i)).c_str(), contents[i].data(),
+        contents[i].size(),
+        [](bool successful, void *userdata) {
+          auto state = static_cast<Completions *>(userdata);
+          std::lock_guard lock(state->mutex);
+          ++(successful ? state->succeeded : state->failed);
+          state->condition.notify_all();
+        },
+        &completions));
+  }
+
+  {
+    std::unique_lock lock(completions.mutex);
+    EXPECT_TRUE(completions.condition.wait_for(lock, kTestTimeout, [&]() {
+      return completions.succeeded + completions.failed == kUploadCount;
+    }));
+    EXPECT_EQ(completions.failed, 0);
+  }
+
+  FTPClientEngineStats stats;
+  FTPClientEngineGetStats(engine, &stats);
+  EXPECT_EQ(stats.completed_operations, kUploadCount);
+  EXPECT_EQ(stats.failed_operations, 0);
+
+  FTPClientEngineDestroy(&engine);
+  EXPECT_EQ(engine, nullptr);
+  server.Stop();
+
+  for (size_t i = 0; i < kUploadCount; ++i) {
+    EXPECT_EQ(server.GetFile("engine_" + std::to_string(i)), contents[i]);
+  }
+}
+
+TEST(FTPClientEngine, ftp_client_engine_send_file__unreadable__keeps_session) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  // A reset session would not reconnect before the test times out.
+  FTPClientEngineOptions options;
+  FTPClientEngineOptionsInit(&options);
+  options.ipv4_ip_host_ordered = ntohl(inet_addr("127.0.0.1"));
+  options.port_host_ordered = server.port();
+  options.username = "username";
+  options.password = "password";
+  options.operations_per_session = 1;
+  options.reconnect_delay_milliseconds = 60 * 1000;
+  FTPClientEngine *engine = FTPClientEngineCreate(&options);
+  ASSERT_NE(engine, nullptr);
+
+  struct Results {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::map<std::string, bool> results;
+  } results;
+  struct Completion {
+    Results *results;
+    std::string filename;
+  } completions[] = {{&results, "directory"}, {&results, "after.txt"}};
+  auto on_complete = [](bool successful, void *userdata) {
+    auto completion = static_cast<Completion *>(userdata);
+    std::lock_guard lock(completion->results->mutex);
+    completion->results->results[completion->filename] = successful;
+    completion->results->condition.notify_all();
+  };
+
+  // Opening a directory succeeds, but reading it fails once the upload runs.
+  ASSERT_TRUE(FTPClientEngineSendFile(engine, testing::TempDir().c_str(),
+                                      "directory", on_complete,
+                                      &completions[0]));
+  const char buffer[] = "after unreadable file";
+  ASSERT_TRUE(FTPClientEngineSendBuffer(engine, "after.txt", buffer,
+                                        strlen(buffer), on_complete,
+                                        &completions[1]));
+
+  {
+    std::unique_lock lock(results.mutex);
+    EXPECT_TRUE(results.condition.wait_for(
+        lock, kTestTimeout, [&]() { return results.results.size() == 2; }));
+    EXPECT_EQ(results.results,
+              (std::map<std::string, bool>{{"directory", false},
+                                           {"after.txt", true}}));
+  }
+
+  FTPClientEngineDestroy(&engine);
+  server.Stop();
+  EXPECT_EQ(server.GetFile("after.txt"), buffer);
+}
+
+//! Connects a client with the given reconnect policy to `server` and drives
+//! it until all `uploads` complete or an error is reported.
+static FTPClientProcessStatus UploadWithReconnectPolicy(
+    FakeFTPServer &server, const FTPClientReconnectPolicy *policy,
+    const std::vector<std::string> &uploads, CompletionRecord &record) {
+  FTPClient *context;
+  EXPECT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  FTPClientSetReconnectPolicy(context, policy);
+  FTPClientSetMaxActiveOperations(context, 1);
+  EXPECT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  std::vector<CompletionContext> contexts;
+  contexts.reserve(uploads.size());
+  for (const auto &filename : uploads) {
+    contexts.push_back({&record, filename});
+    EXPECT_TRUE(FTPClientCopyAndSendBuffer(
+        context, filename.c_str(), filename.data(), filename.size(),
+        RecordCompletionCallback, &contexts.back()));
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  FTPClientProcessStatus status = FTP_CLIENT_PROCESS_STATUS_SUCCESS;
+  while (record.results.size() < uploads.size() &&
+         std::chrono::steady_clock::now() < deadline) {
+    status = FTPClientProcess(context, kSelectTimeoutMilliseconds);
+    if (FTPClientProcessStatusIsError(status)) {
+      break;
+    }
+  }
+
+  FTPClientDestroy(&context);
+  return status;
+}
+
+TEST(FTPClientReconnect,
+     ftp_client_process__with_reconnect_policy__replays_dropped_uploads) {
+  // Every session is dropped once its second upload starts, so each one
+  // completes a single upload before the client has to log in again.
+  FakeFTPServer::Options server_options;
+  server_options.drop_session_at_transfer = 2;
+  FakeFTPServer server(server_options);
+  ASSERT_TRUE(server.Start());
+
+  FTPClientReconnectPolicy policy;
+  FTPClientReconnectPolicyInit(&policy);
+  policy.initial_delay_milliseconds = 5;
+  policy.max_delay_milliseconds = 20;
+
+  std::vector<std::string> uploads{"reconnect_0", "reconnect_1", "reconnect_2",
+                                   "reconnect_3"};
+  CompletionRecord record;
+  EXPECT_EQ(UploadWithReconnectPolicy(server, &policy, uploads, record),
+            FTP_CLIENT_PROCESS_STATUS_SUCCESS);
+  server.Stop();
+
+  ASSERT_EQ(record.results.size(), uploads.size());
+  for (const auto &filename : uploads) {
+    EXPECT_TRUE(record.results[filename]) << filename;
+    EXPECT_EQ(server.GetFile(filename), filename);
+  }
+  EXPECT_EQ(server.sessions_accepted(), uploads.size());
+}
+
+TEST(FTPClientReconnect,
+     ftp_client_process__without_reconnect_policy__reports_closed) {
+  FakeFTPServer::Options server_options;
+  server_options.drop_session_at_transfer = 2;
+  FakeFTPServer server(server_options);
+  ASSERT_TRUE(server.Start());
+
+  std::vector<std::string> uploads{"no_reconnect_0", "no_reconnect_1"};
+  CompletionRecord record;
+  EXPECT_EQ(UploadWithReconnectPolicy(server, nullptr, uploads, record),
+            FTP_CLIENT_PROCESS_STATUS_CLOSED);
+  server.Stop();
+
+  EXPECT_EQ(record.results.size(), 1);
+  EXPECT_EQ(server.sessions_accepted(), 1);
+}
+
+TEST(FTPClientReconnect, ftp_client_process__when_idle__sends_keepalive) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  FTPClientReconnectPolicy policy;
+  FTPClientReconnectPolicyInit(&policy);
+  policy.keepalive_interval_milliseconds = 20;
+  FTPClientSetReconnectPolicy(context, &policy);
+  ASSERT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while (server.noop_commands() < 3 &&
+         std::chrono::steady_clock::now() < deadline) {
+    ASSERT_FALSE(FTPClientProcessStatusIsError(
+        FTPClientProcess(context, kSelectTimeoutMilliseconds)));
+  }
+  EXPECT_GE(server.noop_commands(), 3);
+  EXPECT_TRUE(FTPClientIsFullyConnected(context));
+
+  FTPClientDestroy(&context);
+  server.Stop();
+}
+
+//! Uploads `content` to `server`, either from a local file or from a buffer,
+//! driving the client until the upload completes. Returns whether it
+//! succeeded.
+static bool UploadWithResume(FakeFTPServer &server, const std::string &content,
+                             const std::string &local_filename,
+                             uint32_t max_resume_attempts) {
+  // The server resets the data connection, which must not terminate the
+  // process when the client next writes to it.
+  std::signal(SIGPIPE, SIG_IGN);
+
+  FTPClient *context;
+  EXPECT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  EXPECT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  std::promise<bool> completed;
+  auto on_complete = [](bool successful, void *userdata) {
+    static_cast<std::promise<bool> *>(userdata)->set_value(successful);
+  };
+  if (local_filename.empty()) {
+    FTPClientSetMaxResumeAttempts(context, max_resume_attempts);
+    EXPECT_TRUE(FTPClientSendBuffer(context, "resumed", content.data(),
+                                    content.size(), on_complete, &completed));
+  } else {
+    FTPClientSendOptions options;
+    FTPClientSendOptionsInit(&options);
+    options.max_resume_attempts = max_resume_attempts;
+    EXPECT_TRUE(FTPClientSendFileWithOptions(context, local_filename.c_str(),
+                                             "resumed", &options, on_complete,
+                                             &completed));
+  }
+
+  auto future = completed.get_future();
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while (future.wait_for(std::chrono::seconds(0)) !=
+             std::future_status::ready &&
+         std::chrono::steady_clock::now() < deadline) {
+    FTPClientProcess(context, kSelectTimeoutMilliseconds);
+  }
+
+  FTPClientDestroy(&context);
+  return future.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready &&
+         future.get();
+}
+
+static std::string MakeResumeContent() {
+  std::string content(1024 * 1024, 0);
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<char>(i * 31 + i / 4096);
+  }
+  return content;
+}
+
+TEST(FTPClientResume,
+     ftp_client_send_file__with_dropped_data_connection__resumes) {
+  static constexpr size_t kDropOffset = 300 * 1000;
+  FakeFTPServer::Options server_options;
+  server_options.drop_data_at_offset = kDropOffset;
+  FakeFTPServer server(server_options);
+  ASSERT_TRUE(server.Start());
+
+  std::string content = MakeResumeContent();
+  auto temp_filename = testing::TempDir() + "ftp_client_resume_source.bin";
+  {
+    std::ofstream outfile(temp_filename, std::ios::binary);
+    outfile.write(content.data(), static_cast<std::streamsize>(content.size()));
+  }
+
+  EXPECT_TRUE(UploadWithResume(server, content, temp_filename, 2));
+  server.Stop();
+  std::remove(temp_filename.c_str());
+
+  EXPECT_EQ(server.rest_commands(), 1);
+  // Only the part of the file that the server had not received was resent.
+  EXPECT_EQ(server.total_bytes_received(), content.size());
+  EXPECT_TRUE(server.GetFile("resumed") == content);
+}
+
+TEST(FTPClientResume,
+     ftp_client_send_buffer__with_dropped_data_connection__resumes) {
+  FakeFTPServer::Options server_options;
+  server_options.drop_data_at_offset = 123457;
+  FakeFTPServer server(server_options);
+  ASSERT_TRUE(server.Start());
+
+  std::string content = MakeResumeContent();
+  EXPECT_TRUE(UploadWithResume(server, content, "", 1));
+  server.Stop();
+
+  EXPECT_EQ(server.rest_commands(), 1);
+  EXPECT_EQ(server.total_bytes_received(), content.size());
+  EXPECT_TRUE(server.GetFile("resumed") == content);
+}
+
+TEST(FTPClientResume,
+     ftp_client_send_buffer__without_resume_attempts__fails_when_dropped) {
+  FakeFTPServer::Options server_options;
+  server_options.drop_data_at_offset = 123457;
+  FakeFTPServer server(server_options);
+  ASSERT_TRUE(server.Start());
+
+  std::string content = MakeResumeContent();
+  EXPECT_FALSE(UploadWithResume(server, content, "", 0));
+  server.Stop();
+
+  EXPECT_EQ(server.rest_commands(), 0);
+  EXPECT_EQ(server.GetFileSize("resumed"), 123457);
+}
+
+//! Uploads `content` to `server` split into up to `stripe_count` ranges of at
+//! least 64 KiB, from a local file if `local_filename` is given, and records
+//! the results reported for it.
+static void UploadStriped(FakeFTPServer &server, const std::string &content,
+                          const std::string &local_filename,
+                          bool disable_zero_copy, size_t stripe_count,
+                          TransferResultRecord *record) {
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  ASSERT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+  FTPClientSetTransferResultCallback(context, RecordTransferResult, record);
+
+  if (local_filename.empty()) {
+    FTPClientSetStriping(context, stripe_count, 64 * 1024);
+    EXPECT_TRUE(FTPClientSendBuffer(context, "striped", content.data(),
+                                    content.size(), RecordTransferCompletion,
+                                    record));
+  } else {
+    FTPClientSetStriping(context, 0, 64 * 1024);
+    FTPClientSendOptions options;
+    FTPClientSendOptionsInit(&options);
+    options.stripe_count = stripe_count;
+    options.disable_zero_copy = disable_zero_copy;
+    EXPECT_TRUE(FTPClientSendFileWithOptions(
+        context, local_filename.c_str(), "striped", &options,
+        RecordTransferCompletion, record));
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while ((record->results.empty() || FTPClientHasSendPending(context)) &&
+         std::chrono::steady_clock::now() < deadline) {
+    FTPClientProcess(context, kSelectTimeoutMilliseconds);
+  }
+
+  FTPClientDestroy(&context);
+}
+
+//! Checks that a striped upload of `content` completed once, successfully.
+static void ExpectStripedUploadSucceeded(const TransferResultRecord &record,
+                                         const std::string &content) {
+  ASSERT_EQ(record.results.size(), 1);
+  EXPECT_TRUE(record.completed_first[0]);
+  EXPECT_TRUE(record.successful);
+  EXPECT_EQ(record.filenames[0], "striped");
+  EXPECT_TRUE(record.results[0].successful);
+  EXPECT_EQ(record.results[0].reply_code, 226);
+  EXPECT_EQ(record.results[0].bytes_sent, content.size());
+}
+
+TEST(FTPClientStriping, ftp_client_send_buffer__with_striping__sends_ranges) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  std::string content = MakeResumeContent();
+  TransferResultRecord record;
+  UploadStriped(server, content, "", false, 4, &record);
+  server.Stop();
+
+  ExpectStripedUploadSucceeded(record, content);
+  EXPECT_EQ(server.sessions_accepted(), 4);
+  EXPECT_EQ(server.rest_commands(), 3);
+  EXPECT_EQ(server.total_bytes_received(), content.size());
+  EXPECT_TRUE(server.GetFile("striped") == content);
+}
+
+TEST(FTPClientStriping, ftp_client_send_file__with_striping__sends_ranges) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  std::string content = MakeResumeContent();
+  auto temp_filename = testing::TempDir() + "ftp_client_striped_source.bin";
+  {
+    std::ofstream outfile(temp_filename, std::ios::binary);
+    outfile.write(content.data(), static_cast<std::streamsize>(content.size()));
+  }
+
+  // Uneven ranges, sent both zero-copy and through read-ahead.
+  TransferResultRecord zero_copy_record;
+  UploadStriped(server, content, temp_filename, false, 3, &zero_copy_record);
+  ExpectStripedUploadSucceeded(zero_copy_record, content);
+  EXPECT_EQ(server.rest_commands(), 2);
+  EXPECT_TRUE(server.GetFile("striped") == content);
+
+  TransferResultRecord stdio_record;
+  UploadStriped(server, content, temp_filename, true, 5, &stdio_record);
+  ExpectStripedUploadSucceeded(stdio_record, content);
+  EXPECT_EQ(server.rest_commands(), 6);
+  EXPECT_TRUE(server.GetFile("striped") == content);
+
+  server.Stop();
+  std::remove(temp_filename.c_str());
+}
+
+TEST(FTPClientStriping,
+     ftp_client_send_buffer__below_min_stripe_size__sends_single_range) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  std::string content = MakeResumeContent().substr(0, 100 * 1024);
+  TransferResultRecord record;
+  UploadStriped(server, content, "", false, 4, &record);
+  server.Stop();
+
+  ExpectStripedUploadSucceeded(record, content);
+  EXPECT_EQ(server.sessions_accepted(), 1);
+  EXPECT_EQ(server.rest_commands(), 0);
+  EXPECT_TRUE(server.GetFile("striped") == content);
+}
+
+TEST(FTPClientStats, ftp_client_get_stats__before_connect__reports_queue) {
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")), 21, "user",
+                          "pass"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+
+  FTPClientStats stats;
+  if (!FTPClientGetStats(context, &stats)) {
+    FTPClientDestroy(&context);
+    GTEST_SKIP() << "Built without FTP_CLIENT_ENABLE_STATS";
+  }
+  EXPECT_FALSE(FTPClientGetStats(nullptr, &stats));
+  EXPECT_FALSE(FTPClientGetStats(context, nullptr));
+
+  static constexpr char kBuffer[] = "queued";
+  EXPECT_TRUE(FTPClientSendBuffer(context, "file1", kBuffer, sizeof(kBuffer),
+                                  nullptr, nullptr));
+  EXPECT_TRUE(FTPClientSendBuffer(context, "file2", kBuffer, sizeof(kBuffer),
+                                  nullptr, nullptr));
+  ASSERT_TRUE(FTPClientGetStats(context, &stats));
+  EXPECT_EQ(stats.queued_operations, 2);
+  EXPECT_EQ(stats.queued_bytes, 2 * sizeof(kBuffer));
+  EXPECT_EQ(stats.in_flight_operations, 0);
+  EXPECT_EQ(stats.completed_operations, 0);
+  EXPECT_EQ(stats.control.writes, 0);
+  EXPECT_EQ(stats.data.writes, 0);
+
+  FTPClientDestroy(&context);
+}
+
+TEST(FTPClientStats, ftp_client_get_stats__after_uploads__reports_counters) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  ASSERT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  FTPClientStats stats;
+  if (!FTPClientGetStats(context, &stats)) {
+    FTPClientDestroy(&context);
+    GTEST_SKIP() << "Built without FTP_CLIENT_ENABLE_STATS";
+  }
+
+  std::string content(256 * 1024, 's');
+  EXPECT_TRUE(FTPClientSendBuffer(context, "file1", content.data(),
+                                  content.size(), nullptr, nullptr));
+  EXPECT_TRUE(FTPClientSendBuffer(context, "file2", content.data(),
+                                  content.size(), nullptr, nullptr));
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while (FTPClientHasSendPending(context) &&
+         std::chrono::steady_clock::now() < deadline) {
+    FTPClientProcess(context, kSelectTimeoutMilliseconds);
+  }
+
+  ASSERT_TRUE(FTPClientGetStats(context, &stats));
+  FTPClientDestroy(&context);
+  server.Stop();
+
+  EXPECT_EQ(stats.queued_operations, 0);
+  EXPECT_EQ(stats.in_flight_operations, 0);
+  EXPECT_EQ(stats.in_flight_bytes, 0);
+  EXPECT_EQ(stats.completed_operations, 2);
+  EXPECT_EQ(stats.failed_operations, 0);
+  EXPECT_EQ(stats.completed_bytes, 2 * content.size());
+
+  // Login, TYPE, two PASV/STOR exchanges and their replies.
+  EXPECT_GE(stats.control.writes, 4);
+  EXPECT_GE(stats.control.reads, 4);
+  EXPECT_GT(stats.control.bytes_read, 0);
+  EXPECT_LE(stats.control.partial_writes, stats.control.writes);
+  EXPECT_EQ(stats.data.reads, 0);
+  EXPECT_EQ(stats.data.bytes_written, 2 * content.size());
+  EXPECT_GE(stats.data.writes, 2);
+  EXPECT_LE(stats.data.partial_writes, stats.data.writes);
+
+  EXPECT_GT(stats.poll_waits, 0);
+  EXPECT_EQ(stats.poll_waits, stats.poll_wakeups + stats.poll_timeouts);
+  EXPECT_GT(stats.average_transfer_bytes_per_second, 0);
+}
+
+struct TraceRecord {
+  struct Event {
+    FTPClientTraceEventType type;
+    uint64_t timestamp;
+    uint64_t operation_id;
+    uint64_t value;
+    std::string text;
+  };
+  std::vector<Event> events;
+  uint64_t operation_id{0};
+};
+
+static void RecordTraceEvent(const FTPClientTraceEvent *event,
+                             void *userdata) {
+  auto record = reinterpret_cast<TraceRecord *>(userdata);
+  record->events.push_back(
+      {event->type, event->timestamp, event->operation_id, event->value,
+       event->text ? std::string(event->text, event->text_length) : ""});
+}
+
+static void RecordTraceOperationId(const FTPClientTransferResult *result,
+                                   void *userdata) {
+  reinterpret_cast<TraceRecord *>(userdata)->operation_id =
+      result->operation_id;
+}
+
+TEST(FTPClientTrace, ftp_client_set_trace_callback__reports_upload_timeline) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  TraceRecord record;
+  FTPClientSetTraceCallback(context, RecordTraceEvent, &record);
+  FTPClientSetTransferResultCallback(context, RecordTraceOperationId, &record);
+  ASSERT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  std::string content(64 * 1024, 't');
+  EXPECT_TRUE(FTPClientSendBuffer(context, "file1", content.data(),
+                                  content.size(), nullptr, nullptr));
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while (FTPClientHasSendPending(context) &&
+         std::chrono::steady_clock::now() < deadline) {
+    FTPClientProcess(context, kSelectTimeoutMilliseconds);
+  }
+  FTPClientDestroy(&context);
+  server.Stop();
+
+  ASSERT_NE(record.operation_id, 0);
+  std::vector<std::string> commands;
+  std::vector<FTPClientTraceEventType> data_events;
+  uint64_t previous_timestamp = 0;
+  for (const auto &event : record.events) {
+    EXPECT_GE(event.timestamp, previous_timestamp);
+    previous_timestamp = event.timestamp;
+    if (event.type == FTP_CLIENT_TRACE_EVENT_COMMAND_SENT) {
+      commands.push_back(event.text);
+      bool upload_command = event.text == "PASV" || event.text == "STOR file1";
+      EXPECT_EQ(event.operation_id, upload_command ? record.operation_id : 0)
+          << event.text;
+    } else if (event.type == FTP_CLIENT_TRACE_EVENT_REPLY_RECEIVED) {
+      EXPECT_EQ(event.value, std::stoi(event.text.substr(0, 3)));
+      if (event.value == 227 || event.value == 150 || event.value == 226) {
+        EXPECT_EQ(event.operation_id, record.operation_id) << event.text;
+      }
+    } else if (event.type != FTP_CLIENT_TRACE_EVENT_DATA_PARTIAL_WRITE) {
+      EXPECT_EQ(event.operation_id, record.operation_id);
+      data_events.push_back(event.type);
+      if (event.type == FTP_CLIENT_TRACE_EVENT_DATA_CLOSED) {
+        EXPECT_EQ(event.value, content.size());
+      }
+    }
+  }
+
+  EXPECT_THAT(commands, ElementsAre("USER username", "PASS ****", "TYPE I",
+                                    "PASV", "STOR file1"));
+  EXPECT_THAT(data_events, ElementsAre(FTP_CLIENT_TRACE_EVENT_DATA_CONNECT,
+                                       FTP_CLIENT_TRACE_EVENT_DATA_CONNECTED,
+                                       FTP_CLIENT_TRACE_EVENT_DATA_FIRST_BYTE,
+                                       FTP_CLIENT_TRACE_EVENT_DATA_CLOSED));
+}
+
+TEST(FTPClientTrace, ftp_client_format_trace_event__writes_tab_separated_line) {
+  static constexpr char kText[] = "226 Done\tnow\r\n";
+  FTPClientTraceEvent event;
+  event.type = FTP_CLIENT_TRACE_EVENT_REPLY_RECEIVED;
+  event.timestamp = 1234;
+  event.session = 2;
+  event.operation_id = 7;
+  event.value = 226;
+  event.text = kText;
+  event.text_length = strlen(kText);
+
+  char buffer[64];
+  int length = FTPClientFormatTraceEvent(&event, buffer, sizeof(buffer));
+  EXPECT_STREQ(buffer, "1234\t2\t7\treply_received\t226\t226 Done now  \n");
+  EXPECT_EQ(length, strlen(buffer));
+
+  // Truncates like snprintf.
+  char small[8];
+  EXPECT_EQ(FTPClientFormatTraceEvent(&event, small, sizeof(small)), length);
+  EXPECT_STREQ(small, "1234\t2\t");
+  EXPECT_EQ(FTPClientFormatTraceEvent(&event, nullptr, 0), length);
+}
+
+struct ProgressRecord {
+  std::vector<FTPClientProgress> reports;
+  std::vector<std::string> filenames;
+};
+
+static void RecordProgress(const FTPClientProgress *progress, void *userdata) {
+  auto record = reinterpret_cast<ProgressRecord *>(userdata);
+  record->reports.push_back(*progress);
+  record->filenames.emplace_back(progress->filename);
+}
+
+//! Uploads `content` from a local file with progress reported every
+//! `interval_bytes`, split into `stripe_count` ranges.
+static void UploadWithProgress(FakeFTPServer &server,
+                               const std::string &content,
+                               uint64_t interval_bytes, size_t stripe_count,
+                               ProgressRecord *record) {
+  auto temp_filename = testing::TempDir() + "ftp_client_progress_source.bin";
+  {
+    std::ofstream outfile(temp_filename, std::ios::binary);
+    outfile.write(content.data(), static_cast<std::streamsize>(content.size()));
+  }
+
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  ASSERT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+  FTPClientSetStriping(context, 0, 64 * 1024);
+
+  FTPClientSendOptions options;
+  FTPClientSendOptionsInit(&options);
+  options.stripe_count = stripe_count;
+  options.chunk_size = 16 * 1024;
+  options.disable_zero_copy = true;
+  options.on_progress = RecordProgress;
+  options.progress_userdata = record;
+  options.progress_interval_bytes = interval_bytes;
+  bool completed = false;
+  EXPECT_TRUE(FTPClientSendFileWithOptions(
+      context, temp_filename.c_str(), "progress", &options,
+      [](bool successful, void *userdata) {
+        EXPECT_TRUE(successful);
+        *reinterpret_cast<bool *>(userdata) = true;
+      },
+      &completed));
+
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while ((!completed || FTPClientHasSendPending(context)) &&
+         std::chrono::steady_clock::now() < deadline) {
+    FTPClientProcess(context, kSelectTimeoutMilliseconds);
+  }
+  EXPECT_TRUE(completed);
+
+  FTPClientDestroy(&context);
+  std::remove(temp_filename.c_str());
+}
+
+TEST(FTPClientProgress,
+     ftp_client_send_file_with_options__with_byte_interval__throttles_reports) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  static constexpr uint64_t kInterval = 128 * 1024;
+  std::string content(1024 * 1024 + 100, 'p');
+  ProgressRecord record;
+  UploadWithProgress(server, content, kInterval, 0, &record);
+  server.Stop();
+
+  ASSERT_FALSE(record.reports.empty());
+  EXPECT_LE(record.reports.size(), content.size() / kInterval + 1);
+  uint64_t previous = 0;
+  for (size_t i = 0; i < record.reports.size(); ++i) {
+    const auto &report = record.reports[i];
+    EXPECT_EQ(record.filenames[i], "progress");
+    EXPECT_EQ(report.total_bytes, content.size());
+    EXPECT_GT(report.bytes_sent, previous);
+    if (i + 1 < record.reports.size()) {
+      EXPECT_GE(report.bytes_sent - previous, kInterval);
+    }
+    previous = report.bytes_sent;
+  }
+  EXPECT_EQ(record.reports.back().bytes_sent, content.size());
+}
+
+TEST(FTPClientProgress,
+     ftp_client_send_file_with_options__with_striping__aggregates_ranges) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  std::string content(512 * 1024, 'r');
+  ProgressRecord record;
+  UploadWithProgress(server, content, 64 * 1024, 4, &record);
+  server.Stop();
+
+  EXPECT_EQ(server.rest_commands(), 3);
+  ASSERT_FALSE(record.reports.empty());
+  uint64_t previous = 0;
+  for (const auto &report : record.reports) {
+    EXPECT_EQ(report.total_bytes, content.size());
+    EXPECT_GE(report.bytes_sent, previous);
+    previous = report.bytes_sent;
+  }
+  EXPECT_EQ(record.reports.back().bytes_sent, content.size());
+}
+
+TEST(FTPClientProgress,
+     ftp_client_send_payload_with_options__reports_progress) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  ASSERT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  std::string content(256 * 1024, 'y');
+  FTPClientPayload *payload =
+      FTPClientPayloadCreate(content.data(), content.size());
+  ASSERT_NE(payload, nullptr);
+
+  ProgressRecord record;
+  FTPClientSendOptions options;
+  FTPClientSendOptionsInit(&options);
+  options.on_progress = RecordProgress;
+  options.progress_userdata = &record;
+  options.progress_interval_bytes = 64 * 1024;
+  bool completed = false;
+  EXPECT_TRUE(FTPClientSendPayloadWithOptions(
+      context, "payload", payload, &options,
+      [](bool successful, void *userdata) {
+        EXPECT_TRUE(successful);
+        *reinterpret_cast<bool *>(userdata) = true;
+      },
+      &completed));
+  FTPClientPayloadRelease(&payload);
+
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while ((!completed || FTPClientHasSendPending(context)) &&
+         std::chrono::steady_clock::now() < deadline) {
+    FTPClientProcess(context, kSelectTimeoutMilliseconds);
+  }
+  EXPECT_TRUE(completed);
+  FTPClientDestroy(&context);
+  server.Stop();
+
+  ASSERT_FALSE(record.reports.empty());
+  EXPECT_EQ(record.filenames.front(), "payload");
+  EXPECT_EQ(record.reports.back().total_bytes, content.size());
+  EXPECT_EQ(record.reports.back().bytes_sent, content.size());
+}
+
+//! Uploads `content` and returns the time taken, counting the iterations of
+//! FTPClientProcess in `iterations`.
+static std::chrono::duration<double> UploadRateLimited(
+    FakeFTPServer &server, const std::string &content,
+    uint64_t client_bytes_per_second, const FTPClientSendOptions *options,
+    size_t *iterations) {
+  auto temp_filename = testing::TempDir() + "ftp_client_rate_source.bin";
+  {
+    std::ofstream outfile(temp_filename, std::ios::binary);
+    outfile.write(content.data(), static_cast<std::streamsize>(content.size()));
+  }
+
+  FTPClient *context;
+  EXPECT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  EXPECT_EQ(FTPClientConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+  FTPClientSetRateLimit(context, client_bytes_per_second, 32 * 1024);
+
+  bool successful = false;
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(FTPClientSendFileWithOptions(
+      context, temp_filename.c_str(), "limited", options,
+      [](bool result, void *userdata) {
+        *reinterpret_cast<bool *>(userdata) = result;
+      },
+      &successful));
+  *iterations = 0;
+  auto deadline = start + kTestTimeout;
+  while (FTPClientHasSendPending(context) &&
+         std::chrono::steady_clock::now() < deadline) {
+    FTPClientProcess(context, kSelectTimeoutMilliseconds);
+    ++*iterations;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  EXPECT_TRUE(successful);
+  FTPClientDestroy(&context);
+  std::remove(temp_filename.c_str());
+  return elapsed;
+}
+
+TEST(FTPClientRateLimit, ftp_client_set_rate_limit__limits_achieved_rate) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  static constexpr double kBytesPerSecond = 1024 * 1024;
+  std::string content(384 * 1024, 'l');
+  size_t iterations;
+  auto elapsed = UploadRateLimited(server, content, (uint64_t)kBytesPerSecond,
+                                   nullptr, &iterations);
+  server.Stop();
+  EXPECT_EQ(server.GetFileSize("limited"), content.size());
+
+  // Everything beyond the initial burst is sent at the configured rate.
+  double expected = (content.size() - 32 * 1024) / kBytesPerSecond;
+  EXPECT_GE(elapsed.count(), expected * 0.95);
+  EXPECT_LE(elapsed.count(), expected * 3);
+  // Throttled data connections wait for tokens rather than spinning.
+  EXPECT_LT(iterations, 500);
+}
+
+TEST(FTPClientRateLimit,
+     ftp_client_send_file_with_options__with_rate_limit__limits_upload) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  static constexpr double kBytesPerSecond = 512 * 1024;
+  FTPClientSendOptions options;
+  FTPClientSendOptionsInit(&options);
+  options.rate_limit_bytes_per_second = (uint64_t)kBytesPerSecond;
+  options.rate_limit_burst_bytes = 16 * 1024;
+
+  // The stricter of the client's and the upload's limits applies.
+  std::string content(192 * 1024, 'o');
+  size_t iterations;
+  auto elapsed = UploadRateLimited(server, content, 4 * 1024 * 1024, &options,
+                                   &iterations);
+  server.Stop();
+  EXPECT_EQ(server.GetFileSize("limited"), content.size());
+
+  double expected = (content.size() - 16 * 1024) / kBytesPerSecond;
+  EXPECT_GE(elapsed.count(), expected * 0.95);
+  EXPECT_LE(elapsed.count(), expected * 3);
+  EXPECT_LT(iterations, 500);
+}
+
+struct PriorityUpload {
+  std::string filename;
+  FTPClientPriority priority;
+  size_t size;
+};
+
+//! Submits `uploads` in order before connecting, so that they are queued
+//! together, and processes them one at a time until all have completed.
+static void UploadWithPriorities(FakeFTPServer &server,
+                                 const std::vector<PriorityUpload> &uploads,
+                                 TransferResultRecord *record) {
+  FTPClient *context;
+  ASSERT_EQ(FTPClientInit(&context, ntohl(inet_addr("127.0.0.1")),
+                          server.port(), "username", "password"),
+            FTP_CLIENT_INIT_STATUS_SUCCESS);
+  FTPClientSetMaxActiveOperations(context, 1);
+  FTPClientSetTransferResultCallback(context, RecordTransferResult, record);
+
+  std::vector<std::string> contents;
+  contents.reserve(uploads.size());
+  for (const auto &upload : uploads) {
+    contents.emplace_back(upload.size, upload.filename[0]);
+    FTPClientSendOptions options;
+    FTPClientSendOptionsInit(&options);
+    options.priority = upload.priority;
+    EXPECT_TRUE(FTPClientSendBufferWithOptions(
+        context, upload.filename.c_str(), contents.back().data(),
+        contents.back().size(), &options, nullptr, nullptr));
+  }
+  ASSERT_EQ(FTPClientStartConnect(context, 5000),
+            FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while (record->results.size() < uploads.size() &&
+         std::chrono::steady_clock::now() < deadline) {
+    FTPClientProcess(context, kSelectTimeoutMilliseconds);
+  }
+  FTPClientDestroy(&context);
+}
+
+TEST(FTPClientPriority,
+     ftp_client_send_buffer_with_options__starts_urgent_uploads_first) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  TransferResultRecord record;
+  UploadWithPriorities(server,
+                       {{"bulk", FTP_CLIENT_PRIORITY_BULK, 4096},
+                        {"normal", FTP_CLIENT_PRIORITY_NORMAL, 4096},
+                        {"first urgent", FTP_CLIENT_PRIORITY_URGENT, 4096},
+                        {"second urgent", FTP_CLIENT_PRIORITY_URGENT, 4096}},
+                       &record);
+  server.Stop();
+
+  EXPECT_EQ(record.filenames,
+            (std::vector<std::string>{"first urgent", "second urgent",
+                                      "normal", "bulk"}));
+  for (const auto &result : record.results) {
+    EXPECT_TRUE(result.successful);
+  }
+}
+
+static constexpr size_t kGroupBulkSize = 2 * 1024 * 1024;
+static constexpr size_t kGroupUrgentSize = 512 * 1024;
+
+//! Uploads a bulk and an urgent file over two clients of a group, each
+//! limited to 4 MiB/s, with the urgent upload submitted once the bulk upload
+//! has started sending. Progress of both is recorded in the order reported.
+static void UploadBulkThenUrgentInGroup(FakeFTPServer &server,
+                                        const FTPClientPriorityPolicy *policy,
+                                        ProgressRecord *record) {
+  auto bulk_filename = testing::TempDir() + "ftp_client_bulk_source.bin";
+  auto urgent_filename = testing::TempDir() + "ftp_client_urgent_source.bin";
+  {
+    std::string content(kGroupBulkSize, 'b');
+    std::ofstream outfile(bulk_filename, std::ios::binary);
+    outfile.write(content.data(), static_cast<std::streamsize>(content.size()));
+  }
+  {
+    std::string content(kGroupUrgentSize, 'u');
+    std::ofstream outfile(urgent_filename, std::ios::binary);
+    outfile.write(content.data(), static_cast<std::streamsize>(content.size()));
+  }
+
+  FTPClientGroup *group =
+      FTPClientGroupCreate(FTP_CLIENT_POLLER_BACKEND_DEFAULT);
+  ASSERT_NE(group, nullptr);
+  FTPClient *clients[2];
+  for (auto &client : clients) {
+    ASSERT_EQ(FTPClientInit(&client, ntohl(inet_addr("127.0.0.1")),
+                            server.port(), "username", "password"),
+              FTP_CLIENT_INIT_STATUS_SUCCESS);
+    FTPClientSetPriorityPolicy(client, policy);
+    FTPClientSetRateLimit(client, 4 * 1024 * 1024, 16 * 1024);
+    ASSERT_EQ(FTPClientStartConnect(client, 5000),
+              FTP_CLIENT_CONNECT_STATUS_SUCCESS);
+    ASSERT_TRUE(FTPClientGroupAdd(group, client));
+  }
+
+  FTPClientSendOptions options;
+  FTPClientSendOptionsInit(&options);
+  options.disable_zero_copy = true;
+  options.on_progress = RecordProgress;
+  options.progress_userdata = record;
+  options.progress_interval_bytes = 8 * 1024;
+  int completed = 0;
+  auto on_complete = [](bool successful, void *userdata) {
+    EXPECT_TRUE(successful);
+    ++*reinterpret_cast<int *>(userdata);
+  };
+
+  options.priority = FTP_CLIENT_PRIORITY_BULK;
+  EXPECT_TRUE(FTPClientSendFileWithOptions(clients[0], bulk_filename.c_str(),
+                                           "bulk", &options, on_complete,
+                                           &completed));
+  auto deadline = std::chrono::steady_clock::now() + kTestTimeout;
+  while ((record->reports.empty() || !FTPClientIsFullyConnected(clients[1])) &&
+         std::chrono::steady_clock::now() < deadline) {
+    FTPClientGroupProcess(group, kSelectTimeoutMilliseconds, nullptr,
+                          nullptr);
+  }
+
+  options.priority = FTP_CLIENT_PRIORITY_URGENT;
+  EXPECT_TRUE(FTPClientSendFileWithOptions(
+      clients[1], urgent_filename.c_str(), "urgent", &options, on_complete,
+      &completed));
+  while (completed < 2 && std::chrono::steady_clock::now() < deadline) {
+    FTPClientGroupProcess(group, kSelectTimeoutMilliseconds, nullptr,
+                          nullptr);
+  }
+  EXPECT_EQ(completed, 2);
+
+  FTPClientGroupDestroy(&group);
+  for (auto &client : clients) {
+    FTPClientDestroy(&client);
+  }
+  std::remove(bulk_filename.c_str());
+  std::remove(urgent_filename.c_str());
+}
+
+//! Returns the bytes of the bulk upload reported sent while the urgent upload
+//! was sending, i.e., between its first and last reports.
+static uint64_t BulkBytesSentDuringUrgent(const ProgressRecord &record) {
+  uint64_t bulk_bytes = 0;
+  uint64_t bulk_bytes_at_urgent_start = 0;
+  bool urgent_started = false;
+  for (size_t i = 0; i < record.reports.size(); ++i) {
+    if (record.filenames[i] == "bulk") {
+      bulk_bytes = record.reports[i].bytes_sent;
+      continue;
+    }
+    if (!urgent_started) {
+      urgent_started = true;
+      bulk_bytes_at_urgent_start = bulk_bytes;
+    }
+    if (record.reports[i].bytes_sent == kGroupUrgentSize) {
+      break;
+    }
+  }
+  EXPECT_TRUE(urgent_started);
+  return bulk_bytes - bulk_bytes_at_urgent_start;
+}
+
+TEST(FTPClientPriority,
+     ftp_client_group_process__with_mixed_priorities__shares_by_weight) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  // Equal shares would send as much of the bulk upload as of the urgent one;
+  // weights of 8 and 1 send an eighth.
+  ProgressRecord record;
+  UploadBulkThenUrgentInGroup(server, nullptr, &record);
+  server.Stop();
+  EXPECT_EQ(server.GetFileSize("bulk"), kGroupBulkSize);
+  EXPECT_EQ(server.GetFileSize("urgent"), kGroupUrgentSize);
+
+  uint64_t bulk_bytes = BulkBytesSentDuringUrgent(record);
+  EXPECT_GT(bulk_bytes, 0);
+  EXPECT_LT(bulk_bytes, kGroupUrgentSize / 4);
+}
+
+TEST(FTPClientPriority,
+     ftp_client_group_process__with_pause_bulk__holds_bulk_during_urgent) {
+  FakeFTPServer server;
+  ASSERT_TRUE(server.Start());
+
+  FTPClientPriorityPolicy policy;
+  FTPClientPriorityPolicyInit(&policy);
+  policy.pause_bulk_while_urgent = true;
+  ProgressRecord record;
+  UploadBulkThenUrgentInGroup(server, &policy, &record);
+  server.Stop();
+  EXPECT_EQ(server.GetFileSize("bulk"), kGroupBulkSize);
+  EXPECT_EQ(server.GetFileSize("urgent"), kGroupUrgentSize);
+
+  EXPECT_EQ(BulkBytesSentDuringUrgent(record), 0);
+}
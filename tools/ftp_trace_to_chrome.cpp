@@ -0,0 +1,286 @@
+// Converts a trace recorded with FTPClientSetTraceCallback and
+// FTPClientFormatTraceEvent into the Chrome trace event format, which can be
+// loaded into chrome://tracing or https://ui.perfetto.dev.
+//
+// Usage: ftp_trace_to_chrome [input [output]]
+//
+// Input and output default to stdin and stdout, as does "-". Commands and
+// replies are shown as instant events on a track per control connection.
+// Each upload is shown as an asynchronous span from its first command to its
+// last reply, with nested spans for the establishment and lifetime of its data
+// connections.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+  uint64_t timestamp;
+  uint32_t session;
+  uint64_t operation_id;
+  std::string type;
+  uint64_t value;
+  std::string text;
+};
+
+//! Spans are tracked per upload and connection, as the ranges of a striped
+//! upload share the id of the upload.
+using SpanKey = std::pair<uint64_t, uint32_t>;
+
+struct OperationSpan {
+  //! Indices of the first and last events of the upload.
+  size_t first;
+  size_t last;
+  bool connecting = false;
+  bool data_open = false;
+};
+
+//! Parses a line of tab-separated fields. The text, which is last, may be
+//! empty.
+bool ParseLine(const std::string &line, TraceEvent *event) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  while (fields.size() < 5) {
+    size_t tab = line.find('\t', start);
+    if (tab == std::string::npos) {
+      return false;
+    }
+    fields.push_back(line.substr(start, tab - start));
+    start = tab + 1;
+  }
+
+  char *end;
+  event->timestamp = strtoull(fields[0].c_str(), &end, 10);
+  if (*end) {
+    return false;
+  }
+  event->session = (uint32_t)strtoul(fields[1].c_str(), &end, 10);
+  if (*end) {
+    return false;
+  }
+  event->operation_id = strtoull(fields[2].c_str(), &end, 10);
+  if (*end) {
+    return false;
+  }
+  event->type = fields[3];
+  event->value = strtoull(fields[4].c_str(), &end, 10);
+  if (*end) {
+    return false;
+  }
+  event->text = line.substr(start);
+  if (!event->text.empty() && event->text.back() == '\r') {
+    event->text.pop_back();
+  }
+  return true;
+}
+
+std::string EscapeJson(const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    switch (c) {
+      case '"':
+        escaped += "\\\"";
+        break;
+      case '\\':
+        escaped += "\\\\";
+        break;
+      default:
+        if ((unsigned char)c < ' ') {
+          char buffer[8];
+          snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned char)c);
+          escaped += buffer;
+        } else {
+          escaped += c;
+        }
+        break;
+    }
+  }
+  return escaped;
+}
+
+class ChromeTraceWriter {
+ public:
+  ChromeTraceWriter(std::ostream &out, uint64_t origin)
+      : out_(out), origin_(origin) {
+    out_ << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  }
+
+  ~ChromeTraceWriter() { out_ << "\n]}\n"; }
+
+  void ThreadName(uint32_t session, const std::string &name) {
+    Begin("M", "thread_name", "", session);
+    out_ << ",\"args\":{\"name\":\"" << EscapeJson(name) << "\"}}";
+  }
+
+  void Instant(const TraceEvent &event, const std::string &name) {
+    Begin("i", name, "control", event.session);
+    out_ << ",\"s\":\"t\",\"ts\":" << Timestamp(event.timestamp)
+         << ",\"args\":{\"operation_id\":" << event.operation_id
+         << ",\"value\":" << event.value << "}}";
+  }
+
+  //! Emits the begin ("b") or end ("e") of an asynchronous span.
+  void Async(const char *phase, const std::string &name, const SpanKey &key,
+             uint64_t timestamp) {
+    Begin(phase, name, "upload", key.second);
+    out_ << ",\"id\":\"" << key.first << "." << key.second
+         << "\",\"ts\":" << Timestamp(timestamp)
+         << ",\"args\":{\"operation_id\":" << key.first << "}}";
+  }
+
+ private:
+  void Begin(const char *phase, const std::string &name, const char *category,
+             uint32_t session) {
+    out_ << (first_ ? "\n" : ",\n");
+    first_ = false;
+    out_ << "{\"ph\":\"" << phase << "\",\"name\":\"" << EscapeJson(name)
+         << "\",\"cat\":\"" << category << "\",\"pid\":1,\"tid\":" << session;
+  }
+
+  std::string Timestamp(uint64_t timestamp) const {
+    return std::to_string(timestamp - origin_);
+  }
+
+  std::ostream &out_;
+  uint64_t origin_;
+  bool first_ = true;
+};
+
+std::string OperationName(uint64_t operation_id) {
+  return "upload " + std::to_string(operation_id);
+}
+
+void WriteChromeTrace(const std::vector<TraceEvent> &events,
+                      std::ostream &out) {
+  uint64_t origin = events.empty() ? 0 : events.front().timestamp;
+  std::set<uint32_t> sessions;
+  std::map<SpanKey, OperationSpan> operations;
+  for (size_t i = 0; i < events.size(); ++i) {
+    const TraceEvent &event = events[i];
+    if (event.timestamp < origin) {
+      origin = event.timestamp;
+    }
+    sessions.insert(event.session);
+    if (!event.operation_id) {
+      continue;
+    }
+    SpanKey key(event.operation_id, event.session);
+    auto it = operations.find(key);
+    if (it == operations.end()) {
+      operations[key] = OperationSpan{i, i};
+    } else {
+      it->second.last = i;
+    }
+  }
+
+  ChromeTraceWriter writer(out, origin);
+  for (uint32_t session : sessions) {
+    writer.ThreadName(session, session ? "stripe session " +
+                                             std::to_string(session - 1)
+                                       : "client");
+  }
+
+  for (size_t i = 0; i < events.size(); ++i) {
+    const TraceEvent &event = events[i];
+    SpanKey key(event.operation_id, event.session);
+    OperationSpan *span =
+        event.operation_id ? &operations.find(key)->second : nullptr;
+    if (span && span->first == i) {
+      writer.Async("b", OperationName(event.operation_id), key,
+                   event.timestamp);
+    }
+
+    if (event.type == "command_sent" || event.type == "reply_received") {
+      writer.Instant(event, event.text);
+    } else if (event.type == "data_first_byte" ||
+               event.type == "data_partial_write") {
+      writer.Instant(event, event.type);
+    } else if (span && event.type == "data_connect") {
+      writer.Async("b", "data connection", key, event.timestamp);
+      writer.Async("b", "connecting", key, event.timestamp);
+      span->connecting = true;
+      span->data_open = true;
+    } else if (span && event.type == "data_connected" && span->connecting) {
+      writer.Async("e", "connecting", key, event.timestamp);
+      span->connecting = false;
+    } else if (span && event.type == "data_closed" && span->data_open) {
+      if (span->connecting) {
+        writer.Async("e", "connecting", key, event.timestamp);
+        span->connecting = false;
+      }
+      writer.Async("e", "data connection", key, event.timestamp);
+      span->data_open = false;
+    }
+
+    if (span && span->last == i) {
+      if (span->connecting) {
+        writer.Async("e", "connecting", key, event.timestamp);
+      }
+      if (span->data_open) {
+        writer.Async("e", "data connection", key, event.timestamp);
+      }
+      writer.Async("e", OperationName(event.operation_id), key,
+                   event.timestamp);
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc > 3) {
+    std::cerr << "Usage: " << argv[0] << " [input [output]]" << std::endl;
+    return 1;
+  }
+
+  std::ifstream input_file;
+  std::istream *input = &std::cin;
+  if (argc > 1 && strcmp(argv[1], "-")) {
+    input_file.open(argv[1]);
+    if (!input_file) {
+      std::cerr << "Failed to open " << argv[1] << std::endl;
+      return 1;
+    }
+    input = &input_file;
+  }
+
+  std::vector<TraceEvent> events;
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(*input, line)) {
+    ++line_number;
+    if (line.empty()) {
+      continue;
+    }
+    TraceEvent event;
+    if (!ParseLine(line, &event)) {
+      std::cerr << "Ignoring malformed line " << line_number << std::endl;
+      continue;
+    }
+    events.push_back(std::move(event));
+  }
+
+  std::ofstream output_file;
+  std::ostream *output = &std::cout;
+  if (argc > 2 && strcmp(argv[2], "-")) {
+    output_file.open(argv[2]);
+    if (!output_file) {
+      std::cerr << "Failed to open " << argv[2] << std::endl;
+      return 1;
+    }
+    output = &output_file;
+  }
+
+  WriteChromeTrace(events, *output);
+  return output->good() ? 0 : 1;
+}